@@ -12,7 +12,7 @@ Q?=@
 #############################################################################
 
 remove_fsimg:
-	$(Q)rm -f $(ROOTFS_IMG)
+	$(Q)rm -f $(ROOTFS_IMG) $(ROOTFS_SORT)
 
 .PHONY: remove_fsimg
 
@@ -20,15 +20,32 @@ remove_fsimg:
 #
 # build root file system image
 #
+# BOOT_TRACE is an strace or /proc/<pid>/maps capture of boot and the first
+# UI load, the files read are laid out first in the order they are read.
+BOOT_TRACE?=
+ROOTFS_SORT:=rootfs.sort
+BOOTSORT:=$(if $(BOOT_TRACE),./tools/squashfs-tools/bootsort -o $(ROOTFS_SORT) userland/target $(BOOT_TRACE))
+SORT_OPT:=$(if $(BOOT_TRACE),-sort $(ROOTFS_SORT))
+# The compressed data blocks are kept between builds and reused for files
+# which did not change, the image is the same as a clean build.
+# ROOTFS_CACHE=n compresses everything again.
+ROOTFS_CACHE?=y
+CACHE_OPT:=$(if $(filter y,$(ROOTFS_CACHE)),-cache rootfs.cache)
+CACHE_OPT_LZMA:=$(if $(filter y,$(ROOTFS_CACHE)),-cache rootfs-lzma.cache)
+
 squashfs: clean_CVS remove_fsimg
 	@echo -e "\033[32m$(MYNAME) make squashfs!\033[0m"
 	$(Q)make -C ./tools/squashfs-tools
-	$(Q)./tools/squashfs-tools/mksquashfs userland/target $(ROOTFS_IMG) -be
+	$(Q)$(BOOTSORT)
+	$(Q)./tools/squashfs-tools/mksquashfs userland/target $(ROOTFS_IMG) -be $(SORT_OPT) $(CACHE_OPT)
 
 squashfs_lzma: clean_CVS remove_fsimg
 	@echo -e "\033[32m$(MYNAME) make squashfs (LZMA)!\033[0m"
-	$(Q)make -C ./tools/squashfs-tools
-	$(Q)./tools/squashfs-tools/mksquashfs-lzma userland/target $(ROOTFS_IMG) -be
+	$(Q)start=`date +%s`; \
+	make -C ./tools/squashfs-tools && \
+	$(if $(BOOTSORT),$(BOOTSORT) &&) \
+	./tools/squashfs-tools/mksquashfs-lzma userland/target $(ROOTFS_IMG) -be $(SORT_OPT) $(CACHE_OPT_LZMA) && \
+	echo -e "\033[32m$(MYNAME) squashfs (LZMA) done in $$((`date +%s` - $$start)) seconds.\033[0m"
 
 .PHONY: squashfs squashfs_lzma
 
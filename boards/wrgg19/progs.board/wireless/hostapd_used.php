@@ -49,7 +49,8 @@ if(fread($hostapd_pid)=="")
 	else
 	{
 		if(query("wpa/PassPhraseFormat")=="1")
-		{	fwrite2($hostapd_conf,	"wpa_key_mgmt=WPA-PSK\n"."wpa_passphrase=".$wpapsk."\n");	}
+		{	fwrite2($hostapd_conf,	"wpa_key_mgmt=WPA-PSK\n"."wpa_passphrase=".$wpapsk."\n"
+									."wpa_psk_cache=/var/run/hostapd.psk_cache\n");	}
 		else
 		{	fwrite2($hostapd_conf,	"wpa_key_mgmt=WPA-PSK\n"."wpa_psk=".$wpapsk."\n");			}
 	}
@@ -0,0 +1,586 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Event loop, shared by pppd and hostapd, see eloop.h.
+ * Copyright (c) 2002-2005, Jouni Malinen <jkmaline@cc.hut.fi>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * The timeouts are kept in a hashed timer wheel: a timeout expiring at
+ * tick T sits in slot (T % ELOOP_WHEEL_SIZE), so arming one is O(1) and
+ * only the slots of the elapsed ticks are looked at when the loop wakes
+ * up. Each timeout is also hashed on <handler,eloop_data,user_data>, so
+ * eloop_cancel_timeout() only walks one short chain. The ticks come from
+ * times(), which keeps counting when the wall clock is set by NTP.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/times.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "eloop.h"
+#include "dtrace.h"
+
+#ifdef DEBUG_ELOOP
+#define ELOOPDBG(x) x
+#else
+#define ELOOPDBG(x)
+#endif
+
+#define ELOOP_WHEEL_MASK	(ELOOP_WHEEL_SIZE - 1)
+#define ELOOP_HASH_MASK		(ELOOP_HASH_SIZE - 1)
+/* tick 'a' comes before 'b' (handles the wrap-around) */
+#define ELOOP_BEFORE(a, b)	((long)((a) - (b)) < 0)
+
+struct eloop_sock
+{
+	int sock;
+	void *eloop_data;
+	void *user_data;
+	void (*handler)(int sock, void *eloop_ctx, void *sock_ctx);
+};
+
+struct eloop_timeout
+{
+	unsigned long expires;		/* in ticks */
+	void *eloop_data;
+	void *user_data;
+	void (*handler)(void *eloop_ctx, void *sock_ctx);
+	/* wheel slot, expired or free list */
+	struct eloop_timeout *next, **pprev;
+	/* cancel hash chain */
+	struct eloop_timeout *hnext, **hpprev;
+};
+
+struct eloop_signal
+{
+	int sig;
+	void *user_data;
+	void (*handler)(int sig, void *eloop_ctx, void *signal_ctx);
+	int signaled;
+};
+
+struct eloop_data
+{
+	void *user_data;
+
+	int max_sock, reader_count;
+	struct eloop_sock *readers;
+	fd_set readfds;				/* all the sockets in 'readers' */
+	int readers_changed;
+
+	/* the clock */
+	long clk_tck;
+	clock_t last_clk;
+	unsigned long long clk;		/* in 1/clk_tck seconds since eloop_init() */
+
+	struct eloop_timeout *wheel[ELOOP_WHEEL_SIZE];
+	struct eloop_timeout *hash[ELOOP_HASH_SIZE];
+	/* due timeouts, in the order they will be called */
+	struct eloop_timeout *expired, **expired_tail;
+	struct eloop_timeout *free_timeouts;
+	unsigned long cur_tick;		/* timeouts before this tick are expired */
+	int timeout_count;
+
+	int signal_count;
+	struct eloop_signal *signals;
+	int signaled;
+	int pending_terminate;
+
+	int terminate;
+};
+
+static struct eloop_data eloop;
+
+/***********************************************************************/
+
+/* current time in ticks */
+static unsigned long eloop_now(void)
+{
+	struct tms tms;
+	clock_t now;
+
+	if (eloop.clk_tck == 0) return 0;	/* eloop_init() not called yet */
+	now = times(&tms);
+	/* times() can not fail, but some C libraries take the values which
+	 * look like an errno for one. Let the clock stand still for that
+	 * moment, it catches up on the next call. */
+	if (now != (clock_t)-1)
+	{
+		eloop.clk += (unsigned long)(now - eloop.last_clk);
+		eloop.last_clk = now;
+	}
+	return (unsigned long)(eloop.clk * 1000 / (eloop.clk_tck * ELOOP_TICK));
+}
+
+static unsigned int eloop_hash(void *handler, void *eloop_data, void *user_data)
+{
+	unsigned long h;
+
+	h = (unsigned long)handler ^ ((unsigned long)eloop_data >> 3) ^ ((unsigned long)user_data >> 5);
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h & ELOOP_HASH_MASK;
+}
+
+static void eloop_list_add(struct eloop_timeout **head, struct eloop_timeout *timeout)
+{
+	timeout->next = *head;
+	if (*head) (*head)->pprev = &timeout->next;
+	timeout->pprev = head;
+	*head = timeout;
+}
+
+static void eloop_list_del(struct eloop_timeout *timeout)
+{
+	if (timeout->next) timeout->next->pprev = timeout->pprev;
+	else if (eloop.expired_tail == &timeout->next) eloop.expired_tail = timeout->pprev;
+	*timeout->pprev = timeout->next;
+}
+
+/* take the timeout out of the wheel (or the expired list) and the hash */
+static void eloop_unlink_timeout(struct eloop_timeout *timeout)
+{
+	eloop_list_del(timeout);
+	if (timeout->hnext) timeout->hnext->hpprev = timeout->hpprev;
+	*timeout->hpprev = timeout->hnext;
+
+	timeout->next = eloop.free_timeouts;
+	eloop.free_timeouts = timeout;
+	eloop.timeout_count--;
+}
+
+static void eloop_free_list(struct eloop_timeout *timeout)
+{
+	struct eloop_timeout *next;
+
+	while (timeout)
+	{
+		next = timeout->next;
+		free(timeout);
+		timeout = next;
+	}
+}
+
+/* Move every timeout due by 'now' to the expired list. Only the slots of
+ * the ticks since the last call are looked at, at most one revolution. */
+static void eloop_collect_timeouts(unsigned long now)
+{
+	struct eloop_timeout *timeout, *next, *due;
+	unsigned long ticks;
+	unsigned int slot;
+
+	ticks = now - eloop.cur_tick + 1;
+	if (ELOOP_BEFORE(now, eloop.cur_tick)) return;
+	if (ticks > ELOOP_WHEEL_SIZE) ticks = ELOOP_WHEEL_SIZE;
+
+	for (slot = eloop.cur_tick; ticks > 0; ticks--, slot++)
+	{
+		/* the slots are newest first, reverse them to call the
+		 * timeouts of the same tick in the order they were registered */
+		due = NULL;
+		for (timeout = eloop.wheel[slot & ELOOP_WHEEL_MASK]; timeout; timeout = next)
+		{
+			next = timeout->next;
+			if (ELOOP_BEFORE(now, timeout->expires)) continue;
+
+			eloop_list_del(timeout);
+			timeout->next = due;
+			due = timeout;
+		}
+		for (timeout = due; timeout; timeout = next)
+		{
+			next = timeout->next;
+			timeout->next = NULL;
+			timeout->pprev = eloop.expired_tail;
+			*eloop.expired_tail = timeout;
+			eloop.expired_tail = &timeout->next;
+		}
+	}
+	eloop.cur_tick = now;
+}
+
+/* Ticks until the next timeout, -1 if there is none. */
+static long eloop_next_timeout(unsigned long now)
+{
+	struct eloop_timeout *timeout;
+	unsigned long next = 0;
+	int i, found = 0;
+
+	if (eloop.timeout_count == 0) return -1;
+	if (eloop.expired) return 0;
+
+	/* A timeout within one revolution is in the first non-empty slot
+	 * holding one for this turn of the wheel. */
+	for (i = 0; i < ELOOP_WHEEL_SIZE && !found; i++)
+	{
+		for (timeout = eloop.wheel[(eloop.cur_tick + i) & ELOOP_WHEEL_MASK]; timeout; timeout = timeout->next)
+		{
+			if (timeout->expires - eloop.cur_tick == (unsigned long)i)
+			{
+				next = timeout->expires;
+				found = 1;
+				break;
+			}
+		}
+	}
+	/* otherwise, they are all further away, look for the closest one
+	 * in the whole wheel */
+	if (!found)
+	{
+		for (i = 0; i < ELOOP_WHEEL_SIZE; i++)
+		{
+			for (timeout = eloop.wheel[i]; timeout; timeout = timeout->next)
+			{
+				if (!found || ELOOP_BEFORE(timeout->expires, next)) next = timeout->expires;
+				found = 1;
+			}
+		}
+	}
+
+	if (!ELOOP_BEFORE(now, next)) return 0;
+	return (long)(next - now);
+}
+
+/***********************************************************************/
+
+void eloop_init(void *user_data)
+{
+	struct tms tms;
+
+	memset(&eloop, 0, sizeof(eloop));
+	eloop.user_data = user_data;
+	eloop.expired_tail = &eloop.expired;
+
+	eloop.clk_tck = sysconf(_SC_CLK_TCK);
+	if (eloop.clk_tck <= 0) eloop.clk_tck = 100;
+	eloop.last_clk = times(&tms);
+	eloop.cur_tick = eloop_now();
+}
+
+
+int eloop_register_read_sock(
+		int sock,
+		void (*handler)(int sock, void *eloop_ctx, void *sock_ctx),
+		void *eloop_data,
+		void *user_data
+		)
+{
+	struct eloop_sock *tmp;
+
+	ELOOPDBG(d_dbg("eloop: >>> eloop_register_read_sock(%d, 0x%x,0x%x,0x%x)\n",sock,handler,eloop_data,user_data));
+
+	tmp = (struct eloop_sock *)realloc(eloop.readers,
+			(eloop.reader_count + 1) * sizeof(struct eloop_sock));
+
+	if (tmp == NULL) return -1;
+
+	ELOOPDBG(d_dbg("eloop: eloop_register_read_sock(): add in %d\n", eloop.reader_count));
+	tmp[eloop.reader_count].sock = sock;
+	tmp[eloop.reader_count].eloop_data = eloop_data;
+	tmp[eloop.reader_count].user_data = user_data;
+	tmp[eloop.reader_count].handler = handler;
+	eloop.reader_count++;
+	eloop.readers = tmp;
+	eloop.readers_changed = 1;
+	FD_SET(sock, &eloop.readfds);
+	if (sock > eloop.max_sock) eloop.max_sock = sock;
+
+	return 0;
+}
+
+
+void eloop_unregister_read_sock(int sock)
+{
+	int i;
+
+	for (i = 0; i < eloop.reader_count; i++)
+		if (eloop.readers[i].sock == sock) break;
+	if (i == eloop.reader_count) return;
+
+	ELOOPDBG(d_dbg("eloop: eloop_unregister_read_sock(%d)\n", sock));
+	if (i != eloop.reader_count - 1)
+		memmove(&eloop.readers[i], &eloop.readers[i + 1],
+				(eloop.reader_count - i - 1) * sizeof(struct eloop_sock));
+	eloop.reader_count--;
+	eloop.readers_changed = 1;
+
+	FD_CLR(sock, &eloop.readfds);
+	eloop.max_sock = 0;
+	for (i = 0; i < eloop.reader_count; i++)
+		if (eloop.readers[i].sock > eloop.max_sock) eloop.max_sock = eloop.readers[i].sock;
+}
+
+
+int eloop_register_timeout(
+		unsigned int secs,
+		unsigned int usecs,
+		void (*handler)(void *eloop_ctx, void *timeout_ctx),
+		void *eloop_data,
+		void *user_data
+		)
+{
+	struct eloop_timeout *timeout;
+	unsigned long ticks;
+
+	ELOOPDBG(d_dbg("eloop: >>> eloop_register_timeout(%d.%d, 0x%x, 0x%x,0x%x)\n",secs,usecs,handler,eloop_data,user_data));
+
+	timeout = eloop.free_timeouts;
+	if (timeout) eloop.free_timeouts = timeout->next;
+	else
+	{
+		timeout = (struct eloop_timeout *) malloc(sizeof(*timeout));
+		if (timeout == NULL)
+		{
+			ELOOPDBG(d_error("eloop: >>> memory allocation fail!\n"));
+			return -1;
+		}
+	}
+
+	/* Round up, and count the tick we are in as well since part of it
+	 * has already passed, so that the timeout never fires early. */
+	ticks = secs * (1000 / ELOOP_TICK) + (usecs + ELOOP_TICK * 1000 - 1) / (ELOOP_TICK * 1000);
+	if (ticks) ticks++;
+	timeout->expires = eloop_now() + ticks;
+	timeout->eloop_data = eloop_data;
+	timeout->user_data = user_data;
+	timeout->handler = handler;
+
+	eloop_list_add(&eloop.wheel[timeout->expires & ELOOP_WHEEL_MASK], timeout);
+
+	timeout->hpprev = &eloop.hash[eloop_hash(handler, eloop_data, user_data)];
+	timeout->hnext = *timeout->hpprev;
+	if (timeout->hnext) timeout->hnext->hpprev = &timeout->hnext;
+	*timeout->hpprev = timeout;
+
+	eloop.timeout_count++;
+
+	ELOOPDBG(d_dbg("eloop: >>> timeout(0x%x) added at tick %lu!\n", timeout, timeout->expires));
+
+	return 0;
+}
+
+
+int eloop_cancel_timeout(
+		void (*handler)(void *eloop_ctx, void *sock_ctx),
+		void *eloop_data,
+		void *user_data
+		)
+{
+	struct eloop_timeout *timeout, *next;
+	int i, first, last, removed = 0;
+
+	ELOOPDBG(d_dbg("eloop: >>> eloop_cancel_timeout(0x%x,0x%x,0x%x)\n",handler,eloop_data,user_data));
+
+	if (eloop_data == ELOOP_ALL_CTX || user_data == ELOOP_ALL_CTX)
+	{
+		first = 0;
+		last = ELOOP_HASH_SIZE - 1;
+	}
+	else
+	{
+		first = last = eloop_hash(handler, eloop_data, user_data);
+	}
+
+	for (i = first; i <= last; i++)
+	{
+		for (timeout = eloop.hash[i]; timeout; timeout = next)
+		{
+			next = timeout->hnext;
+			if (timeout->handler == handler &&
+				(timeout->eloop_data == eloop_data || eloop_data == ELOOP_ALL_CTX) &&
+				(timeout->user_data == user_data || user_data == ELOOP_ALL_CTX))
+			{
+				eloop_unlink_timeout(timeout);
+				removed++;
+				ELOOPDBG(d_dbg("eloop: >>> (0x%x) removed\n",timeout));
+			}
+		}
+	}
+
+	return removed;
+}
+
+
+static void eloop_handle_alarm(int sig)
+{
+	fprintf(stderr, "eloop: could not process SIGINT or SIGTERM in two "
+		"seconds. Looks like there\n"
+		"is a bug that ends up in a busy loop that "
+		"prevents clean shutdown.\n"
+		"Killing program forcefully.\n");
+	exit(1);
+}
+
+
+static void eloop_handle_signal(int sig)
+{
+	int i;
+
+	if ((sig == SIGINT || sig == SIGTERM) && !eloop.pending_terminate)
+	{
+		/* Use SIGALRM to break out from potential busy loops that
+		 * would not allow the program to be killed. */
+		eloop.pending_terminate = 1;
+		signal(SIGALRM, eloop_handle_alarm);
+		alarm(2);
+	}
+
+	eloop.signaled++;
+	for (i = 0; i < eloop.signal_count; i++)
+	{
+		if (eloop.signals[i].sig == sig)
+		{
+			eloop.signals[i].signaled++;
+			break;
+		}
+	}
+}
+
+
+static void eloop_process_pending_signals(void)
+{
+	int i;
+
+	if (eloop.signaled == 0) return;
+	eloop.signaled = 0;
+
+	if (eloop.pending_terminate)
+	{
+		alarm(0);
+		eloop.pending_terminate = 0;
+	}
+
+	for (i = 0; i < eloop.signal_count; i++)
+	{
+		if (eloop.signals[i].signaled)
+		{
+			eloop.signals[i].signaled = 0;
+			eloop.signals[i].handler(eloop.signals[i].sig,
+						 eloop.user_data,
+						 eloop.signals[i].user_data);
+		}
+	}
+}
+
+
+int eloop_register_signal(
+		int sig,
+		void (*handler)(int sig, void *eloop_ctx, void *signal_ctx),
+		void *user_data
+		)
+{
+	struct eloop_signal *tmp;
+
+	tmp = (struct eloop_signal *)realloc(eloop.signals,
+			(eloop.signal_count + 1) * sizeof(struct eloop_signal));
+
+	if (tmp == NULL) return -1;
+
+	tmp[eloop.signal_count].sig = sig;
+	tmp[eloop.signal_count].user_data = user_data;
+	tmp[eloop.signal_count].handler = handler;
+	tmp[eloop.signal_count].signaled = 0;
+	eloop.signal_count++;
+	eloop.signals = tmp;
+	signal(sig, eloop_handle_signal);
+
+	return 0;
+}
+
+void eloop_run(void)
+{
+	fd_set rfds;
+	int i, res;
+	long ticks;
+	struct timeval tv;
+	struct eloop_timeout *timeout;
+	void (*handler)(void *eloop_ctx, void *sock_ctx);
+	void *eloop_data, *user_data;
+
+	while (!eloop.terminate &&
+		(eloop.timeout_count > 0 || eloop.reader_count > 0))
+	{
+		ticks = eloop_next_timeout(eloop_now());
+		if (ticks >= 0)
+		{
+			tv.tv_sec = ticks / (1000 / ELOOP_TICK);
+			tv.tv_usec = (ticks % (1000 / ELOOP_TICK)) * ELOOP_TICK * 1000;
+			ELOOPDBG(d_dbg("eloop: eloop_run(): next timeout in %lu.%06lu sec\n", tv.tv_sec, tv.tv_usec));
+		}
+
+		memcpy(&rfds, &eloop.readfds, sizeof(rfds));
+		res = select(eloop.max_sock + 1, &rfds, NULL, NULL, ticks >= 0 ? &tv : NULL);
+		if (res < 0 && errno != EINTR)
+		{
+			d_error("eloop: eloop_run(): select error\n");
+			return;
+		}
+		eloop_process_pending_signals();
+
+		/* call all the timeouts which have occurred, the ones which are
+		 * registered by these handlers wait for the next pass */
+		if (eloop.timeout_count > 0) eloop_collect_timeouts(eloop_now());
+		while (!eloop.terminate && (timeout = eloop.expired) != NULL)
+		{
+			ELOOPDBG(d_dbg("eloop: eloop_run(): someone timeout (0x%x)!\n", timeout));
+			handler = timeout->handler;
+			eloop_data = timeout->eloop_data;
+			user_data = timeout->user_data;
+			eloop_unlink_timeout(timeout);
+			handler(eloop_data, user_data);
+		}
+
+		for (i = 0; i < eloop.reader_count && res > 0 && !eloop.terminate; i++)
+		{
+			if (FD_ISSET(eloop.readers[i].sock, &rfds))
+			{
+				ELOOPDBG(d_dbg("eloop: eloop_run(): call reader %d, socket %d\n",i,eloop.readers[i].sock));
+				res--;
+				eloop.readers_changed = 0;
+				eloop.readers[i].handler(
+					eloop.readers[i].sock,
+					eloop.readers[i].eloop_data,
+					eloop.readers[i].user_data
+					);
+				/* the other ready sockets are still readable next pass */
+				if (eloop.readers_changed) break;
+			}
+		}
+	}
+}
+
+void eloop_terminate(void)
+{
+	eloop.terminate = 1;
+}
+
+void eloop_continue(void)
+{
+	eloop.terminate = 0;
+}
+
+void eloop_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < ELOOP_WHEEL_SIZE; i++) eloop_free_list(eloop.wheel[i]);
+	eloop_free_list(eloop.expired);
+	eloop_free_list(eloop.free_timeouts);
+	free(eloop.readers);
+	free(eloop.signals);
+	memset(&eloop, 0, sizeof(eloop));
+}
+
+int eloop_terminated(void)
+{
+	return eloop.terminate;
+}
@@ -0,0 +1,173 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * klogparse.c
+ *
+ *	Kernel log parser shared by klogd and syslogd, see klogparse.h.
+ *	The message formats are the ones klogd has always produced.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syslog.h>
+
+#include "klogparse.h"
+
+/***********************************************************************/
+
+/* Copy the value of "KEY=value " found from 'from' into 'val'.
+ * Returns where the key was found, or NULL. */
+static const char * klog_field(const char * from, const char * key, char * val, int size)
+{
+	const char * p;
+	int len;
+
+	val[0] = '\0';
+	if (!from || !(p = strstr(from, key))) return NULL;
+	p += strlen(key);
+	len = strcspn(p, " ");
+	if (len >= size) len = size - 1;
+	memcpy(val, p, len);
+	val[len] = '\0';
+	return p;
+}
+
+/* Copy up to the next ':' */
+static const char * klog_reason(const char * from, char * val, int size)
+{
+	int len = strcspn(from, ":");
+
+	if (len >= size) len = size - 1;
+	memcpy(val, from, len);
+	val[len] = '\0';
+	return from + len;
+}
+
+static const char * klog_ifname(const char * from, const struct klog_ifnames * ifn)
+{
+	char ifname[20];
+
+	if (!klog_field(from, "IN=", ifname, sizeof(ifname)))	return "N/A";
+	if (ifn->wanif && strcmp(ifname, ifn->wanif) == 0)		return "WAN";
+	if (ifn->lanif && strcmp(ifname, ifn->lanif) == 0)		return "LAN";
+	return "N/A";
+}
+
+int klog_parse_line(const char * line, const struct klog_ifnames * ifn,
+					int * pri, char * msg, int size)
+{
+	char protocol[10], reason[50], src_ip[25], src_port[6], dst_ip[25], dst_port[6];
+	char tmp[256];
+	const char * start = line;
+	const char * interface;
+	FILE * fp;
+
+	/* skip the "<n>" kernel priority */
+	if (*start == '<' && strchr(start, '>')) start = strchr(start, '>') + 1;
+
+	if (strncmp(start, "ATT:", 4)==0)
+	{
+		*pri = LOG_MAKEPRI(26, 1);
+		start = klog_reason(start + 4, reason, sizeof(reason));
+		interface = klog_ifname(start, ifn);
+		klog_field(start, "SRC=", src_ip, sizeof(src_ip));
+#ifndef LOGNUM
+		snprintf(msg, size, "ATTACK Detected: %s attack from %s (ip:%s) detected. Packet dropped.",
+				reason, interface, src_ip);
+#else
+		/* message format: code[name|type][interface][src_ip]
+		 * ex: ATT:001[Xmas][WAN][1.2.3.4]
+		 * The kernel log line is:
+		 * ATT:001[Xmas]:IN=vlan2 OUT= MAC=... SRC=192.168.20.13 DST=192.168.20.14 ... */
+		snprintf(msg, size, "ATT:%s[%s][%s]", reason, interface, src_ip);
+#endif
+		return KLOG_SYSLOG;
+	}
+	else if (strncmp(start, "DRP:", 4)==0)
+	{
+		*pri = LOG_MAKEPRI(27, 1);
+		start = klog_reason(start + 4, reason, sizeof(reason));
+		interface = klog_ifname(start, ifn);
+		klog_field(start, "SRC=", src_ip, sizeof(src_ip));
+		klog_field(start, "DST=", dst_ip, sizeof(dst_ip));
+		klog_field(start, "PROTO=", protocol, sizeof(protocol));
+
+		if ((strncmp(protocol, "TCP",3)==0) || (strncmp(protocol, "UDP", 3)==0))
+		{
+			klog_field(start, "SPT=", src_port, sizeof(src_port));
+			klog_field(start, "DPT=", dst_port, sizeof(dst_port));
+			/* message format: code[protocol][interface][src_ip][src_port][dst_ip][dst_port]
+			 * ex: DRP:001[TCP][WAN][1.2.3.4][1234][2.3.4.5][80] */
+#ifndef LOGNUM
+			snprintf(msg, size, "DROP: %s.  Drop %s Packet from %s, src:%s:%s, dst:%s:%s.",
+						reason, protocol, interface, src_ip, src_port, dst_ip, dst_port);
+#else
+			snprintf(msg, size, "DRP:%s[%s][%s][%s][%s][%s][%s]",
+						reason, protocol, interface, src_ip, src_port, dst_ip, dst_port);
+#endif
+		}
+		else
+		{
+#ifndef LOGNUM
+			snprintf(msg, size, "DROP: %s.  Drop %s Packet from %s, src:%s, dst:%s.",
+						reason, protocol, interface, src_ip, dst_ip);
+#else
+			snprintf(msg, size, "DRP:%s[%s][%s][%s][][%s][]",
+						reason, protocol, interface, src_ip, dst_ip);
+#endif
+		}
+		return KLOG_SYSLOG;
+	}
+	else if (strncmp(start, "PTR:", 4)==0)
+	{
+		start = klog_reason(start + 4, reason, sizeof(reason));
+		klog_field(start, "SRC=", src_ip, sizeof(src_ip));
+
+		snprintf(tmp, sizeof(tmp), "%s%d", KLOG_PORTT_PATH, atoi(reason));
+		if ((fp = fopen(tmp, "r")) == NULL) return KLOG_NONE;
+		tmp[0] = '\0';
+		fgets(tmp, sizeof(tmp), fp);
+		fclose(fp);
+		tmp[strcspn(tmp, "\n")] = '\0';
+
+		/* msg format: "file_index,src_ip,file_msg" */
+		snprintf(msg, size, "%d,%s,%s", atoi(reason), src_ip, tmp);
+		return KLOG_PORTT;
+	}
+	return KLOG_NONE;
+}
+
+int klog_parse_buffer(char * buf, int len, int size, const struct klog_ifnames * ifn,
+					klog_handler handler, void * param)
+{
+	char msg[256];
+	char * line = buf;
+	char * end;
+	int type, pri, left;
+
+	while (len > 0)
+	{
+		end = memchr(line, '\n', len);
+		if (!end)
+		{
+			/* keep the incomplete line for the next read, unless it
+			 * already fills the whole buffer */
+			if (line != buf || len < size - 1)
+			{
+				memmove(buf, line, len);
+				return len;
+			}
+			end = line + len;
+		}
+		*end = '\0';
+		left = len - (end - line) - 1;
+
+		type = klog_parse_line(line, ifn, &pri, msg, sizeof(msg));
+		if (type != KLOG_NONE) handler(type, pri, msg, param);
+
+		line = end + 1;
+		len = left;
+	}
+	return 0;
+}
@@ -0,0 +1,267 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * logring.c
+ *
+ *	Shared memory log ring, see logring.h.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "logring.h"
+
+/***********************************************************************/
+/* The ring is written by a single process, so all we need is to keep
+ * the compiler (and the CPU on SMP) from reordering the seqlock
+ * updates against the data. */
+#if defined(__mips__)
+#define logring_mb()	__asm__ __volatile__(".set push\n\t.set mips2\n\tsync\n\t.set pop" : : : "memory")
+#else
+#define logring_mb()	__asm__ __volatile__("" : : : "memory")
+#endif
+
+#define LOGRING_ALIGN(x)	(((x) + 3) & ~3)
+#define LOGRING_RETRY		16
+
+/* Is there a record at 'off' or do we have to wrap to 0 ? */
+static inline int logring_wrapped(struct logring_hdr * hdr, const char * data, unsigned int off)
+{
+	if (hdr->size - off < LOGRING_REC_HDR) return 1;
+	return ((const struct logring_rec *)(data + off))->size == 0;
+}
+
+/***********************************************************************/
+/* writer */
+
+int logring_create(struct logring * lr, key_t key, unsigned int size)
+{
+	memset(lr, 0, sizeof(*lr));
+	size = LOGRING_ALIGN(size);
+
+	lr->shmid = shmget(key, sizeof(struct logring_hdr) + size, IPC_CREAT | 0644);
+	if (lr->shmid < 0) return -1;
+	lr->hdr = (struct logring_hdr *)shmat(lr->shmid, NULL, 0);
+	if (lr->hdr == (void *)-1)
+	{
+		lr->hdr = NULL;
+		shmctl(lr->shmid, IPC_RMID, NULL);
+		return -1;
+	}
+	lr->data = (char *)(lr->hdr + 1);
+	lr->owner = 1;
+
+	lr->hdr->magic = 0;
+	logring_mb();
+	lr->hdr->size = size;
+	lr->hdr->lock = 0;
+	lr->hdr->head = lr->hdr->tail = 0;
+	lr->hdr->first = lr->hdr->next = 0;
+	logring_mb();
+	lr->hdr->magic = LOGRING_MAGIC;
+	return 0;
+}
+
+void logring_destroy(struct logring * lr)
+{
+	if (lr->hdr)
+	{
+		if (lr->owner) lr->hdr->magic = 0;
+		shmdt(lr->hdr);
+	}
+	if (lr->owner && lr->shmid >= 0) shmctl(lr->shmid, IPC_RMID, NULL);
+	memset(lr, 0, sizeof(*lr));
+	lr->shmid = -1;
+}
+
+/* drop the oldest record */
+static void logring_evict(struct logring * lr)
+{
+	struct logring_hdr * hdr = lr->hdr;
+	struct logring_rec * rec;
+
+	if (logring_wrapped(hdr, lr->data, hdr->head))
+	{
+		hdr->head = 0;
+		return;
+	}
+	rec = (struct logring_rec *)(lr->data + hdr->head);
+	hdr->head += rec->size;
+	hdr->first++;
+	if (hdr->first == hdr->next) hdr->head = hdr->tail;
+}
+
+void logring_append(struct logring * lr, const char * msg)
+{
+	struct logring_hdr * hdr = lr->hdr;
+	struct logring_rec * rec;
+	unsigned int len, need, end;
+
+	if (!hdr) return;
+
+	/* a single record never takes more than half of the ring */
+	len = strlen(msg);
+	if (len > hdr->size / 2 - LOGRING_REC_HDR - 1) len = hdr->size / 2 - LOGRING_REC_HDR - 1;
+	if (len > 0xffff - LOGRING_REC_HDR - 4) len = 0xffff - LOGRING_REC_HDR - 4;
+	need = LOGRING_ALIGN(LOGRING_REC_HDR + len + 1);
+
+	hdr->lock++;
+	logring_mb();
+
+	if (hdr->tail + need > hdr->size)
+	{
+		/* Not enough room before the end of the ring. Drop the records
+		 * which are still living behind the tail and start again from 0. */
+		end = hdr->tail;
+		while (hdr->first != hdr->next && hdr->head >= end) logring_evict(lr);
+		if (hdr->size - end >= LOGRING_REC_HDR)
+			((struct logring_rec *)(lr->data + end))->size = 0;
+		hdr->tail = 0;
+		if (hdr->first == hdr->next) hdr->head = 0;
+	}
+
+	/* make room for the new record */
+	end = hdr->tail + need;
+	while (hdr->first != hdr->next && hdr->head >= hdr->tail && hdr->head < end)
+		logring_evict(lr);
+
+	rec = (struct logring_rec *)(lr->data + hdr->tail);
+	rec->size = need;
+	rec->len = len;
+	rec->seq = hdr->next;
+	memcpy((char *)rec + LOGRING_REC_HDR, msg, len);
+	((char *)rec)[LOGRING_REC_HDR + len] = '\0';
+
+	if (hdr->first == hdr->next) hdr->head = hdr->tail;
+	hdr->tail = end;
+	hdr->next++;
+
+	logring_mb();
+	hdr->lock++;
+}
+
+/***********************************************************************/
+/* reader */
+
+int logring_open(struct logring * lr, key_t key)
+{
+	memset(lr, 0, sizeof(*lr));
+
+	lr->shmid = shmget(key, 0, 0);
+	if (lr->shmid < 0) return -1;
+	lr->hdr = (struct logring_hdr *)shmat(lr->shmid, NULL, SHM_RDONLY);
+	if (lr->hdr == (void *)-1)
+	{
+		lr->hdr = NULL;
+		return -1;
+	}
+	if (lr->hdr->magic != LOGRING_MAGIC)
+	{
+		shmdt(lr->hdr);
+		lr->hdr = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+	lr->data = (char *)(lr->hdr + 1);
+	return 0;
+}
+
+void logring_close(struct logring * lr)
+{
+	logring_destroy(lr);
+}
+
+/* Take a consistent snapshot of the header. */
+static int logring_snapshot(struct logring * lr, unsigned int * head,
+							unsigned int * first, unsigned int * next)
+{
+	struct logring_hdr * hdr = lr->hdr;
+	unsigned int lock;
+	int i;
+
+	for (i = 0; i < LOGRING_RETRY; i++)
+	{
+		lock = hdr->lock;
+		logring_mb();
+		if (lock & 1) continue;
+		*head = hdr->head;
+		*first = hdr->first;
+		*next = hdr->next;
+		logring_mb();
+		if (hdr->lock == lock) return 0;
+	}
+	return -1;
+}
+
+void logring_range(struct logring * lr, unsigned int * first, unsigned int * next)
+{
+	unsigned int head;
+
+	*first = *next = 0;
+	if (lr->hdr) logring_snapshot(lr, &head, first, next);
+}
+
+/* Has the record 'seq' been overwritten since we looked at it ? */
+int logring_valid(struct logring * lr, unsigned int seq)
+{
+	logring_mb();
+	return (int)(seq - lr->hdr->first) >= 0;
+}
+
+/* Walk the records from '*seq' (or from the oldest one if '*seq' has
+ * already been evicted) and call 'handler' for each of them.
+ * On return '*seq' is the sequence number to ask for next time.
+ * Returns the number of records handed to 'handler', or -1. */
+int logring_read(struct logring * lr, unsigned int * seq, logring_handler handler, void * param)
+{
+	const struct logring_rec * rec;
+	unsigned int head, first, next, off, cur, size;
+	int count = 0, retry = 0;
+
+	if (!lr->hdr) return -1;
+
+again:
+	if (retry++ > LOGRING_RETRY) return count ? count : -1;
+	if (logring_snapshot(lr, &head, &first, &next) < 0) return count ? count : -1;
+
+	if ((int)(*seq - first) < 0)
+	{
+		lr->lost += first - *seq;
+		*seq = first;
+	}
+	if ((int)(next - *seq) > 0)
+	{
+		/* Skip the records we have already seen. We only touch the
+		 * record headers here. */
+		for (off = head, cur = first; cur != next; )
+		{
+			if (off > lr->hdr->size) goto again;
+			if (logring_wrapped(lr->hdr, lr->data, off))
+			{
+				if (off == 0) goto again;
+				off = 0;
+				continue;
+			}
+			rec = (const struct logring_rec *)(lr->data + off);
+			size = rec->size;
+			if (rec->seq != cur || size < LOGRING_REC_HDR || !logring_valid(lr, cur)) goto again;
+
+			if (cur == *seq)
+			{
+				if (handler(cur, LOGRING_REC_MSG(rec), rec->len, param)) { *seq = cur + 1; return count + 1; }
+				count++;
+				*seq = cur + 1;
+				/* the writer caught up with us, restart from its new head */
+				if (!logring_valid(lr, cur)) goto again;
+			}
+			off += size;
+			cur++;
+		}
+	}
+	return count;
+}
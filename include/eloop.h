@@ -1,4 +1,13 @@
 /* vi: set sw=4 ts=4: */
+/*
+ * Event loop, shared by pppd and hostapd.
+ * Copyright (c) 2002-2005, Jouni Malinen <jkmaline@cc.hut.fi>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ */
 
 #ifndef ELOOP_H
 #define ELOOP_H
@@ -6,6 +15,19 @@
 /* Magic number for eloop_cancel_timeout() */
 #define ELOOP_ALL_CTX (void *) -1
 
+/* Timeouts are kept in a hashed timer wheel of ELOOP_WHEEL_SIZE slots,
+ * ELOOP_TICK milliseconds each, and expire with a resolution of one tick.
+ * Both sizes must be powers of 2. */
+#ifndef ELOOP_TICK
+#define ELOOP_TICK			10
+#endif
+#ifndef ELOOP_WHEEL_SIZE
+#define ELOOP_WHEEL_SIZE	256
+#endif
+#ifndef ELOOP_HASH_SIZE
+#define ELOOP_HASH_SIZE		64
+#endif
+
 /* Initialize global event loop data - must be called before any other eloop_*
  * function. user_data is a pointer to global data structure and will be passed
  * as eloop_ctx to signal handlers. */
@@ -18,6 +40,9 @@ int eloop_register_read_sock(
 		void *eloop_data, void *user_data
 		);
 
+/* Unregister handler for read event */
+void eloop_unregister_read_sock(int sock);
+
 /* Register timeout */
 int eloop_register_timeout(
 		unsigned int secs, unsigned int usecs,
@@ -36,9 +61,10 @@ int eloop_cancel_timeout(
 /* Register handler for signal.
  * Note: signals are 'global' events and there is no local eloop_data pointer
  * like with other handlers. The (global) pointer given to eloop_init() will be
- * used as eloop_ctx for signal handlers. */
+ * used as eloop_ctx for signal handlers. The handler is called from
+ * eloop_run(), not from the signal handler. */
 int eloop_register_signal(
-		int sock,
+		int sig,
 		void (*handler)(int sig, void *eloop_ctx, void *signal_ctx),
 		void *user_data
 		);
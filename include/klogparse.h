@@ -0,0 +1,38 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * klogparse.h
+ *
+ *	Turn the firewall messages of the kernel log (ATT:, DRP:, PTR:)
+ *	into Alpha system log messages. Shared by klogd and syslogd -K,
+ *	which reads the kernel log itself.
+ */
+
+#ifndef __KLOGPARSE_HEADER_H__
+#define __KLOGPARSE_HEADER_H__
+
+#define KLOG_NONE		0	/* nothing to do with this line */
+#define KLOG_SYSLOG		1	/* log 'msg' with priority 'pri' */
+#define KLOG_PORTT		2	/* send 'msg' to the port trigger socket */
+
+#define KLOG_PORTT_SOCK	"/var/run/portt.unixsocket"
+#define KLOG_PORTT_PATH	"/var/porttrigger/"
+
+struct klog_ifnames
+{
+	const char * lanif;
+	const char * wanif;
+};
+
+/* Parse one kernel log line ("<n>..." without the '\n'). */
+int klog_parse_line(const char * line, const struct klog_ifnames * ifn,
+					int * pri, char * msg, int size);
+
+/* Split 'len' bytes of kernel log in 'buf' (of 'size' bytes) into lines
+ * and call 'handler' for each parsed line. The lines are parsed in place.
+ * An incomplete last line is moved to the start of 'buf' and its length
+ * returned, the caller appends the next read after it. */
+typedef void (*klog_handler)(int type, int pri, const char * msg, void * param);
+int klog_parse_buffer(char * buf, int len, int size, const struct klog_ifnames * ifn,
+					klog_handler handler, void * param);
+
+#endif
@@ -0,0 +1,83 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * logring.h
+ *
+ *	Shared memory log ring used by syslogd -C (circular logging).
+ *
+ *	syslogd is the only writer. It appends each message as a record
+ *	tagged with a 32 bit sequence number and evicts the oldest records
+ *	when the ring is full. Readers attach the segment read-only and
+ *	never touch a semaphore: the writer bumps 'lock' to an odd value
+ *	while it is changing the ring and back to even when it is done
+ *	(a seqlock), so a reader can snapshot the header and detect that
+ *	a record it was looking at has been overwritten.
+ *
+ *	Records are handed to readers in place (no copy). A reader which
+ *	keeps the sequence number of the last record it saw can ask for
+ *	"everything after seq N" and only walks the new records.
+ */
+
+#ifndef __LOGRING_HEADER_H__
+#define __LOGRING_HEADER_H__
+
+#include <sys/types.h>
+
+/* shared memory key, same as the old circular buffer ("GENA") */
+#define LOGRING_KEY			0x414e4547
+#define LOGRING_MAGIC		0x4c524e47	/* "LRNG" */
+#define LOGRING_DATA_SIZE	32000
+
+/* header at the start of the shared memory segment */
+struct logring_hdr
+{
+	unsigned int magic;				/* LOGRING_MAGIC */
+	unsigned int size;				/* size of the data area */
+	volatile unsigned int lock;		/* seqlock, odd while writing */
+	volatile unsigned int head;		/* offset of the oldest record */
+	volatile unsigned int tail;		/* offset of the next record */
+	volatile unsigned int first;	/* sequence number of the oldest record */
+	volatile unsigned int next;		/* sequence number of the next record */
+	unsigned int reserved;
+};
+
+/* Record header, followed by the message and a '\0'.
+ * A record with size 0, or less than a record header left before
+ * the end of the data area, means "continue at offset 0". */
+struct logring_rec
+{
+	unsigned short size;			/* total size, 4 bytes aligned */
+	unsigned short len;				/* message length without '\0' */
+	unsigned int seq;				/* sequence number */
+};
+
+#define LOGRING_REC_HDR		sizeof(struct logring_rec)
+#define LOGRING_REC_MSG(r)	((const char *)(r) + LOGRING_REC_HDR)
+
+struct logring
+{
+	int shmid;
+	int owner;						/* we created the segment */
+	struct logring_hdr * hdr;
+	char * data;
+	unsigned int lost;				/* records evicted before we read them */
+};
+
+/* Called for each record. 'msg' points into the shared memory and is
+ * only stable until the writer wraps around to it again, use
+ * logring_valid() after consuming it, or copy it.
+ * Return non-zero to stop reading. */
+typedef int (*logring_handler)(unsigned int seq, const char * msg, int len, void * param);
+
+/* writer side (syslogd) */
+int  logring_create(struct logring * lr, key_t key, unsigned int size);
+void logring_destroy(struct logring * lr);
+void logring_append(struct logring * lr, const char * msg);
+
+/* reader side */
+int  logring_open(struct logring * lr, key_t key);
+void logring_close(struct logring * lr);
+void logring_range(struct logring * lr, unsigned int * first, unsigned int * next);
+int  logring_read(struct logring * lr, unsigned int * seq, logring_handler handler, void * param);
+int  logring_valid(struct logring * lr, unsigned int seq);
+
+#endif
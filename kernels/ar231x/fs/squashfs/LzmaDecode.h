@@ -22,8 +22,9 @@
 #ifndef __LZMADECODE_H
 #define __LZMADECODE_H
 
-/* #define _LZMA_IN_CB */
-/* Use callback for input data */
+#define _LZMA_IN_CB
+/* Use callback for input data, squashfs feeds the decoder straight
+   from the buffer heads of the compressed block */
 
 /* #define _LZMA_OUT_READ */
 /* Use read function for output data */
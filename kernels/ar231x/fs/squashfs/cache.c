@@ -0,0 +1,56 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * cache.c
+ *
+ * Least recently used replacement for the metadata and fragment caches.
+ * The callers hold the cache mutex.  This file is also built into the
+ * userspace cachesim harness, so it must not use anything from the kernel.
+ */
+
+#include <linux/squashfs_fs_cache.h>
+
+/* the entry holding (or reading) block, or -1 */
+int squashfs_cache_find(squashfs_cache *cache, int entries, unsigned int block)
+{
+	int i;
+
+	for(i = 0; i < entries; i++)
+		if(cache[i].block == block)
+			return i;
+
+	return -1;
+}
+
+
+/* the least recently used entry that is not locked, or -1 if all are */
+int squashfs_cache_victim(squashfs_cache *cache, int entries)
+{
+	int i, victim = -1;
+
+	for(i = 0; i < entries; i++)
+		if(!cache[i].locked && (victim == -1 || cache[i].used < cache[victim].used))
+			victim = i;
+
+	return victim;
+}
+
+
+void squashfs_cache_use(squashfs_cache *cache, int i, unsigned long *clock)
+{
+	cache[i].used = ++ *clock;
+}
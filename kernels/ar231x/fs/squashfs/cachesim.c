@@ -0,0 +1,188 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * cachesim.c
+ *
+ * Userspace harness for the cache replacement in cache.c, built with
+ * "make -C fs/squashfs cachesim".  It replays a trace of block reads, one
+ * "f <block>" (fragment) or "m <block>" (metadata) per line, through the
+ * least recently used caches the filesystem uses and through the round
+ * robin caches it used before, and prints the hits and misses of each.
+ * "cachesim -t" checks the replacement rules.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/squashfs_fs_cache.h>
+
+#define INVALID_BLK	((unsigned int) -1)
+#define MAX_ENTRIES	128
+
+struct sim {
+	char		*name;
+	int		entries;
+	squashfs_cache	lru[MAX_ENTRIES];
+	unsigned long	clock;
+	unsigned int	rr[MAX_ENTRIES];
+	int		next;
+	unsigned long	reads, lru_misses, rr_misses;
+};
+
+
+void sim_init(struct sim *sim, char *name, int entries)
+{
+	int i;
+
+	memset(sim, 0, sizeof(struct sim));
+	sim->name = name;
+	sim->entries = entries;
+	for(i = 0; i < entries; i++)
+		sim->lru[i].block = sim->rr[i] = INVALID_BLK;
+}
+
+
+/* returns 1 if block was cached by the least recently used cache */
+int sim_read(struct sim *sim, unsigned int block)
+{
+	int i, hit = 1;
+
+	sim->reads ++;
+
+	if((i = squashfs_cache_find(sim->lru, sim->entries, block)) == -1) {
+		i = squashfs_cache_victim(sim->lru, sim->entries);
+		sim->lru[i].block = block;
+		sim->lru_misses ++;
+		hit = 0;
+	}
+	squashfs_cache_use(sim->lru, i, &sim->clock);
+
+	for(i = 0; i < sim->entries && sim->rr[i] != block; i++);
+	if(i == sim->entries) {
+		sim->rr[sim->next] = block;
+		sim->next = (sim->next + 1) % sim->entries;
+		sim->rr_misses ++;
+	}
+
+	return hit;
+}
+
+
+void sim_print(struct sim *sim)
+{
+	printf("%-8s %3d entries, %7lu reads, least recently used %7lu hits %7lu misses, "
+		"round robin %7lu hits %7lu misses\n", sim->name, sim->entries, sim->reads,
+		sim->reads - sim->lru_misses, sim->lru_misses, sim->reads - sim->rr_misses,
+		sim->rr_misses);
+}
+
+
+#define CHECK(cond) \
+	if(!(cond)) { \
+		fprintf(stderr, "cachesim: check failed, line %d: %s\n", __LINE__, #cond); \
+		failed ++; \
+	}
+
+int self_check(void)
+{
+	struct sim sim;
+	int failed = 0, i;
+
+	/* a block read again stays cached while others are replaced */
+	sim_init(&sim, "check", 3);
+	for(i = 1; i <= 10; i++) {
+		sim_read(&sim, 0);
+		sim_read(&sim, i);
+	}
+	CHECK(sim.lru_misses == 11);
+	CHECK(squashfs_cache_find(sim.lru, 3, 0) != -1);
+	CHECK(squashfs_cache_find(sim.lru, 3, 10) != -1);
+	CHECK(squashfs_cache_find(sim.lru, 3, 8) == -1);
+
+	/* empty entries are used before anything is replaced */
+	sim_init(&sim, "check", 4);
+	for(i = 0; i < 4; i++)
+		CHECK(sim_read(&sim, i) == 0);
+	for(i = 0; i < 4; i++)
+		CHECK(sim_read(&sim, i) == 1);
+
+	/* the least recently used entry is replaced */
+	sim_read(&sim, 0);
+	sim_read(&sim, 1);
+	sim_read(&sim, 4);
+	CHECK(squashfs_cache_find(sim.lru, 4, 2) == -1);
+	CHECK(squashfs_cache_find(sim.lru, 4, 3) != -1);
+
+	/* locked entries are never replaced, all locked gives -1 */
+	sim_init(&sim, "check", 2);
+	sim_read(&sim, 1);
+	sim_read(&sim, 2);
+	sim.lru[squashfs_cache_find(sim.lru, 2, 1)].locked = 1;
+	CHECK(squashfs_cache_victim(sim.lru, 2) == squashfs_cache_find(sim.lru, 2, 2));
+	sim.lru[squashfs_cache_find(sim.lru, 2, 2)].locked = 1;
+	CHECK(squashfs_cache_victim(sim.lru, 2) == -1);
+
+	printf("cachesim: %s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct sim frag, meta;
+	int frag_entries = 3, meta_entries = 8, i;
+	FILE *trace = stdin;
+	char line[256], type;
+	long block;
+
+	for(i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if(strcmp(argv[i], "-t") == 0)
+			return self_check();
+		else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			frag_entries = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			meta_entries = atoi(argv[++i]);
+		else
+			break;
+	}
+	if(i < argc - 1 || (i < argc && argv[i][0] == '-') || frag_entries < 1 ||
+			frag_entries > MAX_ENTRIES || meta_entries < 1 || meta_entries > MAX_ENTRIES) {
+		fprintf(stderr, "Usage: %s [-t] [-f fragment_entries] [-m metadata_entries] [trace]\n", argv[0]);
+		return 1;
+	}
+	if(i < argc && (trace = fopen(argv[i], "r")) == NULL) {
+		perror(argv[i]);
+		return 1;
+	}
+
+	sim_init(&frag, "fragment", frag_entries);
+	sim_init(&meta, "metadata", meta_entries);
+
+	while(fgets(line, sizeof(line), trace)) {
+		if(sscanf(line, " %c %li", &type, &block) != 2)
+			continue;
+		if(type == 'f')
+			sim_read(&frag, block);
+		else if(type == 'm')
+			sim_read(&meta, block);
+	}
+
+	sim_print(&frag);
+	sim_print(&meta);
+	return 0;
+}
@@ -45,6 +45,11 @@
 #include <linux/zlib.h>
 #include <linux/blkdev.h>
 #include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/smp.h>
+#include <linux/time.h>
+#include <linux/proc_fs.h>
+#include <asm/atomic.h>
 
 #ifdef SQUASHFS_LZMA
 #include "LzmaDecode.h"
@@ -95,12 +100,40 @@ static unsigned int read_blocklist_1(struct inode *inode, int index, int readahe
 		char *block_list, char **block_p, unsigned int *bsize);
 #endif
 
-DECLARE_MUTEX(read_data_mutex);
-
+/*
+ * Decompression workspaces, one per CPU.  A reader holds one from copying
+ * the compressed block until it has finished with the decompressed data, so
+ * reads of different blocks decompress concurrently
+ */
+struct squashfs_workspace {
+	char				*input;
+	char				*output;
 #ifdef SQUASHFS_LZMA
-static unsigned char lzma_workspace[LZMA_WORKSPACE_SIZE];
+	unsigned char			*lzma;
 #endif
-static z_stream stream;
+	z_stream			stream;
+	struct squashfs_workspace	*next;
+};
+
+static struct squashfs_workspace *workspaces = NULL;
+static int workspace_count = 0;
+static spinlock_t workspace_lock = SPIN_LOCK_UNLOCKED;
+static DECLARE_WAIT_QUEUE_HEAD(workspace_wait);
+
+/* /proc/fs/squashfs counters, for all mounted filesystems.  The cache
+ * mutexes are per mount, so the counters are atomic */
+static struct {
+	atomic_t	meta_hits;
+	atomic_t	meta_misses;
+	atomic_t	fragment_hits;
+	atomic_t	fragment_misses;
+	atomic_t	cache_waits;
+	atomic_t	decompressed;
+	atomic_t	decompress_usecs;
+	atomic_t	workspace_waits;
+} stats;
+
+#define STAT(name)	((unsigned int) atomic_read(&stats.name))
 
 static DECLARE_FSTYPE_DEV(squashfs_fs_type, "squashfs", squashfs_read_super);
 
@@ -141,25 +174,152 @@ static struct inode_operations squashfs_dir_inode_ops = {
 };
 
 
-static unsigned int read_data(struct super_block *s, char *buffer,
-		unsigned int index, unsigned int length, int datablock, unsigned int *next_index)
+static struct squashfs_workspace *get_workspace(void)
+{
+	struct squashfs_workspace *workspace;
+
+	spin_lock(&workspace_lock);
+	while((workspace = workspaces) == NULL) {
+		atomic_inc(&stats.workspace_waits);
+		spin_unlock(&workspace_lock);
+		wait_event(workspace_wait, workspaces != NULL);
+		spin_lock(&workspace_lock);
+	}
+	workspaces = workspace->next;
+	spin_unlock(&workspace_lock);
+
+	return workspace;
+}
+
+
+static void put_workspace(struct squashfs_workspace *workspace)
+{
+	spin_lock(&workspace_lock);
+	workspace->next = workspaces;
+	workspaces = workspace;
+	spin_unlock(&workspace_lock);
+	wake_up(&workspace_wait);
+}
+
+
+/* copy the c_byte bytes starting offset bytes into bh[0] to buffer, releasing the buffer heads */
+static void copy_block(char *buffer, struct buffer_head **bh, int b, unsigned int offset,
+		unsigned int c_byte, int devblksize)
+{
+	int bytes, avail_bytes, k;
+
+	for(bytes = 0, k = 0; k < b; k++) {
+		avail_bytes = (c_byte - bytes) > (devblksize - offset) ? devblksize - offset : c_byte - bytes;
+		memcpy(buffer + bytes, bh[k]->b_data + offset, avail_bytes);
+		bytes += avail_bytes;
+		offset = 0;
+	}
+	for(k = 0; k < b; k++)
+		brelse(bh[k]);
+}
+
+
+#ifdef SQUASHFS_LZMA
+/*
+ * LZMA blocks are decoded straight from the buffer heads, without copying
+ * the compressed block to the workspace first
+ */
+struct lzma_input {
+	ILzmaInCallback		callback;
+	struct buffer_head	**bh;
+	int			b;
+	int			devblksize;
+	unsigned int		offset;
+	unsigned int		remaining;
+};
+
+
+static int lzma_read(void *object, unsigned char **buffer, UInt32 *size)
+{
+	struct lzma_input *input = (struct lzma_input *) object;
+
+	if(input->b == 0 || input->remaining == 0) {
+		*size = 0;
+		return LZMA_RESULT_OK;
+	}
+
+	*buffer = input->bh[0]->b_data + input->offset;
+	*size = input->devblksize - input->offset;
+	if(*size > input->remaining)
+		*size = input->remaining;
+	input->remaining -= *size;
+	input->offset = 0;
+	input->bh ++;
+	input->b --;
+
+	return LZMA_RESULT_OK;
+}
+
+
+/* set up input to read an LZMA block after its "7zip" marker, 0 if the block is zlib */
+static int lzma_input(struct lzma_input *input, struct buffer_head **bh, int b,
+		unsigned int offset, unsigned int c_byte, int devblksize)
+{
+	char marker[4];
+	int k;
+
+	if(c_byte < 4)
+		return 0;
+
+	for(k = 0; k < 4; k++, offset++) {
+		if(offset == devblksize) {
+			offset = 0;
+			bh ++;
+			b --;
+		}
+		marker[k] = bh[0]->b_data[offset];
+	}
+	if(strncmp(marker, "7zip", 4) != 0)
+		return 0;
+
+	if(offset == devblksize) {
+		offset = 0;
+		bh ++;
+		b --;
+	}
+	input->callback.Read = lzma_read;
+	input->bh = bh;
+	input->b = b;
+	input->devblksize = devblksize;
+	input->offset = offset;
+	input->remaining = c_byte - 4;
+
+	return 1;
+}
+#endif
+
+
+/*
+ * Read and decompress the block at index into buffer.  If buffer is NULL the
+ * block is decompressed into the output buffer of a workspace, which is
+ * returned in *workspace_p and must be given back with put_workspace()
+ */
+static unsigned int read_block(struct super_block *s, char *buffer,
+		unsigned int index, unsigned int length, int datablock, unsigned int *next_index,
+		struct squashfs_workspace **workspace_p)
 {
 	squashfs_sb_info *msBlk = &s->u.squashfs_sb;
 	struct buffer_head *bh[((SQUASHFS_FILE_MAX_SIZE - 1) >> msBlk->devblksize_log2) + 2];
 	unsigned int offset = index & ((1 << msBlk->devblksize_log2) - 1);
 	unsigned int cur_index = index >> msBlk->devblksize_log2;
-	int bytes, avail_bytes, b, k;
-	char *c_buffer;
+	int bytes, b, k;
+	char *c_buffer, *output;
+	struct squashfs_workspace *workspace = NULL;
 	unsigned int compressed;
 	unsigned int c_byte = length;
 
 	if(c_byte) {
 		bytes = msBlk->devblksize - offset;
 		if(datablock) {
-			c_buffer = (compressed = SQUASHFS_COMPRESSED_BLOCK(c_byte)) ? msBlk->read_data : buffer;
+			compressed = SQUASHFS_COMPRESSED_BLOCK(c_byte);
 			c_byte = SQUASHFS_COMPRESSED_SIZE_BLOCK(c_byte);
 		} else {
-			c_buffer = (compressed = SQUASHFS_COMPRESSED(c_byte)) ? msBlk->read_data : buffer;
+			compressed = SQUASHFS_COMPRESSED(c_byte);
 			c_byte = SQUASHFS_COMPRESSED_SIZE(c_byte);
 		}
 
@@ -220,10 +380,10 @@ static unsigned int read_data(struct super_block *s, char *buffer,
 
 		bytes = msBlk->devblksize - offset;
 		if(datablock) {
-			c_buffer = (compressed = SQUASHFS_COMPRESSED_BLOCK(c_byte)) ? msBlk->read_data : buffer;
+			compressed = SQUASHFS_COMPRESSED_BLOCK(c_byte);
 			c_byte = SQUASHFS_COMPRESSED_SIZE_BLOCK(c_byte);
 		} else {
-			c_buffer = (compressed = SQUASHFS_COMPRESSED(c_byte)) ? msBlk->read_data : buffer;
+			compressed = SQUASHFS_COMPRESSED(c_byte);
 			c_byte = SQUASHFS_COMPRESSED_SIZE(c_byte);
 		}
 
@@ -237,53 +397,70 @@ static unsigned int read_data(struct super_block *s, char *buffer,
 		ll_rw_block(READ, b - 1, bh + 1);
 	}
 
-	if(compressed)
-		down(&read_data_mutex);
-
-	for(bytes = 0, k = 0; k < b; k++) {
-		avail_bytes = (c_byte - bytes) > (msBlk->devblksize - offset) ? msBlk->devblksize - offset : c_byte - bytes;
+	/* wait for the device before taking a workspace */
+	for(k = 0; k < b; k++)
 		wait_on_buffer(bh[k]);
-		memcpy(c_buffer + bytes, bh[k]->b_data + offset, avail_bytes);
-		bytes += avail_bytes;
-		offset = 0;
-		brelse(bh[k]);
-	}
+
+	if(compressed || !buffer)
+		workspace = get_workspace();
+	output = buffer ? buffer : workspace->output;
 
 	/*
 	 * uncompress block
 	 */
 	if(compressed) {
 		int zlib_err;
+		struct timeval start, end;
+#ifdef SQUASHFS_LZMA
+		struct lzma_input input;
+#endif
 
+		do_gettimeofday(&start);
 #ifdef SQUASHFS_LZMA
-		if ( strncmp(c_buffer,"7zip",4) == 0 )
+		if(lzma_input(&input, bh, b, offset, c_byte, msBlk->devblksize))
 		{
-		if ((zlib_err = LzmaDecode(lzma_workspace, 
+		if ((zlib_err = LzmaDecode(workspace->lzma, 
 			LZMA_WORKSPACE_SIZE, LZMA_LC, LZMA_LP, LZMA_PB, 
-			c_buffer+4, c_byte-4, buffer, msBlk->read_size, &bytes)) != LZMA_RESULT_OK)
+			&input.callback, output, msBlk->read_size, &bytes)) != LZMA_RESULT_OK)
 		{
 			ERROR("lzma returned unexpected result 0x%x\n", zlib_err);
 			bytes = 0;
 		}
+		for(k = 0; k < b; k++)
+			brelse(bh[k]);
 		}
 		else
 		{
 #endif
-		stream.next_in = c_buffer;
-		stream.avail_in = c_byte;
-		stream.next_out = buffer;
-		stream.avail_out = msBlk->read_size;
-		if(((zlib_err = zlib_inflateInit(&stream)) != Z_OK) ||
-				((zlib_err = zlib_inflate(&stream, Z_FINISH)) != Z_STREAM_END) ||
-				((zlib_err = zlib_inflateEnd(&stream)) != Z_OK)) {
+		c_buffer = workspace->input;
+		copy_block(c_buffer, bh, b, offset, c_byte, msBlk->devblksize);
+		workspace->stream.next_in = c_buffer;
+		workspace->stream.avail_in = c_byte;
+		workspace->stream.next_out = output;
+		workspace->stream.avail_out = msBlk->read_size;
+		if(((zlib_err = zlib_inflateInit(&workspace->stream)) != Z_OK) ||
+				((zlib_err = zlib_inflate(&workspace->stream, Z_FINISH)) != Z_STREAM_END) ||
+				((zlib_err = zlib_inflateEnd(&workspace->stream)) != Z_OK)) {
 			ERROR("zlib_fs returned unexpected result 0x%x\n", zlib_err);
 			bytes = 0;
 		} else
-			bytes = stream.total_out;
+			bytes = workspace->stream.total_out;
 #ifdef SQUASHFS_LZMA
-		} // end of if ( strncmp(c_buffer,"7zip") == 0 ) 
+		} // end of if(lzma_input(...))
 #endif
-		up(&read_data_mutex);
+		do_gettimeofday(&end);
+		atomic_inc(&stats.decompressed);
+		atomic_add((end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec, &stats.decompress_usecs);
+	} else {
+		copy_block(output, bh, b, offset, c_byte, msBlk->devblksize);
+		bytes = c_byte;
+	}
+
+	if(workspace) {
+		if(buffer || bytes == 0)
+			put_workspace(workspace);
+		else
+			*workspace_p = workspace;
 	}
 
 	if(next_index)
@@ -300,35 +477,35 @@ read_failure:
 }
 
 
+static unsigned int read_data(struct super_block *s, char *buffer,
+		unsigned int index, unsigned int length, int datablock, unsigned int *next_index)
+{
+	return read_block(s, buffer, index, length, datablock, next_index, NULL);
+}
+
+
 static int squashfs_get_cached_block(struct super_block *s, char *buffer,
 		unsigned int block, unsigned int offset, int length,
 		unsigned int *next_block, unsigned int *next_offset)
 {
 	squashfs_sb_info *msBlk = &s->u.squashfs_sb;
-	int n, i, bytes, return_length = length;
-	unsigned int next_index;
+	int i, bytes, return_length = length;
+	unsigned int next_index, length_read;
 
 	TRACE("Entered squashfs_get_cached_block [%x:%x]\n", block, offset);
 
 	for(;;) {
-		for(i = 0; i < SQUASHFS_CACHED_BLKS; i++) 
-			if(msBlk->block_cache[i].block == block)
-				break; 
-		
 		down(&msBlk->block_cache_mutex);
-		if(i == SQUASHFS_CACHED_BLKS) {
+		if((i = squashfs_cache_find(msBlk->block_cache, msBlk->cached_blks, block)) == -1) {
 			/* read inode header block */
-			for(i = msBlk->next_cache, n = SQUASHFS_CACHED_BLKS; n ; n --, i = (i + 1) % SQUASHFS_CACHED_BLKS)
-				if(msBlk->block_cache[i].block != SQUASHFS_USED_BLK)
-					break;
-			if(n == 0) {
+			if((i = squashfs_cache_victim(msBlk->block_cache, msBlk->cached_blks)) == -1) {
+				atomic_inc(&stats.cache_waits);
 				up(&msBlk->block_cache_mutex);
-				sleep_on(&msBlk->waitq);
+				wait_event(msBlk->waitq, squashfs_cache_victim(msBlk->block_cache, msBlk->cached_blks) != -1);
 				continue;
 			}
-			msBlk->next_cache = (i + 1) % SQUASHFS_CACHED_BLKS;
 
-			if(msBlk->block_cache[i].block == SQUASHFS_INVALID_BLK) {
+			if(msBlk->block_cache[i].data == NULL) {
 				if(!(msBlk->block_cache[i].data = (unsigned char *)
 							kmalloc(SQUASHFS_METADATA_SIZE, GFP_KERNEL))) {
 					ERROR("Failed to allocate cache block\n");
@@ -337,24 +514,38 @@ static int squashfs_get_cached_block(struct super_block *s, char *buffer,
 				}
 			}
 	
-			msBlk->block_cache[i].block = SQUASHFS_USED_BLK;
+			atomic_inc(&stats.meta_misses);
+			msBlk->block_cache[i].block = block;
+			msBlk->block_cache[i].length = 0;
+			msBlk->block_cache[i].locked = 1;
 			up(&msBlk->block_cache_mutex);
-			if(!(msBlk->block_cache[i].length = read_data(s, msBlk->block_cache[i].data, block, 0, 0,
-							&next_index))) {
+			length_read = read_data(s, msBlk->block_cache[i].data, block, 0, 0, &next_index);
+			down(&msBlk->block_cache_mutex);
+			msBlk->block_cache[i].locked = 0;
+			if(length_read == 0) {
 				ERROR("Unable to read cache block [%x:%x]\n", block, offset);
+				msBlk->block_cache[i].block = SQUASHFS_INVALID_BLK;
+				msBlk->block_cache[i].used = 0;
+				wake_up(&msBlk->waitq);
+				up(&msBlk->block_cache_mutex);
 				return 0;
 			}
-			down(&msBlk->block_cache_mutex);
-			wake_up(&msBlk->waitq);
-			msBlk->block_cache[i].block = block;
+			msBlk->block_cache[i].length = length_read;
 			msBlk->block_cache[i].next_index = next_index;
+			/* waiters test block and length without the mutex, wake them
+			 * once those are set */
+			wake_up(&msBlk->waitq);
 			TRACE("Read cache block [%x:%x]\n", block, offset);
-		}
-
-		if(msBlk->block_cache[i].block != block) {
+		} else if(msBlk->block_cache[i].length == 0) {
+			/* another reader is reading the block */
+			atomic_inc(&stats.cache_waits);
 			up(&msBlk->block_cache_mutex);
+			wait_event(msBlk->waitq, msBlk->block_cache[i].block != block || msBlk->block_cache[i].length);
 			continue;
-		}
+		} else
+			atomic_inc(&stats.meta_hits);
+
+		squashfs_cache_use(msBlk->block_cache, i, &msBlk->cache_clock);
 
 		if((bytes = msBlk->block_cache[i].length - offset) >= length) {
 			if(buffer)
@@ -409,7 +600,7 @@ static int get_fragment_location(struct super_block *s, unsigned int fragment, u
 }
 
 
-void release_cached_fragment(squashfs_sb_info *msBlk, struct squashfs_fragment_cache *fragment)
+void release_cached_fragment(squashfs_sb_info *msBlk, squashfs_cache *fragment)
 {
 	down(&msBlk->fragment_mutex);
 	fragment->locked --;
@@ -418,24 +609,21 @@ void release_cached_fragment(squashfs_sb_info *msBlk, struct squashfs_fragment_c
 }
 
 
-struct squashfs_fragment_cache *get_cached_fragment(struct super_block *s, unsigned int start_block, int length)
+squashfs_cache *get_cached_fragment(struct super_block *s, unsigned int start_block, int length)
 {
-	int i, n;
+	int i, length_read;
 	squashfs_sb_info *msBlk = &s->u.squashfs_sb;
 
 	for(;;) {
 		down(&msBlk->fragment_mutex);
-		for(i = 0; i < SQUASHFS_CACHED_FRAGMENTS && msBlk->fragment[i].block != start_block; i++);
-		if(i == SQUASHFS_CACHED_FRAGMENTS) {
-			for(i = msBlk->next_fragment, n = SQUASHFS_CACHED_FRAGMENTS;
-				n && msBlk->fragment[i].locked; n--, i = (i + 1) % SQUASHFS_CACHED_FRAGMENTS);
-
-			if(n == 0) {
+		if((i = squashfs_cache_find(msBlk->fragment, msBlk->cached_fragments, start_block)) == -1) {
+			if((i = squashfs_cache_victim(msBlk->fragment, msBlk->cached_fragments)) == -1) {
+				atomic_inc(&stats.cache_waits);
 				up(&msBlk->fragment_mutex);
-				sleep_on(&msBlk->fragment_wait_queue);
+				wait_event(msBlk->fragment_wait_queue,
+					squashfs_cache_victim(msBlk->fragment, msBlk->cached_fragments) != -1);
 				continue;
 			}
-			msBlk->next_fragment = (msBlk->next_fragment + 1) % SQUASHFS_CACHED_FRAGMENTS;
 			
 			if(msBlk->fragment[i].data == NULL)
 				if(!(msBlk->fragment[i].data = (unsigned char *)
@@ -445,21 +633,42 @@ struct squashfs_fragment_cache *get_cached_fragment(struct super_block *s, unsig
 					return NULL;
 				}
 
-			msBlk->fragment[i].block = SQUASHFS_INVALID_BLK;
+			atomic_inc(&stats.fragment_misses);
+			msBlk->fragment[i].block = start_block;
+			msBlk->fragment[i].length = 0;
 			msBlk->fragment[i].locked = 1;
+			squashfs_cache_use(msBlk->fragment, i, &msBlk->cache_clock);
 			up(&msBlk->fragment_mutex);
-			if(!(msBlk->fragment[i].length = read_data(s, msBlk->fragment[i].data, start_block, length,
-							1, NULL))) {
+			length_read = read_data(s, msBlk->fragment[i].data, start_block, length, 1, NULL);
+			down(&msBlk->fragment_mutex);
+			if(length_read == 0) {
 				ERROR("Unable to read fragment cache block [%x]\n", start_block);
+				msBlk->fragment[i].block = SQUASHFS_INVALID_BLK;
 				msBlk->fragment[i].locked = 0;
+				msBlk->fragment[i].used = 0;
+				wake_up(&msBlk->fragment_wait_queue);
+				up(&msBlk->fragment_mutex);
 				return NULL;
 			}
-			msBlk->fragment[i].block = start_block;
+			msBlk->fragment[i].length = length_read;
+			wake_up(&msBlk->fragment_wait_queue);
+			up(&msBlk->fragment_mutex);
 			TRACE("New fragment %d, start block %d, locked %d\n", i, msBlk->fragment[i].block, msBlk->fragment[i].locked);
 			return &msBlk->fragment[i];
 		}
 
+		if(msBlk->fragment[i].length == 0) {
+			/* another reader is reading the fragment */
+			atomic_inc(&stats.cache_waits);
+			up(&msBlk->fragment_mutex);
+			wait_event(msBlk->fragment_wait_queue, msBlk->fragment[i].block != start_block ||
+				msBlk->fragment[i].length);
+			continue;
+		}
+
+		atomic_inc(&stats.fragment_hits);
 		msBlk->fragment[i].locked ++;
+		squashfs_cache_use(msBlk->fragment, i, &msBlk->cache_clock);
 		up(&msBlk->fragment_mutex);
 		
 		TRACE("Got fragment %d, start block %d, locked %d\n", i, msBlk->fragment[i].block, msBlk->fragment[i].locked);
@@ -840,6 +1049,67 @@ failed_read1:
 }
 
 
+static void free_cache(squashfs_cache *cache, int entries)
+{
+	int i;
+
+	if(cache == NULL)
+		return;
+
+	for(i = 0; i < entries; i++)
+		if(cache[i].data)
+			kfree(cache[i].data);
+	kfree(cache);
+}
+
+
+/*
+ * Mount options, frag_cache=n and meta_cache=n set the number of fragment and
+ * metadata blocks cached.  The root filesystem takes them from rootflags=
+ */
+static int parse_options(squashfs_sb_info *msBlk, char *options, int silent)
+{
+	char *this_char, *value, *end;
+	unsigned long n;
+
+	msBlk->cached_fragments = SQUASHFS_CACHED_FRAGMENTS;
+	msBlk->cached_blks = SQUASHFS_CACHED_BLKS;
+
+	if(!options)
+		return 1;
+
+	for(this_char = strtok(options, ","); this_char; this_char = strtok(NULL, ",")) {
+		if((value = strchr(this_char, '=')) == NULL || *++value == '\0') {
+			SERROR("unknown mount option %s\n", this_char);
+			return 0;
+		}
+		n = simple_strtoul(value, &end, 0);
+		if(*end != '\0' || n == 0) {
+			SERROR("bad value for mount option %s\n", this_char);
+			return 0;
+		}
+		if(!strncmp(this_char, "frag_cache=", 11)) {
+			if(n > SQUASHFS_MAX_CACHED_FRAGMENTS) {
+				SERROR("frag_cache is at most %d\n", SQUASHFS_MAX_CACHED_FRAGMENTS);
+				return 0;
+			}
+			msBlk->cached_fragments = n;
+		} else if(!strncmp(this_char, "meta_cache=", 11)) {
+			if(n > SQUASHFS_MAX_CACHED_BLKS) {
+				SERROR("meta_cache is at most %d\n", SQUASHFS_MAX_CACHED_BLKS);
+				return 0;
+			}
+			msBlk->cached_blks = n;
+		} else {
+			SERROR("unknown mount option %s\n", this_char);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
 static struct super_block *squashfs_read_super(struct super_block *s,
 		void *data, int silent)
 {
@@ -858,7 +1128,9 @@ static struct super_block *squashfs_read_super(struct super_block *s,
 	s->s_blocksize = msBlk->devblksize;
 	s->s_blocksize_bits = msBlk->devblksize_log2;
 
-	init_MUTEX(&msBlk->read_page_mutex);
+	if(!parse_options(msBlk, (char *) data, silent))
+		goto failed_mount;
+
 	init_MUTEX(&msBlk->block_cache_mutex);
 	init_MUTEX(&msBlk->fragment_mutex);
 	
@@ -923,35 +1195,28 @@ static struct super_block *squashfs_read_super(struct super_block *s,
 	s->s_op = &squashfs_ops;
 
 	/* Init inode_table block pointer array */
-	if(!(msBlk->block_cache = (squashfs_cache *) kmalloc(sizeof(squashfs_cache) * SQUASHFS_CACHED_BLKS, GFP_KERNEL))) {
+	if(!(msBlk->block_cache = (squashfs_cache *) kmalloc(sizeof(squashfs_cache) * msBlk->cached_blks, GFP_KERNEL))) {
 		ERROR("Failed to allocate block cache\n");
 		goto failed_mount;
 	}
 
-	for(i = 0; i < SQUASHFS_CACHED_BLKS; i++)
+	for(i = 0; i < msBlk->cached_blks; i++) {
 		msBlk->block_cache[i].block = SQUASHFS_INVALID_BLK;
+		msBlk->block_cache[i].locked = 0;
+		msBlk->block_cache[i].used = 0;
+		msBlk->block_cache[i].data = NULL;
+	}
 
-	msBlk->next_cache = 0;
+	msBlk->cache_clock = 0;
 
-	/* Allocate read_data block */
+	/* Decompressed blocks are read into the caches or the workspace output buffers */
 	msBlk->read_size = (sBlk->block_size < SQUASHFS_METADATA_SIZE) ? SQUASHFS_METADATA_SIZE : sBlk->block_size;
-	if(!(msBlk->read_data = (char *) kmalloc(msBlk->read_size, GFP_KERNEL))) {
-		ERROR("Failed to allocate read_data block\n");
-		goto failed_mount1;
-	}
-
-	/* Allocate read_page block */
-	if(sBlk->block_size > PAGE_CACHE_SIZE && 
-	   !(msBlk->read_page = (char *) kmalloc(sBlk->block_size, GFP_KERNEL))) {
-		ERROR("Failed to allocate read_page block\n");
-		goto failed_mount2;
-	}
 
 	/* Allocate uid and gid tables */
 	if(!(msBlk->uid = (squashfs_uid *) kmalloc((sBlk->no_uids +
 		sBlk->no_guids) * sizeof(squashfs_uid), GFP_KERNEL))) {
 		ERROR("Failed to allocate uid/gid table\n");
-		goto failed_mount3;
+		goto failed_mount1;
 	}
 	msBlk->guid = msBlk->uid + sBlk->no_uids;
    
@@ -976,26 +1241,26 @@ static struct super_block *squashfs_read_super(struct super_block *s,
 	if(sBlk->s_major == 1) {
 		msBlk->iget = squashfs_iget_1;
 		msBlk->read_blocklist = read_blocklist_1;
-		msBlk->fragment = (struct squashfs_fragment_cache *) msBlk->fragment_index = NULL;
+		msBlk->fragment = NULL;
+		msBlk->fragment_index = NULL;
 		goto allocate_root;
 	}
 #endif
 	msBlk->iget = squashfs_iget;
 	msBlk->read_blocklist = read_blocklist;
 
-	if(!(msBlk->fragment = (struct squashfs_fragment_cache *) kmalloc(sizeof(struct squashfs_fragment_cache) * SQUASHFS_CACHED_FRAGMENTS, GFP_KERNEL))) {
+	if(!(msBlk->fragment = (squashfs_cache *) kmalloc(sizeof(squashfs_cache) * msBlk->cached_fragments, GFP_KERNEL))) {
 		ERROR("Failed to allocate fragment block cache\n");
 		goto failed_mount4;
 	}
 
-	for(i = 0; i < SQUASHFS_CACHED_FRAGMENTS; i++) {
+	for(i = 0; i < msBlk->cached_fragments; i++) {
 		msBlk->fragment[i].locked = 0;
+		msBlk->fragment[i].used = 0;
 		msBlk->fragment[i].block = SQUASHFS_INVALID_BLK;
 		msBlk->fragment[i].data = NULL;
 	}
 
-	msBlk->next_fragment = 0;
-
 	/* Allocate fragment index table */
 	if(!(msBlk->fragment_index = (squashfs_fragment_index *) kmalloc(SQUASHFS_FRAGMENT_INDEX_BYTES(sBlk->fragments), GFP_KERNEL))) {
 		ERROR("Failed to allocate uid/gid table\n");
@@ -1033,15 +1298,11 @@ allocate_root:
 failed_mount6:
 	kfree(msBlk->fragment_index);
 failed_mount5:
-	kfree(msBlk->fragment);
+	free_cache(msBlk->fragment, msBlk->cached_fragments);
 failed_mount4:
 	kfree(msBlk->uid);
-failed_mount3:
-	kfree(msBlk->read_page);
-failed_mount2:
-	kfree(msBlk->read_data);
 failed_mount1:
-	kfree(msBlk->block_cache);
+	free_cache(msBlk->block_cache, msBlk->cached_blks);
 failed_mount:
 	return NULL;
 }
@@ -1204,8 +1465,9 @@ static int squashfs_readpage(struct file *file, struct page *page)
 	unsigned int bsize, block, i = 0, bytes = 0, byte_offset = 0;
 	int index = page->index >> (sBlk->block_log - PAGE_CACHE_SHIFT);
  	void *pageaddr = kmap(page);
-	struct squashfs_fragment_cache *fragment;
-	char *data_ptr = msBlk->read_page;
+	squashfs_cache *fragment = NULL;
+	struct squashfs_workspace *workspace = NULL;
+	char *data_ptr;
 	
 	int mask = (1 << (sBlk->block_log - PAGE_CACHE_SHIFT)) - 1;
 	int start_index = page->index & ~mask;
@@ -1218,12 +1480,11 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		if((block = (msBlk->read_blocklist)(inode, index, 1, block_list, NULL, &bsize)) == 0)
 			goto skip_read;
 
-		down(&msBlk->read_page_mutex);
-		if(!(bytes = read_data(inode->i_sb, msBlk->read_page, block, bsize, 1, NULL))) {
+		if(!(bytes = read_block(inode->i_sb, NULL, block, bsize, 1, NULL, &workspace))) {
 			ERROR("Unable to read page, block %x, size %x\n", block, bsize);
-			up(&msBlk->read_page_mutex);
 			goto skip_read;
 		}
+		data_ptr = workspace->output;
 	} else {
 		if((fragment = get_cached_fragment(inode->i_sb, inode->u.squashfs_i.fragment_start_block, inode->u.squashfs_i.fragment_size)) == NULL) {
 			ERROR("Unable to read page, block %x, size %x\n", inode->u.squashfs_i.fragment_start_block, (int) inode->u.squashfs_i.fragment_size);
@@ -1259,8 +1520,8 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		}
 	}
 
-	if(inode->u.squashfs_i.fragment_start_block == SQUASHFS_INVALID_BLK || index < (inode->i_size >> sBlk->block_log))
-		up(&msBlk->read_page_mutex);
+	if(workspace)
+		put_workspace(workspace);
 	else
 		release_cached_fragment(msBlk, fragment);
 
@@ -1295,7 +1556,7 @@ static int squashfs_readpage4K(struct file *file, struct page *page)
 		if(!(bytes = read_data(inode->i_sb, pageaddr, block, bsize, 1, NULL)))
 			ERROR("Unable to read page, block %x, size %x\n", block, bsize);
 	} else {
-		struct squashfs_fragment_cache *fragment;
+		squashfs_cache *fragment;
 
 		if((fragment = get_cached_fragment(inode->i_sb, inode->u.squashfs_i.fragment_start_block, inode->u.squashfs_i.fragment_size)) == NULL)
 			ERROR("Unable to read page, block %x, size %x\n", inode->u.squashfs_i.fragment_start_block, (int) inode->u.squashfs_i.fragment_size);
@@ -1519,30 +1780,121 @@ failed_read:
 
 static void squashfs_put_super(struct super_block *s)
 {
-	if(s->u.squashfs_sb.block_cache) kfree(s->u.squashfs_sb.block_cache);
-	if(s->u.squashfs_sb.read_data) kfree(s->u.squashfs_sb.read_data);
-	if(s->u.squashfs_sb.read_page) kfree(s->u.squashfs_sb.read_page);
-	if(s->u.squashfs_sb.uid) kfree(s->u.squashfs_sb.uid);
-	s->u.squashfs_sb.block_cache = (void *) s->u.squashfs_sb.uid =
-		s->u.squashfs_sb.read_data = s->u.squashfs_sb.read_page = NULL;
+	squashfs_sb_info *msBlk = &s->u.squashfs_sb;
+
+	free_cache(msBlk->block_cache, msBlk->cached_blks);
+	free_cache(msBlk->fragment, msBlk->cached_fragments);
+	if(msBlk->fragment_index) kfree(msBlk->fragment_index);
+	if(msBlk->uid) kfree(msBlk->uid);
+	msBlk->block_cache = msBlk->fragment = NULL;
+	msBlk->fragment_index = NULL;
+	msBlk->uid = NULL;
+}
+
+
+static void free_workspace(struct squashfs_workspace *workspace)
+{
+	kfree(workspace->input);
+	kfree(workspace->output);
+#ifdef SQUASHFS_LZMA
+	kfree(workspace->lzma);
+#endif
+	vfree(workspace->stream.workspace);
+	kfree(workspace);
 }
 
 
+static struct squashfs_workspace *alloc_workspace(void)
+{
+	struct squashfs_workspace *workspace;
+
+	if(!(workspace = (struct squashfs_workspace *) kmalloc(sizeof(struct squashfs_workspace), GFP_KERNEL)))
+		return NULL;
+	memset(workspace, 0, sizeof(struct squashfs_workspace));
+
+	if((workspace->input = (char *) kmalloc(SQUASHFS_FILE_MAX_SIZE, GFP_KERNEL)) &&
+			(workspace->output = (char *) kmalloc(SQUASHFS_FILE_MAX_SIZE, GFP_KERNEL)) &&
+#ifdef SQUASHFS_LZMA
+			(workspace->lzma = (unsigned char *) kmalloc(LZMA_WORKSPACE_SIZE, GFP_KERNEL)) &&
+#endif
+			(workspace->stream.workspace = (char *) vmalloc(zlib_inflate_workspacesize())))
+		return workspace;
+
+	free_workspace(workspace);
+	return NULL;
+}
+
+
+static void free_workspaces(void)
+{
+	struct squashfs_workspace *workspace;
+
+	while((workspace = workspaces) != NULL) {
+		workspaces = workspace->next;
+		free_workspace(workspace);
+	}
+	workspace_count = 0;
+}
+
+
+#ifdef CONFIG_PROC_FS
+static int squashfs_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	int len;
+
+	len = sprintf(page, "workspaces %d, waits %u\n", workspace_count, STAT(workspace_waits));
+	len += sprintf(page + len, "metadata cache hits %u, misses %u\n", STAT(meta_hits), STAT(meta_misses));
+	len += sprintf(page + len, "fragment cache hits %u, misses %u\n", STAT(fragment_hits), STAT(fragment_misses));
+	len += sprintf(page + len, "cache waits %u\n", STAT(cache_waits));
+	len += sprintf(page + len, "decompressed %u blocks in %u us\n", STAT(decompressed), STAT(decompress_usecs));
+
+	if(len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if(len > count)
+		len = count;
+	if(len < 0)
+		len = 0;
+	return len;
+}
+#endif
+
+
 static int __init init_squashfs_fs(void)
 {
+	struct squashfs_workspace *workspace;
+	int err;
 
-	if(!(stream.workspace = (char *) vmalloc(zlib_inflate_workspacesize()))) {
-		ERROR("Failed to allocate zlib workspace\n");
+	while(workspace_count < smp_num_cpus && (workspace = alloc_workspace())) {
+		workspace->next = workspaces;
+		workspaces = workspace;
+		workspace_count ++;
+	}
+	if(workspace_count == 0) {
+		ERROR("Failed to allocate decompression workspace\n");
 		return -ENOMEM;
 	}
-	return register_filesystem(&squashfs_fs_type);
+
+	if((err = register_filesystem(&squashfs_fs_type))) {
+		free_workspaces();
+		return err;
+	}
+
+#ifdef CONFIG_PROC_FS
+	create_proc_read_entry("fs/squashfs", 0, NULL, squashfs_read_proc, NULL);
+#endif
+	return 0;
 }
 
 
 static void __exit exit_squashfs_fs(void)
 {
-	vfree(stream.workspace);
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("fs/squashfs", NULL);
+#endif
 	unregister_filesystem(&squashfs_fs_type);
+	free_workspaces();
 }
 
 
@@ -0,0 +1,240 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * lzmatest.c
+ *
+ * Host test of the two LZMA decoders, built with "make -C fs/squashfs
+ * lzmatest".  Every file under the given directories is split into blocks,
+ * each block is compressed with the compress2() mksquashfs-lzma uses, and
+ * decoded by LzmaDecode.c and LzmaDecodeFast.c through the same input
+ * callback squashfs uses, fed a device block at a time.  Both outputs must
+ * match the original block.  The decode time of each decoder is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "LzmaDecode.h"
+
+#define LZMA_LC 3
+#define LZMA_LP 0
+#define LZMA_PB 2
+
+#define LZMA_WORKSPACE_SIZE ((LZMA_BASE_SIZE + \
+	(LZMA_LIT_SIZE << (LZMA_LC + LZMA_LP))) * sizeof(CProb))
+
+#define DEVBLKSIZE	1024
+
+extern int compress2(unsigned char *dest, unsigned long *destLen, const unsigned char *source,
+	unsigned long sourceLen, int level);
+
+typedef int (*decoder)(unsigned char *buffer, UInt32 bufferSize, int lc, int lp, int pb,
+	ILzmaInCallback *inCallback, unsigned char *outStream, UInt32 outSize,
+	UInt32 *outSizeProcessed);
+
+extern int LzmaDecodeSmall(unsigned char *buffer, UInt32 bufferSize, int lc, int lp, int pb,
+	ILzmaInCallback *inCallback, unsigned char *outStream, UInt32 outSize,
+	UInt32 *outSizeProcessed);
+extern int LzmaDecodeFast(unsigned char *buffer, UInt32 bufferSize, int lc, int lp, int pb,
+	ILzmaInCallback *inCallback, unsigned char *outStream, UInt32 outSize,
+	UInt32 *outSizeProcessed);
+
+struct test_decoder {
+	char		*name;
+	decoder		decode;
+	double		seconds;
+	int		failed;
+} decoders[] = {
+	{ "LzmaDecode.c", LzmaDecodeSmall, 0, 0 },
+	{ "LzmaDecodeFast.c", LzmaDecodeFast, 0, 0 },
+	{ NULL }
+};
+
+/* the compressed block as squashfs sees it, in device blocks starting offset bytes in */
+struct test_input {
+	ILzmaInCallback		callback;
+	unsigned char		*data;
+	unsigned int		offset;
+	unsigned int		remaining;
+};
+
+int block_size = 65536, repeat = 1;
+int files = 0, blocks = 0, stored = 0;
+long long bytes = 0, compressed_bytes = 0;
+unsigned char *in, *out, *dec, workspace[LZMA_WORKSPACE_SIZE];
+
+
+int test_read(void *object, unsigned char **buffer, UInt32 *size)
+{
+	struct test_input *input = (struct test_input *) object;
+
+	*buffer = input->data;
+	*size = DEVBLKSIZE - input->offset;
+	if(*size > input->remaining)
+		*size = input->remaining;
+	input->data += *size;
+	input->remaining -= *size;
+	input->offset = 0;
+
+	return LZMA_RESULT_OK;
+}
+
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+void test_block(char *filename, int block, int size)
+{
+	unsigned long c_byte = block_size << 1;
+	struct test_decoder *d;
+	UInt32 processed;
+	int i, res = 0;
+
+	if(compress2(out, &c_byte, in, size, 9) != 0 || c_byte >= size) {
+		/* mksquashfs stores the block uncompressed */
+		stored ++;
+		return;
+	}
+	blocks ++;
+	bytes += size;
+	compressed_bytes += c_byte;
+
+	for(d = decoders; d->name; d++) {
+		double start = now();
+
+		for(i = 0; i < repeat; i++) {
+			struct test_input input;
+
+			input.callback.Read = test_read;
+			input.data = out + 4;
+			input.offset = (blocks * 37 + 4) % DEVBLKSIZE;
+			input.remaining = c_byte - 4;
+			memset(dec, 0, size);
+			res = d->decode(workspace, sizeof(workspace), LZMA_LC, LZMA_LP, LZMA_PB,
+				&input.callback, dec, block_size, &processed);
+		}
+		d->seconds += now() - start;
+
+		if(res != LZMA_RESULT_OK || processed != size || memcmp(dec, in, size) != 0) {
+			fprintf(stderr, "%s: %s block %d: result %d, %u bytes of %d%s\n", d->name,
+				filename, block, res, processed, size, res == LZMA_RESULT_OK &&
+				processed == size ? ", data differs" : "");
+			d->failed ++;
+		}
+	}
+}
+
+
+void test_file(char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	int size, block;
+
+	if(file == NULL) {
+		perror(filename);
+		return;
+	}
+
+	files ++;
+	for(block = 0; (size = fread(in, 1, block_size, file)) > 0; block++)
+		test_block(filename, block, size);
+	fclose(file);
+}
+
+
+void test_path(char *path)
+{
+	struct stat buf;
+	struct dirent *d;
+	DIR *dir;
+	char *name;
+
+	if(lstat(path, &buf) == -1) {
+		perror(path);
+		return;
+	}
+
+	if(S_ISREG(buf.st_mode)) {
+		test_file(path);
+		return;
+	}
+
+	if(!S_ISDIR(buf.st_mode) || (dir = opendir(path)) == NULL)
+		return;
+
+	while((d = readdir(dir)) != NULL) {
+		if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+			continue;
+		if((name = malloc(strlen(path) + strlen(d->d_name) + 2)) == NULL) {
+			fprintf(stderr, "lzmatest: out of memory\n");
+			exit(1);
+		}
+		sprintf(name, "%s/%s", path, d->d_name);
+		test_path(name);
+		free(name);
+	}
+	closedir(dir);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct test_decoder *d;
+	int i, failed = 0;
+
+	for(i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			block_size = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else
+			break;
+	}
+	if(i == argc || argv[i][0] == '-' || block_size < 4096 || block_size > 65536 || repeat < 1) {
+		fprintf(stderr, "Usage: %s [-b block_size] [-n repeat] directory|file ...\n", argv[0]);
+		return 1;
+	}
+
+	if((in = malloc(block_size)) == NULL || (out = malloc(block_size << 1)) == NULL ||
+			(dec = malloc(block_size)) == NULL) {
+		fprintf(stderr, "lzmatest: out of memory\n");
+		return 1;
+	}
+
+	for(; i < argc; i++)
+		test_path(argv[i]);
+
+	printf("%d files, %d blocks compressed from %lld to %lld bytes, %d stored\n", files, blocks,
+		bytes, compressed_bytes, stored);
+	for(d = decoders; d->name; d++) {
+		printf("%-18s %8.3f s, %7.2f Mbytes/s, %d failed\n", d->name, d->seconds,
+			d->seconds > 0 ? bytes * repeat / d->seconds / 1048576 : 0, d->failed);
+		failed += d->failed;
+	}
+
+	return failed ? 1 : 0;
+}
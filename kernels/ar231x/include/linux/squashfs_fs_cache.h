@@ -0,0 +1,43 @@
+#ifndef SQUASHFS_FS_CACHE
+#define SQUASHFS_FS_CACHE
+/*
+ * Squashfs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * squashfs_fs_cache.h
+ *
+ * Metadata and fragment cache entries.  The replacement policy in
+ * fs/squashfs/cache.c uses nothing from the kernel, so the same source
+ * builds into the cachesim harness.
+ */
+
+/*
+ * An entry being read has its block set and length 0, locked entries
+ * (being read, or fragments in use by readpage) are never replaced
+ */
+typedef struct squashfs_cache {
+	unsigned int	block;
+	int		length;
+	unsigned int	next_index;
+	unsigned int	locked;
+	unsigned long	used;
+	char		*data;
+	} squashfs_cache;
+
+extern int squashfs_cache_find(squashfs_cache *cache, int entries, unsigned int block);
+extern int squashfs_cache_victim(squashfs_cache *cache, int entries);
+extern void squashfs_cache_use(squashfs_cache *cache, int i, unsigned long *clock);
+#endif
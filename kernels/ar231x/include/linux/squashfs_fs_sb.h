@@ -23,20 +23,7 @@
  */
 
 #include <linux/squashfs_fs.h>
-
-typedef struct {
-	unsigned int	block;
-	int		length;
-	unsigned int	next_index;
-	char		*data;
-	} squashfs_cache;
-
-struct squashfs_fragment_cache {
-	unsigned int	block;
-	int		length;
-	unsigned int	locked;
-	char		*data;
-	};
+#include <linux/squashfs_fs_cache.h>
 
 typedef struct squashfs_sb_info {
 	squashfs_super_block	sBlk;
@@ -44,16 +31,14 @@ typedef struct squashfs_sb_info {
 	int			devblksize_log2;
 	int			swap;
 	squashfs_cache		*block_cache;
-	struct squashfs_fragment_cache	*fragment;
-	int			next_cache;
-	int			next_fragment;
+	squashfs_cache		*fragment;
+	int			cached_blks;
+	int			cached_fragments;
+	unsigned long		cache_clock;
 	squashfs_uid		*uid;
 	squashfs_uid		*guid;
 	squashfs_fragment_index		*fragment_index;
 	unsigned int		read_size;
-	char			*read_data;
-	char			*read_page;
-	struct semaphore	read_page_mutex;
 	struct semaphore	block_cache_mutex;
 	struct semaphore	fragment_mutex;
 	wait_queue_head_t	waitq;
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -137,8 +138,160 @@ static int hostapd_config_read_maclist(const char *fname, macaddr **acl,
 }
 
 
+/* PSKs derived from passphrases are kept in the wpa_psk_cache file, so that
+ * the 4096 PBKDF2-SHA1 iterations are not run again for every passphrase on
+ * each start and SIGHUP. An entry is keyed by SHA1(SSID length, SSID,
+ * passphrase) and holds the PSK itself, so the file must stay on tmpfs with
+ * mode 0600. Only the entries used by the current configuration are written
+ * back. */
+struct hostapd_psk_cache {
+	struct hostapd_psk_cache *next;
+	u8 key[SHA1_MAC_LEN];
+	u8 psk[PMK_LEN];
+	int used;
+};
+
+
+static void hostapd_psk_cache_key(struct hostapd_config *conf,
+				  const char *passphrase, u8 *key)
+{
+	u8 ssid_len = conf->ssid_len;
+	const u8 *addr[3];
+	size_t len[3];
+
+	addr[0] = &ssid_len;
+	len[0] = 1;
+	addr[1] = (u8 *) conf->ssid;
+	len[1] = conf->ssid_len;
+	addr[2] = (u8 *) passphrase;
+	len[2] = strlen(passphrase);
+	sha1_vector(3, addr, len, key);
+}
+
+
+static struct hostapd_psk_cache * hostapd_psk_cache_read(const char *fname)
+{
+	FILE *f;
+	char buf[2 * SHA1_MAC_LEN + 1 + 2 * PMK_LEN + 2];
+	struct hostapd_psk_cache *cache = NULL, *entry;
+
+	f = fopen(fname, "r");
+	if (!f)
+		return NULL;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		if (strlen(buf) < 2 * SHA1_MAC_LEN + 1 + 2 * PMK_LEN ||
+		    buf[2 * SHA1_MAC_LEN] != ' ')
+			continue;
+		entry = malloc(sizeof(*entry));
+		if (entry == NULL)
+			break;
+		memset(entry, 0, sizeof(*entry));
+		if (hexstr2bin(buf, entry->key, SHA1_MAC_LEN) ||
+		    hexstr2bin(buf + 2 * SHA1_MAC_LEN + 1, entry->psk,
+			       PMK_LEN)) {
+			free(entry);
+			continue;
+		}
+		entry->next = cache;
+		cache = entry;
+	}
+	memset(buf, 0, sizeof(buf));
+
+	fclose(f);
+	return cache;
+}
+
+
+static void hostapd_psk_cache_write(const char *fname,
+				    struct hostapd_psk_cache *cache)
+{
+	FILE *f;
+	char tmp[256];
+	int fd, i;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+		if (fd >= 0)
+			close(fd);
+		printf("Could not write the PSK cache '%s'\n", tmp);
+		return;
+	}
+
+	for (; cache; cache = cache->next) {
+		if (!cache->used)
+			continue;
+		for (i = 0; i < SHA1_MAC_LEN; i++)
+			fprintf(f, "%02x", cache->key[i]);
+		fputc(' ', f);
+		for (i = 0; i < PMK_LEN; i++)
+			fprintf(f, "%02x", cache->psk[i]);
+		fputc('\n', f);
+	}
+
+	if (fclose(f) == 0)
+		rename(tmp, fname);
+	else
+		unlink(tmp);
+}
+
+
+static void hostapd_psk_cache_free(struct hostapd_psk_cache *cache)
+{
+	struct hostapd_psk_cache *prev;
+
+	while (cache) {
+		prev = cache;
+		cache = cache->next;
+		memset(prev, 0, sizeof(*prev));
+		free(prev);
+	}
+}
+
+
+/* Derive the PSK of 'passphrase' for our SSID, from the cache if it has
+ * it. '*dirty' is set when a new entry is added. */
+static void hostapd_passphrase_psk(struct hostapd_config *conf,
+				   struct hostapd_psk_cache **cache,
+				   int *dirty, const char *passphrase, u8 *psk)
+{
+	struct hostapd_psk_cache *entry;
+	u8 key[SHA1_MAC_LEN];
+
+	if (cache == NULL) {
+		pbkdf2_sha1(passphrase, conf->ssid, conf->ssid_len, 4096,
+			    psk, PMK_LEN);
+		return;
+	}
+
+	hostapd_psk_cache_key(conf, passphrase, key);
+	for (entry = *cache; entry; entry = entry->next) {
+		if (memcmp(entry->key, key, SHA1_MAC_LEN) == 0) {
+			memcpy(psk, entry->psk, PMK_LEN);
+			entry->used = 1;
+			return;
+		}
+	}
+
+	pbkdf2_sha1(passphrase, conf->ssid, conf->ssid_len, 4096,
+		    psk, PMK_LEN);
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL)
+		return;
+	memcpy(entry->key, key, SHA1_MAC_LEN);
+	memcpy(entry->psk, psk, PMK_LEN);
+	entry->used = 1;
+	entry->next = *cache;
+	*cache = entry;
+	*dirty = 1;
+}
+
+
 static int hostapd_config_read_wpa_psk(const char *fname,
-				       struct hostapd_config *conf)
+				       struct hostapd_config *conf,
+				       struct hostapd_psk_cache **cache,
+				       int *dirty)
 {
 	FILE *f;
 	char buf[128], *pos;
@@ -204,8 +357,8 @@ static int hostapd_config_read_wpa_psk(const char *fname,
 		if (len == 64 && hexstr2bin(pos, psk->psk, PMK_LEN) == 0)
 			ok = 1;
 		else if (len >= 8 && len < 64) {
-			pbkdf2_sha1(pos, conf->ssid, conf->ssid_len,
-				    4096, psk->psk, PMK_LEN);
+			hostapd_passphrase_psk(conf, cache, dirty, pos,
+					       psk->psk);
 			ok = 1;
 		}
 		if (!ok) {
@@ -228,6 +381,15 @@ static int hostapd_config_read_wpa_psk(const char *fname,
 
 int hostapd_setup_wpa_psk(struct hostapd_config *conf)
 {
+	struct hostapd_psk_cache *cache = NULL, **pcache = NULL, *entry;
+	int dirty = 0, ret = 0;
+
+	if (conf->wpa_psk_cache &&
+	    (conf->wpa_passphrase != NULL || conf->wpa_psk_file)) {
+		cache = hostapd_psk_cache_read(conf->wpa_psk_cache);
+		pcache = &cache;
+	}
+
 	if (conf->wpa_passphrase != NULL) {
 		if (conf->wpa_psk != NULL) {
 			printf("Warning: both WPA PSK and passphrase set. "
@@ -237,6 +399,7 @@ int hostapd_setup_wpa_psk(struct hostapd_config *conf)
 		conf->wpa_psk = malloc(sizeof(struct hostapd_wpa_psk));
 		if (conf->wpa_psk == NULL) {
 			printf("Unable to alloc space for PSK\n");
+			hostapd_psk_cache_free(cache);
 			return -1;
 		}
 		wpa_hexdump_ascii(MSG_DEBUG, "SSID",
@@ -245,9 +408,9 @@ int hostapd_setup_wpa_psk(struct hostapd_config *conf)
 				  (u8 *) conf->wpa_passphrase,
 				  strlen(conf->wpa_passphrase));
 		memset(conf->wpa_psk, 0, sizeof(struct hostapd_wpa_psk));
-		pbkdf2_sha1(conf->wpa_passphrase,
-			    conf->ssid, conf->ssid_len,
-			    4096, conf->wpa_psk->psk, PMK_LEN);
+		hostapd_passphrase_psk(conf, pcache, &dirty,
+				       conf->wpa_passphrase,
+				       conf->wpa_psk->psk);
 		wpa_hexdump(MSG_DEBUG, "PSK (from passphrase)",
 			    conf->wpa_psk->psk, PMK_LEN);
 		conf->wpa_psk->group = 1;
@@ -258,13 +421,24 @@ int hostapd_setup_wpa_psk(struct hostapd_config *conf)
 	}
 
 	if (conf->wpa_psk_file) {
-		if (hostapd_config_read_wpa_psk(conf->wpa_psk_file, conf))
-			return -1;
+		if (hostapd_config_read_wpa_psk(conf->wpa_psk_file, conf,
+						pcache, &dirty))
+			ret = -1;
 		free(conf->wpa_psk_file);
 		conf->wpa_psk_file = NULL;
 	}
 
-	return 0;
+	if (pcache && ret == 0) {
+		/* also rewrite it to drop the entries no longer used */
+		for (entry = cache; entry && !dirty; entry = entry->next)
+			if (!entry->used)
+				dirty = 1;
+		if (dirty)
+			hostapd_psk_cache_write(conf->wpa_psk_cache, cache);
+	}
+	hostapd_psk_cache_free(cache);
+
+	return ret;
 }
 
 
@@ -903,6 +1077,13 @@ struct hostapd_config * hostapd_config_read(const char *fname)
 				printf("Line %d: allocation failed\n", line);
 				errors++;
 			}
+		} else if (strcmp(buf, "wpa_psk_cache") == 0) {
+			free(conf->wpa_psk_cache);
+			conf->wpa_psk_cache = strdup(pos);
+			if (!conf->wpa_psk_cache) {
+				printf("Line %d: allocation failed\n", line);
+				errors++;
+			}
 		} else if (strcmp(buf, "wpa_key_mgmt") == 0) {
 			conf->wpa_key_mgmt =
 				hostapd_config_parse_key_mgmt(line, pos);
@@ -1066,6 +1247,7 @@ void hostapd_config_free(struct hostapd_config *conf)
 
 	free(conf->wpa_passphrase);
 	free(conf->wpa_psk_file);
+	free(conf->wpa_psk_cache);
 
 	user = conf->eap_user;
 	while (user) {
@@ -136,6 +136,7 @@ struct hostapd_config {
 	struct hostapd_wpa_psk *wpa_psk;
 	char *wpa_passphrase;
 	char *wpa_psk_file;
+	char *wpa_psk_cache; /* PSKs derived from passphrases, on tmpfs */
 #define WPA_KEY_MGMT_IEEE8021X BIT(0)
 #define WPA_KEY_MGMT_PSK BIT(1)
 	int wpa_key_mgmt;
@@ -13,6 +13,32 @@
  * See README and COPYING for more details.
  */
 
+/*
+ * The test driver can also simulate a number of WPA-PSK stations to see how
+ * hostapd scales with the station count. Build with CONFIG_DRIVER_TEST=y
+ * ("make CONFIG_DRIVER_TEST=y"), use driver=test, wpa_key_mgmt=WPA-PSK and no
+ * ctrl_interface in the configuration file and set the environment:
+ *
+ * HOSTAPD_TEST_STATIONS	number of stations (0 = simulator disabled)
+ * HOSTAPD_TEST_REKEYS		group key updates after association (3)
+ * HOSTAPD_TEST_ROAMS		times each station leaves and associates
+ *				again (1)
+ * HOSTAPD_TEST_LOSS		percentage of EAPOL-Key frames the stations
+ *				do not answer, to exercise retransmission (0)
+ *
+ * Stations associate in chunks of TEST_STA_CHUNK, so that the 4-Way
+ * Handshakes of one chunk overlap with the associations of the next. With
+ * wpa=3, every other station uses WPA2. Each phase is timed until the last
+ * station has sent its final EAPOL-Key frame, with and without the time
+ * spent in the simulator itself, and hostapd exits after the report. The
+ * stations check the MIC of every frame and the GTK in 1/2 Group, and
+ * associate again TEST_STA_BACKOFF seconds after being deauthenticated.
+ *
+ * At the start of the first group rekey, a station without a WPA state
+ * machine (as madwifi_new_sta() leaves one when the WPA IE is rejected) is
+ * freed while the paced rekey is about to step it.
+ */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,19 +49,789 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include "hostapd.h"
 #include "driver.h"
+#include "ieee802_1x.h"
+#include "eloop.h"
+#include "sta_info.h"
+#include "eapol_sm.h"
+#include "wpa.h"
+#include "radius.h"
+#include "accounting.h"
+#include "config.h"
+#include "md5.h"
+#include "sha1.h"
+#include "rc4.h"
+#include "aes_wrap.h"
+
 
+#define TEST_STA_CHUNK 32
+#define TEST_STA_HASH_SIZE 256
+#define TEST_STA_HASH(a) ((a)[5])
+#define TEST_STA_BACKOFF 1
+/* a phase that has not finished by then has lost a station */
+#define TEST_PHASE_TIMEOUT 60
+
+struct test_sta {
+	struct test_sta *hnext;
+	u8 addr[ETH_ALEN];
+	int wpa; /* HOSTAPD_WPA_VERSION_WPA or HOSTAPD_WPA_VERSION_WPA2 */
+	u8 wpa_ie[24];
+	size_t wpa_ie_len;
+	const u8 *pmk;
+	u8 snonce[WPA_NONCE_LEN];
+	struct wpa_ptk ptk;
+	int done_phase; /* last phase this station has finished */
+};
+
+/* EAPOL frame from a simulated station, waiting to be received */
+struct test_frame {
+	struct test_frame *next;
+	struct test_sta *sta;
+	int last; /* the station's last frame in this phase */
+	size_t len;
+	/* followed by len bytes of EAPOL frame */
+};
+
+enum { TEST_ASSOC, TEST_REKEY, TEST_ROAM, TEST_DONE };
 
 struct test_driver_data {
 	struct driver_ops ops;
 	struct hostapd_data *hapd;
+
+	/* station simulator */
+	struct test_sta *sta;
+	struct test_sta *sta_hash[TEST_STA_HASH_SIZE];
+	int num_sta, rekeys, roams, loss;
+	int phase; /* 1 = association, then rekeys, then roams */
+	int next_sta; /* next station to associate in this phase */
+	int done; /* stations that have finished this phase */
+	int failed;
+	struct test_frame *rx_head, *rx_tail;
+	int rx_scheduled;
+	struct timeval phase_start, sim_enter;
+	long sim_usec; /* spent in the simulator during this phase */
+	unsigned long frames, lost, deauth, bad_mic, bad_gtk;
+	unsigned long vm_data, vm_rss, peak_vm_data, peak_vm_rss;
+	unsigned long base_vm_data, assoc_vm_data;
 };
 
 static const struct driver_ops test_driver_ops;
 
 
+static long test_usec_since(struct timeval *tv)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - tv->tv_sec) * 1000000 +
+		(now.tv_usec - tv->tv_usec);
+}
+
+
+static void test_sim_enter(struct test_driver_data *drv)
+{
+	gettimeofday(&drv->sim_enter, NULL);
+}
+
+
+static void test_sim_leave(struct test_driver_data *drv)
+{
+	drv->sim_usec += test_usec_since(&drv->sim_enter);
+}
+
+
+/* /proc/self/status of Linux 2.4 has no VmHWM or VmPeak, so the peak is
+ * whatever was sampled at the end of each chunk and phase. */
+static void test_sim_mem(struct test_driver_data *drv)
+{
+	FILE *f;
+	char buf[128];
+	unsigned long kb;
+
+	f = fopen("/proc/self/status", "r");
+	if (f == NULL)
+		return;
+	while (fgets(buf, sizeof(buf), f)) {
+		if (sscanf(buf, "VmData: %lu", &kb) == 1) {
+			drv->vm_data = kb;
+			if (kb > drv->peak_vm_data)
+				drv->peak_vm_data = kb;
+		} else if (sscanf(buf, "VmRSS: %lu", &kb) == 1) {
+			drv->vm_rss = kb;
+			if (kb > drv->peak_vm_rss)
+				drv->peak_vm_rss = kb;
+		}
+	}
+	fclose(f);
+}
+
+
+static int test_sim_phase_type(struct test_driver_data *drv)
+{
+	if (drv->phase == 1)
+		return TEST_ASSOC;
+	if (drv->phase <= 1 + drv->rekeys)
+		return TEST_REKEY;
+	if (drv->phase <= 1 + drv->rekeys + drv->roams)
+		return TEST_ROAM;
+	return TEST_DONE;
+}
+
+
+static struct test_sta * test_sim_get_sta(struct test_driver_data *drv,
+					  const u8 *addr)
+{
+	struct test_sta *sta;
+
+	sta = drv->sta_hash[TEST_STA_HASH(addr)];
+	while (sta && memcmp(sta->addr, addr, ETH_ALEN) != 0)
+		sta = sta->hnext;
+	return sta;
+}
+
+
+static u8 test_sim_suite(int cipher)
+{
+	switch (cipher) {
+	case WPA_CIPHER_CCMP:
+		return 4;
+	case WPA_CIPHER_TKIP:
+		return 2;
+	case WPA_CIPHER_WEP104:
+		return 5;
+	case WPA_CIPHER_WEP40:
+		return 1;
+	}
+	return 0;
+}
+
+
+/* the WPA/RSN IE a station would put in its (Re)Association Request */
+static size_t test_sim_wpa_ie(u8 *buf, int wpa, int group, int pairwise)
+{
+	u8 *pos = buf;
+
+	if (wpa == HOSTAPD_WPA_VERSION_WPA2) {
+		*pos++ = WLAN_EID_RSN;
+		*pos++ = 20;
+		*pos++ = 1; /* version */
+		*pos++ = 0;
+		*pos++ = 0x00; *pos++ = 0x0f; *pos++ = 0xac;
+		*pos++ = test_sim_suite(group);
+		*pos++ = 1;
+		*pos++ = 0;
+		*pos++ = 0x00; *pos++ = 0x0f; *pos++ = 0xac;
+		*pos++ = test_sim_suite(pairwise);
+		*pos++ = 1;
+		*pos++ = 0;
+		*pos++ = 0x00; *pos++ = 0x0f; *pos++ = 0xac;
+		*pos++ = 2; /* PSK */
+		*pos++ = 0; /* RSN capabilities */
+		*pos++ = 0;
+	} else {
+		*pos++ = WLAN_EID_GENERIC;
+		*pos++ = 22;
+		*pos++ = 0x00; *pos++ = 0x50; *pos++ = 0xf2; *pos++ = 1;
+		*pos++ = 1; /* version */
+		*pos++ = 0;
+		*pos++ = 0x00; *pos++ = 0x50; *pos++ = 0xf2;
+		*pos++ = test_sim_suite(group);
+		*pos++ = 1;
+		*pos++ = 0;
+		*pos++ = 0x00; *pos++ = 0x50; *pos++ = 0xf2;
+		*pos++ = test_sim_suite(pairwise);
+		*pos++ = 1;
+		*pos++ = 0;
+		*pos++ = 0x00; *pos++ = 0x50; *pos++ = 0xf2;
+		*pos++ = 2; /* PSK */
+	}
+	return pos - buf;
+}
+
+
+static void test_sim_deliver(void *eloop_ctx, void *timeout_ctx);
+static void test_sim_phase_end(void *eloop_ctx, void *timeout_ctx);
+
+
+static void test_sim_sta_done(struct test_driver_data *drv,
+			      struct test_sta *sta)
+{
+	if (sta->done_phase == drv->phase)
+		return;
+	sta->done_phase = drv->phase;
+	if (++drv->done == drv->num_sta)
+		eloop_register_timeout(0, 0, test_sim_phase_end, drv, NULL);
+}
+
+
+static int test_sim_mic(int ver, u8 *key, u8 *data, size_t len, u8 *mic)
+{
+	u8 hash[SHA1_MAC_LEN];
+
+	switch (ver) {
+	case WPA_KEY_INFO_TYPE_HMAC_MD5_RC4:
+		hmac_md5(key, 16, data, len, mic);
+		break;
+	case WPA_KEY_INFO_TYPE_HMAC_SHA1_AES:
+		hmac_sha1(key, 16, data, len, hash);
+		memcpy(mic, hash, MD5_MAC_LEN);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+
+static int test_sim_check_mic(struct test_sta *sta, int ver, u8 *data,
+			      size_t len)
+{
+	struct wpa_eapol_key *key;
+	u8 mic[16], calc[16];
+
+	key = (struct wpa_eapol_key *) (data + sizeof(struct ieee802_1x_hdr));
+	memcpy(mic, key->key_mic, 16);
+	memset(key->key_mic, 0, 16);
+	if (test_sim_mic(ver, sta->ptk.mic_key, data, len, calc) < 0)
+		memset(calc, 0, 16);
+	memcpy(key->key_mic, mic, 16);
+	return memcmp(mic, calc, 16) == 0 ? 0 : -1;
+}
+
+
+/* Queue the station's answer to 'req'. It is received from eloop, like
+ * a frame from the kernel driver would be, not from within wpa.c. */
+static void test_sim_reply(struct test_driver_data *drv,
+			   struct test_sta *sta, struct wpa_eapol_key *req,
+			   int key_info, u8 *nonce, u8 *key_data,
+			   size_t key_data_len, int last)
+{
+	struct test_frame *f;
+	struct ieee802_1x_hdr *hdr;
+	struct wpa_eapol_key *key;
+	size_t len;
+
+	len = sizeof(*hdr) + sizeof(*key) + key_data_len;
+	f = malloc(sizeof(*f) + len);
+	if (f == NULL)
+		return;
+	memset(f, 0, sizeof(*f) + len);
+	f->sta = sta;
+	f->last = last;
+	f->len = len;
+
+	hdr = (struct ieee802_1x_hdr *) (f + 1);
+	hdr->version = EAPOL_VERSION;
+	hdr->type = IEEE802_1X_TYPE_EAPOL_KEY;
+	hdr->length = htons(len - sizeof(*hdr));
+	key = (struct wpa_eapol_key *) (hdr + 1);
+	key->type = req->type;
+	key->key_info = htons(key_info);
+	key->key_length = req->key_length;
+	memcpy(key->replay_counter, req->replay_counter,
+	       WPA_REPLAY_COUNTER_LEN);
+	if (nonce)
+		memcpy(key->key_nonce, nonce, WPA_NONCE_LEN);
+	if (key_data) {
+		memcpy(key + 1, key_data, key_data_len);
+		key->key_data_length = htons(key_data_len);
+	}
+	test_sim_mic(key_info & WPA_KEY_INFO_TYPE_MASK, sta->ptk.mic_key,
+		     (u8 *) hdr, len, key->key_mic);
+
+	if (drv->rx_tail)
+		drv->rx_tail->next = f;
+	else
+		drv->rx_head = f;
+	drv->rx_tail = f;
+	if (!drv->rx_scheduled) {
+		drv->rx_scheduled = 1;
+		eloop_register_timeout(0, 0, test_sim_deliver, drv, NULL);
+	}
+}
+
+
+static void test_sim_ptk(struct test_sta *sta, const u8 *aa, const u8 *anonce)
+{
+	u8 data[2 * ETH_ALEN + 2 * WPA_NONCE_LEN];
+
+	if (memcmp(aa, sta->addr, ETH_ALEN) < 0) {
+		memcpy(data, aa, ETH_ALEN);
+		memcpy(data + ETH_ALEN, sta->addr, ETH_ALEN);
+	} else {
+		memcpy(data, sta->addr, ETH_ALEN);
+		memcpy(data + ETH_ALEN, aa, ETH_ALEN);
+	}
+	if (memcmp(anonce, sta->snonce, WPA_NONCE_LEN) < 0) {
+		memcpy(data + 2 * ETH_ALEN, anonce, WPA_NONCE_LEN);
+		memcpy(data + 2 * ETH_ALEN + WPA_NONCE_LEN, sta->snonce,
+		       WPA_NONCE_LEN);
+	} else {
+		memcpy(data + 2 * ETH_ALEN, sta->snonce, WPA_NONCE_LEN);
+		memcpy(data + 2 * ETH_ALEN + WPA_NONCE_LEN, anonce,
+		       WPA_NONCE_LEN);
+	}
+	sha1_prf(sta->pmk, WPA_PMK_LEN, "Pairwise key expansion",
+		 data, sizeof(data), (u8 *) &sta->ptk, sizeof(sta->ptk));
+}
+
+
+static int test_sim_check_gtk(struct test_driver_data *drv,
+			      struct test_sta *sta, struct wpa_eapol_key *key,
+			      int ver)
+{
+	struct wpa_authenticator *gsm = drv->hapd->wpa_auth;
+	size_t len = ntohs(key->key_data_length);
+	u8 buf[64], ek[32], *gtk;
+
+	if (len > sizeof(buf))
+		return -1;
+	if (ver == WPA_KEY_INFO_TYPE_HMAC_SHA1_AES) {
+		if (len < 16 || len % 8 ||
+		    aes_unwrap(sta->ptk.encr_key, (len - 8) / 8,
+			       (u8 *) (key + 1), buf))
+			return -1;
+		len -= 8;
+	} else {
+		memcpy(ek, key->key_iv, 16);
+		memcpy(ek + 16, sta->ptk.encr_key, 16);
+		memcpy(buf, key + 1, len);
+		rc4_skip(ek, 32, 256, buf, len);
+	}
+
+	gtk = buf;
+	if (key->type == EAPOL_KEY_TYPE_RSN) {
+		/* GTK KDE: dd len 00:0f:ac:1 keyid 0 GTK */
+		if (len < 8 || buf[0] != WLAN_EID_GENERIC)
+			return -1;
+		gtk += 8;
+	}
+	if (gtk + gsm->GTK_len > buf + len)
+		return -1;
+	return memcmp(gtk, gsm->GTK[gsm->GN - 1], gsm->GTK_len) ? -1 : 0;
+}
+
+
+/* EAPOL-Key frame from wpa.c to a simulated station */
+static void test_sim_receive(struct test_driver_data *drv,
+			     struct test_sta *sta, u8 *data, size_t len)
+{
+	struct ieee802_1x_hdr *hdr = (struct ieee802_1x_hdr *) data;
+	struct wpa_eapol_key *key = (struct wpa_eapol_key *) (hdr + 1);
+	int key_info, ver, info;
+
+	if (len < sizeof(*hdr) + sizeof(*key) ||
+	    hdr->type != IEEE802_1X_TYPE_EAPOL_KEY)
+		return;
+	key_info = ntohs(key->key_info);
+	ver = key_info & WPA_KEY_INFO_TYPE_MASK;
+
+	if ((key_info & WPA_KEY_INFO_KEY_TYPE) &&
+	    !(key_info & WPA_KEY_INFO_MIC)) {
+		/* 1/4: answer with a new SNonce and the IE from AssocReq */
+		inc_byte_array(sta->snonce, WPA_NONCE_LEN);
+		test_sim_ptk(sta, drv->hapd->own_addr, key->key_nonce);
+		test_sim_reply(drv, sta, key, ver | WPA_KEY_INFO_KEY_TYPE |
+			       WPA_KEY_INFO_MIC, sta->snonce, sta->wpa_ie,
+			       sta->wpa_ie_len, 0);
+		return;
+	}
+
+	if (test_sim_check_mic(sta, ver, data, len)) {
+		drv->bad_mic++;
+		return;
+	}
+
+	if (key_info & WPA_KEY_INFO_KEY_TYPE) {
+		/* 3/4; WPA2 is done here, WPA gets the GTK next */
+		info = ver | WPA_KEY_INFO_KEY_TYPE | WPA_KEY_INFO_MIC;
+		if (sta->wpa == HOSTAPD_WPA_VERSION_WPA2)
+			info |= WPA_KEY_INFO_SECURE;
+		test_sim_reply(drv, sta, key, info, NULL, NULL, 0,
+			       sta->wpa == HOSTAPD_WPA_VERSION_WPA2);
+	} else {
+		/* 1/2 Group */
+		if (test_sim_check_gtk(drv, sta, key, ver)) {
+			drv->bad_gtk++;
+			return;
+		}
+		info = ver | WPA_KEY_INFO_MIC | WPA_KEY_INFO_SECURE;
+		if (sta->wpa != HOSTAPD_WPA_VERSION_WPA2)
+			info |= key_info & WPA_KEY_INFO_KEY_INDEX_MASK;
+		test_sim_reply(drv, sta, key, info, NULL, NULL, 0, 1);
+	}
+}
+
+
+static void test_sim_deliver(void *eloop_ctx, void *timeout_ctx)
+{
+	struct test_driver_data *drv = eloop_ctx;
+	struct test_frame *f, *batch;
+
+	/* frames queued while receiving these wait for the next round */
+	batch = drv->rx_head;
+	drv->rx_head = drv->rx_tail = NULL;
+	drv->rx_scheduled = 0;
+
+	while (batch) {
+		f = batch;
+		batch = f->next;
+		ieee802_1x_receive(drv->hapd, f->sta->addr, (u8 *) (f + 1),
+				   f->len);
+		if (f->last)
+			test_sim_sta_done(drv, f->sta);
+		free(f);
+	}
+}
+
+
+/* as madwifi_new_sta() */
+static int test_sim_assoc(struct test_driver_data *drv, struct test_sta *tsta)
+{
+	struct hostapd_data *hapd = drv->hapd;
+	struct sta_info *sta;
+	int new_assoc;
+
+	sta = ap_get_sta(hapd, tsta->addr);
+	if (sta) {
+		accounting_sta_stop(hapd, sta);
+	} else {
+		sta = ap_sta_add(hapd, tsta->addr);
+		if (sta == NULL)
+			return -1;
+	}
+	accounting_sta_get_id(hapd, sta);
+
+	if (wpa_validate_wpa_ie(hapd, sta, tsta->wpa_ie, tsta->wpa_ie_len,
+				tsta->wpa) != WPA_IE_OK)
+		return -1;
+	free(sta->wpa_ie);
+	sta->wpa_ie = malloc(tsta->wpa_ie_len);
+	if (sta->wpa_ie == NULL)
+		return -1;
+	memcpy(sta->wpa_ie, tsta->wpa_ie, tsta->wpa_ie_len);
+	sta->wpa_ie_len = tsta->wpa_ie_len;
+
+	new_assoc = (sta->flags & WLAN_STA_ASSOC) == 0;
+	sta->flags |= WLAN_STA_ASSOC;
+	wpa_sm_event(hapd, sta, WPA_ASSOC);
+	if (new_assoc)
+		hostapd_new_assoc_sta(hapd, sta);
+	else {
+		hostapd_reassoc_sta(hapd, sta);
+		wpa_sm_event(hapd, sta, WPA_REAUTH);
+	}
+	ieee802_1x_notify_port_enabled(sta->eapol_sm, 1);
+	return 0;
+}
+
+
+/* as madwifi_del_sta() */
+static void test_sim_disassoc(struct test_driver_data *drv,
+			      struct test_sta *tsta)
+{
+	struct hostapd_data *hapd = drv->hapd;
+	struct sta_info *sta;
+
+	sta = ap_get_sta(hapd, tsta->addr);
+	if (sta == NULL)
+		return;
+	sta->flags &= ~WLAN_STA_ASSOC;
+	wpa_sm_event(hapd, sta, WPA_DISASSOC);
+	sta->acct_terminate_cause = RADIUS_ACCT_TERMINATE_CAUSE_USER_REQUEST;
+	ieee802_1x_set_port_enabled(hapd, sta, 0);
+	ap_free_sta(hapd, sta);
+}
+
+
+static void test_sim_assoc_chunk(void *eloop_ctx, void *timeout_ctx)
+{
+	struct test_driver_data *drv = eloop_ctx;
+	struct test_sta *sta;
+	int i;
+
+	for (i = 0; i < TEST_STA_CHUNK && drv->next_sta < drv->num_sta; i++) {
+		sta = &drv->sta[drv->next_sta++];
+		if (test_sim_phase_type(drv) == TEST_ROAM)
+			test_sim_disassoc(drv, sta);
+		if (test_sim_assoc(drv, sta) < 0) {
+			printf("driver_test: association of " MACSTR
+			       " failed\n", MAC2STR(sta->addr));
+			drv->failed++;
+			test_sim_sta_done(drv, sta);
+		}
+	}
+
+	test_sim_enter(drv);
+	test_sim_mem(drv);
+	test_sim_leave(drv);
+
+	if (drv->next_sta < drv->num_sta)
+		eloop_register_timeout(0, 0, test_sim_assoc_chunk, drv, NULL);
+}
+
+
+static void test_sim_reassoc(void *eloop_ctx, void *timeout_ctx)
+{
+	struct test_driver_data *drv = eloop_ctx;
+	struct test_sta *sta = timeout_ctx;
+
+	if (test_sim_assoc(drv, sta) < 0) {
+		drv->failed++;
+		test_sim_sta_done(drv, sta);
+	}
+}
+
+
+static void test_sim_stalled(void *eloop_ctx, void *timeout_ctx)
+{
+	struct test_driver_data *drv = eloop_ctx;
+
+	printf("driver_test: phase %d stalled, %d of %d stations done\n",
+	       drv->phase, drv->done, drv->num_sta);
+	eloop_terminate();
+}
+
+
+static void test_sim_report(struct test_driver_data *drv)
+{
+	struct hostapd_data *hapd = drv->hapd;
+	struct sta_info *sta;
+	int i, len, longest = 0;
+
+	for (i = 0; i < STA_HASH_SIZE; i++) {
+		len = 0;
+		for (sta = hapd->sta_hash[i]; sta; sta = sta->hnext)
+			len++;
+		if (len > longest)
+			longest = len;
+	}
+
+	printf("driver_test: peak VmData %lu kB, VmRSS %lu kB\n",
+	       drv->peak_vm_data, drv->peak_vm_rss);
+	printf("driver_test: per station state: sta_info %lu, "
+	       "wpa_state_machine %lu, eapol_state_machine %lu bytes "
+	       "(802.1X only)\n",
+	       (unsigned long) sizeof(struct sta_info),
+	       (unsigned long) sizeof(struct wpa_state_machine),
+	       (unsigned long) sizeof(struct eapol_state_machine));
+	if (drv->assoc_vm_data >= drv->base_vm_data)
+		printf("driver_test: VmData grew by %lu bytes per associated "
+		       "station\n",
+		       (drv->assoc_vm_data - drv->base_vm_data) * 1024 /
+		       drv->num_sta);
+	printf("driver_test: %d stations, longest STA_HASH chain %d, "
+	       "%d failed associations\n", hapd->num_sta, longest,
+	       drv->failed);
+}
+
+
+/* Add a STA without a WPA state machine, so that it is at the head of
+ * sta_list where the paced group rekey will start. */
+static struct sta_info * test_sim_bare_sta(struct test_driver_data *drv)
+{
+	static u8 addr[ETH_ALEN] = { 0x02, 0x00, 0x00, 0xff, 0xff, 0xff };
+
+	return ap_sta_add(drv->hapd, addr);
+}
+
+
+/* Free it while the rekey still points at it. */
+static void test_sim_free_bare_sta(struct test_driver_data *drv,
+				   struct sta_info *sta)
+{
+	struct wpa_authenticator *gsm = drv->hapd->wpa_auth;
+
+	if (gsm == NULL || gsm->GUpdateNext != sta) {
+		printf("driver_test: the group rekey did not start at the "
+		       "station without WPA state\n");
+		ap_free_sta(drv->hapd, sta);
+		return;
+	}
+	ap_free_sta(drv->hapd, sta);
+	if (gsm->GUpdateNext == sta) {
+		printf("driver_test: the group rekey points at a freed "
+		       "station\n");
+		drv->failed++;
+	} else
+		printf("driver_test: freed a station the group rekey was "
+		       "about to step\n");
+}
+
+
+static void test_sim_next_phase(struct test_driver_data *drv)
+{
+	struct sta_info *bare = NULL;
+
+	drv->phase++;
+	drv->next_sta = 0;
+	drv->done = 0;
+	drv->sim_usec = 0;
+	drv->frames = 0;
+	drv->lost = 0;
+	drv->deauth = 0;
+	drv->bad_mic = 0;
+	drv->bad_gtk = 0;
+	gettimeofday(&drv->phase_start, NULL);
+
+	switch (test_sim_phase_type(drv)) {
+	case TEST_ASSOC:
+	case TEST_ROAM:
+		test_sim_assoc_chunk(drv, NULL);
+		break;
+	case TEST_REKEY:
+		if (drv->phase == 2)
+			bare = test_sim_bare_sta(drv);
+		wpa_group_rekey(drv->hapd);
+		if (bare)
+			test_sim_free_bare_sta(drv, bare);
+		break;
+	default:
+		test_sim_report(drv);
+		eloop_terminate();
+		return;
+	}
+	eloop_register_timeout(TEST_PHASE_TIMEOUT, 0, test_sim_stalled, drv,
+			       NULL);
+}
+
+
+static void test_sim_phase_end(void *eloop_ctx, void *timeout_ctx)
+{
+	struct test_driver_data *drv = eloop_ctx;
+	static const char *name[] = { "association", "group rekey", "roam" };
+	long usec, ap_usec;
+
+	usec = test_usec_since(&drv->phase_start);
+	eloop_cancel_timeout(test_sim_stalled, drv, NULL);
+
+	test_sim_mem(drv);
+	if (drv->phase == 1)
+		drv->assoc_vm_data = drv->vm_data;
+
+	ap_usec = usec - drv->sim_usec;
+	if (usec < 1)
+		usec = 1;
+	if (ap_usec < 1)
+		ap_usec = 1;
+	printf("driver_test: %s: %d handshakes in %ld.%03ld s, %.0f/s "
+	       "(hostapd alone %.0f/s), %lu EAPOL-Key frames (%lu lost), "
+	       "%lu deauthenticated, %lu bad MIC, %lu bad GTK\n",
+	       name[test_sim_phase_type(drv)], drv->done, usec / 1000000,
+	       (usec / 1000) % 1000, drv->done * 1000000.0 / usec,
+	       drv->done * 1000000.0 / ap_usec, drv->frames, drv->lost,
+	       drv->deauth, drv->bad_mic, drv->bad_gtk);
+
+	test_sim_next_phase(drv);
+}
+
+
+static int test_sim_env(const char *name, int def)
+{
+	char *val = getenv(name);
+
+	return val ? atoi(val) : def;
+}
+
+
+static void test_sim_start(void *eloop_ctx, void *timeout_ctx)
+{
+	struct test_driver_data *drv = eloop_ctx;
+	struct hostapd_config *conf = drv->hapd->conf;
+	struct test_sta *sta;
+	int i, pairwise;
+
+	if (!conf->wpa || !(conf->wpa_key_mgmt & WPA_KEY_MGMT_PSK)) {
+		printf("driver_test: the station simulator needs WPA-PSK\n");
+		eloop_terminate();
+		return;
+	}
+	pairwise = conf->wpa_pairwise & WPA_CIPHER_CCMP ?
+		WPA_CIPHER_CCMP : WPA_CIPHER_TKIP;
+
+	drv->sta = malloc(drv->num_sta * sizeof(struct test_sta));
+	if (drv->sta == NULL) {
+		printf("driver_test: no memory for %d stations\n",
+		       drv->num_sta);
+		eloop_terminate();
+		return;
+	}
+	memset(drv->sta, 0, drv->num_sta * sizeof(struct test_sta));
+
+	for (i = 0; i < drv->num_sta; i++) {
+		sta = &drv->sta[i];
+		sta->addr[0] = 0x02;
+		sta->addr[4] = (i + 2) >> 8;
+		sta->addr[5] = (i + 2) & 0xff;
+		sta->hnext = drv->sta_hash[TEST_STA_HASH(sta->addr)];
+		drv->sta_hash[TEST_STA_HASH(sta->addr)] = sta;
+
+		if (conf->wpa == (HOSTAPD_WPA_VERSION_WPA |
+				  HOSTAPD_WPA_VERSION_WPA2))
+			sta->wpa = (i & 1) ? HOSTAPD_WPA_VERSION_WPA :
+				HOSTAPD_WPA_VERSION_WPA2;
+		else
+			sta->wpa = conf->wpa;
+		sta->wpa_ie_len = test_sim_wpa_ie(sta->wpa_ie, sta->wpa,
+						  conf->wpa_group, pairwise);
+		sta->pmk = hostapd_get_psk(conf, sta->addr, NULL);
+		if (sta->pmk == NULL) {
+			printf("driver_test: no PSK for " MACSTR "\n",
+			       MAC2STR(sta->addr));
+			eloop_terminate();
+			return;
+		}
+		memcpy(sta->snonce, sta->addr, ETH_ALEN);
+	}
+
+	test_sim_mem(drv);
+	drv->base_vm_data = drv->vm_data;
+	printf("driver_test: simulating %d stations, %d group rekeys, "
+	       "%d roams\n", drv->num_sta, drv->rekeys, drv->roams);
+	test_sim_next_phase(drv);
+}
+
+
+static int test_driver_send_eapol(void *priv, u8 *addr, u8 *data,
+				  size_t data_len, int encrypt)
+{
+	struct test_driver_data *drv = priv;
+	struct test_sta *sta;
+
+	sta = test_sim_get_sta(drv, addr);
+	if (sta == NULL)
+		return 0;
+
+	test_sim_enter(drv);
+	drv->frames++;
+	if (drv->loss && rand() % 100 < drv->loss)
+		drv->lost++;
+	else
+		test_sim_receive(drv, sta, data, data_len);
+	test_sim_leave(drv);
+	return 0;
+}
+
+
+static int test_driver_sta_deauth(void *priv, u8 *addr, int reason)
+{
+	struct test_driver_data *drv = priv;
+	struct test_sta *sta;
+
+	sta = test_sim_get_sta(drv, addr);
+	if (sta == NULL)
+		return 0;
+
+	drv->deauth++;
+	eloop_cancel_timeout(test_sim_reassoc, drv, sta);
+	eloop_register_timeout(TEST_STA_BACKOFF, 0, test_sim_reassoc, drv, sta);
+	return 0;
+}
+
+
 static int test_driver_init(struct hostapd_data *hapd)
 {
 	struct test_driver_data *drv;
@@ -51,6 +847,16 @@ static int test_driver_init(struct hostapd_data *hapd)
 	drv->hapd = hapd;
 
 	hapd->driver = &drv->ops;
+
+	memcpy(hapd->own_addr, "\x02\x00\x00\x00\x00\x01", ETH_ALEN);
+	drv->num_sta = test_sim_env("HOSTAPD_TEST_STATIONS", 0);
+	if (drv->num_sta > MAX_STA_COUNT)
+		drv->num_sta = MAX_STA_COUNT;
+	drv->rekeys = test_sim_env("HOSTAPD_TEST_REKEYS", 3);
+	drv->roams = test_sim_env("HOSTAPD_TEST_ROAMS", 1);
+	drv->loss = test_sim_env("HOSTAPD_TEST_LOSS", 0);
+	if (drv->num_sta > 0)
+		eloop_register_timeout(0, 0, test_sim_start, drv, NULL);
 	return 0;
 }
 
@@ -58,6 +864,20 @@ static int test_driver_init(struct hostapd_data *hapd)
 static void test_driver_deinit(void *priv)
 {
 	struct test_driver_data *drv = priv;
+	struct test_frame *f;
+
+	eloop_cancel_timeout(test_sim_start, drv, NULL);
+	eloop_cancel_timeout(test_sim_assoc_chunk, drv, NULL);
+	eloop_cancel_timeout(test_sim_deliver, drv, NULL);
+	eloop_cancel_timeout(test_sim_phase_end, drv, NULL);
+	eloop_cancel_timeout(test_sim_stalled, drv, NULL);
+	eloop_cancel_timeout(test_sim_reassoc, drv, ELOOP_ALL_CTX);
+	while (drv->rx_head) {
+		f = drv->rx_head;
+		drv->rx_head = f->next;
+		free(f);
+	}
+	free(drv->sta);
 
 	drv->hapd->driver = NULL;
 
@@ -69,6 +889,8 @@ static const struct driver_ops test_driver_ops = {
 	.name = "test",
 	.init = test_driver_init,
 	.deinit = test_driver_deinit,
+	.send_eapol = test_driver_send_eapol,
+	.sta_deauth = test_driver_sta_deauth,
 };
 
 
@@ -249,16 +249,34 @@ int tls_prf(const u8 *secret, size_t secret_len, const char *label,
 }
 
 
+static void sha1_put_state(u8 *out, const u32 *state)
+{
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		out[i * 4] = (state[i] >> 24) & 0xff;
+		out[i * 4 + 1] = (state[i] >> 16) & 0xff;
+		out[i * 4 + 2] = (state[i] >> 8) & 0xff;
+		out[i * 4 + 3] = state[i] & 0xff;
+	}
+}
+
+
 static void pbkdf2_sha1_f(const char *passphrase, const char *ssid,
 			  size_t ssid_len, int iterations, int count,
 			  u8 *digest)
 {
-	unsigned char tmp[SHA1_MAC_LEN], tmp2[SHA1_MAC_LEN];
+	static const u32 sha1_init[5] = {
+		0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+	};
+	unsigned char tmp[SHA1_MAC_LEN];
 	int i, j;
 	unsigned char count_buf[4];
 	const u8 *addr[2];
 	size_t len[2];
 	size_t passphrase_len = strlen(passphrase);
+	u32 istate[5], ostate[5], state[5];
+	u8 pad[64], block[64];
 
 	addr[0] = (u8 *) ssid;
 	len[0] = ssid_len;
@@ -278,13 +296,59 @@ static void pbkdf2_sha1_f(const char *passphrase, const char *ssid,
 	hmac_sha1_vector((u8 *) passphrase, passphrase_len, 2, addr, len, tmp);
 	memcpy(digest, tmp, SHA1_MAC_LEN);
 
+	if (iterations <= 1)
+		return;
+
+	/* Every other U is a HMAC over the 20 bytes of the previous one, with
+	 * the same key. Hash the key XOR ipad/opad blocks once here, then each
+	 * iteration is only one SHA1 block for the inner hash and one for the
+	 * outer hash. The passphrase is 8..63 characters, so it never needs to
+	 * be hashed down to 20 bytes first. */
+	if (passphrase_len > 64) {
+		for (i = 1; i < iterations; i++) {
+			hmac_sha1((u8 *) passphrase, passphrase_len, tmp,
+				  SHA1_MAC_LEN, tmp);
+			for (j = 0; j < SHA1_MAC_LEN; j++)
+				digest[j] ^= tmp[j];
+		}
+		return;
+	}
+
+	memset(pad, 0, sizeof(pad));
+	memcpy(pad, passphrase, passphrase_len);
+	for (j = 0; j < 64; j++)
+		pad[j] ^= 0x36;
+	memcpy(istate, sha1_init, sizeof(istate));
+	sha1_transform((u8 *) istate, pad);
+	for (j = 0; j < 64; j++)
+		pad[j] ^= 0x36 ^ 0x5c;
+	memcpy(ostate, sha1_init, sizeof(ostate));
+	sha1_transform((u8 *) ostate, pad);
+	memset(pad, 0, sizeof(pad));
+
+	/* The message block: the 20 byte hash, then the SHA1 padding for a
+	 * message of 64 + 20 bytes, which does not change. */
+	memset(block, 0, sizeof(block));
+	memcpy(block, tmp, SHA1_MAC_LEN);
+	block[SHA1_MAC_LEN] = 0x80;
+	block[62] = ((64 + SHA1_MAC_LEN) * 8) >> 8;
+	block[63] = ((64 + SHA1_MAC_LEN) * 8) & 0xff;
+
 	for (i = 1; i < iterations; i++) {
-		hmac_sha1((u8 *) passphrase, passphrase_len, tmp, SHA1_MAC_LEN,
-			  tmp2);
-		memcpy(tmp, tmp2, SHA1_MAC_LEN);
+		memcpy(state, istate, sizeof(state));
+		sha1_transform((u8 *) state, block);
+		sha1_put_state(block, state);
+		memcpy(state, ostate, sizeof(state));
+		sha1_transform((u8 *) state, block);
+		sha1_put_state(block, state);
 		for (j = 0; j < SHA1_MAC_LEN; j++)
-			digest[j] ^= tmp2[j];
+			digest[j] ^= block[j];
 	}
+
+	memset(istate, 0, sizeof(istate));
+	memset(ostate, 0, sizeof(ostate));
+	memset(state, 0, sizeof(state));
+	memset(block, 0, sizeof(block));
 }
 
 
@@ -618,6 +682,8 @@ void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
 
 #ifdef TEST_MAIN
 
+#include <time.h>
+
 #include "md5.c"
 
 static int test_eap_fast(void)
@@ -872,6 +938,75 @@ static struct passphrase_test passphrase_tests[] =
 (sizeof(passphrase_tests) / sizeof(passphrase_tests[0]))
 
 
+/* PBKDF2 the straightforward way, a full HMAC per iteration, to check
+ * pbkdf2_sha1() against and to compare the speed with. */
+static void pbkdf2_sha1_ref(const char *passphrase, const char *ssid,
+			    size_t ssid_len, int iterations, u8 *buf)
+{
+	u8 tmp[SHA1_MAC_LEN], digest[SHA1_MAC_LEN], count_buf[4];
+	const u8 *addr[2];
+	size_t len[2], plen = strlen(passphrase);
+	int i, j, count;
+
+	addr[0] = (u8 *) ssid;
+	len[0] = ssid_len;
+	addr[1] = count_buf;
+	len[1] = 4;
+	for (count = 1; count <= 2; count++) {
+		count_buf[0] = count_buf[1] = count_buf[2] = 0;
+		count_buf[3] = count;
+		hmac_sha1_vector((u8 *) passphrase, plen, 2, addr, len, tmp);
+		memcpy(digest, tmp, SHA1_MAC_LEN);
+		for (i = 1; i < iterations; i++) {
+			hmac_sha1((u8 *) passphrase, plen, tmp, SHA1_MAC_LEN,
+				  tmp);
+			for (j = 0; j < SHA1_MAC_LEN; j++)
+				digest[j] ^= tmp[j];
+		}
+		memcpy(buf + (count - 1) * SHA1_MAC_LEN, digest,
+		       count == 1 ? SHA1_MAC_LEN : 32 - SHA1_MAC_LEN);
+	}
+}
+
+
+static int test_pbkdf2_speed(void)
+{
+	char passphrase[64], ssid[33];
+	u8 psk[32], ref[32];
+	clock_t start, fast, slow;
+	int i, j, ret = 0, rounds = 8;
+
+	printf("PBKDF2-SHA1 against the plain HMAC version:\n");
+	srand(1);
+	fast = slow = 0;
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < 8 + i * 7; j++)
+			passphrase[j] = ' ' + rand() % 95;
+		passphrase[j] = '\0';
+		for (j = 0; j < 1 + i * 4; j++)
+			ssid[j] = rand();
+		ssid[j] = '\0';
+
+		start = clock();
+		pbkdf2_sha1(passphrase, ssid, j, 4096, psk, 32);
+		fast += clock() - start;
+		start = clock();
+		pbkdf2_sha1_ref(passphrase, ssid, j, 4096, ref);
+		slow += clock() - start;
+
+		if (memcmp(psk, ref, 32) != 0) {
+			printf("Passphrase length %d - FAILED!\n",
+			       (int) strlen(passphrase));
+			ret++;
+		}
+	}
+	printf("%d passphrases: %.1f ms each, %.1f ms with plain HMAC\n",
+	       rounds, fast * 1000.0 / CLOCKS_PER_SEC / rounds,
+	       slow * 1000.0 / CLOCKS_PER_SEC / rounds);
+	return ret;
+}
+
+
 int main(int argc, char *argv[])
 {
 	u8 res[512];
@@ -923,6 +1058,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	ret += test_pbkdf2_speed();
+
 	return ret;
 }
 #endif /* TEST_MAIN */
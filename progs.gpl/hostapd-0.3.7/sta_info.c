@@ -70,6 +70,11 @@ static void ap_sta_list_del(hostapd *hapd, struct sta_info *sta)
 {
 	struct sta_info *tmp;
 
+	/* a paced group rekey may be about to step this STA, whether it has a
+	 * WPA state machine or not */
+	if (hapd->wpa_auth && hapd->wpa_auth->GUpdateNext == sta)
+		hapd->wpa_auth->GUpdateNext = sta->next;
+
 	if (hapd->sta_list == sta) {
 		hapd->sta_list = sta->next;
 		return;
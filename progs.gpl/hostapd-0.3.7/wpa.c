@@ -47,6 +47,9 @@ static void wpa_sm_step(struct wpa_state_machine *sm);
 static int wpa_verify_key_mic(struct wpa_ptk *PTK, u8 *data, size_t data_len);
 static void wpa_sm_call_step(void *eloop_ctx, void *timeout_ctx);
 static void wpa_group_sm_step(struct hostapd_data *hapd);
+static void wpa_group_update(void *eloop_ctx, void *timeout_ctx);
+static void wpa_group_retry(void *eloop_ctx, void *timeout_ctx);
+static void wpa_group_msg_flush(struct wpa_authenticator *gsm);
 static void pmksa_cache_free(struct hostapd_data *hapd);
 static struct rsn_pmksa_cache * pmksa_cache_get(struct hostapd_data *hapd,
 						u8 *spa, u8 *pmkid);
@@ -59,6 +62,10 @@ static const u32 dot11RSNAConfigGroupUpdateCount = 3;
 static const u32 dot11RSNAConfigPairwiseUpdateTimeOut = 1000; /* ms */
 static const u32 dot11RSNAConfigPairwiseUpdateCount = 3;
 
+/* Stations sent a group key update per eloop pass. The rest of the eloop
+ * (beacons, new associations) gets its turn between the chunks. */
+static const int wpa_group_update_chunk = 16;
+
 /* TODO: make these configurable */
 static const int dot11RSNAConfigPMKLifetime = 43200;
 static const int dot11RSNAConfigPMKReauthThreshold = 70;
@@ -741,6 +748,8 @@ void wpa_deinit(struct hostapd_data *hapd)
 
 	eloop_cancel_timeout(wpa_rekey_gmk, hapd, NULL);
 	eloop_cancel_timeout(wpa_rekey_gtk, hapd, NULL);
+	eloop_cancel_timeout(wpa_group_update, hapd, NULL);
+	eloop_cancel_timeout(wpa_group_retry, hapd, NULL);
 
 	if (hostapd_set_privacy(hapd, 0)) {
 		printf("Could not disable PrivacyInvoked for interface %s\n",
@@ -754,6 +763,8 @@ void wpa_deinit(struct hostapd_data *hapd)
 
 	free(hapd->wpa_ie);
 	hapd->wpa_ie = NULL;
+	if (hapd->wpa_auth)
+		wpa_group_msg_flush(hapd->wpa_auth);
 	free(hapd->wpa_auth);
 	hapd->wpa_auth = NULL;
 
@@ -1933,6 +1944,174 @@ static void wpa_send_eapol(struct hostapd_data *hapd, struct sta_info *sta,
 }
 
 
+
+static void wpa_group_msg_flush(struct wpa_authenticator *gsm)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		free(gsm->group_msg[i]);
+		gsm->group_msg[i] = NULL;
+	}
+}
+
+
+/* Build the parts of EAPOL(1, 1, 1, !Pair, G, RSC, GNonce, MIC(PTK), GTK[GN])
+ * that are the same for every station using this key descriptor. */
+static struct wpa_group_msg * wpa_group_msg_get(struct hostapd_data *hapd,
+						struct sta_info *sta)
+{
+	struct wpa_authenticator *gsm = hapd->wpa_auth;
+	struct wpa_group_msg *msg;
+	struct ieee802_1x_hdr *hdr;
+	struct wpa_eapol_key *key;
+	int wpa2, aes, key_info, pad_len = 0;
+	size_t key_data_len, len;
+	u8 *pos;
+
+	wpa2 = sta->wpa == WPA_VERSION_WPA2;
+	aes = sta->pairwise == WPA_CIPHER_CCMP;
+	msg = gsm->group_msg[(wpa2 ? 2 : 0) | (aes ? 1 : 0)];
+	if (msg)
+		return msg;
+
+	key_data_len = gsm->GTK_len;
+	if (wpa2)
+		key_data_len += 2 + RSN_SELECTOR_LEN + 2;
+	if (aes) {
+		pad_len = key_data_len % 8;
+		if (pad_len)
+			pad_len = 8 - pad_len;
+		key_data_len += pad_len;
+	}
+	len = sizeof(*hdr) + sizeof(*key) + key_data_len + (aes ? 8 : 0);
+
+	msg = malloc(sizeof(*msg) + len + key_data_len);
+	if (msg == NULL)
+		return NULL;
+	memset(msg, 0, sizeof(*msg) + len + key_data_len);
+	msg->frame = (u8 *) (msg + 1);
+	msg->len = len;
+	msg->key_data = msg->frame + len;
+	msg->key_data_len = key_data_len;
+
+	hdr = (struct ieee802_1x_hdr *) msg->frame;
+	hdr->version = EAPOL_VERSION;
+	hdr->type = IEEE802_1X_TYPE_EAPOL_KEY;
+	hdr->length = htons(len - sizeof(*hdr));
+	key = (struct wpa_eapol_key *) (hdr + 1);
+
+	key->type = wpa2 ? EAPOL_KEY_TYPE_RSN : EAPOL_KEY_TYPE_WPA;
+	key_info = aes ? WPA_KEY_INFO_TYPE_HMAC_SHA1_AES :
+		WPA_KEY_INFO_TYPE_HMAC_MD5_RC4;
+	key_info |= WPA_KEY_INFO_SECURE | WPA_KEY_INFO_MIC | WPA_KEY_INFO_ACK;
+	if (wpa2)
+		key_info |= WPA_KEY_INFO_ENCR_KEY_DATA;
+	else
+		key_info |= gsm->GN << WPA_KEY_INFO_KEY_INDEX_SHIFT;
+	key->key_info = htons(key_info);
+
+	switch (hapd->conf->wpa_group) {
+	case WPA_CIPHER_CCMP:
+		key->key_length = htons(16);
+		break;
+	case WPA_CIPHER_TKIP:
+		key->key_length = htons(32);
+		break;
+	case WPA_CIPHER_WEP40:
+		key->key_length = htons(5);
+		break;
+	case WPA_CIPHER_WEP104:
+		key->key_length = htons(13);
+		break;
+	}
+	memcpy(key->key_nonce, gsm->GNonce, WPA_NONCE_LEN);
+	key->key_data_length = htons(key_data_len + (aes ? 8 : 0));
+
+	pos = msg->key_data;
+	if (wpa2) {
+		*pos++ = WLAN_EID_GENERIC;
+		*pos++ = RSN_SELECTOR_LEN + 2 + gsm->GTK_len;
+		memcpy(pos, RSN_KEY_DATA_GROUPKEY, RSN_SELECTOR_LEN);
+		pos += RSN_SELECTOR_LEN;
+		*pos++ = gsm->GN & 0x03;
+		*pos++ = 0;
+	}
+	memcpy(pos, gsm->GTK[gsm->GN - 1], gsm->GTK_len);
+	pos += gsm->GTK_len;
+	if (pad_len)
+		*pos++ = 0xdd;
+
+	gsm->group_msg[(wpa2 ? 2 : 0) | (aes ? 1 : 0)] = msg;
+	return msg;
+}
+
+
+/* Send 1/2 Group from the shared frame, see wpa_group_msg_get(). */
+static void wpa_send_group_msg(struct hostapd_data *hapd, struct sta_info *sta,
+			       u8 *key_rsc)
+{
+	struct wpa_state_machine *sm = sta->wpa_sm;
+	struct wpa_authenticator *gsm = hapd->wpa_auth;
+	struct wpa_group_msg *msg;
+	struct wpa_eapol_key *key;
+	int ver;
+	u8 ek[32];
+
+	if (sm == NULL)
+		return;
+	if (!sm->PTK_valid) {
+		hostapd_logger(hapd, sta->addr, HOSTAPD_MODULE_WPA,
+			       HOSTAPD_LEVEL_DEBUG, "PTK not valid "
+			       "when sending EAPOL-Key frame");
+		return;
+	}
+	msg = wpa_group_msg_get(hapd, sta);
+	if (msg == NULL)
+		return;
+
+	key = (struct wpa_eapol_key *) (msg->frame +
+					sizeof(struct ieee802_1x_hdr));
+	ver = ntohs(key->key_info) & WPA_KEY_INFO_TYPE_MASK;
+
+	inc_byte_array(sm->key_replay_counter, WPA_REPLAY_COUNTER_LEN);
+	memcpy(key->replay_counter, sm->key_replay_counter,
+	       WPA_REPLAY_COUNTER_LEN);
+	sm->key_replay_counter_valid = TRUE;
+
+	*((u_int64_t *) key->key_rsc) = host_to_le64(*((u_int64_t *) key_rsc));
+
+	if (ver == WPA_KEY_INFO_TYPE_HMAC_SHA1_AES) {
+		aes_wrap(sm->PTK.encr_key, msg->key_data_len / 8,
+			 msg->key_data, (u8 *) (key + 1));
+	} else {
+		memcpy(key->key_iv, gsm->Counter + WPA_NONCE_LEN - 16, 16);
+		inc_byte_array(gsm->Counter, WPA_NONCE_LEN);
+		memcpy(ek, key->key_iv, 16);
+		memcpy(ek + 16, sm->PTK.encr_key, 16);
+		memcpy(key + 1, msg->key_data, msg->key_data_len);
+		rc4_skip(ek, 32, 256, (u8 *) (key + 1), msg->key_data_len);
+	}
+
+	memset(key->key_mic, 0, sizeof(key->key_mic));
+	wpa_calc_eapol_key_mic(ver, sm->PTK.mic_key, msg->frame, msg->len,
+			       key->key_mic);
+
+	if (sta->eapol_sm)
+		sta->eapol_sm->dot1xAuthEapolFramesTx++;
+	hostapd_send_eapol(hapd, sta->addr, msg->frame, msg->len,
+			   sm->pairwise_set);
+
+	sm->GTimeoutRound = gsm->GRetryRound;
+	if (!gsm->GRetryArmed) {
+		gsm->GRetryArmed = TRUE;
+		eloop_register_timeout(
+			dot11RSNAConfigGroupUpdateTimeOut / 1000,
+			(dot11RSNAConfigGroupUpdateTimeOut % 1000) * 1000,
+			wpa_group_retry, hapd, NULL);
+	}
+}
+
 static int wpa_verify_key_mic(struct wpa_ptk *PTK, u8 *data, size_t data_len)
 {
 	struct ieee802_1x_hdr *hdr;
@@ -2482,9 +2661,7 @@ SM_STATE(WPA_PTK_GROUP, REKEYNEGOTIATING)
 	hostapd_logger(sm->hapd, sm->sta->addr, HOSTAPD_MODULE_WPA,
 		       HOSTAPD_LEVEL_DEBUG,
 		       "sending 1/2 msg of Group Key Handshake");
-	wpa_send_eapol(sm->hapd, sm->sta, 1, 1, 1, !sm->Pair, 0, rsc,
-		       gsm->GNonce, NULL, 0,
-		       gsm->GTK[gsm->GN - 1], gsm->GTK_len, gsm->GN);
+	wpa_send_group_msg(sm->hapd, sm->sta, rsc);
 	sm->GTimeoutCtr++;
 }
 
@@ -2555,6 +2732,7 @@ static void wpa_group_gtk_init(struct hostapd_data *hapd)
 	memset(sm->GTK, 0, sizeof(sm->GTK));
 	sm->GN = 1;
 	sm->GM = 2;
+	wpa_group_msg_flush(sm);
 	/* GTK[GN] = CalcGTK() */
 	/* FIX: is this the correct way of getting GNonce? */
 	memcpy(sm->GNonce, sm->Counter, WPA_NONCE_LEN);
@@ -2584,14 +2762,85 @@ static void wpa_group_setkeys(struct hostapd_data *hapd)
 	inc_byte_array(sm->Counter, WPA_NONCE_LEN);
 	wpa_gmk_to_gtk(hapd, sm->GMK, hapd->own_addr, sm->GNonce,
 		       sm->GTK[sm->GN - 1], sm->GTK_len);
+	wpa_group_msg_flush(sm);
 
-	sta = hapd->sta_list;
-	while (sta) {
-		if (sta->wpa_sm) {
+	/* Mark every station now, so that GKeyDoneStations stays right,
+	 * but leave sending the 1/2 Group messages to wpa_group_update(). */
+	for (sta = hapd->sta_list; sta; sta = sta->next) {
+		if (sta->wpa_sm)
 			sta->wpa_sm->GUpdateStationKeys = TRUE;
+	}
+	sm->GUpdateNext = hapd->sta_list;
+	eloop_cancel_timeout(wpa_group_update, hapd, NULL);
+	eloop_register_timeout(0, 0, wpa_group_update, hapd, NULL);
+}
+
+
+static void wpa_group_update(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_data *hapd = eloop_ctx;
+	struct wpa_authenticator *gsm = hapd->wpa_auth;
+	struct sta_info *sta;
+	int n = 0;
+
+	if (gsm == NULL)
+		return;
+
+	while ((sta = gsm->GUpdateNext) != NULL &&
+	       n < wpa_group_update_chunk) {
+		gsm->GUpdateNext = sta->next;
+		if (sta->wpa_sm && sta->wpa_sm->GUpdateStationKeys &&
+		    sta->wpa_sm->wpa_ptk_group_state == WPA_PTK_GROUP_IDLE) {
 			wpa_sm_step(sta->wpa_sm);
+			n++;
 		}
-		sta = sta->next;
+	}
+
+	if (gsm->GUpdateNext)
+		eloop_register_timeout(0, 0, wpa_group_update, hapd, NULL);
+}
+
+
+/* The retransmit timer of all the 1/2 Group messages. A message times out
+ * at the first expiry that comes at least one full interval after it was
+ * sent, i.e. after 1 to 2 times dot11RSNAConfigGroupUpdateTimeOut. The ones
+ * sent again from here are tagged with the old round, so that they get
+ * exactly one interval. */
+static void wpa_group_retry(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_data *hapd = eloop_ctx;
+	struct wpa_authenticator *gsm = hapd->wpa_auth;
+	struct wpa_state_machine *sm;
+	struct sta_info *sta, *next;
+	int pending = 0;
+
+	if (gsm == NULL)
+		return;
+
+	gsm->GRetryArmed = FALSE;
+	for (sta = hapd->sta_list; sta; sta = next) {
+		next = sta->next;
+		sm = sta->wpa_sm;
+		if (sm == NULL || !(sta->flags & WLAN_STA_ASSOC) ||
+		    sm->wpa_ptk_group_state != WPA_PTK_GROUP_REKEYNEGOTIATING)
+			continue;
+		if (sm->GTimeoutRound == gsm->GRetryRound) {
+			pending = 1;
+			continue;
+		}
+		hostapd_logger(hapd, sta->addr, HOSTAPD_MODULE_WPA,
+			       HOSTAPD_LEVEL_DEBUG, "EAPOL-Key timeout");
+		sm->TimeoutEvt = TRUE;
+		wpa_sm_step(sm);
+	}
+	gsm->GRetryRound++;
+
+	if (pending && !gsm->GRetryArmed) {
+		gsm->GRetryArmed = TRUE;
+		eloop_register_timeout(
+			dot11RSNAConfigGroupUpdateTimeOut / 1000,
+			(dot11RSNAConfigGroupUpdateTimeOut % 1000) * 1000,
+			wpa_group_retry, hapd, NULL);
 	}
 }
 
@@ -2697,6 +2946,15 @@ void wpa_gtk_rekey(struct hostapd_data *hapd)
 		wpa_gmk_to_gtk(hapd, sm->GMK, hapd->own_addr, sm->GNonce,
 			       sm->GTK[sm->GN - 1], sm->GTK_len);
 	}
+	wpa_group_msg_flush(sm);
+}
+
+
+/* Start a group key update now, as if wpa_group_rekey had expired. */
+void wpa_group_rekey(struct hostapd_data *hapd)
+{
+	eloop_cancel_timeout(wpa_rekey_gtk, hapd, NULL);
+	wpa_rekey_gtk(hapd, NULL);
 }
 
 
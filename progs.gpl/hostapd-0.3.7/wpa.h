@@ -98,6 +98,7 @@ struct wpa_state_machine {
 	Boolean Disconnect;
 	int TimeoutCtr;
 	int GTimeoutCtr;
+	unsigned int GTimeoutRound; /* GRetryRound when 1/2 Group was sent */
 	Boolean TimeoutEvt;
 	Boolean EAPOLKeyReceived;
 	Boolean EAPOLKeyPairwise;
@@ -124,6 +125,16 @@ struct wpa_state_machine {
 	Boolean changed;
 };
 
+/* EAPOL-Key 1/2 Group frame for the current GTK, shared by all the stations
+ * with the same key descriptor. Only the replay counter, RSC, IV, key data
+ * and MIC are filled in for each station. */
+struct wpa_group_msg {
+	u8 *frame;
+	size_t len;
+	u8 *key_data; /* plaintext, padded for AES key wrap */
+	size_t key_data_len;
+};
+
 /* per authenticator data */
 struct wpa_authenticator {
 	Boolean GInit;
@@ -145,6 +156,15 @@ struct wpa_authenticator {
 	u8 GNonce[WPA_NONCE_LEN];
 	Boolean changed;
 
+	/* group key updates are sent to a few stations per eloop pass,
+	 * starting from here */
+	struct sta_info *GUpdateNext;
+	/* indexed by (WPA2 ? 2 : 0) | (pairwise CCMP ? 1 : 0) */
+	struct wpa_group_msg *group_msg[4];
+	/* one retransmit timer for all the 1/2 Group messages */
+	unsigned int GRetryRound;
+	Boolean GRetryArmed;
+
 	unsigned int dot11RSNAStatsTKIPRemoteMICFailures;
 	u8 dot11RSNAAuthenticationSuiteSelected[4];
 	u8 dot11RSNAPairwiseCipherSelected[4];
@@ -186,6 +206,7 @@ void rsn_preauth_finished(struct hostapd_data *hapd, struct sta_info *sta,
 void rsn_preauth_send(struct hostapd_data *hapd, struct sta_info *sta,
 		      u8 *buf, size_t len);
 void wpa_gtk_rekey(struct hostapd_data *hapd);
+void wpa_group_rekey(struct hostapd_data *hapd);
 int wpa_get_mib(struct hostapd_data *hapd, char *buf, size_t buflen);
 int wpa_get_mib_sta(struct hostapd_data *hapd, struct sta_info *sta,
 		    char *buf, size_t buflen);
@@ -0,0 +1,466 @@
+/* vi: set sw=4 ts=4: */
+/* fcstest.c
+ *
+ * Host test and benchmark of the async HDLC codec in ppp_fcs.c, against
+ * copies of the code it replaced:
+ *
+ *   - pppfcs16() as it was in ppp_fcs.c, and pppFCS16() with its fcstab
+ *     from pppoe/ppp.c (the same table),
+ *   - the pptp encaps_hdlc() and decaps_hdlc() from pptp/pptp_gre.c,
+ *   - the encoder of asyncReadFromEth() in pppoe/pppoe.c, which
+ *     l2tp/async-pppd.c had a copy of.
+ *
+ * It checks that pppfcs16() gives the same FCS at every alignment, that
+ * ppp_hdlc_encode() output is the same as the old encoders byte for byte,
+ * and that ppp_hdlc_decode() finds the same frames as the old decaps_hdlc()
+ * in streams of random, and sometimes corrupted, frames cut at random
+ * chunk boundaries. Then it prints the throughput of the old and new code
+ * for 1500 byte frames.
+ *
+ * Build with "make fcstest CC=gcc", "fcstest [seed]" exits non zero when
+ * a check fails.
+ */
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ppp_fcs.h"
+
+#define PACKET_MAX		8196	/* as in pptp/pptp_gre.c */
+#define FRAME_MAX		1600	/* longest random frame */
+#define ENCODE_RUNS		20000
+#define DECODE_RUNS		2000
+#define STREAM_FRAMES	32
+#define BENCH_LEN		1500
+#define BENCH_MB		64
+
+/*
+ * The old code, kept as it was apart from the names.
+ */
+static u_int16_t old_fcstab[256] = {
+	0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+	0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+	0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+	0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+	0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+	0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+	0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+	0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+	0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+	0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+	0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+	0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+	0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+	0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+	0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+	0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+	0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+	0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+	0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+	0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+	0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+	0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+	0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+	0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+	0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+	0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+	0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+	0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+	0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+	0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+	0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+	0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
+};
+
+/* ppp_fcs.c */
+static u_int16_t
+old_pppfcs16(u_int16_t fcs, void *_cp, int len)
+{
+	register unsigned char *cp = (unsigned char *) _cp;
+
+	while (len--)
+		fcs = (fcs >> 8) ^ old_fcstab[(fcs ^ *cp++) & 0xff];
+
+	return (fcs);
+}
+
+/* pppoe/ppp.c */
+static u_int16_t old_pppFCS16(u_int16_t fcs,  unsigned char * cp, int len)
+{
+	while (len--) fcs = (fcs >> 8) ^ old_fcstab[(fcs ^ *cp++) & 0xff];
+	return fcs;
+}
+
+#define FRAME_ESC	0x7d
+#define FRAME_FLAG	0x7e
+#define FRAME_ADDR	0xff
+#define FRAME_CTRL	0x03
+#define FRAME_ENC	0x20
+
+/* pppoe/pppoe.c asyncReadFromEth() and l2tp/async-pppd.c */
+static int old_pppoe_encaps(unsigned char *pppBuf, unsigned char *payload, int plen)
+{
+	int i;
+	unsigned char *ptr = pppBuf;
+	unsigned char c;
+	u_int16_t fcs;
+	unsigned char header[2] = {FRAME_ADDR, FRAME_CTRL};
+	unsigned char tail[2];
+
+	/* Compute FCS */
+	fcs = old_pppfcs16(PPPINITFCS16, header, 2);
+	fcs = old_pppfcs16(fcs, payload, plen) ^ 0xffff;
+	tail[0] = fcs & 0x00ff;
+	tail[1] = (fcs >> 8) & 0x00ff;
+
+	/* Build a buffer to send to PPP */
+	*ptr++ = FRAME_FLAG;
+	*ptr++ = FRAME_ADDR;
+	*ptr++ = FRAME_ESC;
+	*ptr++ = FRAME_CTRL ^ FRAME_ENC;
+
+	for (i=0; i<plen; i++)
+	{
+		c = payload[i];
+		if (c == FRAME_FLAG || c == FRAME_ADDR || c == FRAME_ESC || c < 0x20)
+		{
+			*ptr++ = FRAME_ESC;
+			*ptr++ = c ^ FRAME_ENC;
+		}
+		else
+		{
+			*ptr++ = c;
+		}
+	}
+	for (i=0; i<2; i++)
+	{
+		c = tail[i];
+		if (c == FRAME_FLAG || c == FRAME_ADDR || c == FRAME_ESC || c < 0x20)
+		{
+			*ptr++ = FRAME_ESC;
+			*ptr++ = c ^ FRAME_ENC;
+		}
+		else
+		{
+			*ptr++ = c;
+		}
+	}
+	*ptr++ = FRAME_FLAG;
+
+	return ptr - pppBuf;
+}
+
+#define HDLC_FLAG			0x7E
+#define HDLC_ESCAPE			0x7D
+#define HDLC_TRANSPARENCY	0x20
+
+/* pptp/pptp_gre.c encaps_hdlc(), without the write */
+static int old_encaps_hdlc(unsigned char *dest, void *pack, unsigned int len)
+{
+	unsigned char *source = (unsigned char *)pack;
+	unsigned int pos = 0, i;
+	u_int16_t fcs;
+
+	/* Compute the FCS */
+	fcs = old_pppfcs16(PPPINITFCS16, source, len) ^ 0xFFFF;
+
+	/* start character */
+	dest[pos++] = HDLC_FLAG;
+	/* escape the payload */
+	for (i = 0; i < len + 2; i++)
+	{
+		/* wacked out assignment to add FCS to end of source buffer */
+		unsigned char c = (i < len) ? source[i] : (i==len) ? (fcs & 0xFF) : ((fcs >> 8) & 0xFF);
+		if (pos >= (2*PACKET_MAX+2)) break;	/* truncate on overflow */
+		if ((c < 0x20) || (c == HDLC_FLAG) || (c == HDLC_ESCAPE))
+		{
+			dest[pos++] = HDLC_ESCAPE;
+			if (pos < (2*PACKET_MAX+2)) dest[pos++] = c ^ 0x20;
+		}
+		else
+		{
+			dest[pos++] = c;
+		}
+	}
+	/* tack on the end-flag */
+	if (pos < (2*PACKET_MAX+2)) dest[pos++] = HDLC_FLAG;
+
+	return pos;
+}
+
+/* pptp/pptp_gre.c decaps_hdlc(), on a buffer instead of a read() and with
+ * the FCS check result passed to the callback instead of logged */
+static unsigned char copy[PACKET_MAX];
+static unsigned int len = 0, escape = 0;
+
+static int old_decaps_hdlc(unsigned char *buffer, int end,
+						   int (*cb)(unsigned char *frame, int len, int fcs_ok, void *param), void *param)
+{
+	unsigned int start = 0;
+	int status, fcs_ok;
+
+	while (start < end)
+	{	/* Copy to 'copy' and un-escape as we go. */
+		while (buffer[start] != HDLC_FLAG)
+		{
+			if ((escape == 0) && buffer[start] == HDLC_ESCAPE)
+			{
+				escape = HDLC_TRANSPARENCY;
+			}
+			else
+			{
+				if (len < PACKET_MAX) copy[len++] = buffer[start] ^ escape;
+				escape = 0;
+			}
+			start++;
+
+			if (start >= end)
+			{
+				return 0;	/* No more data, but the frame is not complete yet. */
+			}
+		}
+
+		/* found flag.  skip past it */
+		start++;
+
+		/* check for over-short packets and silently discard, as per RFC1662 */
+		if ((len < 4) || (escape != 0))
+		{
+			len = 0;
+			escape = 0;
+			continue;
+		}
+		/* check, then remove the 16-bit FCS checksum field */
+		fcs_ok = old_pppfcs16(PPPINITFCS16, copy, len) == PPPGOODFCS16;
+
+		/* so now we have a packet of length 'len' in 'copy' */
+		if ((status = cb(copy, len, fcs_ok, param)) < 0)
+		{
+			return status;	/* error-check */
+		}
+
+		/* Great!  Let's do more! */
+		len = 0;
+		escape = 0;
+	}
+
+	return 0;
+	/* No more data to process. */
+}
+
+/*
+ * The tests.
+ */
+static int failed = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failed++; } } while (0)
+
+/* random payload: random bytes, mostly bytes to escape, or none at all */
+static void random_frame(unsigned char *p, int n)
+{
+	static const unsigned char special[] = { 0x7d, 0x7e, 0x01, 0xff, 0x41 };
+	int kind = rand() % 3, i;
+
+	for (i = 0; i < n; i++)
+		p[i] = kind == 0 ? rand() : kind == 1 ? special[rand() % sizeof(special)] : 0x41;
+}
+
+static void test_fcs(void)
+{
+	static unsigned char buf[FRAME_MAX + 4];
+	int i, off, n;
+	u_int16_t fcs;
+
+	for (i = 0; i < ENCODE_RUNS; i++) {
+		n = rand() % FRAME_MAX;
+		random_frame(buf, n + 4);
+		for (off = 0; off < 4; off++) {
+			fcs = pppfcs16(PPPINITFCS16, buf + off, n);
+			CHECK(fcs == old_pppfcs16(PPPINITFCS16, buf + off, n) &&
+				  fcs == old_pppFCS16(PPPINITFCS16, buf + off, n),
+				  "pppfcs16() of %d bytes at offset %d is %04x, was %04x", n, off,
+				  fcs, old_pppfcs16(PPPINITFCS16, buf + off, n));
+		}
+	}
+	printf("fcs: %d lengths at 4 alignments\n", ENCODE_RUNS);
+}
+
+static void test_encode(void)
+{
+	static unsigned char src[FRAME_MAX], a[PPP_HDLC_MAXLEN(FRAME_MAX)], b[PPP_HDLC_MAXLEN(FRAME_MAX)];
+	int i, n, la, lb;
+
+	for (i = 0; i < ENCODE_RUNS; i++) {
+		n = rand() % FRAME_MAX;
+		random_frame(src, n);
+
+		la = old_encaps_hdlc(a, src, n);
+		lb = ppp_hdlc_encode(b, src, n, 0);
+		CHECK(la == lb && memcmp(a, b, la) == 0, "pptp: %d byte frame encoded differently", n);
+
+		la = old_pppoe_encaps(a, src, n);
+		lb = ppp_hdlc_encode(b, src, n, PPP_HDLC_ADDCTL | PPP_HDLC_ESCFF);
+		CHECK(la == lb && memcmp(a, b, la) == 0, "pppoe: %d byte frame encoded differently", n);
+	}
+	printf("encode: %d frames, pptp and pppoe/l2tp flags\n", ENCODE_RUNS);
+}
+
+struct frames
+{
+	int count;
+	int len[4 * STREAM_FRAMES];
+	int fcs_ok[4 * STREAM_FRAMES];
+	unsigned char data[4 * STREAM_FRAMES][FRAME_MAX + 8];
+};
+
+static int keep_frame(unsigned char *frame, int len, int fcs_ok, void *param)
+{
+	struct frames *f = (struct frames *)param;
+
+	if (f->count < 4 * STREAM_FRAMES) {
+		/* frames merged by a corrupted flag are only compared by length */
+		if (len <= FRAME_MAX + 8)
+			memcpy(f->data[f->count], frame, len);
+		f->len[f->count] = len;
+		f->fcs_ok[f->count] = fcs_ok;
+	}
+	f->count++;
+	return 0;
+}
+
+/* feed 'n' bytes to both decoders, each in its own random chunks */
+static void decode_both(struct ppp_hdlc_decoder *d, unsigned char *stream, int n,
+						struct frames *fnew, struct frames *fold)
+{
+	int pos, c;
+
+	for (pos = 0; pos < n; pos += c) {
+		c = 1 + rand() % 700;
+		if (c > n - pos)
+			c = n - pos;
+		ppp_hdlc_decode(d, stream + pos, c, keep_frame, fnew);
+	}
+	for (pos = 0; pos < n; pos += c) {
+		c = 1 + rand() % 700;
+		if (c > n - pos)
+			c = n - pos;
+		old_decaps_hdlc(stream + pos, c, keep_frame, fold);
+	}
+}
+
+static void test_decode(void)
+{
+	static unsigned char stream[STREAM_FRAMES * (PPP_HDLC_MAXLEN(FRAME_MAX) + 1)];
+	static unsigned char pay[STREAM_FRAMES][FRAME_MAX];
+	static unsigned char buf[PACKET_MAX];
+	static struct frames fnew, fold;
+	struct ppp_hdlc_decoder d;
+	int plen[STREAM_FRAMES], hdr[STREAM_FRAMES];
+	int i, k, n, cnt, corrupt, frames = 0;
+
+	ppp_hdlc_decoder_init(&d, buf, sizeof(buf), 1);
+	for (i = 0; i < DECODE_RUNS; i++) {
+		/* a stream of frames, sometimes with extra flags between them */
+		cnt = 1 + rand() % STREAM_FRAMES;
+		for (n = k = 0; k < cnt; k++) {
+			plen[k] = 4 + rand() % (FRAME_MAX - 4);
+			random_frame(pay[k], plen[k]);
+			hdr[k] = rand() % 2;
+			n += ppp_hdlc_encode(stream + n, pay[k], plen[k], hdr[k] ? PPP_HDLC_ADDCTL | PPP_HDLC_ESCFF : 0);
+			if (rand() % 3 == 0)
+				stream[n++] = PPP_HDLC_FLAG;
+		}
+		/* one in four gets a few random bytes overwritten */
+		corrupt = rand() % 4 == 0;
+		if (corrupt)
+			for (k = rand() % 4; k >= 0; k--)
+				stream[rand() % n] = rand();
+
+		fnew.count = fold.count = 0;
+		decode_both(&d, stream, n, &fnew, &fold);
+		frames += fnew.count;
+
+		CHECK(fnew.count == fold.count, "decode: %d frames found, %d by the old code", fnew.count, fold.count);
+		for (k = 0; k < fnew.count && k < fold.count && k < 4 * STREAM_FRAMES; k++)
+			CHECK(fnew.len[k] == fold.len[k] && fnew.fcs_ok[k] == fold.fcs_ok[k] &&
+				  (fnew.len[k] > FRAME_MAX + 8 || memcmp(fnew.data[k], fold.data[k], fnew.len[k]) == 0),
+				  "decode: frame %d is different from the old code", k);
+		if (corrupt)
+			continue;
+
+		/* and without corruption they are the frames sent */
+		CHECK(fnew.count == cnt, "decode: %d of %d frames", fnew.count, cnt);
+		for (k = 0; k < fnew.count && k < cnt; k++)
+			CHECK(fnew.fcs_ok[k] && fnew.len[k] == 2 * hdr[k] + plen[k] + 2 &&
+				  memcmp(fnew.data[k] + 2 * hdr[k], pay[k], plen[k]) == 0,
+				  "decode: frame %d did not round-trip", k);
+	}
+	CHECK(d.dropped == 0, "decode: %u frames dropped", d.dropped);
+	printf("decode: %d frames in %d streams\n", frames, DECODE_RUNS);
+}
+
+/*
+ * Throughput.
+ */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_frame(unsigned char *frame, int len, int fcs_ok, void *param)
+{
+	(*(int *)param)++;
+	return 0;
+}
+
+#define BENCH(name, expr) \
+	do { \
+		double t = now(); \
+		for (i = 0; i < runs; i++) \
+			expr; \
+		t = now() - t; \
+		printf("  %-10s %8.1f MB/s\n", name, (double)runs * BENCH_LEN / t / 1e6); \
+	} while (0)
+
+static void bench(void)
+{
+	static unsigned char src[BENCH_LEN], out[PPP_HDLC_MAXLEN(BENCH_LEN)], buf[PACKET_MAX];
+	struct ppp_hdlc_decoder d;
+	int runs = BENCH_MB * 1000000 / BENCH_LEN;
+	int i, n, frames = 0;
+	volatile u_int16_t fcs;
+
+	for (i = 0; i < BENCH_LEN; i++)
+		src[i] = rand();
+	n = ppp_hdlc_encode(out, src, BENCH_LEN, 0);
+	ppp_hdlc_decoder_init(&d, buf, sizeof(buf), 1);
+
+	printf("%d byte frames, random payload:\n", BENCH_LEN);
+	BENCH("old fcs", fcs = old_pppfcs16(PPPINITFCS16, src, BENCH_LEN));
+	BENCH("new fcs", fcs = pppfcs16(PPPINITFCS16, src, BENCH_LEN));
+	BENCH("old encode", old_encaps_hdlc(out, src, BENCH_LEN));
+	BENCH("new encode", ppp_hdlc_encode(out, src, BENCH_LEN, 0));
+	BENCH("old decode", old_decaps_hdlc(out, n, count_frame, &frames));
+	BENCH("new decode", ppp_hdlc_decode(&d, out, n, count_frame, &frames));
+	(void)fcs;
+}
+
+int main(int argc, char **argv)
+{
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+
+	test_fcs();
+	test_encode();
+	test_decode();
+	if (failed) {
+		printf("FAILED, %d checks\n", failed);
+		return 1;
+	}
+	bench();
+	return 0;
+}
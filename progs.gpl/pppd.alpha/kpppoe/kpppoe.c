@@ -34,6 +34,19 @@ extern char linkname[];
 extern char kpppoe_dev[];
 extern char kpppoe_ac_name[];
 extern char kpppoe_srv_name[];
+extern int  kpppoe_hostuniq;
+extern int  kpppoe_synchronous;
+extern int  kpppoe_mss;
+extern bool kpppoe_fallback;
+
+/* pty (user space) PPPoE, used when the kernel has no PPPoX support. */
+extern char pppoe_dev[];
+extern char pppoe_ac_name[];
+extern char pppoe_srv_name[];
+extern int  pppoe_hostuniq;
+extern int  pppoe_synchronous;
+extern int  pppoe_mss;
+extern struct channel tty_channel;
 
 extern void kpppoe_discovery(PPPoEConnection * conn);
 void kpppoe_sendPADT(PPPoEConnection * conn, const char * msg);
@@ -42,12 +55,49 @@ struct channel kpppoe_channel;
 static PPPoEConnection poeconn;
 static PPPoEConnection *conn = NULL;
 
+/* Does the kernel know about PPPoX sockets ? */
+static int kpppoe_kernel_support(void)
+{
+	int sock = socket(AF_PPPOX, SOCK_STREAM, PX_PROTO_OE);
+
+	if (sock < 0) return 0;
+	close(sock);
+	return 1;
+}
+
+/* Switch to the pty PPPoE channel. Discovery and the session data
+ * are then handled by pppoe/pppoe.c through a pty, as pty_pppoe does. */
+static int kpppoe_fallback_connect(void)
+{
+	d_warn("kpppoe: no kernel PPPoE support (%s), using pty PPPoE\n", strerror(errno));
+
+	strlcpy(pppoe_dev, kpppoe_dev, 32);
+	strlcpy(pppoe_ac_name, kpppoe_ac_name, 64);
+	strlcpy(pppoe_srv_name, kpppoe_srv_name, 64);
+	pppoe_hostuniq = kpppoe_hostuniq;
+	pppoe_synchronous = kpppoe_synchronous;
+	pppoe_mss = kpppoe_mss;
+
+	/* From now on (also for the next connections in persist mode)
+	 * pppd talks to the pty channel. */
+	pty_module = 0;
+	the_channel = &tty_channel;
+	return the_channel->connect();
+}
+
 static int PPPOEConnectDevice(void)
 {
 	struct sockaddr_pppox sp;
 
 	d_dbg("PPPOEConnectDevice() >>>\n");
 
+	if (!kpppoe_kernel_support())
+	{
+		if (kpppoe_fallback) return kpppoe_fallback_connect();
+		d_error("kpppoe: no kernel PPPoE support: %s\n", strerror(errno));
+		return -1;
+	}
+
 	conn->acName = kpppoe_ac_name[0] ? kpppoe_ac_name : NULL;
 	conn->serviceName = kpppoe_srv_name[0] ? kpppoe_srv_name : NULL;
 	conn->ifName = kpppoe_dev;
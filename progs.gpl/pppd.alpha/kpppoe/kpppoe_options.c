@@ -15,6 +15,7 @@ char kpppoe_ac_name[64] = {0};	/* desired access concentrator name. */
 int  kpppoe_hostuniq = 0;
 int  kpppoe_synchronous = 0;
 int  kpppoe_mss = 0;
+bool kpppoe_fallback = 1;		/* use pty PPPoE if the kernel can't do it. */
 
 static option_t kpppoe_options[] =
 {
@@ -36,6 +37,9 @@ static option_t kpppoe_options[] =
 	{ "pppoe_mss", o_int, &kpppoe_mss,
 	  "Clamp MSS to this value",
 	  OPT_PRIO, &kpppoe_mss },
+	{ "pppoe_nofallback", o_bool, &kpppoe_fallback,
+	  "PPPoE don't fall back to pty PPPoE without kernel support",
+	  0 },
 	{ NULL }
 };
 
@@ -10,23 +10,30 @@
 #include "dtrace.h"
 
 
-#define FRAME_ESC	0x7d
-#define FRAME_FLAG	0x7e
 #define FRAME_ADDR	0xff
 #define FRAME_CTRL	0x03
-#define FRAME_ENC	0x20
-
-#define STATE_WAITFOR_FRAME_ADDR	0
-#define STATE_DROP_PROTO			1
-#define STATE_BUILDING_PACKET		2
-
-static int PPPState = STATE_WAITFOR_FRAME_ADDR;
-static int PPPPacketSize = 0;
-static unsigned char PPPXorValue = 0;
 
 #define PPP_BUF_SIZE	4096
+#define PPP_MAX_FRAME	1536
 
 static unsigned char pppBuf[PPP_BUF_SIZE + EXTRA_HEADER_ROOM];
+/* frames from pppd are decoded after EXTRA_HEADER_ROOM bytes, for the l2tp header */
+static unsigned char packet[EXTRA_HEADER_ROOM + PPP_MAX_FRAME + 2];
+static struct ppp_hdlc_decoder hdlc_dec;
+
+/**********************************************************************
+* %FUNCTION: init
+* %ARGUMENTS:
+*  None
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Resets the decoder of the frames coming from PPP's pty
+***********************************************************************/
+void l2tp_async_ppp_init(void)
+{
+	ppp_hdlc_decoder_init(&hdlc_dec, packet + EXTRA_HEADER_ROOM, PPP_MAX_FRAME + 2, 0);
+}
 
 /**********************************************************************
 * %FUNCTION: handle_frame_from_tunnel
@@ -42,55 +49,24 @@ static unsigned char pppBuf[PPP_BUF_SIZE + EXTRA_HEADER_ROOM];
 void l2tp_async_ppp_handle_frame_from_tunnel(l2tp_session *ses, unsigned char *buf, size_t len)
 {
 	int n;
-	unsigned char header[2] = {FRAME_ADDR, FRAME_CTRL};
-	unsigned char tail[2];
-	unsigned short fcs;
-	unsigned char *ptr = pppBuf;
-	unsigned char c;
-	int i;
-
-	/* compute FCS */
-	fcs = pppfcs16(PPPINITFCS16, header, 2);
-	fcs = pppfcs16(fcs, buf, len) ^ 0xffff;
-	tail[0] = fcs & 0x00ff;
-	tail[1] = (fcs >> 8) & 0x00ff;
-
-	/* build a buffer to send to PPP */
-	*ptr++ = FRAME_FLAG;
-	*ptr++ = FRAME_ADDR;
-	*ptr++ = FRAME_ESC;
-	*ptr++ = FRAME_CTRL ^ FRAME_ENC;
-
-	for (i=0; i<len; i++)
-	{
-		c = buf[i];
-		if (c == FRAME_FLAG || c==FRAME_ADDR || c==FRAME_ESC || c < 0x20)
-		{
-			*ptr++ = FRAME_ESC;
-			*ptr++ = c ^ FRAME_ENC;
-		}
-		else
-		{
-			*ptr++ = c;
-		}
-	}
-	for (i=0; i<2; i++)
-	{
-		c = tail[i];
-		if (c==FRAME_FLAG || c==FRAME_ADDR || c==FRAME_ESC || c < 0x20)
-		{
-			*ptr++ = FRAME_ESC;
-			*ptr++ = c ^ FRAME_ENC;
-		}
-		else
-		{
-			*ptr++ = c;
-		}
-	}
-	*ptr++ = FRAME_FLAG;
+
+	if (PPP_HDLC_MAXLEN(len) > sizeof(pppBuf)) return;
+
+	/* build a buffer to send to PPP, the FCS is computed on the way */
+	n = ppp_hdlc_encode(pppBuf, buf, len, PPP_HDLC_ADDCTL | PPP_HDLC_ESCFF);
 
 	/* TODO: Add error checking */
-	n = write(ses->pty_fd, pppBuf, (ptr-pppBuf));
+	n = write(ses->pty_fd, pppBuf, n);
+}
+
+/* a frame decoded from PPP's pty, "ff 03 <frame> <fcs>" */
+static int async_frame_to_tunnel(unsigned char *frame, int len, int fcs_ok, void *param)
+{
+	l2tp_session *ses = (l2tp_session *)param;
+
+	if (frame[0] != FRAME_ADDR || frame[1] != FRAME_CTRL) return 0;
+	l2tp_dgram_send_ppp_frame(ses, frame + 2, len - 4);
+	return 0;
 }
 
 /**********************************************************************
@@ -105,78 +81,10 @@ void l2tp_async_ppp_handle_frame_from_tunnel(l2tp_session *ses, unsigned char *b
 void l2tp_async_ppp_handle_frame_to_tunnel(l2tp_session * ses)
 {
 	int r;
-	unsigned char * ptr = pppBuf;
-	unsigned char c;
-	static unsigned char packet[1536];
 
-	/* EXTRA_HEADER_ROOM bytes extra space for l2tp header */
-	r = read(ses->pty_fd, ptr, PPP_BUF_SIZE);
+	r = read(ses->pty_fd, pppBuf, PPP_BUF_SIZE);
 	if (r < 0) return;
 	if (r==0) return;
 
-	while (r)
-	{
-		if (PPPState == STATE_WAITFOR_FRAME_ADDR)
-		{
-			while (r)
-			{
-				--r;
-				if (*ptr++ == FRAME_ADDR)
-				{
-					PPPState = STATE_DROP_PROTO;
-					break;
-				}
-			}
-		}
-		/* Still waiting ... */
-		if (PPPState == STATE_WAITFOR_FRAME_ADDR) return;
-		while (r && PPPState == STATE_DROP_PROTO)
-		{
-			--r;
-			c = *ptr++;
-			if (c == (FRAME_CTRL ^ FRAME_ENC))
-			{
-				PPPState = STATE_BUILDING_PACKET;
-			}
-			else if (c == FRAME_CTRL)
-			{
-				PPPState = STATE_BUILDING_PACKET;
-			}
-		}
-		if (PPPState == STATE_DROP_PROTO) return;
-
-		/* Start building frame */
-		while (r && PPPState == STATE_BUILDING_PACKET)
-		{
-			--r;
-			c = *ptr++;
-			switch (c)
-			{
-			case FRAME_ESC:
-				PPPXorValue = FRAME_ENC;
-				break;
-			case FRAME_FLAG:
-				if (PPPPacketSize < 2) return;
-				l2tp_dgram_send_ppp_frame(ses, packet, PPPPacketSize - 2);
-				PPPPacketSize = 0;
-				PPPXorValue = 0;
-				PPPState = STATE_WAITFOR_FRAME_ADDR;
-				break;
-			default:
-				if (PPPPacketSize >= 1536)
-				{
-					PPPPacketSize = 0;
-					PPPXorValue = 0;
-					PPPState = STATE_WAITFOR_FRAME_ADDR;
-					break;
-				}
-				else
-				{
-					packet[PPPPacketSize++] = c ^ PPPXorValue;
-					PPPXorValue = 0;
-				}
-			}
-		}
-	}
-	return;
+	ppp_hdlc_decode(&hdlc_dec, pppBuf, r, async_frame_to_tunnel, ses);
 }
@@ -308,7 +308,7 @@ l2tp_dgram * l2tp_dgram_take_from_wire(struct sockaddr_in *from)
 
 	/* Limit iterations before bailing back to select look.  Otherwise,
 	 * we have a nice DoS possibility */
-	int iters = 5;
+	int iters = DATA_BURST;
 
 	uint16_t off;
 	int framelen;
@@ -318,7 +318,7 @@ l2tp_dgram * l2tp_dgram_take_from_wire(struct sockaddr_in *from)
 
 	while (1)
 	{
-		if (--iters <= 0) return NULL;
+		if (iters-- <= 0) return NULL;
 		framelen = -1;
 		r = recvfrom(Sock, buf, MAX_PACKET_LEN, 0, (struct sockaddr *) from, &len);
 		if (r <= 0)
@@ -387,7 +387,7 @@ l2tp_dgram * l2tp_dgram_take_from_wire(struct sockaddr_in *from)
 		if (!ses || tid != cache_tid || sid != cache_sid)
 		{
 			ses = NULL;
-			tunnel = (the_tunnel->my_id == tid) ? the_tunnel : NULL;
+			tunnel = (the_tunnel && the_tunnel->my_id == tid) ? the_tunnel : NULL;
 			if (!tunnel)
 			{
 				d_error("l2tp: l2tp_dgram_take_from_wire(): Unknown tunnel %d\n", (int) tid);
@@ -399,7 +399,7 @@ l2tp_dgram * l2tp_dgram_take_from_wire(struct sockaddr_in *from)
 				continue;
 			}
 			/* TODO: Verify source address */
-			ses = (the_session->my_id == sid) ? the_session : NULL;
+			ses = (the_session && the_session->my_id == sid) ? the_session : NULL;
 			if (!ses)
 			{
 				d_error("l2tp: l2tp_dgram_take_from_wire(): Unknown session %d in tunnel %d\n", (int) sid, (int) tid);
@@ -1032,7 +1032,12 @@ int l2tp_dgram_send_ppp_frame(l2tp_session *ses, unsigned char const *buf, int l
 	real_buf[5] = ses->assigned_id & 0xFF;
 	real_buf[6] = 0xFF;		/* HDLC address */
 	real_buf[7] = 0x03;		/* HDLC control */
-	r = sendto(Sock, real_buf, len+8, 0, (struct sockaddr const *) &tunnel->peer_addr, sizeof(struct sockaddr_in));
+	/* The socket is connected once the session is up, which saves the
+	 * route lookup of sendto() on each frame. */
+	if (tunnel->connected)
+		r = send(Sock, real_buf, len+8, 0);
+	else
+		r = sendto(Sock, real_buf, len+8, 0, (struct sockaddr const *) &tunnel->peer_addr, sizeof(struct sockaddr_in));
 
 #if 0
 	print_packet(2, real_buf, len+8, "l2tp_dgram_send_ppp_frame:");
@@ -163,6 +163,13 @@ int l2tp_module_connect(int pty_fd)
 		if (the_session->state == SESSION_ESTABLISHED)
 		{
 			d_dbg("l2tp: session established!\n");
+			/* Only the LNS talks to us from now on. Connect the socket
+			 * to it: the kernel keeps the route for the data frames
+			 * and drops datagrams from anybody else. */
+			if (connect(Sock, (struct sockaddr *)&the_tunnel->peer_addr, sizeof(struct sockaddr_in)) == 0)
+				the_tunnel->connected = 1;
+			else
+				d_warn("l2tp: unable to connect the socket to the LNS: %s\n", strerror(errno));
 			eloop_register_read_sock(pty_fd, handle_pty, NULL, ses);
 			eloop_continue();
 			return 0;
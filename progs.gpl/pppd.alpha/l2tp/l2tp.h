@@ -21,6 +21,7 @@
 #define MAX_HOSTNAME		128
 #define MAX_RETRANSMISSIONS	5
 #define EXTRA_HEADER_ROOM	32
+#define DATA_BURST			16	/* max. data frames moved per wakeup */
 
 /* Bit definitions */
 #define TYPE_BIT			0x80
@@ -208,6 +209,7 @@ typedef struct l2tp_tunnel_t
 
 	unsigned int ack_scheduled:1;		/* set at scheduling ack, reset when fired. */
 	unsigned int hello_scheduled:1;		/* set at scheduling hello, reset when fired. */
+	unsigned int connected:1;			/* Sock is connected to peer_addr */
 }
 l2tp_tunnel;
 
@@ -250,6 +252,7 @@ void l2tp_sync_ppp_handle_frame_from_tunnel(l2tp_session * ses, unsigned char *
 void l2tp_sync_ppp_handle_frame_to_tunnel(l2tp_session * ses);
 
 /* async_pppd.c */
+void l2tp_async_ppp_init(void);
 void l2tp_async_ppp_handle_frame_from_tunnel(l2tp_session * ses, unsigned char * buf, size_t size);
 void l2tp_async_ppp_handle_frame_to_tunnel(l2tp_session * ses);
 
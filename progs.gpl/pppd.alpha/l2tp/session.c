@@ -102,6 +102,7 @@ l2tp_session * l2tp_session_call_lns(l2tp_peer * peer, char const * calling_numb
 	{
 		ses->handle_frame_from_tunnel = l2tp_async_ppp_handle_frame_from_tunnel;
 		ses->handle_frame_to_tunnel   = l2tp_async_ppp_handle_frame_to_tunnel;
+		l2tp_async_ppp_init();
 	}
 	ses->state = SESSION_WAIT_TUNNEL;
 	strncpy(ses->calling_number, calling_number, MAX_HOSTNAME);
@@ -57,17 +57,16 @@ void l2tp_sync_ppp_handle_frame_to_tunnel(l2tp_session * ses)
 	static unsigned char buf[4096+EXTRA_HEADER_ROOM];
 	unsigned char * payload;
 	int n;
-	int iters = 5;
+	int iters = DATA_BURST;
 
 	d_dbg("l2tp_sync_ppp_handle_from_to_tunnel >>>\n");
 	
 	/* It seems to be better to read in a loop than to go
 	 * back to select loop.  However, don't loop forever, or
 	 * we could have a DoS potential */
-	payload = buf + EXTRA_HEADER_ROOM;
-
 	while (iters--)
 	{	/* EXTRA_HEADER_ROOM bytes extra space for l2tp header */
+		payload = buf + EXTRA_HEADER_ROOM;
 		n = read(ses->pty_fd, payload, sizeof(buf)-EXTRA_HEADER_ROOM);
 		/* TODO: Check this.... */
 		if (n <= 2) break;
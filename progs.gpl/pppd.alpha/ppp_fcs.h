@@ -1,10 +1,57 @@
-/* ppp_fcs.h ... header file for PPP-HDLC FCS 
+/* ppp_fcs.h ... header file for PPP-HDLC FCS
  *               C. Scott Ananian <cananian@alumni.princeton.edu>
  *
  * $Id: ppp_fcs.h,v 1.1.1.1 2005/05/19 10:53:06 r01122 Exp $
  */
 
+#ifndef __PPP_FCS_H__
+#define __PPP_FCS_H__
+
 #define PPPINITFCS16    0xffff	/* Initial FCS value */
 #define PPPGOODFCS16    0xf0b8	/* Good final FCS value */
 
 u_int16_t pppfcs16(u_int16_t fcs, void *cp, int len);
+
+/*
+ * Async HDLC-like framing (RFC1662), shared by the PPPoE, PPTP and L2TP
+ * pty modules.
+ */
+#define PPP_HDLC_FLAG		0x7e
+#define PPP_HDLC_ESCAPE		0x7d
+#define PPP_HDLC_TRANS		0x20
+
+/* ppp_hdlc_encode() flags */
+#define PPP_HDLC_ADDCTL		0x01	/* prepend the 0xff 0x03 address and control */
+#define PPP_HDLC_ESCFF		0x02	/* escape 0xff in the payload and FCS too */
+
+/* room needed in 'dst' to encode 'len' bytes */
+#define PPP_HDLC_MAXLEN(len)	(2 * ((len) + 4) + 2)
+
+/* Escape 'len' bytes of 'src' and their FCS into 'dst', between two
+ * flags, in one pass. Returns the number of bytes in 'dst'. */
+int ppp_hdlc_encode(unsigned char *dst, const unsigned char *src, int len, int flags);
+
+/* Called with each frame found by ppp_hdlc_decode(), un-escaped and
+ * with its FCS still at the end. 'fcs_ok' is only meaningful if the
+ * decoder was asked to check it. Return <0 to stop decoding. */
+typedef int (*ppp_hdlc_handler)(unsigned char *frame, int len, int fcs_ok, void *param);
+
+struct ppp_hdlc_decoder
+{
+	unsigned char *buf;	/* frames are rebuilt here */
+	int size;			/* size of buf */
+	int len;			/* bytes of the current frame in buf */
+	int escape;			/* the last byte was PPP_HDLC_ESCAPE */
+	int toss;			/* the current frame overflowed buf */
+	int check_fcs;		/* compute the FCS while decoding */
+	u_int16_t fcs;
+	unsigned int dropped;	/* frames too long for buf */
+};
+
+void ppp_hdlc_decoder_init(struct ppp_hdlc_decoder *d, unsigned char *buf, int size, int check_fcs);
+/* Feed 'len' bytes read from the pty, a frame may span several calls.
+ * Returns 0, or what the handler returned if it was <0. */
+int ppp_hdlc_decode(struct ppp_hdlc_decoder *d, const unsigned char *src, int len,
+					ppp_hdlc_handler handler, void *param);
+
+#endif
@@ -130,13 +130,7 @@ void asyncReadFromEth(PPPoEConnection *conn, int sock, int clampMss)
 //	PPPoEPacket packet;
 	int len;
 	int plen;
-	int i;
 //	unsigned char pppBuf[4096];
-	unsigned char *ptr = pppBuf;
-	unsigned char c;
-	UINT16_t fcs;
-	unsigned char header[2] = {FRAME_ADDR, FRAME_CTRL};
-	unsigned char tail[2];
 
 	//d_dbg("pppoe: >>> asyncReadFromEth()\n");
 	
@@ -197,50 +191,11 @@ void asyncReadFromEth(PPPoEConnection *conn, int sock, int clampMss)
 	/* Clamp MSS */
 	if (clampMss) clampMSS(&pkt_eth, "incoming", clampMss);
 
-	/* Compute FCS */
-	//fcs = pppFCS16(PPPINITFCS16, header, 2);
-	//fcs = pppFCS16(fcs, pkt_eth.payload, plen) ^ 0xffff;
-	fcs = pppfcs16(PPPINITFCS16, header, 2);
-	fcs = pppfcs16(fcs, pkt_eth.payload, plen) ^ 0xffff;
-	tail[0] = fcs & 0x00ff;
-	tail[1] = (fcs >> 8) & 0x00ff;
-
-	/* Build a buffer to send to PPP */
-	*ptr++ = FRAME_FLAG;
-	*ptr++ = FRAME_ADDR;
-	*ptr++ = FRAME_ESC;
-	*ptr++ = FRAME_CTRL ^ FRAME_ENC;
-
-	for (i=0; i<plen; i++)
-	{
-		c = pkt_eth.payload[i];
-		if (c == FRAME_FLAG || c == FRAME_ADDR || c == FRAME_ESC || c < 0x20)
-		{
-			*ptr++ = FRAME_ESC;
-			*ptr++ = c ^ FRAME_ENC;
-		}
-		else
-		{
-			*ptr++ = c;
-		}
-	}
-	for (i=0; i<2; i++)
-	{
-		c = tail[i];
-		if (c == FRAME_FLAG || c == FRAME_ADDR || c == FRAME_ESC || c < 0x20)
-		{
-			*ptr++ = FRAME_ESC;
-			*ptr++ = c ^ FRAME_ENC;
-		}
-		else
-		{
-			*ptr++ = c;
-		}
-	}
-	*ptr++ = FRAME_FLAG;
+	/* Build a buffer to send to PPP, the FCS is computed on the way */
+	len = ppp_hdlc_encode(pppBuf, pkt_eth.payload, plen, PPP_HDLC_ADDCTL | PPP_HDLC_ESCFF);
 
 	/* Ship it out */
-	if (write(master_pty_fd, pppBuf, (ptr-pppBuf)) < 0)
+	if (write(master_pty_fd, pppBuf, len) < 0)
 	{
 		d_error("pppoe: asyncReadFromEth(): write fail !\n");
 	}
@@ -411,7 +366,7 @@ static void session(PPPoEConnection * conn)
 	pkt_ppp.code = CODE_SESS;
 	pkt_ppp.session = conn->session;
 
-	initPPP();
+	initPPP(&pkt_ppp);
 
 	d_dbg("pppoe: register discovery socket (%d)\n", conn->discoverySocket);
 	eloop_register_read_sock(conn->discoverySocket, discovery_read, NULL, conn);
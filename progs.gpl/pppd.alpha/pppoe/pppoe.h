@@ -280,7 +280,7 @@ int sendPADT(PPPoEConnection *conn, char const *msg);
 int sendPADTf(PPPoEConnection *conn, char const *fmt, ...);
 
 int sendSessionPacket(PPPoEConnection *conn, PPPoEPacket *packet, int len);
-void initPPP(void);
+void initPPP(PPPoEPacket *packet);
 void clampMSS(PPPoEPacket *packet, char const *dir, int clampMss);
 UINT16_t computeTCPChecksum(unsigned char *ipHdr, unsigned char *tcpHdr);
 //UINT16_t pppFCS16(UINT16_t fcs, unsigned char *cp, int len);
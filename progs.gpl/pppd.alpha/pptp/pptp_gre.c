@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -37,6 +38,8 @@
 #define WRAPPED( curseq, lastseq) \
     ((((curseq) & 0xffffff00)==0) && (((lastseq) & 0xffffff00 )==0xffffff00))
 #define REORDER_LOGGING 1
+/* max. frames moved from the N_HDLC pty per wakeup in sync mode */
+#define SYNC_READ_BURST 16
 
 
 static PPTP_CONN * g_conn = NULL;
@@ -48,10 +51,11 @@ static u_int32_t seq_sent, seq_recv;
 static u_int16_t pptp_gre_call_id, pptp_gre_peer_call_id;
 gre_stats_t stats;
 
-static unsigned char hdlc_buff[PACKET_MAX * 2 + 2];
+static unsigned char hdlc_buff[PPP_HDLC_MAXLEN(PACKET_MAX)];
 static unsigned char copy[PACKET_MAX];
+static struct ppp_hdlc_decoder hdlc_dec;
 static unsigned char gre_buff[PACKET_MAX+64];
-static unsigned int len = 0, escape = 0;
+static struct pptp_gre_header gre_hdr;
 static int checkedsync = 0;
 static int first = 1;
 static u_int32_t seq = 1;	/* first sequence number sent must be 1 */
@@ -70,11 +74,12 @@ static void init_vars(void)
 	memset(&stats, 0, sizeof(stats));
 	ack_sent = ack_recv = seq_sent = seq_recv = 0;
 
-	len = escape = 0;
+	ppp_hdlc_decoder_init(&hdlc_dec, copy, sizeof(copy), 1);
 	checkedsync = 0;
 	first = 1;
 	seq = 1;
 	pptp_ready = pptp_exit = 0;
+	pqueue_flush();
 }
 
 
@@ -179,9 +184,32 @@ static void gre_send_ack(void * eloop_ctx, void * timeout_ctx)
 	}
 }
 
-#define HDLC_FLAG			0x7E
-#define HDLC_ESCAPE			0x7D
-#define HDLC_TRANSPARENCY	0x20
+struct hdlc_callback
+{
+	callback_t cb;
+	int cl;
+};
+
+/* a frame has been un-escaped into 'copy' by the HDLC decoder */
+static int decaps_hdlc_frame(unsigned char * frame, int len, int fcs_ok, void * param)
+{
+	struct hdlc_callback * hc = (struct hdlc_callback *)param;
+	int status;
+
+	/* check, then remove the 16-bit FCS checksum field */
+	if (!fcs_ok)
+	{
+		d_warn("pptp: decaps_hdlc(): Bad Frame Check Sequence during PPP to GRE decapsulation\n");
+	}
+	len -= sizeof (u_int16_t);
+
+	//d_dbg("pptp: decaps_hdlc(): put %d bytes to encaps_gre()\n", len);
+	if ((status = hc->cb(hc->cl, frame, len)) < 0)
+	{
+		d_dbg("pptp: decaps_hdlc(): callback function return %d\n", status);
+	}
+	return status;
+}
 
 /* ONE blocking read per call; dispatches all packets possible */
 /* returns 0 on success, or <0 on read failure                 */
@@ -189,6 +217,7 @@ static int decaps_hdlc(int fd, int (*cb)(int cl, void *pack, unsigned int len),
 {
 	//unsigned char buffer[PACKET_MAX];
 	unsigned char * buffer = hdlc_buff;
+	struct hdlc_callback hc;
 	unsigned int start = 0;
 	int end;
 	int status;
@@ -198,6 +227,29 @@ static int decaps_hdlc(int fd, int (*cb)(int cl, void *pack, unsigned int len),
 	/* start is start of packet.  end is end of buffer data */
 	/*  this is the only blocking read we will allow */
 
+	if (pptp_sync)
+	{
+		/* N_HDLC hands us one whole frame per read(), without any
+		 * escaping or FCS, so it goes to the callback as is.
+		 * The pty is non-blocking, take what is there. */
+		for (start = 0; start < SYNC_READ_BURST; start++)
+		{
+			if ((end = read(fd, buffer, PACKET_MAX)) <= 0)
+			{
+				if (end < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+				d_warn("pptp: decaps_hdlc(): short read (%d): %s\n", end, strerror(errno));
+				if (errno == EIO) d_warn("pptp: decaps_hdlc(): pppd may have shutdown, see pppd log\n");
+				return -1;
+			}
+			if ((status = cb(cl, buffer, end)) < 0)
+			{
+				d_dbg("pptp: decaps_hdlc(): callback function return %d\n", status);
+				return status; /* error-check */
+			}
+		}
+		return 0;
+	}
+
 	if ((end = read(fd, buffer, PACKET_MAX)) <= 0)
 	{
 		d_warn("pptp: decaps_hdlc(): short read (%d): %s\n", end, strerror(errno));
@@ -213,91 +265,12 @@ static int decaps_hdlc(int fd, int (*cb)(int cl, void *pack, unsigned int len),
 	if (!checkedsync)
 	{
 		checkedsync = 1;
-		d_info("pptp: PPP mode seems to be %s.\n", buffer[0] == HDLC_FLAG ? "Asynchronous" : "Synchronous");
-	}
-	if (pptp_sync)
-	{
-#if 0
-		while (start + 8 < end)
-		{
-			len = ntoh16(*(short int *)(buffer + start + 6)) + 4;
-			/* note: the buffer may contain an incomplete packet at the end
-			 * this packet will be read again at the next read() */
-			d_dbg("start=%d, len=%d\n", start, len);
-			if (start + len <= end)
-			{
-				if ((status = cb(cl, buffer + start, len)) < 0)
-				{
-					d_dbg("pptp: decaps_hdlc(): callback function return %d\n", status);
-					return status;	/* error-check */
-				}
-			}
-			start += len;
-		}
-#else
-		if ((status = cb(cl, buffer, end)) < 0)
-		{
-			d_dbg("pptp: decaps_hdlc(): callback function return %d\n", status);
-			return status; /* error-check */
-		}
-#endif
-		return 0;
+		d_info("pptp: PPP mode seems to be %s.\n", buffer[0] == PPP_HDLC_FLAG ? "Asynchronous" : "Synchronous");
 	}
 
-	while (start < end)
-	{	/* Copy to 'copy' and un-escape as we go. */
-		while (buffer[start] != HDLC_FLAG)
-		{
-			if ((escape == 0) && buffer[start] == HDLC_ESCAPE)
-			{
-				escape = HDLC_TRANSPARENCY;
-			}
-			else
-			{
-				if (len < PACKET_MAX) copy[len++] = buffer[start] ^ escape;
-				escape = 0;
-			}
-			start++;
-
-			if (start >= end)
-			{
-				d_info("pptp: decaps_hdlc(): No more data, but the frame is not complete yet.\n");
-				return 0;	/* No more data, but the frame is not complete yet. */
-			}
-		}
-
-		/* found flag.  skip past it */
-		start++;
-
-		/* check for over-short packets and silently discard, as per RFC1662 */
-		if ((len < 4) || (escape != 0))
-		{
-			len = 0;
-			escape = 0;
-			continue;
-		}
-		/* check, then remove the 16-bit FCS checksum field */
-		if (pppfcs16(PPPINITFCS16, copy, len) != PPPGOODFCS16)
-		{
-			d_warn("pptp: decaps_hdlc(): Bad Frame Check Sequence during PPP to GRE decapsulation\n");
-		}
-		len -= sizeof (u_int16_t);
-
-		/* so now we have a packet of length 'len' in 'copy' */
-		//d_dbg("pptp: decaps_hdlc(): put %d bytes to encaps_gre()\n", len);
-		if ((status = cb(cl, copy, len)) < 0)
-		{
-			d_dbg("pptp: decaps_hdlc(): callback function return %d\n", status);
-			return status;	/* error-check */
-		}
-
-		/* Great!  Let's do more! */
-		len = 0;
-		escape = 0;
-	}
-
-	return 0;
-	/* No more data to process. */
+	hc.cb = cb;
+	hc.cl = cl;
+	return ppp_hdlc_decode(&hdlc_dec, buffer, end, decaps_hdlc_frame, &hc);
 }
 
 /* Make stripped packet into HDLC packet */
@@ -306,36 +279,21 @@ static int encaps_hdlc(int fd, void *pack, unsigned int len)
 	unsigned char *source = (unsigned char *)pack;
 	//unsigned char dest[2 * PACKET_MAX + 2];	/* largest expansion possible */
 	unsigned char * dest = hdlc_buff;
-	unsigned int pos = 0, i;
-	u_int16_t fcs;
+	unsigned int pos;
 
 	//d_dbg("pptp: >>> encaps_hdlc(fd=%d, len=%d)\n", fd, len);
 
-	if (pptp_sync) return write(fd, source, len);
-
-	/* Compute the FCS */
-	fcs = pppfcs16(PPPINITFCS16, source, len) ^ 0xFFFF;
-
-	/* start character */
-	dest[pos++] = HDLC_FLAG;
-	/* escape the payload */
-	for (i = 0; i < len + 2; i++)
+	if (pptp_sync)
 	{
-		/* wacked out assignment to add FCS to end of source buffer */
-		unsigned char c = (i < len) ? source[i] : (i==len) ? (fcs & 0xFF) : ((fcs >> 8) & 0xFF);
-		if (pos >= (2*PACKET_MAX+2)) break;	/* truncate on overflow */
-		if ((c < 0x20) || (c == HDLC_FLAG) || (c == HDLC_ESCAPE))
-		{
-			dest[pos++] = HDLC_ESCAPE;
-			if (pos < (2*PACKET_MAX+2)) dest[pos++] = c ^ 0x20;
-		}
-		else
-		{
-			dest[pos++] = c;
-		}
+		/* The pty is non-blocking in sync mode. If pppd is not keeping
+		 * up, drop the frame like a full line would instead of closing
+		 * the call. */
+		if (write(fd, source, len) < 0 && errno != EAGAIN) return -1;
+		return len;
 	}
-	/* tack on the end-flag */
-	if (pos < (2*PACKET_MAX+2)) dest[pos++] = HDLC_FLAG;
+
+	if (len > PACKET_MAX) return 0;	/* drop this, it's too big */
+	pos = ppp_hdlc_encode(dest, source, len, 0);
 
 	/* now write this packet */
 	//d_dbg("pptp: encaps_hdlc(): write(fd=%d, len=%d)\n", fd, pos);
@@ -445,8 +403,10 @@ static int decaps_gre(int fd, callback_t callback, int cl)
 #if 1	/* some logging of reordening is required, we might miss some "side effects" */
 		d_dbg("pptp: decaps_gre(): buffering out-of-order packet %d (expecting %d)\n", seq, seq_recv + 1);
 #endif
-		pqueue_add(seq, buffer + ip_len + headersize, payload_len);
-		stats.rx_buffered++;
+		status = pqueue_add(seq, buffer + ip_len + headersize, payload_len);
+		if (status == 0) stats.rx_buffered++;
+		else if (status == PQUEUE_DUPLICATE) stats.rx_duplicate++;
+		else stats.rx_overwin++;
 	}
 	else
 	{
@@ -495,11 +455,15 @@ static int encaps_gre(int fd, void *pack, unsigned int len)
 {
 	struct pptp_gre_header * header;
 	unsigned int header_len;
+	struct iovec iov[2];
 	int rc;
 
 	//d_dbg("pptp: >>> encaps_gre(fd=%d, len=%d)\n", fd, len);
 	
-	header = (struct pptp_gre_header *)gre_buff;
+	/* The header is built apart and sent with the payload in one writev(),
+	 * the payload is never copied. gre_buff may hold a packet being
+	 * dequeued when this is called to send the ACK. */
+	header = &gre_hdr;
 
 	/* package this up in a GRE shell. */
 	header->flags = hton8(PPTP_GRE_FLAG_K);
@@ -562,16 +526,18 @@ static int encaps_gre(int fd, void *pack, unsigned int len)
 		stats.tx_oversize++;
 		return 0;	/* drop this, it's too big */
 	}
-	/* copy payload into buffer */
-	memcpy(gre_buff + header_len, pack, len);
+	iov[0].iov_base = header;
+	iov[0].iov_len = header_len;
+	iov[1].iov_base = pack;
+	iov[1].iov_len = len;
 	/* record and increment sequence numbers */
 	seq_sent = seq;
 	seq++;
 	/* write this baby out to the net */
 #if 0
-	print_packet(2, gre_buff, header_len+len, "encaps_gre:");
+	print_packet(2, pack, len, "encaps_gre:");
 #endif
-	rc = write(fd, gre_buff, header_len + len);
+	rc = writev(fd, iov, 2);
 	if (rc < 0)
 	{
 		d_dbg("rc = %d, errno=%d, %s\n", rc, errno, strerror(errno));
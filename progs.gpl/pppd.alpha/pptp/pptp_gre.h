@@ -25,6 +25,7 @@ typedef struct gre_stats {
 	uint32_t rx_lost;	// data packet did not arrive before timeout
 	uint32_t rx_underwin;	// data packet was under window (arrived too late
 	// or duplicate packet)
+	uint32_t rx_duplicate;	// data packet was already in the reorder queue
 	uint32_t rx_overwin;	// data packet was over window
 	// (too many packets lost?)
 	uint32_t rx_buffered;	// data packet arrived earlier than expected,
@@ -3,192 +3,107 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
 #include "pqueue.h"
 #include "dtrace.h"
 
-#define MIN_CAPACITY 128	/* min allocated buffer for a packet */
+#define PQ_SLOT(seq)		(&pq_ring[(unsigned int)(seq) & (PQUEUE_RING - 1)])
+/* sequence number 'a' comes before 'b' (handles the wrap-around) */
+#define PQ_BEFORE(a, b)		((int)((unsigned int)(a) - (unsigned int)(b)) < 0)
 
-static int pqueue_alloc(int seq, unsigned char *packet, int packlen, pqueue_t ** new);
 int packet_timeout_usecs = DEFAULT_PACKET_TIMEOUT * 1000000;
-static pqueue_t *pq_head = NULL, *pq_tail = NULL;
 
-/* contains a list of free queue elements.*/
-static pqueue_t *pq_freelist_head = NULL;
+/* the reorder window, indexed by sequence number */
+static pqueue_t pq_ring[PQUEUE_RING];
+static int pq_count = 0;
+/* no packet in the window has a lower sequence number than this one */
+static unsigned int pq_low = 0;
 
-static int pqueue_alloc(int seq, unsigned char *packet, int packlen, pqueue_t ** new)
-{
-	pqueue_t *newent;
-
-	//d_dbg("PQUEUE: seq=%d, packlen=%d\n", seq, packlen);
+/* packet buffers, allocated once and never freed */
+static unsigned char *pq_pool = NULL;
+static unsigned char *pq_freebuf[PQUEUE_BUFFERS];
+static int pq_nfree = 0;
 
-	/* search the freelist for one that has sufficient space  */
-	if (pq_freelist_head)
-	{
-		for (newent = pq_freelist_head; newent; newent = newent->next)
-		{
-			if (newent->capacity >= packlen)
-			{
-				/* unlink from freelist */
-				if (pq_freelist_head == newent) pq_freelist_head = newent->next;
-				if (newent->prev) newent->prev->next = newent->next;
-				if (newent->next) newent->next->prev = newent->prev;
-				if (pq_freelist_head) pq_freelist_head->prev = NULL;
-				break;
-			} /* end if capacity >= packlen */
-		} /* end for */
-
-		/* nothing found? Take first and reallocate it */
-		if (NULL == newent)
-		{
-			newent = pq_freelist_head;
-			pq_freelist_head = pq_freelist_head->next;
-
-			if (pq_freelist_head) pq_freelist_head->prev = NULL;
-
-			d_dbg("PQUEUE: realloc capacity %d to %d\n", newent->capacity, packlen);
-
-			newent->packet = (unsigned char *) realloc(newent->packet, packlen);
-			if (!newent->packet)
-			{
-				d_warn("PQUEUE: error reallocating packet: %s\n", strerror(errno));
-				return -1;
-			}
-			newent->capacity = packlen;
-		}
+static int pqueue_alloc_pool(void)
+{
+	int i;
 
-		d_dbg("PQUEUE: Recycle entry from freelist. Capacity: %d\n", newent->capacity);
-	}
-	else
+	pq_pool = (unsigned char *) malloc(PQUEUE_BUFFERS * PQUEUE_BUFFER_SIZE);
+	if (!pq_pool)
 	{
-		/* allocate a new one */
-		newent = (pqueue_t *) malloc(sizeof(pqueue_t));
-		if (!newent)
-		{
-			d_warn("PQUEUE: error allocating newent: %s\n", strerror(errno));
-			return -1;
-		}
-		newent->capacity = 0;
-
-		d_dbg("PQUEUE: Alloc new queue entry\n");
+		d_warn("PQUEUE: error allocating packet buffers: %s\n", strerror(errno));
+		return -1;
 	}
+	for (i = 0; i < PQUEUE_BUFFERS; i++) pq_freebuf[i] = pq_pool + i * PQUEUE_BUFFER_SIZE;
+	pq_nfree = PQUEUE_BUFFERS;
 
-	if (!newent->capacity)
-	{
-		/* a new queue entry was allocated. Allocate the packet buffer */
-		int size = packlen < MIN_CAPACITY ? MIN_CAPACITY : packlen;
-		/* Allocate at least MIN_CAPACITY */
-		d_dbg("PQUEUE: allocating for packet size %d\n", size);
-		newent->packet = (unsigned char *) malloc(size);
-		if (!newent->packet)
-		{
-			d_warn("PQUEUE: error allocating packet: %s\n", strerror(errno));
-			return -1;
-		}
-		newent->capacity = size;
-	} /* endif ! capacity */
-
-	assert(newent->capacity >= packlen);
-
-	/* store the contents into the buffer */
-	memcpy(newent->packet, packet, packlen);
-
-	newent->next = newent->prev = NULL;
-	newent->seq = seq;
-	newent->packlen = packlen;
-
-	gettimeofday(&newent->expires, NULL);
-	newent->expires.tv_usec += packet_timeout_usecs;
-	newent->expires.tv_sec += (newent->expires.tv_usec / 1000000);
-	newent->expires.tv_usec %= 1000000;
-
-	*new = newent;
+	d_dbg("PQUEUE: allocated %d buffers of %d bytes\n", PQUEUE_BUFFERS, PQUEUE_BUFFER_SIZE);
 	return 0;
 }
 
 int pqueue_add(int seq, unsigned char *packet, int packlen)
 {
-	pqueue_t *newent, *point;
+	pqueue_t *slot;
 
-	/* get a new entry */
-	if (0 != pqueue_alloc(seq, packet, packlen, &newent)) return -1;
+	if (packlen > PQUEUE_BUFFER_SIZE)
+	{
+		d_warn("PQUEUE: discarding oversized packet %d (%d bytes)\n", seq, packlen);
+		return PQUEUE_ERROR;
+	}
+	if (!pq_pool && pqueue_alloc_pool() < 0) return PQUEUE_ERROR;
 
-	for (point = pq_head; point != NULL; point = point->next)
+	slot = PQ_SLOT(seq);
+	if (slot->used)
 	{
-		if (point->seq == seq)
+		if (slot->seq == seq)
 		{	/* queue already contains this packet */
 			d_warn("PQUEUE: discarding duplicate packet %d\n", seq);
-			return -1;
-		}
-		if (point->seq > seq)
-		{	/* gone too far: point->seq > seq and point->prev->seq < seq */
-			if (point->prev)
-			{	/* insert between point->prev and point */
-				d_dbg("PQUEUE: adding %d between %d and %d\n", seq, point->prev->seq, point->seq);
-				point->prev->next = newent;
-			}
-			else
-			{	/* insert at head of queue, before point */
-				d_dbg("PQUEUE: adding %d before %d\n", seq, point->seq);
-				pq_head = newent;
-			}
-			newent->prev = point->prev;	/* will be NULL, at head of queue */
-			newent->next = point;
-			point->prev = newent;
-			return 0;
+			return PQUEUE_DUPLICATE;
 		}
+		/* A packet one full ring behind, which should have been
+		 * dequeued long ago. Make room for the new one. */
+		d_dbg("PQUEUE: dropping stale packet %d for %d\n", slot->seq, seq);
+		pqueue_del(slot);
 	}
 
-	/* We didn't find anywhere to insert the packet,
-	 * so there are no packets in the queue with higher sequences than this one,
-	 * so all the packets in the queue have lower sequences,
-	 * so this packet belongs at the end of the queue (which might be empty)
-	 */
-
-	if (pq_head == NULL)
-	{
-		d_dbg("PQUEUE: adding %d to empty queue\n", seq);
-		pq_head = newent;
-	}
-	else
+	if (pq_nfree == 0)
 	{
-		d_dbg("PQUEUE: adding %d as tail, after %d\n", seq, pq_tail->seq);
-		pq_tail->next = newent;
+		d_warn("PQUEUE: no free buffer, discarding packet %d\n", seq);
+		return PQUEUE_ERROR;
 	}
-	newent->prev = pq_tail;
-	pq_tail = newent;
 
+	slot->packet = pq_freebuf[--pq_nfree];
+	memcpy(slot->packet, packet, packlen);
+	slot->seq = seq;
+	slot->packlen = packlen;
+	slot->used = 1;
+
+	gettimeofday(&slot->expires, NULL);
+	slot->expires.tv_usec += packet_timeout_usecs;
+	slot->expires.tv_sec += (slot->expires.tv_usec / 1000000);
+	slot->expires.tv_usec %= 1000000;
+
+	if (pq_count == 0 || PQ_BEFORE(seq, pq_low)) pq_low = seq;
+	pq_count++;
+
+	d_dbg("PQUEUE: adding %d, queue length is %d\n", seq, pq_count);
 	return 0;
 }
 
 int pqueue_del(pqueue_t * point)
 {
-#ifdef DEBUG_PQUEUE
-	int pq_count = 0;
-	int pq_freelist_count = 0;
-	pqueue_t * point;
-#endif
-	
-	d_dbg("PQUEUE: Move seq %d to freelist\n", point->seq);
-
-	/* unlink from pq */
-	if (pq_head == point) pq_head = point->next;
-	if (pq_tail == point) pq_tail = point->prev;
-	if (point->prev) point->prev->next = point->next;
-	if (point->next) point->next->prev = point->prev;
+	if (!point->used) return -1;
 
-	/* add point to the freelist */
-	point->next = pq_freelist_head;
-	point->prev = NULL;
+	d_dbg("PQUEUE: release seq %d\n", point->seq);
 
-	if (point->next) point->next->prev = point;
-	pq_freelist_head = point;
+	pq_freebuf[pq_nfree++] = point->packet;
+	point->packet = NULL;
+	point->used = 0;
+	pq_count--;
+	if ((unsigned int)point->seq == pq_low) pq_low++;
 
 #ifdef DEBUG_PQUEUE
-	for (point = pq_head; point; point = point->next) ++pq_count;
-	for (point = pq_freelist_head; point; point = point->next) ++pq_freelist_count;
-	d_dbg("PQUEUE: queue length is %d, freelist length is %d\n", pq_count, pq_freelist_count);
+	d_dbg("PQUEUE: queue length is %d, free buffers %d\n", pq_count, pq_nfree);
 #endif
 
 	return 0;
@@ -196,7 +111,37 @@ int pqueue_del(pqueue_t * point)
 
 pqueue_t * pqueue_head()
 {
-	return pq_head;
+	pqueue_t *slot, *low = NULL;
+	int i;
+
+	if (pq_count == 0) return NULL;
+
+	/* The packets in the window never span more than MISSING_WINDOW
+	 * sequence numbers, so this stops within one turn of the ring.
+	 * pq_low only moves forward here, which keeps the cost of walking
+	 * over the holes bounded by the number of dequeued packets. */
+	for (i = 0; i < PQUEUE_RING; i++, pq_low++)
+	{
+		slot = PQ_SLOT(pq_low);
+		if (slot->used && (unsigned int)slot->seq == pq_low) return slot;
+	}
+
+	/* pq_low went past a queued packet, which should not happen.
+	 * Start again from the lowest sequence number in the window. */
+	for (i = 0; i < PQUEUE_RING; i++)
+	{
+		slot = &pq_ring[i];
+		if (slot->used && (!low || PQ_BEFORE(slot->seq, low->seq))) low = slot;
+	}
+	if (!low)
+	{
+		d_warn("PQUEUE: %d packets counted but none queued\n", pq_count);
+		pq_count = 0;
+		return NULL;
+	}
+	d_warn("PQUEUE: lost track of the queue head, resyncing at %d\n", low->seq);
+	pq_low = low->seq;
+	return low;
 }
 
 int pqueue_expiry_time(pqueue_t * entry)
@@ -209,3 +154,14 @@ int pqueue_expiry_time(pqueue_t * entry)
 	expiry_time += (entry->expires.tv_usec - tv.tv_usec);
 	return expiry_time;
 }
+
+/* drop everything left from the previous call */
+void pqueue_flush(void)
+{
+	int i;
+
+	if (pq_count == 0) return;
+	for (i = 0; i < PQUEUE_RING; i++)
+		if (pq_ring[i].used) pqueue_del(&pq_ring[i]);
+	pq_low = 0;
+}
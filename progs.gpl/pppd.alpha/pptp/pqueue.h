@@ -11,20 +11,31 @@ extern int packet_timeout_usecs;
 /* assume packet is bad/spoofed if it's more than this many seqs ahead */
 #define MISSING_WINDOW 300
 
-/* Packet queue structure: linked list of packets received out-of-order */
+/* The reorder window is a ring of slots indexed by (seq % PQUEUE_RING),
+ * it must be a power of 2 larger than MISSING_WINDOW. The packets are
+ * copied into one of PQUEUE_BUFFERS buffers of PQUEUE_BUFFER_SIZE bytes
+ * which are allocated once, on the first out-of-order packet. */
+#define PQUEUE_RING			512
+#define PQUEUE_BUFFERS		64
+#define PQUEUE_BUFFER_SIZE	1600
+
+/* Packet queue structure: one slot of the reorder window */
 typedef struct pqueue {
-	struct pqueue *next;
-	struct pqueue *prev;
 	int seq;
+	int used;
 	struct timeval expires;
 	unsigned char *packet;
 	int packlen;
-	int capacity;
 } pqueue_t;
 
+/* pqueue_add() returns 0, or one of these */
+#define PQUEUE_ERROR		-1	/* too big, or no buffer left for it */
+#define PQUEUE_DUPLICATE	-2	/* this packet is already queued */
+
 int pqueue_add(int seq, unsigned char *packet, int packlen);
 int pqueue_del(pqueue_t * point);
 pqueue_t *pqueue_head();
 int pqueue_expiry_time(pqueue_t * entry);
+void pqueue_flush(void);
 
 #endif				/* PQUEUE_H */
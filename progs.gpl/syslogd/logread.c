@@ -0,0 +1,81 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * logread - print the messages in the syslogd -C circular buffer.
+ *
+ * The buffer is attached read-only and the records are printed in
+ * place, see logring.h. With -s a caller which remembers the sequence
+ * number printed by -n (e.g. the log web page) only gets the messages
+ * logged since its last read.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "logring.h"
+
+static int print_seq = 0;
+
+static void show_usage(void)
+{
+	printf("Usage: logread [-f] [-p] [-n] [-s seq]\n\n");
+	printf("  -f      :Follow, keep printing new messages.\n");
+	printf("  -p      :Prefix each message with its sequence number.\n");
+	printf("  -n      :Print the next sequence number to ask for at the end.\n");
+	printf("  -s seq  :Only print the messages from sequence number 'seq'.\n");
+	exit(EXIT_FAILURE);
+}
+
+static int print_record(unsigned int seq, const char * msg, int len, void * param)
+{
+	if (print_seq) printf("%u ", seq);
+	fwrite(msg, 1, len, stdout);
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	struct logring lr;
+	unsigned int seq = 0, first, next;
+	int opt, follow = 0, print_next = 0;
+
+	while ((opt = getopt(argc, argv, "fpns:")) > 0)
+	{
+		switch (opt)
+		{
+		case 'f': follow = 1; break;
+		case 'p': print_seq = 1; break;
+		case 'n': print_next = 1; break;
+		case 's': seq = strtoul(optarg, NULL, 0); break;
+		default: show_usage(); break;
+		}
+	}
+
+	if (logring_open(&lr, LOGRING_KEY) < 0)
+	{
+		fprintf(stderr, "logread: can't attach the log buffer: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* without -s, start from the oldest record */
+	logring_range(&lr, &first, &next);
+	if (seq == 0) seq = first;
+
+	do
+	{
+		logring_read(&lr, &seq, print_record, NULL);
+		fflush(stdout);
+		if (follow) sleep(1);
+	} while (follow);
+
+	if (print_next) printf("%u\n", seq);
+	logring_close(&lr);
+	return EXIT_SUCCESS;
+}
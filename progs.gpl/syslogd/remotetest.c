@@ -0,0 +1,256 @@
+/* vi: set sw=4 ts=4: */
+/* remotetest.c
+ *
+ * Host test of the syslogd -R forwarding stage against a UDP and a TCP
+ * sink on the loopback. syslogd.c is included as is, so the test drives
+ * the real remote_enqueue()/remote_flush()/remote_poll() and checks what
+ * the sink receives and what the sent/dropped counters say:
+ *
+ *   - UDP, one message per datagram.
+ *   - UDP with -B, messages packed into datagrams.
+ *   - TCP with octet counting.
+ *   - TCP connection lost in the middle of a message: the messages before
+ *     it count as sent, it is dropped, the rest go out after the reconnect.
+ *
+ * Build with "make remotetest CC=gcc" and run it, it exits non zero when
+ * a check fails.
+ */
+#define main syslogd_main
+#include "syslogd.c"
+#undef main
+
+#include <arpa/inet.h>
+
+#define NMSG		10
+
+static int failed = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failed++; } } while (0)
+
+/* Bind a loopback sink, RemotePort is set to the port it got. */
+static int sink_open(int type)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int fd = socket(AF_INET, type, 0);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+		(type == SOCK_STREAM && listen(fd, 1) < 0) ||
+		getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+	{
+		perror("sink");
+		exit(1);
+	}
+	RemotePort = ntohs(sin.sin_port);
+	return fd;
+}
+
+static int wait_readable(int fd)
+{
+	struct timeval tv = { 1, 0 };
+	fd_set rfds;
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+	return select(fd + 1, &rfds, NULL, NULL, &tv) > 0;
+}
+
+/* Run the select loop part of syslogd until the queue is drained. */
+static void pump(void)
+{
+	struct timeval tv;
+	fd_set wfds;
+	int i;
+
+	for (i = 0; i < 100; i++)
+	{
+		remote_poll();
+		if (!remote_want_write()) return;
+		FD_ZERO(&wfds);
+		FD_SET(remotefd, &wfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		if (select(remotefd + 1, NULL, &wfds, NULL, &tv) > 0) remote_flush();
+	}
+}
+
+static void reset(int tcp, int batch)
+{
+	remote_close();
+	remote_qhead = remote_qcount = 0;
+	remote_sent = remote_drop_full = remote_drop_rate = remote_drop_err = 0;
+	remote_retry = 0;
+	RemoteTCP = tcp;
+	RemoteBatch = batch;
+}
+
+static void enqueue(int first, int count)
+{
+	char msg[32];
+	int i;
+
+	for (i = first; i < first + count; i++)
+	{
+		sprintf(msg, "test message %d", i);
+		remote_enqueue("<6>", msg);
+	}
+}
+
+/* Check a received message is the next one expected. */
+static void expect(const char *data, int len, int *next)
+{
+	char want[32];
+	int wlen = sprintf(want, "<6>test message %d", *next);
+
+	CHECK(len == wlen && memcmp(data, want, len) == 0,
+		"got \"%.*s\", expected \"%s\"", len, data, want);
+	(*next)++;
+}
+
+static void test_udp(int batch)
+{
+	int sink = sink_open(SOCK_DGRAM);
+	int next = 0, datagrams = 0, n;
+	char buf[4096], *p, *nl;
+
+	reset(FALSE, batch);
+	init_RemoteLog();
+	enqueue(0, NMSG);
+	pump();
+
+	while (next < NMSG && wait_readable(sink) && (n = recv(sink, buf, sizeof(buf), 0)) > 0)
+	{
+		datagrams++;
+		for (p = buf; p < buf + n; p = nl + 1)
+		{
+			if (!(nl = memchr(p, '\n', buf + n - p))) nl = buf + n;
+			expect(p, nl - p, &next);
+		}
+	}
+	CHECK(next == NMSG, "UDP -B %d: received %d of %d messages", batch, next, NMSG);
+	CHECK(remote_sent == NMSG && remote_drop_err == 0,
+		"UDP -B %d: sent %lu, error %lu", batch, remote_sent, remote_drop_err);
+	if (batch)
+		CHECK(datagrams < NMSG, "UDP -B %d: %d datagrams, not packed", batch, datagrams);
+	else
+		CHECK(datagrams == NMSG, "UDP: %d datagrams for %d messages", datagrams, NMSG);
+	printf("UDP -B %d: %d messages in %d datagrams\n", batch, next, datagrams);
+
+	remote_close();
+	close(sink);
+}
+
+/* Read octet counted frames from a TCP peer until count messages are seen. */
+static void tcp_read(int fd, int *next, int last)
+{
+	static char buf[8192];
+	static int len = 0;
+	char *sp;
+	int n, mlen;
+
+	if (fd < 0)
+	{
+		len = 0;
+		return;
+	}
+	while (*next < last)
+	{
+		while ((sp = memchr(buf, ' ', len)) != NULL)
+		{
+			mlen = atoi(buf);
+			if (sp + 1 + mlen > buf + len) break;
+			expect(sp + 1, mlen, next);
+			n = sp + 1 + mlen - buf;
+			memmove(buf, buf + n, len - n);
+			len -= n;
+		}
+		if (*next >= last || !wait_readable(fd)) break;
+		if ((n = recv(fd, buf + len, sizeof(buf) - len, 0)) <= 0) break;
+		len += n;
+	}
+}
+
+static int tcp_accept(int sink)
+{
+	int fd;
+
+	pump();
+	if (!wait_readable(sink) || (fd = accept(sink, NULL, NULL)) < 0)
+	{
+		CHECK(0, "TCP: no connection");
+		exit(1);
+	}
+	return fd;
+}
+
+static void test_tcp(void)
+{
+	int sink = sink_open(SOCK_STREAM);
+	int peer, next = 0, cut;
+
+	reset(TRUE, 0);
+	init_RemoteLog();
+	peer = tcp_accept(sink);
+
+	enqueue(0, NMSG);
+	pump();
+	tcp_read(peer, &next, NMSG);
+	CHECK(next == NMSG, "TCP: received %d of %d messages", next, NMSG);
+	CHECK(remote_sent == NMSG && remote_drop_err == 0,
+		"TCP: sent %lu, error %lu", remote_sent, remote_drop_err);
+	printf("TCP: %d messages\n", next);
+
+	/* Lose the connection with message 3 of the next batch half written:
+	 * remote_fill() the buffer, pretend the first bytes went out and
+	 * make the next send() fail. */
+	enqueue(NMSG, NMSG);
+	remote_fill();
+	cut = remote_txend[1] + 5;
+	remote_txoff = cut;
+	shutdown(remotefd, SHUT_WR);
+	remote_flush();
+	CHECK(remotefd < 0, "TCP: the broken connection was not closed");
+	CHECK(remote_sent == NMSG + 2 && remote_drop_err == 1,
+		"TCP: after the error sent %lu, error %lu, expected %d and 1",
+		remote_sent, remote_drop_err, NMSG + 2);
+	CHECK(remote_qcount == NMSG - 3, "TCP: %d messages still queued, expected %d",
+		remote_qcount, NMSG - 3);
+	close(peer);
+	tcp_read(-1, NULL, 0);
+
+	/* the reconnect sends the rest, starting on a message boundary */
+	remote_retry = 0;
+	peer = tcp_accept(sink);
+	pump();
+	next = NMSG + 3;
+	tcp_read(peer, &next, 2 * NMSG);
+	CHECK(next == 2 * NMSG, "TCP: received up to %d after the reconnect, expected %d",
+		next, 2 * NMSG);
+	CHECK(remote_sent == 2 * NMSG - 1 && remote_drop_err == 1 && remote_qcount == 0,
+		"TCP: after the reconnect sent %lu, error %lu, queued %d",
+		remote_sent, remote_drop_err, remote_qcount);
+	printf("TCP: connection lost in a message, %lu sent, %lu dropped\n",
+		remote_sent, remote_drop_err);
+
+	remote_close();
+	close(peer);
+	close(sink);
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGPIPE, SIG_IGN);
+	RemoteHost = "127.0.0.1";
+	doRemoteLog = TRUE;
+
+	test_udp(0);
+	test_udp(200);
+	test_tcp();
+
+	printf("%s\n", failed ? "FAILED" : "all passed");
+	return failed ? 1 : 0;
+}
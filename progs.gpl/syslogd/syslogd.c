@@ -75,13 +75,26 @@ static char LocalHostName[64];
 
 #ifdef REMOTE_LOG
 #include <netinet/in.h>
-static int  remotefd 		= -1;	 /* udp socket for logging to remote host */
+static int  remotefd 		= -1;	 /* udp/tcp socket for logging to remote host */
 static char *RemoteHost; 			 /* where do we log? */
 static int  RemotePort 		= 514;	 /* what port to log to? */
 static int  doRemoteLog 	= FALSE; /* To remote log or not to remote log. */
 static int  local_logging 	= FALSE;
+static int  RemoteTCP		= FALSE; /* -T, TCP with RFC 6587 octet counting. */
+static int  RemoteBatch		= 0;	 /* -B, max UDP datagram size when packing messages. */
+static int  RemoteRate		= 0;	 /* -r, max messages per second, 0 is no limit. */
 #endif
 
+/* syslogd -K reads the kernel log itself, klogd is not needed. */
+#include "klogparse.h"
+#define __KMSG_FILE "/proc/kmsg"
+static int  klog_fd			= -1;		/* /proc/kmsg */
+static int  klog_sock		= -1;		/* port trigger socket */
+static int  klog_left		= 0;		/* incomplete line in klog_buf */
+static int  doKernelLog		= FALSE;
+static char klog_buf[4096];
+static struct klog_ifnames klog_ifn = { "", "" };
+
 /* joanw add for mailing log message. 2004.04.14 */
 /* initial the variables of mail				 */
 static int  mail_log      = 0;						/* -m , Enable mail log message.		*/
@@ -121,8 +134,14 @@ static void show_usage(char **argv)
 	printf("  -O path               :Log File Path.\n");
 #ifdef REMOTE_LOG
 	printf("  -R remote_ip:port     :Remote logging.\n");
+	printf("  -T                    :Remote logging over TCP (RFC 6587 framing).\n");
+	printf("  -B size               :Pack messages in UDP datagrams of up to size bytes.\n");
+	printf("  -r rate               :Forward at most rate messages per second.\n");
 #endif
 	printf("  -L                    :Local logging.\n");
+	printf("  -K                    :Read the kernel log (instead of klogd).\n");
+	printf("  -l interface          :LAN interface, for the kernel log.\n");
+	printf("  -w interface          :WAN interface, for the kernel log.\n");
 #ifdef IPC_SYSLOG
 	printf("  -C                    :Circular logging the message.\n");
 #endif
@@ -168,200 +187,57 @@ static void perror_msg_and_die(const char *s, ...)
 #error Please disable IPC_SYSLOG
 #endif
 
-#include <sys/ipc.h>
-#include <sys/sem.h>
-#include <sys/shm.h>
-
-/* our shared key */
-static const long KEY_ID = 0x414e4547; /*"GENA"*/
-
-/* Semaphore operation structures */
-static struct shbuf_ds 
-{
-	int  size;               /* size of data written	*/
-	int  head;               /* start of message list	*/
-	int  tail;               /* end of message list		*/
-	char data[1];            /* data/messages			*/
-} *buf = NULL;               /* shared memory pointer	*/
+#include "logring.h"
 
-static struct sembuf SMwup[1] = {{1, -1, IPC_NOWAIT}};		/* set SMwup 			*/
-static struct sembuf SMwdn[3] = {{0, 0}, {1, 0}, {1, +1}};	/* set SMwdn 			*/
-
-static int    shmid 			= -1;						/* ipc shared memory id	*/
-static int    s_semid 			= -1;						/* ipc semaphore id		*/
-int			  data_size 		= 32000;					/* data size			*/
-int			  shm_size 			= 32000 + sizeof(*buf);		/* our buffer size		*/
+/* The circular buffer lives in comlib/logring.c. syslogd is the only
+ * writer, readers (logread, the web pages) attach it read-only and
+ * sync with us through the seqlock in the ring header, so we don't
+ * need the semaphores any more. */
+static struct logring ring = { -1, 0, NULL, NULL, 0 };
+int			  data_size 		= LOGRING_DATA_SIZE;		/* data size			*/
 static int	  circular_logging 	= FALSE;
-
-
-/*
- * sem_up - up()'s a semaphore.
- */
-static inline void sem_up(int semid)
-{
-	if ( semop(semid, SMwup, 1) == -1 )
-		perror_msg_and_die("semop[SMwup]");
-}
-
-/*
- * sem_down - down()'s a semaphore
- */
-static inline void sem_down(int semid)
-{
-	if ( semop(semid, SMwdn, 3) == -1 )
-		perror_msg_and_die("semop[SMwdn]");
-}
-
+static unsigned int mail_seq	= 0;						/* first record not mailed yet */
 
 void ipcsyslog_cleanup(void){
 	printf("Exiting Syslogd!\n");
-	if (shmid != -1)
-		shmdt(buf);
-
-	if (shmid != -1)
-		shmctl(shmid, IPC_RMID, NULL);
-	if (s_semid != -1)
-		semctl(s_semid, 0, IPC_RMID, 0);
+	logring_destroy(&ring);
 }
 
 void ipcsyslog_init(void)
 {
-	if (buf == NULL)
+	if (ring.hdr == NULL)
 	{
-		if ((shmid = shmget(KEY_ID, shm_size, IPC_CREAT | 1023)) == -1)
+		if (logring_create(&ring, LOGRING_KEY, data_size) < 0)
 			perror_msg_and_die("shmget");
-
-		if ((buf = shmat(shmid, NULL, 0)) == NULL)
-			perror_msg_and_die("shmat");
-
-		buf->size=data_size;
-		buf->head=buf->tail=0;
-
-		/* we'll trust the OS to set initial semval to 0 (let's hope) */
-		if ((s_semid = semget(KEY_ID, 2, IPC_CREAT | IPC_EXCL | 1023)) == -1)
-		{
-			if (errno == EEXIST)
-			{
-				if ((s_semid = semget(KEY_ID, 2, 0)) == -1)
-					perror_msg_and_die("semget");
-			}
-			else
-			{
-				perror_msg_and_die("semget");
-			}
-		}
 	}
 	else
 	{
-		printf("Buffer already allocated just grab the semaphore?");
+		printf("Buffer already allocated.\n");
 	}
 }
 
 /* write message to buffer */
 void circ_message(const char *msg)
 {
-	int l=strlen(msg)+1; /* count the whole message w/ '\0' included */
-
-	sem_down(s_semid);
-
-	/*
-	 * Circular Buffer Algorithm:
-	 * --------------------------
-	 *
-	 * Start-off w/ empty buffer of specific size SHM_SIZ
-	 * Start filling it up w/ messages. I use '\0' as separator to break up messages.
-	 * This is also very handy since we can do printf on message.
-	 *
-	 * Once the buffer is full we need to get rid of the first message in buffer and
-	 * insert the new message. (Note: if the message being added is >1 message then
-	 * we will need to "remove" >1 old message from the buffer). The way this is done
-	 * is the following:
-	 *      When we reach the end of the buffer we set a mark and start from the beginning.
-	 *      Now what about the beginning and end of the buffer? Well we have the "head"
-	 *      index/pointer which is the starting point for the messages and we have "tail"
-	 *      index/pointer which is the ending point for the messages. When we "display" the
-	 *      messages we start from the beginning and continue until we reach "tail". If we
-	 *      reach end of buffer, then we just start from the beginning (offset 0). "head" and
-	 *      "tail" are actually offsets from the beginning of the buffer.
-	 *
-	 * Note: This algorithm uses Linux IPC mechanism w/ shared memory and semaphores to provide
-	 *       a threasafe way of handling shared memory operations.
-	 */
-	if ( (buf->tail + l) < buf->size )
-	{
-		/* before we append the message we need to check the HEAD so that we won't
-		 * overwrite any of the message that we still need and adjust HEAD to point
-		 * to the next message! 
-		 */
-		if ( buf->tail < buf->head)
-		{
-			if ( (buf->tail + l) >= buf->head )
-			{
-			  /* we need to move the HEAD to point to the next message
-			   * Theoretically we have enough room to add the whole message to the
-			   * buffer, because of the first outer IF statement, so we don't have
-			   * to worry about overflows here!
-			   */
-				/* we need to know how many bytes we are overwriting to make enough room */	
-			 	int k= buf->tail + l - buf->head;
-				char *c=memchr(buf->data+buf->head + k,'\0',buf->size - (buf->head + k));
-				if (c != NULL) /* do a sanity check just in case! */
-				{
-					/* we need to convert pointer to offset + skip the '\0' 
-					 * since we need to point to the beginning of the next message 
-					 */
-					buf->head = c - buf->data + 1; 
-					/* Note: HEAD is only used to "retrieve" messages, it's not used
-					 *when writing messages into our buffer 
-					 */
-				}
-				else /* show an error message to know we messed up? */
-				{ 
-					printf("Weird! Can't find the terminator token??? \n");
-					buf->head=0;
-				}
-			}
-		} /* in other cases no overflows have been done yet, so we don't care! */
-
-		/* we should be ok to append the message now */
-		strncpy(buf->data + buf->tail,msg,l); /* append our message */
-		buf->tail+=l; /* count full message w/ '\0' terminating char */
-	}
-	else
-	{
-		/* we need to break up the message and "circle" it around */
-		char *c;
-		int  k=buf->tail + l - buf->size; /* count # of bytes we don't fit */
-
-		/* We need to move HEAD! This is always the case since we are going
-		 * to "circle" the message.
-		 */
-		c=memchr(buf->data + k ,'\0', buf->size - k);
-
-		if (c != NULL) /* if we don't have '\0'??? weird!!! */
-		{
-			/* move head pointer*/
-			buf->head=c-buf->data+1;
-
-			/* now write the first part of the message */
-			strncpy(buf->data + buf->tail, msg, l - k - 1);
+	logring_append(&ring, msg);
+}
 
-			/* ALWAYS terminate end of buffer w/ '\0' */
-			buf->data[buf->size-1]='\0';
+static int mail_record(unsigned int seq, const char *msg, int len, void *param)
+{
+	fwrite(msg, 1, len, (FILE *)param);
+	return 0;
+}
 
-			/* now write out the rest of the string to the beginning of the buffer */
-			strcpy(buf->data, &msg[l-k-1]);
+/* Dump the records which have not been mailed yet to the mail file.
+ * We only walk the records appended since the last mail. */
+static int circ_dump_unmailed(const char *path)
+{
+	FILE *fp;
 
-			/* we need to place the TAIL at the end of the message */
-			buf->tail = k + 1;
-		}
-		else
-		{
-			printf("Weird! Can't find the terminator token from the beginning??? \n");
-			buf->head = buf->tail = 0; /* reset buffer, since it's probably corrupted */
-		}
-	}
-	sem_up(s_semid);
+	if ((fp = fopen(path, "w")) == NULL) return -1;
+	logring_read(&ring, &mail_seq, mail_record, fp);
+	fclose(fp);
+	return 0;
 }
 #endif  /* IPC_SYSLOG */
 
@@ -430,6 +306,34 @@ static size_t read_log(char *pstrFilename, char **pcBuffer)
 	return -1;
 }
 
+/* Mail the log file which has been moved to temp_log_path. */
+static void mail_log_file(void)
+{
+	char buf[255];
+
+	sprintf(buf, "%s -s \"%s\" -f \"%s\" -r \"%s\" -H \"%s\" -S \"%s\" -P \"%s\" \"%s\" < %s",
+				smtp_path , mail_subject, email_addr, email_addr, src_host, mail_host, mail_port, 
+				email_addr, temp_log_path);
+	system(buf);
+}
+
+/* The line we log after the log has been mailed. */
+static void log_mailed_message(char *msg, size_t size)
+{
+	char   stamp[16];
+	time_t now;
+
+	time(&now);
+	memcpy(stamp, ctime(&now)+4, 15);
+	stamp[15]='\0';
+#ifdef LOGNUM
+	snprintf(msg, size, "%s  |  SYS:003[%s]\n", stamp, email_addr);
+#else
+	snprintf(msg, size, "%s  |  Log Message is full. Mailed the Log Message file to %s.\n",
+				stamp, email_addr);
+#endif
+}
+
 static void insert_log(const char *pstrMsg)
 {
 	FILE   *pfileLog	= NULL;
@@ -438,7 +342,6 @@ static void insert_log(const char *pstrMsg)
 	int    iLines		= defMaxLine;
 	size_t iBufLen		= -1;
 	char   mailmsg[255];
-	time_t now;
 		
 
 	iBufLen=read_log(__LOG_FILE, &pcBuf);
@@ -477,28 +380,20 @@ static void insert_log(const char *pstrMsg)
 		
 		if(send_mail)
 		{
-			sprintf(buf, "%s -s \"%s\" -f \"%s\" -r \"%s\" -H \"%s\" -S \"%s\" -P \"%s\" \"%s\" < %s",
-						smtp_path , mail_subject, email_addr, email_addr, src_host, mail_host, mail_port, 
-						email_addr, temp_log_path);
-			system(buf);
+			mail_log_file();
 
 			if(NULL!=(pfileLog=fopen(__LOG_FILE,"w")))
 			{
-				time(&now);
-				memcpy(mailmsg, ctime(&now)+4, 15);
-				mailmsg[15]='\0';
-#ifdef LOGNUM
-				fprintf(pfileLog,"%s  |  SYS:003[%s]\n", mailmsg, email_addr);
-#else
-				fprintf(pfileLog,"%s  |  Log Message is full. Mailed the Log Message file to %s.\n",
-							mailmsg, email_addr);
-#endif
+				log_mailed_message(mailmsg, sizeof(mailmsg));
+				fprintf(pfileLog, "%s", mailmsg);
 				fclose(pfileLog);
 			}
 		}
 	}
 }
 
+static void logMessage (int pri, char *msg);
+
 /* Note: There is also a function called "message()" in init.c	*/
 /* Print a message to the log file.								*/
 static void message (char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
@@ -515,13 +410,24 @@ static void message (char *fmt, ...)
 	fl.l_len    = 1;
 
 #ifdef IPC_SYSLOG
-	if ((circular_logging == TRUE) && (buf != NULL))
+	if ((circular_logging == TRUE) && (ring.hdr != NULL))
 	{
 		char b[1024];
 		va_start (arguments, fmt);
 		vsnprintf (b, sizeof(b)-1, fmt, arguments);
 		va_end (arguments);
 		circ_message(b);
+
+		/* Mail the records appended since the last mail, we don't
+		 * need to reparse the whole log to know when it is full. */
+		if (mail_log && ring.hdr->next - mail_seq >= defMaxLine &&
+			circ_dump_unmailed(temp_log_path) == 0)
+		{
+			mail_log_file();
+			log_mailed_message(b, sizeof(b));
+			circ_message(b);
+			mail_seq = ring.hdr->next;
+		}
 	}
 	else
 #endif
@@ -572,6 +478,241 @@ static void message (char *fmt, ...)
 	}
 }
 
+#ifdef REMOTE_LOG
+/* Remote forwarding stage.
+ *
+ * logMessage() only queues the message, the queue is drained from the
+ * select loop when the remote socket is writable, so a stalled network
+ * never blocks the local logging. With -B several queued messages are
+ * packed into one datagram (separated by '\n'), with -T they are sent
+ * over TCP using the octet counting framing of RFC 6587. Messages which
+ * don't fit in the queue or go over the -r rate are dropped and counted.
+ * A message stays queued until all of its bytes are sent, so when the TCP
+ * connection breaks only the one cut short is lost, the rest go out after
+ * the reconnect.
+ */
+#define REMOTE_QLEN			32		/* queued messages */
+#define REMOTE_MSGLEN		512		/* max length of a forwarded message */
+#define REMOTE_TXLEN		2048	/* max bytes sent per write */
+#define REMOTE_RETRY		10		/* seconds between TCP reconnects */
+#define REMOTE_REPORT		60		/* seconds between drop reports */
+
+static struct remote_msg
+{
+	unsigned short len;
+	char data[REMOTE_MSGLEN];
+} remote_q[REMOTE_QLEN];
+
+static int			remote_qhead	= 0;	/* oldest queued message */
+static int			remote_qcount	= 0;	/* number of queued messages */
+static char			remote_tx[REMOTE_TXLEN + 16];
+static int			remote_txlen	= 0;	/* bytes pending in remote_tx */
+static int			remote_txoff	= 0;	/* bytes of remote_tx already sent */
+static int			remote_txmsgs	= 0;	/* queued messages copied to remote_tx */
+static int			remote_txend[REMOTE_QLEN];	/* where each of them ends in remote_tx */
+static int			remote_connecting = FALSE;
+static time_t		remote_retry	= 0;	/* when to try to reconnect */
+static struct sockaddr_in remoteaddr;
+
+static time_t		rate_time		= 0;
+static int			rate_count		= 0;
+
+static unsigned long remote_sent		= 0;
+static unsigned long remote_drop_full	= 0;
+static unsigned long remote_drop_rate	= 0;
+static unsigned long remote_drop_err	= 0;
+static unsigned long remote_reported	= 0;
+static time_t		remote_report_time	= 0;
+
+static void remote_close(void)
+{
+	if (remotefd >= 0) close(remotefd);
+	remotefd = -1;
+	remote_connecting = FALSE;
+	remote_txlen = remote_txoff = remote_txmsgs = 0;
+	remote_retry = time(NULL) + REMOTE_RETRY;
+}
+
+static void remote_connect(void)
+{
+	remotefd = socket(AF_INET, RemoteTCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (remotefd < 0)
+	{
+		perror_msg_and_die("cannot create socket");
+	}
+	fcntl(remotefd, F_SETFL, fcntl(remotefd, F_GETFL) | O_NONBLOCK);
+
+	/*
+	 *  For UDP sockets, connect just sets the default host and port
+	 *  for future operations. For TCP we wait for the socket to be
+	 *  writable in the select loop.
+	 */
+	if (connect(remotefd, (struct sockaddr *) &remoteaddr, sizeof(remoteaddr)) < 0)
+	{
+		if (RemoteTCP && errno == EINPROGRESS)
+			remote_connecting = TRUE;
+		else
+		{
+			printf("cannot connect to remote host %s:%d: %s\n", RemoteHost, RemotePort, strerror(errno));
+			remote_close();
+		}
+	}
+}
+
+/* Should the select loop wait for the remote socket to be writable ? */
+static int remote_want_write(void)
+{
+	return remotefd >= 0 && (remote_connecting || remote_txlen > 0 || remote_qcount > 0);
+}
+
+static void remote_enqueue(const char *pri, const char *msg)
+{
+	struct remote_msg *m;
+	time_t now = time(NULL);
+	int len;
+
+	if (RemoteRate > 0)
+	{
+		if (now != rate_time)
+		{
+			rate_time = now;
+			rate_count = 0;
+		}
+		if (++rate_count > RemoteRate)
+		{
+			remote_drop_rate++;
+			return;
+		}
+	}
+	if (remote_qcount >= REMOTE_QLEN)
+	{
+		remote_drop_full++;
+		return;
+	}
+
+	m = &remote_q[(remote_qhead + remote_qcount) % REMOTE_QLEN];
+	len = snprintf(m->data, sizeof(m->data), "%s%s", pri, msg);
+	if (len < 0 || len >= (int)sizeof(m->data)) len = sizeof(m->data) - 1;
+	m->len = len;
+	remote_qcount++;
+}
+
+/* Remove the count oldest messages from the queue, adding them to counter. */
+static void remote_dequeue(int count, unsigned long *counter)
+{
+	remote_qhead = (remote_qhead + count) % REMOTE_QLEN;
+	remote_qcount -= count;
+	*counter += count;
+}
+
+/* Copy queued messages to the transmit buffer, they are dequeued once sent. */
+static void remote_fill(void)
+{
+	struct remote_msg *m;
+	int max = RemoteBatch > 0 ? RemoteBatch : REMOTE_MSGLEN;
+
+	if (max > REMOTE_TXLEN) max = REMOTE_TXLEN;
+	remote_txlen = remote_txoff = remote_txmsgs = 0;
+
+	while (remote_txmsgs < remote_qcount)
+	{
+		m = &remote_q[(remote_qhead + remote_txmsgs) % REMOTE_QLEN];
+		if (RemoteTCP)
+		{
+			/* octet counting: "MSG-LEN SP SYSLOG-MSG" */
+			char hdr[8];
+			int hlen = sprintf(hdr, "%d ", m->len);
+			if (remote_txlen > 0 && remote_txlen + hlen + m->len > REMOTE_TXLEN) break;
+			memcpy(remote_tx + remote_txlen, hdr, hlen);
+			remote_txlen += hlen;
+		}
+		else if (remote_txlen > 0)
+		{
+			/* one message per datagram, unless -B allows packing */
+			if (RemoteBatch <= 0 || remote_txlen + 1 + m->len > max) break;
+			remote_tx[remote_txlen++] = '\n';
+		}
+		memcpy(remote_tx + remote_txlen, m->data, m->len);
+		remote_txlen += m->len;
+		remote_txend[remote_txmsgs++] = remote_txlen;
+	}
+}
+
+/* Drain the queue while the socket accepts data. */
+static void remote_flush(void)
+{
+	int n, i, err;
+	socklen_t elen = sizeof(err);
+
+	if (remote_connecting)
+	{
+		if (getsockopt(remotefd, SOL_SOCKET, SO_ERROR, &err, &elen) < 0 || err)
+		{
+			printf("cannot connect to remote host %s:%d\n", RemoteHost, RemotePort);
+			remote_close();
+			return;
+		}
+		remote_connecting = FALSE;
+	}
+
+	for (;;)
+	{
+		if (remote_txoff >= remote_txlen)
+		{
+			remote_fill();
+			if (remote_txlen == 0) return;
+		}
+		n = send(remotefd, remote_tx + remote_txoff, remote_txlen - remote_txoff, MSG_DONTWAIT);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+			if (RemoteTCP)
+			{
+				/* The connection is gone. What was written before is sent,
+				 * the message cut short can't be resumed on a new connection,
+				 * the rest stays queued for the reconnect. */
+				for (i = 0; i < remote_txmsgs && remote_txend[i] <= remote_txoff; i++);
+				remote_dequeue(i, &remote_sent);
+				if (i < remote_txmsgs && remote_txoff > (i > 0 ? remote_txend[i - 1] : 0))
+					remote_dequeue(1, &remote_drop_err);
+				remote_close();
+				return;
+			}
+			/* UDP errors (ICMP unreachable ...) only lose this datagram */
+			remote_dequeue(remote_txmsgs, &remote_drop_err);
+			remote_txlen = remote_txoff = remote_txmsgs = 0;
+			continue;
+		}
+		remote_txoff += n;
+		if (remote_txoff >= remote_txlen)
+		{
+			remote_dequeue(remote_txmsgs, &remote_sent);
+			remote_txlen = remote_txoff = remote_txmsgs = 0;
+		}
+	}
+}
+
+/* Called once per select loop pass. */
+static void remote_poll(void)
+{
+	time_t now = time(NULL);
+	unsigned long dropped = remote_drop_full + remote_drop_rate + remote_drop_err;
+
+	if (remotefd < 0 && remote_qcount > 0 && now >= remote_retry) remote_connect();
+
+	if (dropped != remote_reported && now - remote_report_time >= REMOTE_REPORT)
+	{
+		char b[128];
+		snprintf(b, sizeof(b), "remote log: sent %lu, dropped %lu (queue full %lu, rate %lu, error %lu)",
+				remote_sent, dropped, remote_drop_full, remote_drop_rate, remote_drop_err);
+		remote_reported = dropped;
+		remote_report_time = now;
+		logMessage(LOG_SYSLOG | LOG_INFO, b);
+	}
+}
+#endif
+
 static void logMessage (int pri, char *msg)
 {
 	time_t 		now;
@@ -624,36 +765,16 @@ static void logMessage (int pri, char *msg)
 		/* todo: supress duplicates */
 
 #ifdef REMOTE_LOG
-		/* send message to remote logger */
-		if ( -1 != remotefd){
-			static const int IOV_COUNT = 2;
-			struct iovec iov[IOV_COUNT];
-			struct iovec *v = iov;
-	
-			memset(&res, 0, sizeof(res));
+		/* queue message for the remote logger */
+		if (doRemoteLog == TRUE)
+		{
 			/* joanw fixed 
 			 * When REMOTE_LOG, we set the all the message's priority as 6,LOG_INFO,
 			 * and priority should be between 0 to 7(you can find out the detail in the syslog.h),
 			 * or the message will be refused by the remote host.
 			 */
-			 //snprintf(res, sizeof(res), "<%d>", pri);
 			snprintf(res, sizeof(res), "<%d>", LOG_INFO);
-			v->iov_base = res ;
-			v->iov_len = strlen(res);
-			v++;
-	
-			v->iov_base = msg;
-			v->iov_len = strlen(msg);
-writev_retry:
-			if ( -1 == writev(remotefd,iov, IOV_COUNT))
-			{
-				printf("err %d: %s\n", errno, strerror(errno));
-				if (errno == EINTR) goto writev_retry;
-				/* joanw fixed													 */
-				/* we don't want syslogd to terminate, so we mark below 2 lines. */
-				 //perror_msg_and_die("cannot write to remote file handle on"
-				 //		"%s:%d",RemoteHost,RemotePort);
-			}
+			remote_enqueue(res, msg);
 		}
 		/* joanw fixed 																  */
 		/* whatever remote logging or local logging, we both log the message locally, */
@@ -757,18 +878,9 @@ static void init_RemoteLog (void)
 {
 	/* joanw debug */
 	printf("init_RemotedLog\n");
-	struct 	sockaddr_in remoteaddr;
 	struct	 hostent *hostinfo;
-	int		len = sizeof(remoteaddr);
-
-	memset(&remoteaddr, 0, len);
 
-	remotefd = socket(AF_INET, SOCK_DGRAM, 0);
-
-	if (remotefd < 0) 
-	{
-    	perror_msg_and_die("cannot create socket");
-	}
+	memset(&remoteaddr, 0, sizeof(remoteaddr));
 
 	if ((hostinfo = gethostbyname(RemoteHost)) == NULL)
 		perror_msg_and_die("%s", RemoteHost);
@@ -777,16 +889,50 @@ static void init_RemoteLog (void)
 	remoteaddr.sin_addr = *(struct in_addr *) *hostinfo->h_addr_list;
 	remoteaddr.sin_port = htons(RemotePort);
 
-	/*
-	 *  Since we are using UDP sockets, connect just sets the default host and port
-	 *  for future operations
-	 */
-	if ( 0 != (connect(remotefd, (struct sockaddr *) &remoteaddr, len)))
+	remote_connect();
+}
+#endif
+
+/* Kernel log, this is what klogd used to send us through /dev/log. */
+static void klog_message(int type, int pri, const char *msg, void *param)
+{
+	char line[MAXLINE];
+	struct sockaddr_un sunix;
+
+	if (type == KLOG_SYSLOG)
+	{
+		/* logMessage() strips the "tag: " prefix */
+		snprintf(line, sizeof(line), "kernel: %s", msg);
+		logMessage(pri, line);
+	}
+	else if (type == KLOG_PORTT)
 	{
-		perror_msg_and_die("cannot connect to remote host %s:%d", RemoteHost, RemotePort);
+		if (klog_sock < 0 && (klog_sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) return;
+		memset(&sunix, 0, sizeof(sunix));
+		sunix.sun_family = AF_UNIX;
+		strncpy(sunix.sun_path, KLOG_PORTT_SOCK, sizeof(sunix.sun_path) - 1);
+		sendto(klog_sock, msg, strlen(msg)+1, 0,
+				(struct sockaddr *)&sunix, sizeof(sunix.sun_family) + strlen(sunix.sun_path));
 	}
 }
-#endif
+
+static void init_KernelLog (void)
+{
+	if ((klog_fd = open(__KMSG_FILE, O_RDONLY)) < 0)
+		perror_msg_and_die("Could not open " __KMSG_FILE);
+}
+
+/* 2.4 ignores O_NONBLOCK on /proc/kmsg and sleeps in read() once the log
+ * is empty, so read only once for each time select() says it is readable. */
+static void read_KernelLog (void)
+{
+	int n;
+
+	n = read(klog_fd, klog_buf + klog_left, sizeof(klog_buf) - 1 - klog_left);
+	if (n <= 0) return;
+	klog_left = klog_parse_buffer(klog_buf, klog_left + n, sizeof(klog_buf),
+							&klog_ifn, klog_message, NULL);
+}
 
 //static void doSyslogd (void) __attribute__ ((noreturn));
 static void doSyslogd (void)
@@ -795,13 +941,15 @@ static void doSyslogd (void)
 	socklen_t addrLength;
 
 	int sock_fd;
-	fd_set fds;
+	fd_set fds, wfds;
 
 	/* Set up signal handlers. */
 	signal (SIGINT,  quit_signal);
 	signal (SIGTERM, quit_signal);
 	signal (SIGQUIT, quit_signal);
 	signal (SIGHUP,  SIG_IGN);
+	/* a remote collector closing the -T connection must not kill us */
+	signal (SIGPIPE, SIG_IGN);
 	signal (SIGCHLD, SIG_IGN);
 #ifdef SIGCLD
 	signal (SIGCLD,  SIG_IGN);
@@ -840,14 +988,49 @@ static void doSyslogd (void)
 	}
 #endif
 
+	if (doKernelLog == TRUE)
+	{
+		init_KernelLog();
+	}
+
 	logMessage (LOG_SYSLOG | LOG_INFO, "syslogd started: ");
 
 	for (;;) 
 	{
+		int maxfd = sock_fd;
+		struct timeval *tv = NULL;
+
 		FD_ZERO (&fds);
+		FD_ZERO (&wfds);
 		FD_SET (sock_fd, &fds);
+		if (klog_fd >= 0)
+		{
+			FD_SET (klog_fd, &fds);
+			if (klog_fd > maxfd) maxfd = klog_fd;
+		}
 
-		if (select (sock_fd+1, &fds, NULL, NULL, NULL) < 0) 
+#ifdef REMOTE_LOG
+		if (doRemoteLog == TRUE)
+		{
+			struct timeval retry;
+
+			remote_poll();
+			if (remote_want_write())
+			{
+				FD_SET (remotefd, &wfds);
+				if (remotefd > maxfd) maxfd = remotefd;
+			}
+			else if (remotefd < 0 && remote_qcount > 0)
+			{
+				/* wake up to reconnect */
+				retry.tv_sec = 1;
+				retry.tv_usec = 0;
+				tv = &retry;
+			}
+		}
+#endif
+
+		if (select (maxfd+1, &fds, &wfds, NULL, tv) < 0) 
 		{
 			if (errno == EINTR) 
 			{
@@ -871,6 +1054,18 @@ static void doSyslogd (void)
 				perror_msg_and_die("UNIX socket error");
 			}
 		}/* FD_ISSET() */
+
+		if (klog_fd >= 0 && FD_ISSET (klog_fd, &fds))
+		{
+			read_KernelLog();
+		}
+
+#ifdef REMOTE_LOG
+		if (remotefd >= 0 && FD_ISSET (remotefd, &wfds))
+		{
+			remote_flush();
+		}
+#endif
 	} /* for main loop */
 }
 
@@ -884,7 +1079,7 @@ int main(int argc, char **argv)
 	char 	*p;
 
 	/* do normal option parsing */
-	while ((opt = getopt(argc, argv, "pnO:R:LCF:ms:S:f:P:H:Ma:t:")) > 0) 
+	while ((opt = getopt(argc, argv, "pnO:R:TB:r:LKl:w:CF:ms:S:f:P:H:Ma:t:")) > 0) 
 	{
 		switch (opt) 
 		{
@@ -909,10 +1104,28 @@ int main(int argc, char **argv)
 				}
 				doRemoteLog = TRUE;
 				break;
+			case 'T':
+				RemoteTCP = TRUE;
+				break;
+			case 'B':
+				RemoteBatch = atoi(optarg);
+				break;
+			case 'r':
+				RemoteRate = atoi(optarg);
+				break;
 			case 'L':
 				local_logging = TRUE;
 				break;
 #endif
+			case 'K':
+				doKernelLog = TRUE;
+				break;
+			case 'l':
+				klog_ifn.lanif = optarg;
+				break;
+			case 'w':
+				klog_ifn.wanif = optarg;
+				break;
 #ifdef IPC_SYSLOG
 			case 'C':
 				circular_logging = TRUE;
@@ -61,10 +61,10 @@ struct tsession {
 	struct tsession *next;
 	int sockfd, ptyfd;
 	int shell_pid;
-	/* two circular buffers */
-	char *buf1, *buf2;
 	int rdidx1, wridx1, size1;
 	int rdidx2, wridx2, size2;
+	/* two circular buffers */
+	char buf1[BUFSIZE], buf2[BUFSIZE];
 };
 
 /*
@@ -82,11 +82,27 @@ struct tsession {
 
    Each session has got two buffers.
 
+   Sessions are taken from a pool and put back there when they are
+   closed, so bulk scripted logins don't malloc/free 8k each time.
+   Data read from one side is written to the other side right away,
+   only what the other side can't take yet stays in the buffer.
+
 */
 
+#define DEF_MAX_SESSIONS 8
+
 static int maxfd;
+static int master_fd;
 
 static struct tsession *sessions;
+static struct tsession *free_sessions;	/* session pool */
+static int nsessions;
+static int max_sessions = DEF_MAX_SESSIONS;
+
+/* The fd sets we select on. They are updated when a session buffer
+ * fills or drains instead of being rebuilt over all the sessions
+ * before each select(). */
+static fd_set rdfdset_master, wrfdset_master;
 
 
 /*------------------------------*/
@@ -94,7 +110,7 @@ static struct tsession *sessions;
 /* Add support ilde timeout */
 static void show_usage(char *name)
 {
-	fprintf(stderr, "Usage: %s [-p port] [-i ifname] [-u user:password] [-t timeout] [-l loginpath]\n", name);
+	fprintf(stderr, "Usage: %s [-p port] [-i ifname] [-u user:password] [-t timeout] [-l loginpath] [-m max_sessions]\n", name);
 }
 
 /* 
@@ -122,31 +138,41 @@ remove_iacs(unsigned char *bf, int len, int *processed, int *num_totty) {
     unsigned char *ptr = bf;
     unsigned char *totty = bf;
     unsigned char *end = bf + len;
+    unsigned char *iac;
    
     while (ptr < end) {
-	if (*ptr != IAC) {
-	    *totty++ = *ptr++;
-	}
-	else {
-	    if ((ptr+2) < end) {
+	/* move the whole run up to the next IAC at once, most buffers
+	   don't have any IAC at all. */
+	iac = memchr(ptr, IAC, end - ptr);
+	if (!iac)
+	    iac = end;
+	if (totty != ptr)
+	    memmove(totty, ptr, iac - ptr);
+	totty += iac - ptr;
+	ptr = iac;
+	if (ptr == end)
+	    break;
+
+	if ((ptr+2) < end) {
 		/* the entire IAC is contained in the buffer 
 		   we were asked to process. */
 #ifdef DEBUG
 		fprintf(stderr, "Ignoring IAC %s,%s\n", 
-			*ptr, TELCMD(*(ptr+1)), TELOPT(*(ptr+2)));
+			TELCMD(*(ptr+1)), TELOPT(*(ptr+2)));
 #endif
 		ptr += 3;
-	    } else {
+	} else {
 		/* only the beginning of the IAC is in the 
 		   buffer we were asked to process, we can't
 		   process this char. */
 		break;
-	    }
 	}
     }
 
     *processed = ptr - bf;
     *num_totty = totty - bf;
+    if (*processed == *num_totty)
+	return (char *)bf;
     /* move the chars meant for the terminal towards the end of the 
        buffer. */
     return memmove(ptr - *num_totty, bf, *num_totty);
@@ -204,16 +230,52 @@ send_iac(struct tsession *ts, unsigned char command, int option)
 }
 
 
+static struct tsession *
+alloc_session(void)
+{
+	struct tsession *ts;
+
+	if (max_sessions > 0 && nsessions >= max_sessions)
+		return 0;
+
+	if (free_sessions) {
+		ts = free_sessions;
+		free_sessions = ts->next;
+	} else if (!(ts = (struct tsession *)malloc(sizeof(struct tsession)))) {
+		return 0;
+	}
+	nsessions++;
+	return ts;
+}
+
+static void
+update_fdsets(struct tsession *ts)
+{
+	/* buf1 is used from socket to pty
+	 * buf2 is used from pty to socket
+	 */
+	if (ts->size1 > 0)	FD_SET(ts->ptyfd, &wrfdset_master);  /* can write to pty */
+	else				FD_CLR(ts->ptyfd, &wrfdset_master);
+	if (ts->size1 < BUFSIZE)	FD_SET(ts->sockfd, &rdfdset_master); /* can read from socket */
+	else						FD_CLR(ts->sockfd, &rdfdset_master);
+	if (ts->size2 > 0)	FD_SET(ts->sockfd, &wrfdset_master); /* can write to socket */
+	else				FD_CLR(ts->sockfd, &wrfdset_master);
+	if (ts->size2 < BUFSIZE)	FD_SET(ts->ptyfd, &rdfdset_master);  /* can read from pty */
+	else						FD_CLR(ts->ptyfd, &rdfdset_master);
+}
+
 static struct tsession *
 make_new_session(int sockfd)
 {
 	struct termios termbuf;
 	int pty, pid;
 	static char tty_name[32];
-	struct tsession *ts = (struct tsession *)malloc(sizeof(struct tsession));
+	struct tsession *ts = alloc_session();
 
-	ts->buf1 = (char *)malloc(BUFSIZE);
-	ts->buf2 = (char *)malloc(BUFSIZE);
+	if (!ts) {
+		fprintf(stderr, "Too many telnet sessions!\n");
+		return 0;
+	}
 
 	ts->sockfd = sockfd;
 
@@ -226,6 +288,9 @@ make_new_session(int sockfd)
 
 	if (pty < 0) {
 		fprintf(stderr, "All network ports in use!\n");
+		ts->next = free_sessions;
+		free_sessions = ts;
+		nsessions--;
 		return 0;
 	}
 
@@ -295,6 +360,10 @@ make_new_session(int sockfd)
 
 	ts->shell_pid = pid;
 
+	/* we never want to block on one session */
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+	fcntl(pty, F_SETFL, fcntl(pty, F_GETFL) | O_NONBLOCK);
+
 	return ts;
 }
 
@@ -312,22 +381,99 @@ free_session(struct tsession *ts)
 		t->next = ts->next;
 	}
 
-	free(ts->buf1);
-	free(ts->buf2);
-
 	kill(ts->shell_pid, SIGKILL);
 
 	wait4(ts->shell_pid, NULL, 0, NULL);
 
+	FD_CLR(ts->ptyfd, &rdfdset_master);
+	FD_CLR(ts->ptyfd, &wrfdset_master);
+	FD_CLR(ts->sockfd, &rdfdset_master);
+	FD_CLR(ts->sockfd, &wrfdset_master);
+
 	close(ts->ptyfd);
 	close(ts->sockfd);
 
-	if(ts->ptyfd == maxfd || ts->sockfd == maxfd)
-		maxfd--;
-	if(ts->ptyfd == maxfd || ts->sockfd == maxfd)
-		maxfd--;
+	/* update_fdsets() may have left a live pty out of both sets, so
+	   look at the fds of the sessions, not at the sets */
+	maxfd = master_fd;
+	for (t = sessions; t; t = t->next) {
+		if (t->sockfd > maxfd)
+			maxfd = t->sockfd;
+		if (t->ptyfd > maxfd)
+			maxfd = t->ptyfd;
+	}
+
+	/* back to the pool */
+	ts->next = free_sessions;
+	free_sessions = ts;
+	nsessions--;
+}
+
+/* Write buffer 1 to the pty.  */
+static int
+flush_to_pty(struct tsession *ts)
+{
+	int maxlen, w, processed, num_totty;
+	char *ptr;
+
+	while (ts->size1 > 0) {
+		maxlen = MIN(BUFSIZE - ts->wridx1, ts->size1);
+		ptr = remove_iacs(ts->buf1 + ts->wridx1, maxlen, 
+			&processed, &num_totty);
+
+		/* the difference between processed and num_totty
+		   is all the iacs we removed from the stream.
+		   Adjust buf1 accordingly. */
+		ts->wridx1 += processed - num_totty;
+		ts->size1 -= processed - num_totty;
+
+		if (ts->wridx1 == BUFSIZE)
+			ts->wridx1 = 0;
+		if (num_totty == 0) {
+			if (processed == 0)
+				break;	/* an IAC split across the end of buf1 */
+			continue;
+		}
+		w = write(ts->ptyfd, ptr, num_totty);
+		if (w < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			perror("write");
+			return -1;
+		}
+		ts->wridx1 += w;
+		ts->size1 -= w;
+		if (ts->wridx1 == BUFSIZE)
+			ts->wridx1 = 0;
+		if (w < num_totty)
+			break;
+	}
+	return 0;
+}
+
+/* Write buffer 2 to the socket.  */
+static int
+flush_to_socket(struct tsession *ts)
+{
+	int maxlen, w;
 
-	free(ts);
+	while (ts->size2 > 0) {
+		maxlen = MIN(BUFSIZE - ts->wridx2, ts->size2);
+		w = write(ts->sockfd, ts->buf2 + ts->wridx2, maxlen);
+		if (w < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			perror("write");
+			return -1;
+		}
+		ts->wridx2 += w;
+		ts->size2 -= w;
+		if (ts->wridx2 == BUFSIZE)
+			ts->wridx2 = 0;
+		if (w < maxlen)
+			break;
+	}
+	return 0;
 }
 
 int
@@ -335,7 +481,6 @@ main(int argc, char **argv)
 {
 	struct sockaddr_in sa;
 	char *user=NULL, *passwd=NULL, *ifname=NULL;
-	int master_fd;
 	fd_set rdfdset, wrfdset;
 	int selret;
 	int timeout = 300;
@@ -351,7 +496,7 @@ main(int argc, char **argv)
 	/* check if user supplied a port number */
 
 	for (;;) {
-		c = getopt( argc, argv, "p:u:l:i:t:h:");
+		c = getopt( argc, argv, "p:u:l:i:t:m:h:");
 		if (c == EOF) break;
 		switch (c) {
 			case 'p':
@@ -378,6 +523,9 @@ main(int argc, char **argv)
 			case 'l':
 				loginpath = strdup (optarg);
 				break;
+			case 'm':
+				max_sessions = atoi(optarg);
+				break;
 			case 'h':
 			default:
 				show_usage(argv[0]);
@@ -438,38 +586,15 @@ main(int argc, char **argv)
 
 
 	maxfd = master_fd;
+	FD_ZERO(&rdfdset_master);
+	FD_ZERO(&wrfdset_master);
+	FD_SET(master_fd, &rdfdset_master);
 
 	do {
 		struct tsession *ts;
 
-		FD_ZERO(&rdfdset);
-		FD_ZERO(&wrfdset);
-
-		/* select on the master socket, all telnet sockets and their
-		 * ptys if there is room in their respective session buffers.
-		 */
-
-		FD_SET(master_fd, &rdfdset);
-
-		ts = sessions;
-		while (ts) {
-			/* buf1 is used from socket to pty
-			 * buf2 is used from pty to socket
-			 */
-			if (ts->size1 > 0) {
-				FD_SET(ts->ptyfd, &wrfdset);  /* can write to pty */
-			}
-			if (ts->size1 < BUFSIZE) {
-				FD_SET(ts->sockfd, &rdfdset); /* can read from socket */
-			}
-			if (ts->size2 > 0) {
-				FD_SET(ts->sockfd, &wrfdset); /* can write to socket */
-			}
-			if (ts->size2 < BUFSIZE) {
-				FD_SET(ts->ptyfd, &rdfdset);  /* can read from pty */
-			}
-			ts = ts->next;
-		}
+		rdfdset = rdfdset_master;
+		wrfdset = wrfdset_master;
 
 /*------------------------------*/
 /* Added/Modified by StPAUL 20060616 */
@@ -483,7 +608,10 @@ main(int argc, char **argv)
 			selret = select(maxfd + 1, &rdfdset, &wrfdset, 0, &tv);
 		}
 		if(selret==-1)
+		{
+			if(errno==EINTR)	continue;
 			break;
+		}
 		if(selret==0)
 		{
 			if(sessions)	continue;
@@ -508,6 +636,9 @@ main(int argc, char **argv)
 					sessions = new_ts;
 					if (fd > maxfd)
 						maxfd = fd;
+					if (new_ts->ptyfd > maxfd)
+						maxfd = new_ts->ptyfd;
+					update_fdsets(new_ts);
 				} else {
 					close(fd);
 				}
@@ -518,53 +649,23 @@ main(int argc, char **argv)
 
 		ts = sessions;
 		while (ts) { /* For all sessions...  */
-			int maxlen, w, r;
+			int maxlen, r;
 			struct tsession *next = ts->next; /* in case we free ts. */
 
 			if (ts->size1 && FD_ISSET(ts->ptyfd, &wrfdset)) {
-			    int processed, num_totty;
-			    char *ptr;
-				/* Write to pty from buffer 1.  */
-				
-				maxlen = MIN(BUFSIZE - ts->wridx1,
-					     ts->size1);
-				ptr = remove_iacs(ts->buf1 + ts->wridx1, maxlen, 
-					&processed, &num_totty);
-		
-				/* the difference between processed and num_totty
-				   is all the iacs we removed from the stream.
-				   Adjust buf1 accordingly. */
-				ts->wridx1 += processed - num_totty;
-				ts->size1 -= processed - num_totty;
-
-				w = write(ts->ptyfd, ptr, num_totty);
-				if (w < 0) {
-					perror("write");
+				if (flush_to_pty(ts) < 0) {
 					free_session(ts);
 					ts = next;
 					continue;
 				}
-				ts->wridx1 += w;
-				ts->size1 -= w;
-				if (ts->wridx1 == BUFSIZE)
-					ts->wridx1 = 0;
 			}
 
 			if (ts->size2 && FD_ISSET(ts->sockfd, &wrfdset)) {
-				/* Write to socket from buffer 2.  */
-				maxlen = MIN(BUFSIZE - ts->wridx2,
-					     ts->size2);
-				w = write(ts->sockfd, ts->buf2 + ts->wridx2, maxlen);
-				if (w < 0) {
-					perror("write");
+				if (flush_to_socket(ts) < 0) {
 					free_session(ts);
 					ts = next;
 					continue;
 				}
-				ts->wridx2 += w;
-				ts->size2 -= w;
-				if (ts->wridx2 == BUFSIZE)
-					ts->wridx2 = 0;
 			}
 
 			if (ts->size1 < BUFSIZE && FD_ISSET(ts->sockfd, &rdfdset)) {
@@ -572,20 +673,25 @@ main(int argc, char **argv)
 				maxlen = MIN(BUFSIZE - ts->rdidx1,
 					     BUFSIZE - ts->size1);
 				r = read(ts->sockfd, ts->buf1 + ts->rdidx1, maxlen);
-				if (!r || (r < 0 && errno != EINTR)) {
+				if (!r || (r < 0 && errno != EINTR && errno != EAGAIN)) {
 					free_session(ts);
 					ts = next;
 					continue;
 				}
-				if(!*(ts->buf1 + ts->rdidx1 + r - 1)) {
+				if (r > 0 && !*(ts->buf1 + ts->rdidx1 + r - 1))
 					r--;
-					if(!r)
+				if (r > 0) {
+					ts->rdidx1 += r;
+					ts->size1 += r;
+					if (ts->rdidx1 == BUFSIZE)
+						ts->rdidx1 = 0;
+					/* and pass it on right away */
+					if (flush_to_pty(ts) < 0) {
+						free_session(ts);
+						ts = next;
 						continue;
+					}
 				}
-				ts->rdidx1 += r;
-				ts->size1 += r;
-				if (ts->rdidx1 == BUFSIZE)
-					ts->rdidx1 = 0;
 			}
 
 			if (ts->size2 < BUFSIZE && FD_ISSET(ts->ptyfd, &rdfdset)) {
@@ -593,15 +699,23 @@ main(int argc, char **argv)
 				maxlen = MIN(BUFSIZE - ts->rdidx2,
 					     BUFSIZE - ts->size2);
 				r = read(ts->ptyfd, ts->buf2 + ts->rdidx2, maxlen);
-				if (!r || (r < 0 && errno != EINTR)) {
+				if (!r || (r < 0 && errno != EINTR && errno != EAGAIN)) {
 					free_session(ts);
 					ts = next;
 					continue;
 				}
-				ts->rdidx2 += r;
-				ts->size2 += r;
-				if (ts->rdidx2 == BUFSIZE)
-					ts->rdidx2 = 0;
+				if (r > 0) {
+					ts->rdidx2 += r;
+					ts->size2 += r;
+					if (ts->rdidx2 == BUFSIZE)
+						ts->rdidx2 = 0;
+					/* and pass it on right away */
+					if (flush_to_socket(ts) < 0) {
+						free_session(ts);
+						ts = next;
+						continue;
+					}
+				}
 			}
 
 			if (ts->size1 == 0) {
@@ -612,6 +726,7 @@ main(int argc, char **argv)
 				ts->rdidx2 = 0;
 				ts->wridx2 = 0;
 			}
+			update_fdsets(ts);
 			ts = next;
 		}
 	} while (1);
@@ -208,6 +208,59 @@ typedef struct _IXML_NamedNodeMap
     struct _IXML_NamedNodeMap *next;
 } IXML_NamedNodeMap;
 
+/*================================================================
+*
+*   Streaming parser
+*
+*   ixmlScan_next() reads a buffer one start tag, end tag or piece
+*   of text at a time and builds no tree. The buffer is parsed in
+*   place: names and text are terminated and entities decoded in
+*   the buffer itself, so it must be writable and is not XML any
+*   more afterwards.
+*
+*=================================================================*/
+#define IXML_SCAN_MAX_DEPTH     16
+#define IXML_SCAN_MAX_NS        16
+
+typedef enum
+{
+    IXML_SCAN_ERROR = -1,
+    IXML_SCAN_EOF = 0,
+    IXML_SCAN_START,        // start tag, also for an empty element
+    IXML_SCAN_END,          // end tag, also after an empty element
+    IXML_SCAN_TEXT          // character data and CDATA sections
+
+} IXML_SCAN_EVENT;
+
+typedef struct _IXML_ScanNS
+{
+    char    *prefix;        // NULL for the default namespace
+    char    *uri;
+    int     depth;
+
+} IXML_ScanNS;
+
+typedef struct _IXML_Scanner
+{
+    char        *cur;
+    int         tagNext;    // a '<' at cur was overwritten
+    int         emptyEnd;   // the last start tag was <.../>
+    int         rootSeen;
+    int         level;      // open elements
+
+    char        *open[IXML_SCAN_MAX_DEPTH];
+    IXML_ScanNS ns[IXML_SCAN_MAX_NS];
+    int         nsCount;
+
+    // the current event
+    int         depth;      // of the element, the root is 1
+    char        *name;      // qualified name
+    char        *localName;
+    char        *namespaceURI;  // NULL if not in a namespace
+    char        *text;
+
+} IXML_Scanner;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -1827,6 +1880,43 @@ ixmlLoadDocumentEx(char* xmlFile,
    *                      be completed.
    */
 
+  /** Starts the streaming parser on a NUL terminated buffer. The buffer
+   *  is changed by the following {\bf ixmlScan_next} calls.
+   *
+   *  @return [void] This function does not return a value.
+   */
+
+void
+ixmlScan_init(IXML_Scanner *scan,
+		/** The parser state to set up. */
+              char *buffer
+		/** The XML text to parse. */
+             );
+
+  /** Reads the next start tag, end tag or text of the document.
+   *
+   *  For {\tt IXML_SCAN_START} and {\tt IXML_SCAN_END}, {\bf name},
+   *  {\bf localName}, {\bf namespaceURI} and {\bf depth} of the scanner
+   *  describe the element. For {\tt IXML_SCAN_TEXT}, {\bf text} holds the
+   *  text with the entities replaced. Attributes other than namespace
+   *  declarations are skipped. Document type declarations are not
+   *  accepted.
+   *
+   *  @return [int] An integer representing one of the following:
+   *    \begin{itemize}
+   *      \item {\tt IXML_SCAN_START}, {\tt IXML_SCAN_END} or
+   *            {\tt IXML_SCAN_TEXT}: The next part of the document.
+   *      \item {\tt IXML_SCAN_EOF}: The end of a well-formed document.
+   *      \item {\tt IXML_SCAN_ERROR}: The document is not well-formed or
+   *            nests deeper than {\tt IXML_SCAN_MAX_DEPTH} elements.
+   *    \end{itemize}
+   */
+
+int
+ixmlScan_next(IXML_Scanner *scan
+		/** The parser state. */
+             );
+
 DOMString   
 ixmlCloneDOMString(const DOMString src  
 		     /** The source {\bf DOMString} to clone. */
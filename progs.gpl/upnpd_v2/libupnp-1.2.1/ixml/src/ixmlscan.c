@@ -0,0 +1,468 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000-2003 Intel Corporation 
+// All rights reserved. 
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met: 
+//
+// * Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer. 
+// * Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation 
+// and/or other materials provided with the distribution. 
+// * Neither name of Intel Corporation nor the names of its contributors 
+// may be used to endorse or promote products derived from this software 
+// without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR 
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include "ixml.h"
+
+/*================================================================
+*   Scan_isSpace
+*
+*=================================================================*/
+static int
+Scan_isSpace( IN char c )
+{
+    return ( c == ' ' || c == '\t' || c == '\r' || c == '\n' );
+}
+
+/*================================================================
+*   Scan_isNameChar
+*       Names are not checked against the XML grammar, anything
+*       up to a delimiter is taken.
+*
+*=================================================================*/
+static int
+Scan_isNameChar( IN char c )
+{
+    return ( c != '\0' && !Scan_isSpace( c ) && c != '/' && c != '>' &&
+             c != '<' && c != '=' && c != '"' && c != '\'' && c != '&' );
+}
+
+/*================================================================
+*   Scan_skipSpace
+*
+*=================================================================*/
+static char *
+Scan_skipSpace( IN char *p )
+{
+    while( Scan_isSpace( *p ) ) {
+        p++;
+    }
+    return p;
+}
+
+/*================================================================
+*   Scan_entity
+*       Decodes the entity or character reference at *src into *dst
+*       and moves both past it. *dst never gets ahead of *src.
+*       Returns 0 on success, -1 on an unknown entity.
+*
+*=================================================================*/
+static int
+Scan_entity( INOUT char **src,
+             INOUT char **dst )
+{
+    char *p = *src + 1;
+    char *end;
+    char *stop;
+    char *d = *dst;
+    long c;
+
+    for( end = p; *end != ';'; end++ ) {
+        if( *end == '\0' || end - p > 10 ) {
+            return -1;
+        }
+    }
+
+    if( *p == '#' ) {
+        if( p[1] == 'x' ) {
+            c = strtol( p + 2, &stop, 16 );
+            p += 2;
+        } else {
+            c = strtol( p + 1, &stop, 10 );
+            p += 1;
+        }
+        if( stop != end || p == end || *p == '-' || *p == '+' ||
+            Scan_isSpace( *p ) || c <= 0 || c > 0x10FFFF ) {
+            return -1;
+        }
+        // "&#N;" is at least four bytes, UTF-8 at most four
+        if( c < 0x80 ) {
+            *d++ = ( char )c;
+        } else if( c < 0x800 ) {
+            *d++ = ( char )( 0xC0 | ( c >> 6 ) );
+            *d++ = ( char )( 0x80 | ( c & 0x3F ) );
+        } else if( c < 0x10000 ) {
+            *d++ = ( char )( 0xE0 | ( c >> 12 ) );
+            *d++ = ( char )( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+            *d++ = ( char )( 0x80 | ( c & 0x3F ) );
+        } else {
+            *d++ = ( char )( 0xF0 | ( c >> 18 ) );
+            *d++ = ( char )( 0x80 | ( ( c >> 12 ) & 0x3F ) );
+            *d++ = ( char )( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+            *d++ = ( char )( 0x80 | ( c & 0x3F ) );
+        }
+    } else if( end - p == 2 && strncmp( p, "lt", 2 ) == 0 ) {
+        *d++ = '<';
+    } else if( end - p == 2 && strncmp( p, "gt", 2 ) == 0 ) {
+        *d++ = '>';
+    } else if( end - p == 3 && strncmp( p, "amp", 3 ) == 0 ) {
+        *d++ = '&';
+    } else if( end - p == 4 && strncmp( p, "quot", 4 ) == 0 ) {
+        *d++ = '"';
+    } else if( end - p == 4 && strncmp( p, "apos", 4 ) == 0 ) {
+        *d++ = '\'';
+    } else {
+        return -1;
+    }
+
+    *src = end + 1;
+    *dst = d;
+    return 0;
+}
+
+/*================================================================
+*   Scan_lookupNS
+*       Finds the namespace bound to the prefix of a qualified name,
+*       the innermost declaration wins.
+*
+*=================================================================*/
+static char *
+Scan_lookupNS( IN IXML_Scanner *scan,
+               IN char *name,
+               OUT char **localName )
+{
+    char *colon = strchr( name, ':' );
+    size_t len = 0;
+    int i;
+
+    if( colon != NULL ) {
+        len = colon - name;
+        *localName = colon + 1;
+    } else {
+        *localName = name;
+    }
+
+    for( i = scan->nsCount - 1; i >= 0; i-- ) {
+        if( colon == NULL ) {
+            if( scan->ns[i].prefix == NULL ) {
+                return scan->ns[i].uri[0] != '\0' ? scan->ns[i].uri : NULL;
+            }
+        } else if( scan->ns[i].prefix != NULL &&
+                   strncmp( scan->ns[i].prefix, name, len ) == 0 &&
+                   scan->ns[i].prefix[len] == '\0' ) {
+            return scan->ns[i].uri;
+        }
+    }
+    return NULL;
+}
+
+/*================================================================
+*   Scan_endElement
+*       Reports the end of the innermost open element and drops the
+*       namespaces it declared.
+*
+*=================================================================*/
+static int
+Scan_endElement( INOUT IXML_Scanner *scan )
+{
+    scan->depth = scan->level;
+    scan->name = scan->open[scan->level - 1];
+    scan->namespaceURI = Scan_lookupNS( scan, scan->name,
+                                        &scan->localName );
+    scan->text = NULL;
+
+    while( scan->nsCount > 0 &&
+           scan->ns[scan->nsCount - 1].depth == scan->level ) {
+        scan->nsCount--;
+    }
+    scan->level--;
+    return IXML_SCAN_END;
+}
+
+/*================================================================
+*   Scan_text
+*       Collects character data up to the next tag, CDATA sections
+*       included and comments left out.
+*
+*=================================================================*/
+static int
+Scan_text( INOUT IXML_Scanner *scan )
+{
+    char *src = scan->cur;
+    char *dst = scan->cur;
+    char *end;
+
+    for( ;; ) {
+        if( *src == '\0' ) {
+            return IXML_SCAN_ERROR;
+        }
+        if( *src == '<' ) {
+            if( strncmp( src, "<![CDATA[", 9 ) == 0 ) {
+                end = strstr( src + 9, "]]>" );
+                if( end == NULL ) {
+                    return IXML_SCAN_ERROR;
+                }
+                memmove( dst, src + 9, end - ( src + 9 ) );
+                dst += end - ( src + 9 );
+                src = end + 3;
+                continue;
+            }
+            if( strncmp( src, "<!--", 4 ) == 0 ) {
+                end = strstr( src + 4, "-->" );
+                if( end == NULL ) {
+                    return IXML_SCAN_ERROR;
+                }
+                src = end + 3;
+                continue;
+            }
+            break;
+        }
+        if( *src == '&' ) {
+            if( Scan_entity( &src, &dst ) != 0 ) {
+                return IXML_SCAN_ERROR;
+            }
+            continue;
+        }
+        *dst++ = *src++;
+    }
+
+    // the terminator may overwrite the '<' of the next tag
+    scan->depth = scan->level;
+    scan->text = scan->cur;
+    scan->cur = src;
+    scan->tagNext = 1;
+    *dst = '\0';
+    return IXML_SCAN_TEXT;
+}
+
+/*================================================================
+*   Scan_endTag
+*       p points past "</".
+*
+*=================================================================*/
+static int
+Scan_endTag( INOUT IXML_Scanner *scan,
+             IN char *p )
+{
+    char *name = p;
+    size_t len;
+
+    if( scan->level == 0 ) {
+        return IXML_SCAN_ERROR;
+    }
+    while( Scan_isNameChar( *p ) ) {
+        p++;
+    }
+    len = p - name;
+    if( strncmp( scan->open[scan->level - 1], name, len ) != 0 ||
+        scan->open[scan->level - 1][len] != '\0' ) {
+        return IXML_SCAN_ERROR;
+    }
+    p = Scan_skipSpace( p );
+    if( *p != '>' ) {
+        return IXML_SCAN_ERROR;
+    }
+    scan->cur = p + 1;
+    return Scan_endElement( scan );
+}
+
+/*================================================================
+*   Scan_startTag
+*       p points past "<". The whole tag is read before anything is
+*       terminated, a delimiter is only overwritten once it has been
+*       looked at.
+*
+*=================================================================*/
+static int
+Scan_startTag( INOUT IXML_Scanner *scan,
+               IN char *p )
+{
+    char *name = p;
+    char *nameEnd;
+    char *attr;
+    char *attrEnd;
+    char *value;
+    char *dst;
+    char quote;
+    int empty = 0;
+
+    if( scan->level == IXML_SCAN_MAX_DEPTH ||
+        ( scan->level == 0 && scan->rootSeen ) ) {
+        return IXML_SCAN_ERROR;
+    }
+    while( Scan_isNameChar( *p ) ) {
+        p++;
+    }
+    nameEnd = p;
+    if( nameEnd == name ) {
+        return IXML_SCAN_ERROR;
+    }
+
+    for( ;; ) {
+        p = Scan_skipSpace( p );
+        if( *p == '>' ) {
+            p++;
+            break;
+        }
+        if( p[0] == '/' && p[1] == '>' ) {
+            p += 2;
+            empty = 1;
+            break;
+        }
+        if( p == nameEnd || !Scan_isSpace( p[-1] ) ) {
+            return IXML_SCAN_ERROR;
+        }
+
+        attr = p;
+        while( Scan_isNameChar( *p ) ) {
+            p++;
+        }
+        attrEnd = p;
+        p = Scan_skipSpace( p );
+        if( attrEnd == attr || *p != '=' ) {
+            return IXML_SCAN_ERROR;
+        }
+        p = Scan_skipSpace( p + 1 );
+        quote = *p;
+        if( quote != '"' && quote != '\'' ) {
+            return IXML_SCAN_ERROR;
+        }
+        value = dst = ++p;
+        while( *p != quote ) {
+            if( *p == '\0' || *p == '<' ) {
+                return IXML_SCAN_ERROR;
+            }
+            if( *p == '&' ) {
+                if( Scan_entity( &p, &dst ) != 0 ) {
+                    return IXML_SCAN_ERROR;
+                }
+                continue;
+            }
+            *dst++ = *p++;
+        }
+        p++;
+
+        if( strncmp( attr, "xmlns", 5 ) == 0 &&
+            ( attrEnd == attr + 5 || attr[5] == ':' ) ) {
+            if( scan->nsCount == IXML_SCAN_MAX_NS ) {
+                return IXML_SCAN_ERROR;
+            }
+            *attrEnd = '\0';
+            *dst = '\0';
+            scan->ns[scan->nsCount].prefix =
+                ( attrEnd == attr + 5 ) ? NULL : attr + 6;
+            scan->ns[scan->nsCount].uri = value;
+            scan->ns[scan->nsCount].depth = scan->level + 1;
+            scan->nsCount++;
+        }
+    }
+
+    *nameEnd = '\0';
+    scan->cur = p;
+    scan->rootSeen = 1;
+    scan->open[scan->level++] = name;
+
+    scan->depth = scan->level;
+    scan->name = name;
+    scan->namespaceURI = Scan_lookupNS( scan, name, &scan->localName );
+    scan->text = NULL;
+    scan->emptyEnd = empty;
+    return IXML_SCAN_START;
+}
+
+/*================================================================
+*   ixmlScan_init
+*       Interface routine. Starts scanning a buffer.
+*
+*=================================================================*/
+void
+ixmlScan_init( IXML_Scanner *scan,
+               char *buffer )
+{
+    memset( scan, 0, sizeof( IXML_Scanner ) );
+    scan->cur = buffer;
+}
+
+/*================================================================
+*   ixmlScan_next
+*       Interface routine. Returns the next event of the document.
+*
+*=================================================================*/
+int
+ixmlScan_next( IXML_Scanner *scan )
+{
+    char *p;
+    char *end;
+
+    if( scan->emptyEnd ) {
+        scan->emptyEnd = 0;
+        return Scan_endElement( scan );
+    }
+
+    for( ;; ) {
+        p = scan->cur;
+        if( scan->tagNext ) {
+            scan->tagNext = 0;
+        } else if( scan->level == 0 ) {
+            p = Scan_skipSpace( p );
+            scan->cur = p;
+            if( *p == '\0' ) {
+                return scan->rootSeen ? IXML_SCAN_EOF : IXML_SCAN_ERROR;
+            }
+            if( *p != '<' ) {
+                return IXML_SCAN_ERROR;
+            }
+        } else if( *p != '<' ||
+                   strncmp( p, "<![CDATA[", 9 ) == 0 ) {
+            if( Scan_text( scan ) == IXML_SCAN_ERROR ) {
+                return IXML_SCAN_ERROR;
+            }
+            if( *scan->text != '\0' ) {
+                return IXML_SCAN_TEXT;
+            }
+            continue;
+        }
+
+        // p points at the '<' of a tag
+        p++;
+        if( *p == '?' ) {
+            end = strstr( p + 1, "?>" );
+            if( end == NULL ) {
+                return IXML_SCAN_ERROR;
+            }
+            scan->cur = end + 2;
+        } else if( strncmp( p, "!--", 3 ) == 0 ) {
+            end = strstr( p + 3, "-->" );
+            if( end == NULL ) {
+                return IXML_SCAN_ERROR;
+            }
+            scan->cur = end + 3;
+        } else if( *p == '!' ) {
+            // DOCTYPE, or CDATA outside the root element
+            return IXML_SCAN_ERROR;
+        } else if( *p == '/' ) {
+            return Scan_endTag( scan, p + 1 );
+        } else {
+            return Scan_startTag( scan, p );
+        }
+    }
+}
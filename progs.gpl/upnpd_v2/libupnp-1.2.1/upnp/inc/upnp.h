@@ -54,6 +54,7 @@
 #define NUM_HANDLE 200
 #define LINE_SIZE  180
 #define NAME_SIZE  100
+#define UPNP_MAX_ARGS  32
 #define MNFT_NAME_SIZE  64
 #define MODL_NAME_SIZE  32
 #define SERL_NUMR_SIZE  64
@@ -650,7 +651,9 @@ struct Upnp_Action_Request
   /** The service ID. */
   char ServiceID[NAME_SIZE];
 
-  /** The DOM document describing the action. */
+  /** The DOM document describing the action. This is {\tt NULL} when
+      the request was read by the streaming parser, the arguments are
+      always in {\bf ArgName} and {\bf ArgValue}. */
   IXML_Document *ActionRequest;
 
   /** The DOM document describing the result of the action. */
@@ -662,6 +665,19 @@ struct Upnp_Action_Request
   /** The DOM document containing the information from the
       the SOAP header. */
   IXML_Document *SoapHeader;
+
+  /** The number of arguments of the action. */
+  int ArgCount;
+
+  /** The names and values of the arguments, in request order. They
+      point into the request and are valid during the callback only. */
+  const char *ArgName[UPNP_MAX_ARGS];
+  const char *ArgValue[UPNP_MAX_ARGS];
+
+  /** The result of the action as XML text, used instead of
+      {\bf ActionResult} when it is not {\tt NULL}. The SDK frees it
+      with {\bf free}. */
+  char *ActionResultText;
 };
 
 struct Upnp_Action_Complete
@@ -1323,6 +1339,10 @@ int UpnpSetContentLength(
 extern char UpnpServerInfo[];
 void UpnpSetServerInfo(const char * string);
 
+/* Run func(param) from the miniserver loop once msec milliseconds have
+ * passed, 0 runs it right after the request being handled. */
+void UpnpScheduleCallback(void (*func)(void *), void * param, unsigned int msec);
+
 ////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////
 //                                                                    //
@@ -113,6 +113,11 @@ void UpnpSetServerInfo(const char * string)
 	strcpy(UpnpServerInfo, string);
 }
 
+void UpnpScheduleCallback(void (*func)(void *), void * param, unsigned int msec)
+{
+	miniserv_add_timed_callback(func, param, msec);
+}
+
 
 
 /****************************************************************************
@@ -133,273 +133,305 @@ static int GeneratePropertySet(
 	return XML_SUCCESS;
 }
 
+/* Changes of evented variables are collected per service for
+ * GENA_COALESCE_MSEC and go out as one event. The property set of an event
+ * is rendered once and shared by the NOTIFY of every subscriber. */
+typedef struct GENA_PENDING
+{
+	struct GENA_PENDING *	next;
+	UpnpDevice_Handle		device_handle;
+	char					UDN[NAME_SIZE];
+	char					servId[NAME_SIZE];
+	int						count;
+	char *					names[GENA_MAX_VARS];
+	char *					values[GENA_MAX_VARS];	// XML text
+} gena_pending;
+
+static gena_pending *pending_list = NULL;
+static int pending_timer = 0;
+
 /************************************************************************
-* Function : free_notify_struct
-*																	
-* Parameters:														
-*	IN notify_thread_struct * input : Notify structure
+* Function : fan_out
 *
-* Description:														
-*	This function frees memory used in notify_threads if the reference 
-*	count is 0 otherwise decrements the refrence count
+* Parameters:
+*	IN UpnpDevice_Handle device_handle: Device handle
+*	IN char *UDN: Device udn
+*	IN char *servId: Service ID
+*	IN char *propertySet: The evented XML
 *
-* Returns: VOID
-*	
+* Description:
+*	Queues one event for every active subscription of the service.
+*
+* Returns: int
+*	GENA_SUCCESS, or an error if the service is gone or out of memory
 ****************************************************************************/
-static void
-free_notify_struct( IN notify_thread_struct * input )
+static int fan_out(
+		IN UpnpDevice_Handle device_handle,
+		IN char *UDN,
+		IN char *servId,
+		IN char *propertySet
+		)
 {
-    ( *input->reference_count )--;
-    if( ( *input->reference_count ) == 0 ) {
-   //     free( input->headers );
-//        ixmlFreeDOMString( input->propertySet );
-      //  free( input->servId );
-       // free( input->UDN );
- //       free( input->reference_count );
-    }
-    free( input );
+	struct Handle_Info *handle_info;
+	service_info *service;
+	subscription *finger;
+	gena_event *event;
+	int return_code = GENA_SUCCESS;
+
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) return GENA_E_BAD_HANDLE;
+	service = FindServiceId(&handle_info->ServiceTable, servId, UDN);
+	if (service == NULL) return GENA_E_BAD_SERVICE;
+
+	event = genaEventNew(propertySet);
+	if (event == NULL) return UPNP_E_OUTOF_MEMORY;
+
+	for (finger = GetFirstSubscription(service); finger; finger = GetNextSubscription(service, finger))
+	{
+		if (genaNotifyQueue(device_handle, UDN, servId, finger, event) != GENA_SUCCESS)
+			return_code = UPNP_E_OUTOF_MEMORY;
+	}
+	genaEventRelease(event);
+	return return_code;
 }
 
-/****************************************************************************
-*	Function :	notify_send_and_recv
-*
-*	Parameters :
-*		IN uri_type* destination_url : subscription callback URL 
-*										(URL of the control point)
-*		IN membuffer* mid_msg :	Common HTTP headers 
-*		IN char* propertySet :	The evented XML 
-*		OUT http_parser_t* response : The response from the control point.
+/************************************************************************
+* Function : pending_flush
 *
-*	Description :	This function sends the notify message and returns a 
-*					reply.
+* Parameters:
+*	IN gena_pending *p: collected changes of a service
 *
-*	Return : int
-*		on success: returns UPNP_E_SUCCESS; else returns a UPNP error
+* Description:
+*	Sends the collected changes as one event and frees them.
 *
-*	Note : called by genaNotify
+* Returns: int
+*	GENA_SUCCESS, or the error of fan_out
 ****************************************************************************/
-static XINLINE int notify_send_and_recv(
-		IN uri_type * destination_url,
-		IN membuffer * mid_msg,
-		IN char *propertySet,
-		OUT http_parser_t * response
-		)
+static int pending_flush(IN gena_pending *p)
 {
-	uri_type url;
-	int conn_fd;
-	membuffer start_msg;
-	int ret_code;
-	int err_code;
-	int timeout;
-	SOCKINFO info;
-#if 0
-	static char xml_head[] = "<?xml version=\"1.0\"?>\n";
-#endif
-
-	// connect
-	dtrace("gena notify to: %.*s\n", destination_url->hostport.text.size, destination_url->hostport.text.buff );
-	//conn_fd = http_Connect(destination_url, &url);
-	conn_fd = http_connect_with_timeout(destination_url, &url, 2);
-	dtrace("http_Connect(%d) <<<<\n", conn_fd);
-	if (conn_fd < 0) return conn_fd;         // return UPNP error
-
-	if ((ret_code = sock_init(&info, conn_fd)) != 0)
-	{
-		sock_destroy(&info, SD_BOTH);
-		return ret_code;
-	}
-	// make start line and HOST header
-	membuffer_init( &start_msg );
-	if (http_MakeMessage( &start_msg, 1, 1, "q" "s", HTTPMETHOD_NOTIFY, &url, mid_msg->buf) != 0)
+	gena_pending **prev;
+	DOMString propertySet = NULL;
+	int return_code;
+	int i;
+
+	for (prev = &pending_list; *prev; prev = &(*prev)->next)
 	{
-		membuffer_destroy( &start_msg );
-		sock_destroy( &info, SD_BOTH );
-		return UPNP_E_OUTOF_MEMORY;
+		if (*prev == p)
+		{
+			*prev = p->next;
+			break;
+		}
 	}
 
-	timeout = HTTP_DEFAULT_TIMEOUT;
-
-	// send msg (note +1 for propertyset; null-terminator is also sent)
-#if 0
-	if ((ret_code = http_SendMessage( &info, &timeout, "bbb", start_msg.buf, start_msg.length,
-					xml_head, strlen(xml_head),
-					propertySet, strlen( propertySet ) + 1 ) ) != 0)
-#else
-	if ((ret_code = http_SendMessage( &info, &timeout, "bb", start_msg.buf, start_msg.length,
-					propertySet, strlen( propertySet ) + 1 ) ) != 0)
-#endif
+	return_code = GeneratePropertySet(p->names, p->values, p->count, &propertySet);
+	if (return_code == XML_SUCCESS)
 	{
-		membuffer_destroy( &start_msg );
-		sock_destroy( &info, SD_BOTH );
-		return ret_code;
+		dtrace("GENA EVENT %s: %d variable(s)\n", p->servId, p->count);
+		return_code = fan_out(p->device_handle, p->UDN, p->servId, propertySet);
+		ixmlFreeDOMString(propertySet);
 	}
-	if ((ret_code = http_RecvMessage(&info, response, HTTPMETHOD_NOTIFY, &timeout, &err_code)) != 0)
+
+	for (i = 0; i < p->count; i++)
 	{
-		membuffer_destroy( &start_msg );
-		sock_destroy( &info, SD_BOTH );
-		httpmsg_destroy( &response->msg );
-		return ret_code;
+		free(p->names[i]);
+		free(p->values[i]);
 	}
-	sock_destroy( &info, SD_BOTH ); //should shutdown completely
-	//when closing socket
-	//  sock_destroy( &info,SD_RECEIVE);
-	membuffer_destroy( &start_msg );
-	return UPNP_E_SUCCESS;
-
+	free(p);
+	return return_code;
 }
 
-/****************************************************************************
-*	Function :	genaNotify
-*
-*	Parameters :
-*		IN char *headers :	(null terminated) (includes all headers 
-*							(including \r\n) except SID and SEQ)
-*		IN char *propertySet :	The evented XML 
-*		IN subscription* sub :	subscription to be Notified, 
-*								Assumes this is valid for life of function)
+/************************************************************************
+* Function : pending_timeout
 *
-*	Description :	Function to Notify a particular subscription of a 
-*					particular event. In general the service should NOT be 
-*					blocked around this call. (this may cause deadlock 
-*					with a client) NOTIFY http request is sent and the 
-*					reply is processed.
+* Description:
+*	Timer callback, sends the changes of every service.
+****************************************************************************/
+static void pending_timeout(IN void *param)
+{
+	pending_timer = 0;
+	while (pending_list) pending_flush(pending_list);
+}
+
+/************************************************************************
+* Function : pending_find
 *
-*	Return :	int
-*		GENA_SUCCESS  if the event was delivered else returns appropriate 
-*		error
+* Description:
+*	Finds the collected changes of a service, or makes an empty set.
 *
-*	Note :
+* Returns: gena_pending *
+*	NULL if out of memory
 ****************************************************************************/
-int genaNotify(IN char *headers, IN char *propertySet, IN subscription * sub)
+static gena_pending *pending_find(
+		IN UpnpDevice_Handle device_handle,
+		IN char *UDN,
+		IN char *servId
+		)
 {
-	int i;
-	membuffer mid_msg;
-	membuffer endmsg;
-	uri_type *url;
-	http_parser_t response;
-	int return_code = -1;
-
-	membuffer_init( &mid_msg );
-
-	// make 'end' msg (the part that won't vary with the destination)
-	endmsg.size_inc = 30;
-	if (http_MakeMessage(&mid_msg, 1, 1, "s" "ssc" "sdcc",
-				headers, "SID: ", sub->sid, "SEQ: ", sub->ToSendEventKey) != 0)
+	gena_pending *p;
+
+	for (p = pending_list; p; p = p->next)
 	{
-		membuffer_destroy( &mid_msg );
-		return UPNP_E_OUTOF_MEMORY;
+		if (p->device_handle == device_handle &&
+			strcmp(p->UDN, UDN) == 0 && strcmp(p->servId, servId) == 0)
+		{
+			return p;
+		}
 	}
-	// send a notify to each url until one goes thru
-	for ( i = 0; i < sub->DeliveryURLs.size; i++ )
-	{
-		url = &sub->DeliveryURLs.parsedURLs[i];
+	if (strlen(UDN) >= NAME_SIZE || strlen(servId) >= NAME_SIZE) return NULL;
 
-		return_code = notify_send_and_recv(url, &mid_msg, propertySet, &response);
-		if (return_code == UPNP_E_SUCCESS) break;
-	}
-	membuffer_destroy(&mid_msg);
+	p = (gena_pending *)malloc(sizeof(gena_pending));
+	if (p == NULL) return NULL;
+	memset(p, 0, sizeof(gena_pending));
+	p->device_handle = device_handle;
+	strcpy(p->UDN, UDN);
+	strcpy(p->servId, servId);
+	p->next = pending_list;
+	pending_list = p;
 
-	if (return_code == UPNP_E_SUCCESS)
+	if (!pending_timer)
 	{
-		if (response.msg.status_code == HTTP_OK)
-		{
-			return_code = GENA_SUCCESS;
-		}
-		else
-		{
-			if (response.msg.status_code == HTTP_PRECONDITION_FAILED)
-			{
-				//Invalid SID gets removed
-				return_code = GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB;
-			}
-			else
-			{
-				return_code = GENA_E_NOTIFY_UNACCEPTED;
-			}
-		}
-		httpmsg_destroy( &response.msg );
+		pending_timer = 1;
+		miniserv_add_timed_callback(pending_timeout, NULL, GENA_COALESCE_MSEC);
 	}
-	return return_code;
+	return p;
 }
 
-/****************************************************************************
-*	Function :	genaNotifyThread
-*
-*	Parameters :
-*			IN void * input : notify thread structure containing all the 
-*								headers and property set info
+/************************************************************************
+* Function : pending_add
 *
-*	Description :	Thread job to Notify a control point. It validates the
-*		subscription and copies the subscription. Also make sure that 
-*		events are sent in order. 
+* Parameters:
+*	INOUT gena_pending **p: collected changes of a service
+*	IN const char *name: variable name
+*	IN char *value: XML text of the value, taken over by the set
 *
-*	Return : void
+* Description:
+*	Adds a change, a later value of a variable replaces the earlier one.
+*	A full set is sent first.
 *
-*	Note : calls the genaNotify to do the actual work
+* Returns: int
+*	GENA_SUCCESS, or UPNP_E_OUTOF_MEMORY and value is freed
 ****************************************************************************/
-static void genaNotifyThread( IN void *input )
+static int pending_add(INOUT gena_pending **p, IN const char *name, IN char *value)
 {
-	subscription *sub;
-	service_info *service;
-	subscription sub_copy;
-	notify_thread_struct *in = ( notify_thread_struct * ) input;
-	int return_code;
-	struct Handle_Info *handle_info;
-	//ThreadPoolJob job;
+	UpnpDevice_Handle device_handle;
+	char UDN[NAME_SIZE];
+	char servId[NAME_SIZE];
+	int i;
 
-	//validate context
-	if (GetHandleInfo(in->device_handle, &handle_info) != HND_DEVICE)
+	for (i = 0; i < (*p)->count; i++)
 	{
-		free_notify_struct(in);
-		return;
+		if (strcmp((*p)->names[i], name) == 0)
+		{
+			free((*p)->values[i]);
+			(*p)->values[i] = value;
+			return GENA_SUCCESS;
+		}
 	}
-	service = FindServiceId(&handle_info->ServiceTable, in->servId, in->UDN);
-	if ((service == NULL) ||
-		(!service->active) ||
-		((sub = GetSubscriptionSID(in->sid, service)) == NULL) ||
-		(copy_subscription(sub, &sub_copy) != HTTP_SUCCESS)
-		)
+
+	if ((*p)->count == GENA_MAX_VARS)
 	{
-		free_notify_struct(in);
-		return;
+		device_handle = (*p)->device_handle;
+		strcpy(UDN, (*p)->UDN);
+		strcpy(servId, (*p)->servId);
+		pending_flush(*p);
+		*p = pending_find(device_handle, UDN, servId);
+		if (*p == NULL)
+		{
+			free(value);
+			return UPNP_E_OUTOF_MEMORY;
+		}
 	}
-	//If the event is out of order push it back to the job queue
-	if (in->eventKey != sub->ToSendEventKey)
+
+	(*p)->names[(*p)->count] = strdup(name);
+	if ((*p)->names[(*p)->count] == NULL)
 	{
-		genaNotifyThread(input);
-		freeSubscription(&sub_copy);
-		return;
+		free(value);
+		return UPNP_E_OUTOF_MEMORY;
 	}
+	(*p)->values[(*p)->count++] = value;
+	return GENA_SUCCESS;
+}
 
-	//send the notify
-	//return_code=UPNP_E_SUCCESS;
-	return_code = genaNotify(in->headers, in->propertySet, &sub_copy);
-	freeSubscription(&sub_copy);
+/************************************************************************
+* Function : escape_text
+*
+* Description:
+*	Returns a copy of the text with '&', '<' and '>' escaped.
+****************************************************************************/
+static char *escape_text(IN const char *text)
+{
+	const char *src;
+	char *copy;
+	char *dst;
+	size_t size = 1;
 
-	if (GetHandleInfo( in->device_handle, &handle_info ) != HND_DEVICE)
+	for (src = text; *src; src++)
 	{
-		free_notify_struct( in );
-		return;
+		if (*src == '&')					size += 5;
+		else if (*src == '<' || *src == '>')	size += 4;
+		else								size++;
 	}
-	//validate context
-	if (((service = FindServiceId( &handle_info->ServiceTable, in->servId, in->UDN )) == NULL)
-		|| (!service->active) || ((sub = GetSubscriptionSID( in->sid, service )) == NULL))
+	copy = (char *)malloc(size);
+	if (copy == NULL) return NULL;
+
+	for (src = text, dst = copy; *src; src++)
 	{
-		free_notify_struct(in);
-		return;
+		if (*src == '&')		{ strcpy(dst, "&amp;"); dst += 5; }
+		else if (*src == '<')	{ strcpy(dst, "&lt;"); dst += 4; }
+		else if (*src == '>')	{ strcpy(dst, "&gt;"); dst += 4; }
+		else					*dst++ = *src;
 	}
+	*dst = '\0';
+	return copy;
+}
 
-	sub->ToSendEventKey++;
-
-	if (sub->ToSendEventKey < 0)	/* wrap to 1 for overflow */
-		sub->ToSendEventKey = 1;
+/************************************************************************
+* Function : scan_property_set
+*
+* Parameters:
+*	INOUT char *text: printed property set, parsed in place
+*	OUT char **names, char **values: the variables, point into text
+*
+* Description:
+*	Reads the variables of a plain property set: propertyset, property
+*	and a variable without namespace holding text.
+*
+* Returns: int
+*	the number of variables, -1 if the document has another shape
+****************************************************************************/
+static int scan_property_set(INOUT char *text, OUT char **names, OUT char **values)
+{
+	IXML_Scanner scan;
+	int count = 0;
+	int ev;
 
-	if (return_code == GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB)
+	ixmlScan_init(&scan, text);
+	while ((ev = ixmlScan_next(&scan)) > 0)
 	{
-		RemoveSubscriptionSID( in->sid, service );
+		switch (ev)
+		{
+		case IXML_SCAN_START:
+			if (scan.depth == 1 && strcmp(scan.localName, "propertyset") == 0) break;
+			if (scan.depth == 2 && strcmp(scan.localName, "property") == 0) break;
+			if (scan.depth != 3 || scan.namespaceURI != NULL || count == GENA_MAX_VARS) return -1;
+			names[count] = scan.name;
+			values[count] = "";
+			break;
+
+		case IXML_SCAN_TEXT:
+			if (scan.depth == 3 && values[count][0] == '\0')
+			{
+				values[count] = scan.text;
+				break;
+			}
+			if (scan.text[strspn(scan.text, " \t\r\n")] != '\0') return -1;
+			break;
+
+		case IXML_SCAN_END:
+			if (scan.depth == 3) count++;
+			break;
+		}
 	}
-	return;
-	//   free_notify_struct( in );
+	return (ev == IXML_SCAN_EOF) ? count : -1;
 }
 
 /****************************************************************************
@@ -421,7 +453,8 @@ static void genaNotifyThread( IN void *input )
 *		returns GENA_E_SUCCESS if successful else returns appropriate error
 * 
 *	Note : No other event will be sent to this control point before the 
-*			intial state table dump.
+*			intial state table dump, it is queued right away and not
+*			collected with other changes.
 ****************************************************************************/
 int genaInitNotify(
 		IN UpnpDevice_Handle device_handle,
@@ -433,133 +466,40 @@ int genaInitNotify(
 		IN Upnp_SID sid
 		)
 {
-	char *UDN_copy = NULL;
-	char *servId_copy = NULL;
 	char *propertySet = NULL;
-	char *headers = NULL;
 	subscription *sub = NULL;
 	service_info *service = NULL;
 	int return_code = GENA_SUCCESS;
-	int headers_size;
-	int *reference_count = NULL;
 	struct Handle_Info *handle_info;
-
-	notify_thread_struct *thread_struct = NULL;
+	gena_event *event;
 
 	dtrace("GENA BEGIN INITIAL NOTIFY\n");
 
-	reference_count = (int *)malloc(sizeof(int));
-	if (reference_count == NULL) return UPNP_E_OUTOF_MEMORY;
-	(*reference_count) = 0;
-
-	UDN_copy = (char *)malloc(strlen(UDN)+1);
-	if (UDN_copy == NULL)
-	{
-		free(reference_count);
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	servId_copy = (char *)malloc(strlen(servId)+1);
-	if (servId_copy == NULL)
-	{
-		free( UDN_copy );
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	strcpy(UDN_copy, UDN);
-	strcpy(servId_copy, servId);
-
-	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
-		return GENA_E_BAD_HANDLE;
-	}
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) return GENA_E_BAD_HANDLE;
 
 	if ((service = FindServiceId(&handle_info->ServiceTable, servId, UDN)) == NULL)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
 		return GENA_E_BAD_SERVICE;
-	}
 
-	dtrace("FOUND SERVICE IN INIT NOTFY: UDN %s, ServID: %d\n",UDN, servId);
+	dtrace("FOUND SERVICE IN INIT NOTFY: UDN %s, ServID: %s\n", UDN, servId);
 
 	if (((sub = GetSubscriptionSID(sid, service)) == NULL) || (sub->active))
-	{
-		free( UDN_copy );
-		free( reference_count );
-		free( servId_copy );
 		return GENA_E_BAD_SID;
-	}
 
 	dtrace("FOUND SUBSCRIPTION IN INIT NOTIFY: SID %s\n", sid);
 
 	sub->active = 1;
 
 	return_code = GeneratePropertySet(VarNames, VarValues, var_count, &propertySet);
-	if (return_code != XML_SUCCESS)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
-		return return_code;
-	}
+	if (return_code != XML_SUCCESS) return return_code;
 
 	dtrace("GENERATED PROPERY SET IN INIT NOTIFY: \n'%s'\n", propertySet);
 
-	headers_size =	strlen("CONTENT-TYPE text/xml\r\n") +
-					strlen("CONTENT-LENGTH: \r\n") + MAX_CONTENT_LENGTH +
-					strlen("NT: upnp:event\r\n") +
-					strlen("NTS: upnp:propchange\r\n") + 1;
-
-	headers = (char *)malloc(headers_size);
-	if (headers == NULL)
-	{
-		ixmlFreeDOMString(propertySet);
-		free(UDN_copy);
-		free(servId_copy);
-		free(reference_count);
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	sprintf(headers,"CONTENT-TYPE: text/xml\r\nCONTENT-LENGTH: %d\r\n"
-					"NT: upnp:event\r\nNTS: upnp:propchange\r\n", strlen(propertySet) + 1);
-
-	//schedule thread for initial notification
-	thread_struct = (notify_thread_struct *)malloc(sizeof(notify_thread_struct));
-	if (thread_struct == NULL)
-	{
-		return_code = UPNP_E_OUTOF_MEMORY;
-	}
-	else
-	{
-		( *reference_count ) = 1;
-		thread_struct->servId = servId_copy;
-		thread_struct->UDN = UDN_copy;
-		thread_struct->headers = headers;
-		thread_struct->propertySet = propertySet;
-		strcpy( thread_struct->sid, sid );
-		thread_struct->eventKey = sub->eventKey++;
-		thread_struct->reference_count = reference_count;
-		thread_struct->device_handle = device_handle;
-		genaNotifyThread(thread_struct);
-	}
-
-	if (return_code != GENA_SUCCESS)
-	{
-		free(reference_count);
-		free(UDN_copy);
-		free(servId_copy);
-		free(thread_struct);
-		ixmlFreeDOMString(propertySet);
-		free(headers);
-	}
-
+	event = genaEventNew(propertySet);
+	ixmlFreeDOMString(propertySet);
+	if (event == NULL) return UPNP_E_OUTOF_MEMORY;
 
+	return_code = genaNotifyQueue(device_handle, UDN, servId, sub, event);
+	genaEventRelease(event);
 	return return_code;
 }
 
@@ -591,134 +531,40 @@ int genaInitNotifyExt(
 		IN Upnp_SID sid
 		)
 {
-	char *UDN_copy = NULL;
-	char *servId_copy = NULL;
-	char *headers = NULL;
 	subscription *sub = NULL;
 	service_info *service = NULL;
 	int return_code = GENA_SUCCESS;
-	int headers_size;
-	int *reference_count = NULL;
 	struct Handle_Info *handle_info;
 	DOMString propertySet = NULL;
-
-	notify_thread_struct *thread_struct = NULL;
+	gena_event *event;
 
 	dtrace("GENA BEGIN INITIAL NOTIFY EXT\n");
-	reference_count = (int *)malloc(sizeof(int));
-	if (reference_count == NULL) return UPNP_E_OUTOF_MEMORY;
-	(*reference_count) = 0;
-
-	UDN_copy = (char *)malloc(strlen(UDN) + 1);
-	if (UDN_copy == NULL)
-	{
-		free(reference_count);
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	servId_copy = (char *)malloc(strlen(servId) + 1);
-	if (servId_copy == NULL)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		return UPNP_E_OUTOF_MEMORY;
-	}
 
-	strcpy(UDN_copy, UDN);
-	strcpy(servId_copy, servId);
-
-	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
-		return GENA_E_BAD_HANDLE;
-	}
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) return GENA_E_BAD_HANDLE;
 
 	if ((service = FindServiceId(&handle_info->ServiceTable, servId, UDN)) == NULL)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
 		return GENA_E_BAD_SERVICE;
-	}
 
-	dtrace("FOUND SERVICE IN INIT NOTFY EXT: UDN %s, ServID: %d\n", UDN, servId);
+	dtrace("FOUND SERVICE IN INIT NOTFY EXT: UDN %s, ServID: %s\n", UDN, servId);
 
 	if (((sub = GetSubscriptionSID(sid, service)) == NULL) || (sub->active))
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
 		return GENA_E_BAD_SID;
-	}
 
 	dtrace("FOUND SUBSCRIPTION IN INIT NOTIFY EXT: SID %s\n", sid);
 
 	sub->active = 1;
 
 	propertySet = ixmlPrintDocument(PropSet);
-	if (propertySet == NULL)
-	{
-		free(UDN_copy);
-		free(reference_count);
-		free(servId_copy);
-		return UPNP_E_INVALID_PARAM;
-	}
+	if (propertySet == NULL) return UPNP_E_INVALID_PARAM;
 
 	dtrace("GENERATED PROPERY SET IN INIT EXT NOTIFY: \n%s\n", propertySet);
 
-	headers_size =	strlen("CONTENT-TYPE text/xml\r\n") +
-					strlen("CONTENT-LENGTH: \r\n") + MAX_CONTENT_LENGTH +
-					strlen("NT: upnp:event\r\n") +
-					strlen("NTS: upnp:propchange\r\n") + 1;
-
-	headers = (char *)malloc(headers_size);
-	if (headers == NULL)
-	{
-		free(UDN_copy);
-		free(servId_copy);
-		free(reference_count);
-		ixmlFreeDOMString(propertySet);
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	sprintf(headers,	"CONTENT-TYPE: text/xml\r\n"
-						"CONTENT-LENGTH: %d\r\n"
-						"NT: upnp:event\r\n"
-						"NTS: upnp:propchange\r\n", strlen(propertySet) + 1);
-
-	//schedule thread for initial notification
-
-	thread_struct = (notify_thread_struct *)malloc(sizeof(notify_thread_struct));
-	if (thread_struct == NULL)
-	{
-		return_code = UPNP_E_OUTOF_MEMORY;
-	}
-	else
-	{
-		( *reference_count ) = 1;
-		thread_struct->servId = servId_copy;
-		thread_struct->UDN = UDN_copy;
-		thread_struct->headers = headers;
-		thread_struct->propertySet = propertySet;
-		strcpy( thread_struct->sid, sid );
-		thread_struct->eventKey = sub->eventKey++;
-		thread_struct->reference_count = reference_count;
-		thread_struct->device_handle = device_handle;
-		genaNotifyThread(thread_struct);
-	}
-
-	if (return_code != GENA_SUCCESS)
-	{
-		ixmlFreeDOMString(propertySet);
-		free( reference_count );
-		free( UDN_copy );
-		free( servId_copy );
-		free( thread_struct );
-		free( headers );
-	}
+	event = genaEventNew(propertySet);
+	ixmlFreeDOMString(propertySet);
+	if (event == NULL) return UPNP_E_OUTOF_MEMORY;
 
+	return_code = genaNotifyQueue(device_handle, UDN, servId, sub, event);
+	genaEventRelease(event);
 	return return_code;
 }
 
@@ -732,7 +578,9 @@ int genaInitNotifyExt(
 *           IN IXML_Document *PropSet :	XML document Event varible property set
 *
 *	Description : 	This function sends a notification to all the subscribed
-*	control points
+*	control points. The variables of a plain property set are collected
+*	with the other changes of the service, any other document is sent as
+*	it is after the changes collected so far.
 *
 *	Return :	int
 *
@@ -746,129 +594,55 @@ int genaNotifyAllExt(
 		IN IXML_Document * PropSet
 		)
 {
-	char *headers = NULL;
-	int headers_size;
 	int return_code = GENA_SUCCESS;
-	char UDN_copy[44];
-	char servId_copy[44];
-	int *reference_count = NULL;
 	struct Handle_Info *handle_info;
 	DOMString propertySet = NULL;
-	subscription *finger = NULL;
-	notify_thread_struct *thread_struct = NULL;
 	service_info *service = NULL;
+	gena_pending *p;
+	char *names[GENA_MAX_VARS];
+	char *values[GENA_MAX_VARS];
+	char *value;
+	int count;
+	int i;
 
-	reference_count = (int *)malloc(sizeof(int));
-	if (reference_count == NULL) return UPNP_E_OUTOF_MEMORY;
-	(*reference_count = 0);
-
-#if 0
-	UDN_copy = ( char * )malloc( strlen( UDN ) + 1 );
-	if( UDN_copy == NULL )
-	{
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-	servId_copy = ( char * )malloc( strlen( servId ) + 1 );
-	if( servId_copy == NULL )
-	{
-		free( UDN_copy );
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-#endif
-
-	strcpy( UDN_copy, UDN );
-	strcpy( servId_copy, servId );
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) return GENA_E_BAD_HANDLE;
+	if ((service = FindServiceId(&handle_info->ServiceTable, servId, UDN)) == NULL)
+		return GENA_E_BAD_SERVICE;
+	if (GetFirstSubscription(service) == NULL) return GENA_SUCCESS;
 
 	propertySet = ixmlPrintDocument(PropSet);
-	if (propertySet == NULL)
-	{
-#if 0
-		free( UDN_copy );
-		free( servId_copy );
-#endif
-		free( reference_count );
-		return UPNP_E_INVALID_PARAM;
-	}
+	if (propertySet == NULL) return UPNP_E_INVALID_PARAM;
 
-	headers_size =	strlen( "CONTENT-TYPE text/xml\r\n" ) +
-					strlen( "CONTENT-LENGTH: \r\n" ) + MAX_CONTENT_LENGTH +
-					strlen( "NT: upnp:event\r\n" ) +
-					strlen( "NTS: upnp:propchange\r\n" ) + 1;
-
-	headers = (char *)malloc(headers_size);
-	if (headers == NULL)
+	count = scan_property_set(propertySet, names, values);
+	if (count < 0)
 	{
-#if 0
-		free( UDN_copy );
-		free( servId_copy );
-#endif
-		ixmlFreeDOMString( propertySet );
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-	/* changed to add null terminator at end of content
-	 * content length = (length in bytes of property set) + null char */
-	sprintf(headers,	"CONTENT-TYPE: text/xml\r\n"
-						"CONTENT-LENGTH: %d\r\n"
-						"NT: upnp:event\r\n"
-						"NTS: upnp:propchange\r\n", strlen(propertySet) + 1);
-
-	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE)
-		return_code = GENA_E_BAD_HANDLE;
-	else
-	{
-		if ((service = FindServiceId( &handle_info->ServiceTable, servId, UDN)) != NULL)
+		// keep the order with the changes collected so far
+		for (p = pending_list; p; p = p->next)
 		{
-			finger = GetFirstSubscription(service);
-			while (finger)
+			if (p->device_handle == device_handle &&
+				strcmp(p->UDN, UDN) == 0 && strcmp(p->servId, servId) == 0)
 			{
-				thread_struct = (notify_thread_struct *)malloc(sizeof(notify_thread_struct));
-				if (thread_struct == NULL)
-				{
-					return_code = UPNP_E_OUTOF_MEMORY;
-					break;
-				}
-
-				memset(thread_struct,0,sizeof(notify_thread_struct));
-				( *reference_count )++;
-				thread_struct->reference_count = reference_count;
-				thread_struct->UDN = UDN_copy;
-				thread_struct->servId = servId_copy;
-				thread_struct->headers = headers;
-				thread_struct->propertySet = propertySet;
-				strcpy( thread_struct->sid, finger->sid );
-				thread_struct->eventKey = finger->eventKey++;
-				thread_struct->device_handle = device_handle;
-				//if overflow, wrap to 1
-				if (finger->eventKey < 0)
-				{
-					finger->eventKey = 1;
-				}
-				//		printf("into genanotifythread\n");
-				//		printf("sid%s\n",thread_struct->sid);
-				genaNotifyThread(thread_struct);
-				//   free_notify_struct( thread_struct);
-				(* reference_count)--;
-				free(thread_struct);
-				thread_struct=NULL;
-
-				finger = GetNextSubscription(service, finger);
+				pending_flush(p);
+				break;
 			}
 		}
-		else
-			return_code = GENA_E_BAD_SERVICE;
+		ixmlFreeDOMString(propertySet);
+		propertySet = ixmlPrintDocument(PropSet);
+		if (propertySet == NULL) return UPNP_E_INVALID_PARAM;
+		return_code = fan_out(device_handle, UDN, servId, propertySet);
+		ixmlFreeDOMString(propertySet);
+		return return_code;
 	}
-	if ((*reference_count) == 0)
+
+	p = pending_find(device_handle, UDN, servId);
+	for (i = 0; i < count && return_code == GENA_SUCCESS; i++)
 	{
-		free( reference_count );
-		free( headers );
-		ixmlFreeDOMString( propertySet );
-		// free( UDN_copy );
-		//  free( servId_copy );
+		if (p == NULL || (value = escape_text(values[i])) == NULL)
+			return_code = UPNP_E_OUTOF_MEMORY;
+		else
+			return_code = pending_add(&p, names[i], value);
 	}
-
+	ixmlFreeDOMString(propertySet);
 	return return_code;
 }
 
@@ -884,7 +658,8 @@ int genaNotifyAllExt(
 *		IN int var_count	 :	number of variables
 *
 *	Description : 	This function sends a notification to all the subscribed
-*	control points
+*	control points. The changes are collected for GENA_COALESCE_MSEC and
+*	sent as one event.
 *
 *	Return :	int
 *
@@ -900,123 +675,26 @@ int genaNotifyAll(
 		IN int var_count
 		)
 {
-	char *headers = NULL;
-	char *propertySet = NULL;
-	int headers_size;
 	int return_code = GENA_SUCCESS;
-	char *UDN_copy = NULL;
-	char *servId_copy = NULL;
-	int *reference_count = NULL;
 	struct Handle_Info *handle_info;
-	subscription *finger = NULL;
-	notify_thread_struct *thread_struct = NULL;
 	service_info *service = NULL;
+	gena_pending *p;
+	char *value;
+	int i;
 
-	reference_count = (int *)malloc(sizeof(int));
-	if (reference_count == NULL) return UPNP_E_OUTOF_MEMORY;
-	(*reference_count = 0);
-
-	UDN_copy = (char *)malloc(strlen(UDN) + 1);
-	if (UDN_copy == NULL)
-	{
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	servId_copy = (char *)malloc(strlen(servId) + 1);
-	if (servId_copy == NULL)
-	{
-		free( UDN_copy );
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-
-	strcpy(UDN_copy, UDN);
-	strcpy(servId_copy, servId);
-
-	return_code = GeneratePropertySet(VarNames, VarValues, var_count, &propertySet);
-	if (return_code != XML_SUCCESS)
-	{
-		free( UDN_copy );
-		free( servId_copy );
-		free( reference_count );
-		return return_code;
-	}
-
-	headers_size =	strlen( "CONTENT-TYPE text/xml\r\n" ) +
-					strlen( "CONTENT-LENGTH: \r\n" ) + MAX_CONTENT_LENGTH +
-					strlen( "NT: upnp:event\r\n" ) +
-					strlen( "NTS: upnp:propchange\r\n" ) + 1;
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) return GENA_E_BAD_HANDLE;
+	if ((service = FindServiceId(&handle_info->ServiceTable, servId, UDN)) == NULL)
+		return GENA_E_BAD_SERVICE;
+	if (GetFirstSubscription(service) == NULL) return GENA_SUCCESS;
 
-	headers = (char *)malloc(headers_size);
-	if (headers == NULL)
-	{
-		free( UDN_copy );
-		free( servId_copy );
-		ixmlFreeDOMString( propertySet );
-		free( reference_count );
-		return UPNP_E_OUTOF_MEMORY;
-	}
-	/* changed to add null terminator at end of content
-	 * content length = (length in bytes of property set) + null char */
-	sprintf(headers,"CONTENT-TYPE: text/xml\r\n"
-					"CONTENT-LENGTH: %d\r\n"
-					"NT: upnp:event\r\n"
-					"NTS: upnp:propchange\r\n", strlen(propertySet) + 1);
-
-	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE)
+	p = pending_find(device_handle, UDN, servId);
+	for (i = 0; i < var_count && return_code == GENA_SUCCESS; i++)
 	{
-		return_code = GENA_E_BAD_HANDLE;
-	}
-	else
-	{
-		if ((service = FindServiceId( &handle_info->ServiceTable, servId, UDN)) != NULL)
-		{
-			finger = GetFirstSubscription( service );
-
-			while (finger)
-			{
-				thread_struct = (notify_thread_struct *)malloc(sizeof(notify_thread_struct));
-				if (thread_struct == NULL)
-				{
-					return_code = UPNP_E_OUTOF_MEMORY;
-					break;
-				}
-				( *reference_count )++;
-				thread_struct->reference_count = reference_count;
-				thread_struct->UDN = UDN_copy;
-				thread_struct->servId = servId_copy;
-				thread_struct->headers = headers;
-				thread_struct->propertySet = propertySet;
-				strcpy( thread_struct->sid, finger->sid );
-				thread_struct->eventKey = finger->eventKey++;
-				thread_struct->device_handle = device_handle;
-				//if overflow, wrap to 1
-				if (finger->eventKey < 0)
-				{
-					finger->eventKey = 1;
-				}
-				genaNotifyThread(thread_struct);
-
-				finger = GetNextSubscription( service, finger );
-
-			}
-		}
+		if (p == NULL || (value = strdup(VarValues[i])) == NULL)
+			return_code = UPNP_E_OUTOF_MEMORY;
 		else
-		{
-			return_code = GENA_E_BAD_SERVICE;
-		}
+			return_code = pending_add(&p, VarNames[i], value);
 	}
-
-	if ((*reference_count ) == 0)
-	{
-		free( reference_count );
-		free( headers );
-		ixmlFreeDOMString( propertySet );
-		free( UDN_copy );
-		free( servId_copy );
-	}
-
 	return return_code;
 }
 
@@ -0,0 +1,700 @@
+/* vi: set sw=4 ts=4: */
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000-2003 Intel Corporation 
+// All rights reserved. 
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met: 
+//
+// * Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer. 
+// * Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation 
+// and/or other materials provided with the distribution. 
+// * Neither name of Intel Corporation nor the names of its contributors 
+// may be used to endorse or promote products derived from this software 
+// without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR 
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+#include "config.h"
+#if EXCLUDE_GENA == 0
+#ifdef INCLUDE_DEVICE_APIS
+
+#include <fcntl.h>
+#include <errno.h>
+#include "gena.h"
+#include "sysdep.h"
+#include "upnpapi.h"
+#include "parsetools.h"
+#include "statcodes.h"
+#include "httpparser.h"
+#include "httpreadwrite.h"
+
+#include "unixutil.h"
+
+/* Event notification for the device side. Every subscription has a small
+ * queue of events and at most one NOTIFY in flight, sent and answered from
+ * the miniserver loop without blocking it. The connection to the control
+ * point is kept open for the next NOTIFY. */
+
+#define NOTIFY_IDLE			0	// nothing in flight, fd is a kept connection or -1
+#define NOTIFY_CONNECTING	1
+#define NOTIFY_SENDING		2
+#define NOTIFY_RECEIVING	3
+
+#define NOTIFY_WAIT			1	// notifier_connect(): no watch free, try from the tick
+
+typedef struct GENA_QUEUED
+{
+	gena_event *			event;
+	int						eventKey;
+} gena_queued;
+
+typedef struct GENA_NOTIFIER
+{
+	struct GENA_NOTIFIER *	next;
+	Upnp_SID				sid;
+	UpnpDevice_Handle		device_handle;
+	char					UDN[NAME_SIZE];
+	char					servId[NAME_SIZE];
+	URL_list				urls;
+	int						url;		// delivery URL of the connection
+	int						tries;		// delivery URLs tried for this event
+	int						reused;		// the NOTIFY went out on a kept connection
+	int						fd;
+	int						state;
+	time_t					deadline;
+	membuffer				request;	// start line and headers
+	size_t					sent;
+	http_parser_t			response;
+	gena_queued				queue[GENA_NOTIFY_QUEUE];
+	int						head;
+	int						count;
+} gena_notifier;
+
+static gena_notifier *notifier_list = NULL;
+static int notifier_ticking = 0;
+
+static void notifier_io(int fd, int events, void *param);
+static void notifier_start(gena_notifier *n);
+
+/****************************************************************************
+*	Function :	genaEventNew
+*
+*	Parameters :
+*		IN const char *propertySet :	The evented XML
+*
+*	Description :	Makes an event with one reference from a property set.
+*
+*	Return : gena_event *
+*		the event, NULL if out of memory
+****************************************************************************/
+gena_event *genaEventNew(IN const char *propertySet)
+{
+	gena_event *event;
+	size_t len = strlen(propertySet);
+
+	event = (gena_event *)malloc(sizeof(gena_event) + len);
+	if (event == NULL) return NULL;
+	event->refcount = 1;
+	event->length = len + 1;
+	memcpy(event->text, propertySet, len + 1);
+	return event;
+}
+
+/****************************************************************************
+*	Function :	genaEventRelease
+*
+*	Parameters :
+*		IN gena_event *event :	event to release
+*
+*	Description :	Drops a reference to the event.
+*
+*	Return : void
+****************************************************************************/
+void genaEventRelease(IN gena_event *event)
+{
+	if (event && --event->refcount == 0) free(event);
+}
+
+/****************************************************************************
+*	Function :	notifier_find
+*
+*	Description :	Finds the notifier of a subscription.
+****************************************************************************/
+static gena_notifier *notifier_find(IN const char *sid)
+{
+	gena_notifier *n;
+
+	for (n = notifier_list; n; n = n->next)
+	{
+		if (strcmp(n->sid, sid) == 0) return n;
+	}
+	return NULL;
+}
+
+/****************************************************************************
+*	Function :	notifier_close
+*
+*	Description :	Closes the connection of a notifier.
+****************************************************************************/
+static void notifier_close(INOUT gena_notifier *n)
+{
+	if (n->fd >= 0)
+	{
+		miniserv_watch_fd(n->fd, 0, NULL, NULL);
+		shutdown(n->fd, SD_BOTH);
+		UpnpCloseSocket(n->fd);
+		n->fd = -1;
+	}
+	if (n->state == NOTIFY_RECEIVING) httpmsg_destroy(&n->response.msg);
+	n->state = NOTIFY_IDLE;
+}
+
+/****************************************************************************
+*	Function :	notifier_free
+*
+*	Description :	Closes a notifier and drops the events it still has.
+****************************************************************************/
+static void notifier_free(INOUT gena_notifier *n)
+{
+	gena_notifier **prev;
+
+	for (prev = &notifier_list; *prev; prev = &(*prev)->next)
+	{
+		if (*prev == n)
+		{
+			*prev = n->next;
+			break;
+		}
+	}
+	notifier_close(n);
+	while (n->count > 0)
+	{
+		genaEventRelease(n->queue[n->head].event);
+		n->head = (n->head + 1) % GENA_NOTIFY_QUEUE;
+		n->count--;
+	}
+	membuffer_destroy(&n->request);
+	free_URL_list(&n->urls);
+	free(n);
+}
+
+/****************************************************************************
+*	Function :	notifier_watch
+*
+*	Description :	Watches fd for the notifier. When the watch table is
+*		full, the kept connections idle the longest are closed to make room.
+*		A notifier left without connection and events is freed by the tick,
+*		not here, as the callers may be walking the list.
+*
+*	Return : int
+*		0 if watched, -1 if every watch is busy
+****************************************************************************/
+static int notifier_watch(IN int fd, IN int events, INOUT gena_notifier *n)
+{
+	gena_notifier *m, *oldest;
+
+	while (miniserv_watch_fd(fd, events, notifier_io, n) < 0)
+	{
+		oldest = NULL;
+		for (m = notifier_list; m; m = m->next)
+		{
+			if (m != n && m->state == NOTIFY_IDLE && m->fd >= 0 &&
+				(oldest == NULL || m->deadline < oldest->deadline))
+			{
+				oldest = m;
+			}
+		}
+		if (oldest == NULL) return -1;
+		dtrace("gena notify %s: watch table full, kept connection closed\n", oldest->sid);
+		notifier_close(oldest);
+		oldest->deadline = 0;
+	}
+	return 0;
+}
+
+/****************************************************************************
+*	Function :	notifier_subscription
+*
+*	Description :	Looks the subscription of a notifier up again, it may
+*		have been cancelled or expired in the meantime.
+****************************************************************************/
+static subscription *notifier_subscription(
+		IN gena_notifier *n,
+		OUT service_info **service
+		)
+{
+	struct Handle_Info *handle_info;
+
+	if (GetHandleInfo(n->device_handle, &handle_info) != HND_DEVICE) return NULL;
+	*service = FindServiceId(&handle_info->ServiceTable, n->servId, n->UDN);
+	if (*service == NULL || !(*service)->active) return NULL;
+	return GetSubscriptionSID(n->sid, *service);
+}
+
+/****************************************************************************
+*	Function :	notifier_next
+*
+*	Description :	Takes the event at the head of the queue off and goes
+*		on with the next one. A notifier with nothing left to send and no
+*		connection is freed.
+****************************************************************************/
+static void notifier_next(INOUT gena_notifier *n)
+{
+	genaEventRelease(n->queue[n->head].event);
+	n->head = (n->head + 1) % GENA_NOTIFY_QUEUE;
+	n->count--;
+	n->tries = 0;
+
+	if (n->count > 0)
+	{
+		notifier_start(n);
+	}
+	else if (n->fd >= 0)
+	{
+		// watch the kept connection for the control point closing it
+		n->deadline = time(NULL) + GENA_IDLE_TIMEOUT;
+		if (notifier_watch(n->fd, MSERV_WATCH_READ, n) < 0)
+		{
+			notifier_close(n);
+			notifier_free(n);
+		}
+	}
+	else
+	{
+		notifier_free(n);
+	}
+}
+
+/****************************************************************************
+*	Function :	notifier_fail
+*
+*	Description :	The NOTIFY did not get through. A kept connection that
+*		turned out closed is replaced once, then the other delivery URLs are
+*		tried; after that the event is dropped.
+****************************************************************************/
+static void notifier_fail(INOUT gena_notifier *n)
+{
+	int reused = n->reused;
+
+	notifier_close(n);
+	if (!reused)
+	{
+		n->tries++;
+		n->url = (n->url + 1) % n->urls.size;
+	}
+	if (n->tries < n->urls.size)
+	{
+		notifier_start(n);
+		return;
+	}
+	dtrace("gena notify %s: SEQ %d not delivered\n", n->sid, n->queue[n->head].eventKey);
+	notifier_next(n);
+}
+
+/****************************************************************************
+*	Function :	notifier_done
+*
+*	Description :	Handles the response of the control point.
+****************************************************************************/
+static void notifier_done(INOUT gena_notifier *n)
+{
+	service_info *service;
+	subscription *sub;
+	http_header_t *header;
+	memptr value;
+	int status = n->response.msg.status_code;
+	int keep;
+
+	// the connection is kept unless the control point does not want it
+	keep = (n->response.msg.major_version == 1 && n->response.msg.minor_version >= 1);
+	header = httpmsg_find_hdr_str(&n->response.msg, "CONNECTION");
+	if (header && header->value.length >= 5 && strncasecmp(header->value.buf, "close", 5) == 0)
+	{
+		keep = 0;
+	}
+	// a body is not expected, it would be in the way of the next response
+	if (httpmsg_find_hdr(&n->response.msg, HDR_CONTENT_LENGTH, &value) &&
+		raw_to_int(&value, 10) != 0)
+	{
+		keep = 0;
+	}
+	httpmsg_destroy(&n->response.msg);
+	n->state = NOTIFY_IDLE;
+	if (keep)	miniserv_watch_fd(n->fd, 0, NULL, NULL);
+	else		notifier_close(n);
+
+	if ((sub = notifier_subscription(n, &service)) != NULL)
+	{
+		sub->ToSendEventKey = n->queue[n->head].eventKey + 1;
+		if (sub->ToSendEventKey < 0) sub->ToSendEventKey = 1;
+		if (status == HTTP_PRECONDITION_FAILED)
+		{
+			//Invalid SID gets removed
+			RemoveSubscriptionSID(n->sid, service);
+		}
+	}
+	else
+	{
+		status = HTTP_PRECONDITION_FAILED;
+	}
+	if (status == HTTP_PRECONDITION_FAILED)
+	{
+		notifier_free(n);
+		return;
+	}
+	notifier_next(n);
+}
+
+/****************************************************************************
+*	Function :	notifier_send
+*
+*	Description :	Writes as much of the NOTIFY as the socket takes.
+****************************************************************************/
+static void notifier_send(INOUT gena_notifier *n)
+{
+	gena_event *event = n->queue[n->head].event;
+	size_t total = n->request.length + event->length;
+	ssize_t num_written;
+
+	while (n->sent < total)
+	{
+		if (n->sent < n->request.length)
+			num_written = send(n->fd, n->request.buf + n->sent,
+					n->request.length - n->sent, MSG_NOSIGNAL);
+		else
+			num_written = send(n->fd, event->text + (n->sent - n->request.length),
+					total - n->sent, MSG_NOSIGNAL);
+		if (num_written < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR) return;
+			notifier_fail(n);
+			return;
+		}
+		n->sent += num_written;
+	}
+
+	n->state = NOTIFY_RECEIVING;
+	n->deadline = time(NULL) + HTTP_DEFAULT_TIMEOUT;
+	parser_response_init(&n->response, HTTPMETHOD_NOTIFY);
+	miniserv_watch_fd(n->fd, MSERV_WATCH_READ, notifier_io, n);
+}
+
+/****************************************************************************
+*	Function :	notifier_recv
+*
+*	Description :	Reads the response of the control point.
+****************************************************************************/
+static void notifier_recv(INOUT gena_notifier *n)
+{
+	char buf[512];
+	int num_read;
+	parse_status_t status;
+
+	num_read = recv(n->fd, buf, sizeof(buf), MSG_NOSIGNAL);
+	if (num_read < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if (num_read <= 0)
+	{
+		// a kept connection closed under us is tried again only when
+		// nothing of the response came
+		if (n->response.msg.msg.length != 0) n->reused = 0;
+		notifier_fail(n);
+		return;
+	}
+	status = parser_append(&n->response, buf, num_read);
+	if (status == PARSE_SUCCESS)
+	{
+		notifier_done(n);
+	}
+	else if (status == PARSE_FAILURE)
+	{
+		n->reused = 0;
+		notifier_fail(n);
+	}
+}
+
+/****************************************************************************
+*	Function :	notifier_io
+*
+*	Description :	Miniserver watch callback of a notifier connection.
+****************************************************************************/
+static void notifier_io(int fd, int events, void *param)
+{
+	gena_notifier *n = (gena_notifier *)param;
+	int option = 0;
+	socklen_t optlen = sizeof(option);
+	char buf[64];
+
+	switch (n->state)
+	{
+	case NOTIFY_IDLE:
+		// the control point closed the kept connection, or sent junk
+		if (recv(fd, buf, sizeof(buf), MSG_NOSIGNAL) < 0 && errno == EAGAIN) break;
+		notifier_close(n);
+		if (n->count == 0) notifier_free(n);
+		break;
+
+	case NOTIFY_CONNECTING:
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &option, &optlen) != 0 || option != 0)
+		{
+			notifier_fail(n);
+			break;
+		}
+		n->state = NOTIFY_SENDING;
+		n->deadline = time(NULL) + HTTP_DEFAULT_TIMEOUT;
+		notifier_send(n);
+		break;
+
+	case NOTIFY_SENDING:
+		notifier_send(n);
+		break;
+
+	case NOTIFY_RECEIVING:
+		notifier_recv(n);
+		break;
+	}
+}
+
+/****************************************************************************
+*	Function :	notifier_connect
+*
+*	Description :	Starts a non-blocking connect to the delivery URL.
+*
+*	Return : int
+*		0 if connecting, NOTIFY_WAIT if there is no watch free for it now,
+*		else -1
+****************************************************************************/
+static int notifier_connect(INOUT gena_notifier *n)
+{
+	uri_type url;
+	int fd;
+
+	if (http_FixUrl(&n->urls.parsedURLs[n->url], &url) != 0) return -1;
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if (connect(fd, (struct sockaddr *)&url.hostport.IPv4address, sizeof(struct sockaddr_in)) < 0 &&
+		errno != EINPROGRESS)
+	{
+		UpnpCloseSocket(fd);
+		return -1;
+	}
+	if (notifier_watch(fd, MSERV_WATCH_WRITE, n) < 0)
+	{
+		UpnpCloseSocket(fd);
+		return NOTIFY_WAIT;
+	}
+	n->fd = fd;
+	n->state = NOTIFY_CONNECTING;
+	n->deadline = time(NULL) + GENA_CONNECT_TIMEOUT;
+	return 0;
+}
+
+/****************************************************************************
+*	Function :	notifier_start
+*
+*	Description :	Sends the event at the head of the queue, over the kept
+*		connection if there is one.
+****************************************************************************/
+static void notifier_start(INOUT gena_notifier *n)
+{
+	service_info *service;
+	gena_queued *q = &n->queue[n->head];
+	int ret;
+
+	if (notifier_subscription(n, &service) == NULL)
+	{
+		notifier_free(n);
+		return;
+	}
+
+	for (; n->tries < n->urls.size; n->tries++)
+	{
+		dtrace("gena notify to: %.*s\n", n->urls.parsedURLs[n->url].hostport.text.size,
+				n->urls.parsedURLs[n->url].hostport.text.buff);
+
+		membuffer_destroy(&n->request);
+		membuffer_init(&n->request);
+		if (http_MakeMessage(&n->request, 1, 1, "q" "sdc" "s" "ssc" "sdcc",
+					HTTPMETHOD_NOTIFY, &n->urls.parsedURLs[n->url],
+					"CONTENT-LENGTH: ", (int)q->event->length,
+					"CONTENT-TYPE: text/xml\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\n",
+					"SID: ", n->sid, "SEQ: ", q->eventKey) != 0)
+		{
+			break;
+		}
+		n->sent = 0;
+
+		if (n->fd >= 0)
+		{
+			n->reused = 1;
+			n->state = NOTIFY_SENDING;
+			n->deadline = time(NULL) + HTTP_DEFAULT_TIMEOUT;
+			if (notifier_watch(n->fd, MSERV_WATCH_WRITE, n) == 0) return;
+			// not watched, make a fresh connection instead
+			notifier_close(n);
+		}
+		n->reused = 0;
+		if ((ret = notifier_connect(n)) == 0) return;
+		if (ret == NOTIFY_WAIT)
+		{
+			// the event stays queued, notifier_tick() starts it again
+			n->deadline = 0;
+			return;
+		}
+		n->url = (n->url + 1) % n->urls.size;
+	}
+
+	dtrace("gena notify %s: SEQ %d not delivered\n", n->sid, q->eventKey);
+	notifier_next(n);
+}
+
+/****************************************************************************
+*	Function :	notifier_tick
+*
+*	Description :	Timer of the notifiers: times out connects, responses
+*		and kept connections, and starts the notifiers that waited for a
+*		watch. Runs once a second while there are notifiers.
+****************************************************************************/
+static void notifier_tick(void *param)
+{
+	gena_notifier *n;
+	gena_notifier *next;
+	time_t now = time(NULL);
+
+	for (n = notifier_list; n; n = next)
+	{
+		next = n->next;
+		if (now < n->deadline) continue;
+		if (n->state != NOTIFY_IDLE)
+		{
+			dtrace("gena notify %s: timeout in state %d\n", n->sid, n->state);
+			n->reused = 0;
+			notifier_fail(n);
+		}
+		else if (n->fd >= 0)
+		{
+			notifier_close(n);
+			if (n->count == 0) notifier_free(n);
+		}
+		else if (n->count == 0)
+		{
+			// its kept connection was closed by notifier_watch()
+			notifier_free(n);
+		}
+		else
+		{
+			// waiting for a watch
+			notifier_start(n);
+		}
+	}
+
+	notifier_ticking = (notifier_list != NULL);
+	if (notifier_ticking) miniserv_add_timed_callback(notifier_tick, NULL, 1000);
+}
+
+/****************************************************************************
+*	Function :	genaNotifyQueue
+*
+*	Parameters :
+*		IN UpnpDevice_Handle device_handle :	Device handle
+*		IN char *UDN :	Device udn
+*		IN char *servId :	Service ID
+*		IN subscription *sub :	subscription to be notified
+*		IN gena_event *event :	the event, a reference is taken
+*
+*	Description :	Queues a NOTIFY for the subscription and returns, the
+*		NOTIFY goes out from the miniserver loop.
+*
+*	Return : int
+*		GENA_SUCCESS if queued, else UPNP_E_OUTOF_MEMORY
+****************************************************************************/
+int genaNotifyQueue(
+		IN UpnpDevice_Handle device_handle,
+		IN char *UDN,
+		IN char *servId,
+		IN subscription *sub,
+		IN gena_event *event
+		)
+{
+	gena_notifier *n;
+	int first, i, from, to;
+
+	n = notifier_find(sub->sid);
+	if (n == NULL)
+	{
+		if (strlen(UDN) >= NAME_SIZE || strlen(servId) >= NAME_SIZE ||
+			sub->DeliveryURLs.size <= 0)
+		{
+			return GENA_E_BAD_SERVICE;
+		}
+		n = (gena_notifier *)malloc(sizeof(gena_notifier));
+		if (n == NULL) return UPNP_E_OUTOF_MEMORY;
+		memset(n, 0, sizeof(gena_notifier));
+		if (copy_URL_list(&sub->DeliveryURLs, &n->urls) != HTTP_SUCCESS)
+		{
+			free(n);
+			return UPNP_E_OUTOF_MEMORY;
+		}
+		strcpy(n->sid, sub->sid);
+		strcpy(n->UDN, UDN);
+		strcpy(n->servId, servId);
+		n->device_handle = device_handle;
+		n->fd = -1;
+		n->state = NOTIFY_IDLE;
+		membuffer_init(&n->request);
+		n->next = notifier_list;
+		notifier_list = n;
+	}
+
+	if (n->count == GENA_NOTIFY_QUEUE)
+	{
+		// drop the oldest event that is not in flight
+		first = (n->state == NOTIFY_IDLE) ? 0 : 1;
+		dtrace("gena notify %s: queue full, SEQ %d dropped\n", n->sid,
+				n->queue[(n->head + first) % GENA_NOTIFY_QUEUE].eventKey);
+		genaEventRelease(n->queue[(n->head + first) % GENA_NOTIFY_QUEUE].event);
+		for (i = first; i < n->count - 1; i++)
+		{
+			to = (n->head + i) % GENA_NOTIFY_QUEUE;
+			from = (n->head + i + 1) % GENA_NOTIFY_QUEUE;
+			n->queue[to] = n->queue[from];
+		}
+		n->count--;
+	}
+
+	i = (n->head + n->count) % GENA_NOTIFY_QUEUE;
+	event->refcount++;
+	n->queue[i].event = event;
+	n->queue[i].eventKey = sub->eventKey++;
+	//if overflow, wrap to 1
+	if (sub->eventKey < 0) sub->eventKey = 1;
+	n->count++;
+
+	if (!notifier_ticking)
+	{
+		notifier_ticking = 1;
+		miniserv_add_timed_callback(notifier_tick, NULL, 1000);
+	}
+	if (n->count == 1 && n->state == NOTIFY_IDLE) notifier_start(n);
+	return GENA_SUCCESS;
+}
+
+#endif // INCLUDE_DEVICE_APIS
+#endif // EXCLUDE_GENA
@@ -474,11 +474,15 @@ struct schedule_callback
 	struct schedule_callback * next;
 	void (*func)(void *);
 	void * param;
+	struct timeval due;
 };
 
 static struct schedule_callback * callback_list = NULL;
 
-void miniserv_add_callback(void (*func)(void *), void * param)
+/* Queue func(param) to run from the miniserver loop once 'msec'
+ * milliseconds have passed. Callbacks added while the due ones are
+ * running wait for the next pass. */
+void miniserv_add_timed_callback(void (*func)(void *), void * param, unsigned int msec)
 {
 	struct schedule_callback * entry;
 	struct schedule_callback * list;
@@ -489,8 +493,16 @@ void miniserv_add_callback(void (*func)(void *), void * param)
 		entry->func = func;
 		entry->param = param;
 		entry->next = NULL;
+		gettimeofday(&entry->due, NULL);
+		entry->due.tv_sec += msec / 1000;
+		entry->due.tv_usec += (msec % 1000) * 1000;
+		if (entry->due.tv_usec >= 1000000)
+		{
+			entry->due.tv_sec++;
+			entry->due.tv_usec -= 1000000;
+		}
 
-		dtrace("callback: add entry:0x%x, func:0x%x, param:0x%x\n", entry, func, param);
+		dtrace("callback: add entry:0x%x, func:0x%x, param:0x%x, msec:%u\n", entry, func, param, msec);
 		
 		if (callback_list)
 		{
@@ -505,14 +517,77 @@ void miniserv_add_callback(void (*func)(void *), void * param)
 	}
 }
 
+void miniserv_add_callback(void (*func)(void *), void * param)
+{
+	miniserv_add_timed_callback(func, param, 0);
+}
+
+static int callback_due(struct schedule_callback * entry, struct timeval * now)
+{
+	if (entry->due.tv_sec != now->tv_sec) return entry->due.tv_sec < now->tv_sec;
+	return entry->due.tv_usec <= now->tv_usec;
+}
+
+/* Shorten 'timeout' to the nearest pending callback. Returns 1 if it was
+ * shortened. */
+static int callback_timeout(struct timeval * timeout)
+{
+	struct schedule_callback * entry;
+	struct timeval now;
+	long msec, wait;
+	int shortened = 0;
+
+	if (!callback_list) return 0;
+	gettimeofday(&now, NULL);
+	wait = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+	for (entry = callback_list; entry; entry = entry->next)
+	{
+		msec = (entry->due.tv_sec - now.tv_sec) * 1000 + (entry->due.tv_usec - now.tv_usec) / 1000;
+		if (msec < 0) msec = 0;
+		if (msec < wait)
+		{
+			wait = msec;
+			shortened = 1;
+		}
+	}
+	if (shortened)
+	{
+		timeout->tv_sec = wait / 1000;
+		timeout->tv_usec = (wait % 1000) * 1000;
+	}
+	return shortened;
+}
+
 static void call_callback(void)
 {
 	struct schedule_callback * entry;
+	struct schedule_callback ** prev;
+	struct schedule_callback * due = NULL;
+	struct schedule_callback ** tail = &due;
+	struct timeval now;
+
+	/* take the due callbacks off the list first, they may add new ones */
+	gettimeofday(&now, NULL);
+	prev = &callback_list;
+	while ((entry = *prev) != NULL)
+	{
+		if (callback_due(entry, &now))
+		{
+			*prev = entry->next;
+			entry->next = NULL;
+			*tail = entry;
+			tail = &entry->next;
+		}
+		else
+		{
+			prev = &entry->next;
+		}
+	}
 
-	while (callback_list)
+	while (due)
 	{
-		entry = callback_list;
-		callback_list = entry->next;
+		entry = due;
+		due = entry->next;
 		if (entry->func)
 		{
 			dtrace("callback: process entry:0x%x, func:0x%x, param:0x%x\n", entry, entry->func, entry->param);
@@ -535,6 +610,87 @@ static void destroy_callback_list(void)
 
 /************************************************************************/
 
+struct watch_fd
+{
+	int fd;
+	int events;
+	void (*func)(int, int, void *);
+	void * param;
+};
+
+static struct watch_fd watch_list[MSERV_MAX_WATCH];
+static int watch_count = 0;
+
+/* Call func(fd, events, param) from the miniserver loop when 'fd' is
+ * readable (MSERV_WATCH_READ) or writable (MSERV_WATCH_WRITE). Setting the
+ * events of a watched fd again replaces them, 0 stops watching it.
+ * Returns -1 if all MSERV_MAX_WATCH slots are in use. */
+int miniserv_watch_fd(int fd, int events, void (*func)(int, int, void *), void * param)
+{
+	int i;
+
+	for (i=0; i<watch_count; i++)
+	{
+		if (watch_list[i].fd == fd) break;
+	}
+	if (events == 0)
+	{
+		if (i < watch_count) watch_list[i] = watch_list[--watch_count];
+		return 0;
+	}
+	if (i == watch_count)
+	{
+		if (watch_count == MSERV_MAX_WATCH) return -1;
+		watch_count++;
+	}
+	watch_list[i].fd = fd;
+	watch_list[i].events = events;
+	watch_list[i].func = func;
+	watch_list[i].param = param;
+	return 0;
+}
+
+static int watch_set(fd_set * rdSet, fd_set * wrSet, int maxfd)
+{
+	int i;
+
+	for (i=0; i<watch_count; i++)
+	{
+		if (watch_list[i].events & MSERV_WATCH_READ) FD_SET(watch_list[i].fd, rdSet);
+		if (watch_list[i].events & MSERV_WATCH_WRITE) FD_SET(watch_list[i].fd, wrSet);
+		if (watch_list[i].fd >= maxfd) maxfd = watch_list[i].fd + 1;
+	}
+	return maxfd;
+}
+
+/* The handlers may change the watches, so a copy is walked and an entry
+ * is only called while it is still registered. */
+static void call_watch(fd_set * rdSet, fd_set * wrSet)
+{
+	struct watch_fd ready[MSERV_MAX_WATCH];
+	int count, i, j, events;
+
+	memcpy(ready, watch_list, watch_count * sizeof(struct watch_fd));
+	count = watch_count;
+	for (i=0; i<count; i++)
+	{
+		events = 0;
+		if (FD_ISSET(ready[i].fd, rdSet)) events |= MSERV_WATCH_READ;
+		if (FD_ISSET(ready[i].fd, wrSet)) events |= MSERV_WATCH_WRITE;
+		if (!events) continue;
+		for (j=0; j<watch_count; j++)
+		{
+			if (watch_list[j].fd == ready[i].fd) break;
+		}
+		if (j == watch_count || watch_list[j].func != ready[i].func || watch_list[j].param != ready[i].param)
+			continue;
+		events &= watch_list[j].events;
+		if (events) ready[i].func(ready[i].fd, events, ready[i].param);
+	}
+}
+
+/************************************************************************/
+
 
 /************************************************************************
 *	Function :	RunMiniServer
@@ -564,13 +720,16 @@ void RunMiniServer(MiniServerSockArray * miniSock)
 #endif
 	fd_set expSet;
 	fd_set rdSet;
+	fd_set wrSet;
 	unsigned int maxMiniSock;
+	int maxfd;
 	int byteReceived;
 	char requestBuf[256];
 
 	time_t delay_pre=0, delay_post=0;
 	struct timeval timeout;
 	int result,time_in = 1797,one=0;
+	int callback_wait;
 	int sig;
 
 	dtrace("RunMiniServer >>>>\n");
@@ -618,6 +777,7 @@ void RunMiniServer(MiniServerSockArray * miniSock)
 		timeout.tv_usec = 0;
 
 		FD_ZERO(&rdSet);
+		FD_ZERO(&wrSet);
 		FD_ZERO(&expSet);
 		FD_SET(miniServStopSock, &expSet);
 		FD_SET(miniServSock, &rdSet);
@@ -627,12 +787,18 @@ void RunMiniServer(MiniServerSockArray * miniSock)
 		FD_SET(ssdpReqSock, &rdSet);
 #endif
 		FD_SET(signal_pipe[0], &rdSet);
-		result = select(maxMiniSock, &rdSet, NULL, &expSet, &timeout);
+		maxfd = watch_set(&rdSet, &wrSet, maxMiniSock);
+		callback_wait = callback_timeout(&timeout);
+		result = select(maxfd, &rdSet, &wrSet, &expSet, &timeout);
 
 		if (result == 0)
 		{
-			UpnpSendAdvertisement(device_handle, default_advr_expire);
-			time_in=1797;
+			if (!callback_wait)
+			{
+				UpnpSendAdvertisement(device_handle, default_advr_expire);
+				time_in=1797;
+			}
+			call_callback();
 			continue;
 		}
 		else if (result < 0)
@@ -662,6 +828,8 @@ void RunMiniServer(MiniServerSockArray * miniSock)
 			}
 		}
 		
+		call_watch(&rdSet, &wrSet);
+
 		if (FD_ISSET(miniServSock, &rdSet))
 		{
 			clientLen = sizeof(struct sockaddr_in);
@@ -101,17 +101,71 @@
 	DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"Subscribe UnLock");)
 
 
-//Structure to send NOTIFY message to all subscribed control points
-typedef struct NOTIFY_THREAD_STRUCT {
-  char * headers;
-  DOMString propertySet;
-  char * servId;
-  char * UDN;
-  Upnp_SID sid;
-  int eventKey;
-  int *reference_count;
-  UpnpDevice_Handle device_handle;
-} notify_thread_struct;
+#define GENA_NOTIFY_QUEUE		8	// events waiting per subscription
+#define GENA_CONNECT_TIMEOUT	2	// seconds
+#define GENA_IDLE_TIMEOUT		30	// a kept connection is closed after this
+#define GENA_COALESCE_MSEC		100	// changes are collected this long
+#define GENA_MAX_VARS			32	// variables of one collected event
+
+//A property set rendered once and shared by the NOTIFY of every subscriber
+typedef struct GENA_EVENT {
+  int refcount;
+  size_t length;			// sent with the terminating null
+  char text[1];
+} gena_event;
+
+/************************************************************************
+* Function : genaEventNew
+*
+* Parameters:
+*	IN const char *propertySet: the evented XML
+*
+* Description:
+*	Makes an event with one reference from a property set.
+*
+* Returns: gena_event *
+*	the event, NULL if out of memory
+***************************************************************************/
+DEVICEONLY(EXTERN_C gena_event *genaEventNew(IN const char *propertySet);)
+
+/************************************************************************
+* Function : genaEventRelease
+*
+* Parameters:
+*	IN gena_event *event: event to release
+*
+* Description:
+*	Drops a reference to the event, frees it with the last one.
+*
+* Returns: void
+***************************************************************************/
+DEVICEONLY(EXTERN_C void genaEventRelease(IN gena_event *event);)
+
+/************************************************************************
+* Function : genaNotifyQueue
+*
+* Parameters:
+*	IN UpnpDevice_Handle device_handle: Device handle
+*	IN char *UDN: Device udn
+*	IN char *servId: Service ID
+*	IN subscription *sub: subscription to be notified
+*	IN gena_event *event: the event, a reference is taken
+*
+* Description:
+*	Queues a NOTIFY for the subscription with the next event key and
+*	returns. The NOTIFY is sent from the miniserver loop over a connection
+*	that is kept for the following ones. When GENA_NOTIFY_QUEUE events are
+*	already waiting the oldest of them is dropped, the gap in SEQ tells
+*	the control point.
+*
+* Returns: int
+*	GENA_SUCCESS if queued, else UPNP_E_OUTOF_MEMORY
+***************************************************************************/
+DEVICEONLY(EXTERN_C int genaNotifyQueue(IN UpnpDevice_Handle device_handle,
+			IN char *UDN,
+			IN char *servId,
+			IN subscription *sub,
+			IN gena_event *event);)
 
 
 /************************************************************************
@@ -161,6 +161,13 @@ int StartMiniServer(
 int StopMiniServer( void );
 
 void miniserv_add_callback(void (*func)(void *), void * param);
+void miniserv_add_timed_callback(void (*func)(void *), void * param, unsigned int msec);
+
+#define MSERV_MAX_WATCH		32
+#define MSERV_WATCH_READ	1
+#define MSERV_WATCH_WRITE	2
+
+int miniserv_watch_fd(int fd, int events, void (*func)(int, int, void *), void * param);
 
 #ifdef __cplusplus
 }   /* extern C */
@@ -79,6 +79,13 @@ typedef enum SsdpCmdType{SSDP_ERROR=-1,
 #define  THREAD_LIMIT 50
 #define  COMMAND_LEN  300
 
+//Search replies
+#define  SSDP_MAX_SEARCHES   32	// searches waiting for their reply or deduplicated
+#define  SSDP_MAX_SOURCES    16	// control points rate limited
+#define  SSDP_SEARCH_BURST   8	// searches accepted at once from one control point
+#define  SSDP_SEARCH_RATE    4	// and then per second
+#define  SSDP_SEARCH_REFILL  (SSDP_SEARCH_BURST * 1000 / SSDP_SEARCH_RATE)	// msec to refill the burst
+
 //Error code
 #define NO_ERROR_FOUND    0
 #define E_REQUEST_INVALID  	-3
@@ -513,7 +520,7 @@ void * advertiseAndReplyThread(IN void * data);
 *																	
 * Parameters:														
 *	IN int AdFlag: -1 = Send shutdown, 0 = send reply, 
-*					1 = Send Advertisement
+*					1 = Send Advertisement, 2 = prepare the search replies
 *	IN UpnpDevice_Handle Hnd: Device handle
 *	IN enum SsdpSearchType SearchType:Search type for sending replies
 *	IN struct sockaddr_in *DestAddr:Destination address
@@ -536,5 +543,73 @@ int AdvertiseAndReply(IN int AdFlag,
 					IN char *DeviceUDN, 
                     IN char *ServiceType, int Exp);
 
+/************************************************************************
+* Function : ssdp_reply_clear
+*
+* Description:
+*	Drops the prepared search replies, they are prepared again with the
+*	next advertisement.
+*
+* Returns: void
+***************************************************************************/
+void ssdp_reply_clear(void);
+
+/************************************************************************
+* Function : ssdp_reply_device
+*
+* Parameters:
+*	IN int RootDev: 1 means root device
+*	IN char *DevType: Device type
+*	IN char *Udn: Device UDN
+*	IN char *Location: Location of Device description document.
+*	IN int Duration: Life time of this device.
+*
+* Description:
+*	Prepares the search replies of a device, the same DeviceReply sends.
+*
+* Returns: int
+*	UPNP_E_SUCCESS if successful else UPNP_E_OUTOF_MEMORY
+***************************************************************************/
+int ssdp_reply_device(IN int RootDev, IN char *DevType, IN char *Udn,
+					IN char *Location, IN int Duration);
+
+/************************************************************************
+* Function : ssdp_reply_service
+*
+* Parameters:
+*	IN char *ServType: Service type
+*	IN char *Udn: Device UDN
+*	IN char *Location: Location of Device description document.
+*	IN int Duration: Life time of this device.
+*
+* Description:
+*	Prepares the search reply of a service, the same ServiceReply sends.
+*
+* Returns: int
+*	UPNP_E_SUCCESS if successful else UPNP_E_OUTOF_MEMORY
+***************************************************************************/
+int ssdp_reply_service(IN char *ServType, IN char *Udn,
+					IN char *Location, IN int Duration);
+
+/************************************************************************
+* Function : ssdp_reply_search
+*
+* Parameters:
+*	IN UpnpDevice_Handle Hnd: Device handle
+*	IN struct sockaddr_in *DestAddr: address of the control point
+*	IN SsdpEvent *Evt: the search
+*	IN int Mx: MX of the search, in seconds
+*	IN int Delay: when to reply, in msec
+*
+* Description:
+*	Queues the replies to a search. A search repeated by the same control
+*	point within its MX is answered once, and a control point sending
+*	searches faster than SSDP_SEARCH_RATE is not answered.
+*
+* Returns: void
+***************************************************************************/
+void ssdp_reply_search(IN UpnpDevice_Handle Hnd, IN struct sockaddr_in *DestAddr,
+					IN SsdpEvent *Evt, IN int Mx, IN int Delay);
+
 #endif
 
@@ -58,6 +58,9 @@
 #define SOAP_INVALID_VAR	404
 #define SOAP_ACTION_FAILED	501
 
+// requests up to this size are read by the streaming parser
+#define SOAP_SCAN_SIZE		4096
+
 static const char *Soap_Invalid_Action = "Invalid Action";
 
 //static const char* Soap_Invalid_Args = "Invalid Args";
@@ -578,9 +581,11 @@ check_soap_action_header( IN http_message_t * request,
 *	Parameters :
 *		IN http_message_t* request :	HTTP request
 *		IN int isQuery :	flag for a querry
-*		IN IXML_Document *actionDoc :	action request document
+*		IN IXML_Document *actionDoc :	action request document, NULL if
+*									the body is checked by the caller
 *		OUT char device_udn[LINE_SIZE] :	Device UDN string
 *		OUT char service_id[LINE_SIZE] :	Service ID string
+*		OUT char service_type[NAME_SIZE] :	Service type string
 *		OUT Upnp_FunPtr *callback :	callback function of the device 
 *									application
 *		OUT void** cookie :	cookie stored by device application 
@@ -601,6 +606,7 @@ static int get_device_info(
 		IN IXML_Document * actionDoc,
 		OUT char device_udn[LINE_SIZE],
 		OUT char service_id[LINE_SIZE],
+		OUT char service_type[NAME_SIZE],
 		OUT Upnp_FunPtr * callback,
 		OUT void **cookie
 		)
@@ -653,7 +659,7 @@ static int get_device_info(
 		}
 		/**/
 		//check soap body
-		ret_code = check_soap_body(actionDoc, serv_info->serviceType, actionName);
+		if (actionDoc) ret_code = check_soap_body(actionDoc, serv_info->serviceType, actionName);
 		free(actionName);
 		/**//*leon 20040428*/
 		if (ret_code != UPNP_E_SUCCESS)
@@ -664,6 +670,7 @@ static int get_device_info(
 		/**/
 	}
 
+	namecopy(service_type, serv_info->serviceType);
 	namecopy(service_id, serv_info->serviceId);
 	namecopy(device_udn, serv_info->UDN);
 	*callback = device_info->Callback;
@@ -682,6 +689,8 @@ error_handler:
 *	Parameters :
 *		IN SOCKINFO *info :	socket info
 *		IN IXML_Document *action_resp : The response document	
+*		IN const char *resp_text :	The response as text, used instead of
+*									action_resp if not NULL
 *		IN http_message_t* request :	action request document
 *
 *	Description :	This function sends the SOAP response 
@@ -693,10 +702,12 @@ error_handler:
 static XINLINE void send_action_response(
 		IN SOCKINFO * info,
 		IN IXML_Document * action_resp,
+		IN const char * resp_text,
 		IN http_message_t * request
 		)
 {
-	char *xml_response = NULL;
+	const char *xml_response = resp_text;
+	char *printed = NULL;
 	membuffer headers;
 	int major, minor;
 	int err_code;
@@ -719,8 +730,12 @@ static XINLINE void send_action_response(
 	err_code = UPNP_E_OUTOF_MEMORY; // one error only
 
 	// get xml
-	xml_response = ixmlPrintDocument((IXML_Node *)action_resp);
-	if (xml_response == NULL) goto error_handler;
+	if (xml_response == NULL)
+	{
+		printed = ixmlPrintDocument((IXML_Node *)action_resp);
+		if (printed == NULL) goto error_handler;
+		xml_response = printed;
+	}
 
 	content_length = strlen(start_body) + strlen(xml_response) + strlen(end_body);
 
@@ -743,7 +758,7 @@ static XINLINE void send_action_response(
 	err_code = 0;
 
 error_handler:
-	ixmlFreeDOMString(xml_response);
+	ixmlFreeDOMString(printed);
 	membuffer_destroy(&headers);
 	if (err_code != 0)
 	{
@@ -832,6 +847,7 @@ static XINLINE void handle_query_variable(
 	Upnp_FunPtr soap_event_callback;
 	void *cookie;
 	char var_name[LINE_SIZE];
+	char service_type[NAME_SIZE];
 	struct Upnp_State_Var_Request variable;
 	const char *err_str;
 	int err_code;
@@ -844,7 +860,7 @@ static XINLINE void handle_query_variable(
 	}
 	// get info for event
 	if (get_device_info(request, 1, xml_doc, variable.DevUDN,
-			variable.ServiceID, &soap_event_callback, &cookie ) != 0)
+			variable.ServiceID, service_type, &soap_event_callback, &cookie ) != 0)
 	{
 		send_error_response(info, SOAP_INVALID_VAR, Soap_Invalid_Var, request);
 		return;
@@ -889,6 +905,136 @@ static XINLINE void handle_query_variable(
 	ixmlFreeDOMString(variable.CurrentVal);
 }
 
+/****************************************************************************
+*	Function :	scan_action
+*
+*	Parameters :
+*		INOUT char *body :	SOAP request, changed by the parser
+*		IN const char *action_name :	Name of the SOAP action
+*		IN const char *urn :	Service type the action must belong to
+*		OUT struct Upnp_Action_Request *action :	gets the arguments
+*
+*	Description :	This function reads the action and its arguments with
+*		the streaming parser, without building a DOM tree. The arguments
+*		point into the body.
+*
+*	Return :	int
+*		0 if successful, -1 if the request has to go to the DOM parser
+*		(not well-formed, arguments with child elements, or more than
+*		UPNP_MAX_ARGS of them).
+*
+*	Note :
+****************************************************************************/
+static int scan_action(
+		INOUT char *body,
+		IN const char *action_name,
+		IN const char *urn,
+		OUT struct Upnp_Action_Request *action
+		)
+{
+	IXML_Scanner scan;
+	int event;
+	int depth;
+
+	ixmlScan_init(&scan, body);
+
+	// Envelope
+	if (ixmlScan_next(&scan) != IXML_SCAN_START ||
+		scan.namespaceURI == NULL || strcmp(scan.namespaceURI, SOAP_URN) != 0 ||
+		strcmp(scan.localName, "Envelope") != 0)
+	{
+		return -1;
+	}
+
+	// Body, a Header before it is skipped
+	for (;;)
+	{
+		event = ixmlScan_next(&scan);
+		if (event == IXML_SCAN_TEXT) continue;
+		if (event != IXML_SCAN_START) return -1;
+		if (scan.namespaceURI && strcmp(scan.namespaceURI, SOAP_URN) == 0 &&
+			strcmp(scan.localName, SOAP_BODY) == 0)
+		{
+			break;
+		}
+		depth = scan.depth;
+		do
+		{
+			event = ixmlScan_next(&scan);
+			if (event <= IXML_SCAN_EOF) return -1;
+		} while (event != IXML_SCAN_END || scan.depth != depth);
+	}
+
+	// action
+	while ((event = ixmlScan_next(&scan)) == IXML_SCAN_TEXT);
+	if (event != IXML_SCAN_START || scan.namespaceURI == NULL ||
+		strcmp(scan.localName, action_name) != 0 || strcmp(scan.namespaceURI, urn) != 0)
+	{
+		return -1;
+	}
+
+	// arguments
+	action->ArgCount = 0;
+	for (;;)
+	{
+		event = ixmlScan_next(&scan);
+		if (event == IXML_SCAN_TEXT)
+		{
+			if (scan.depth == 4) action->ArgValue[action->ArgCount] = scan.text;
+			continue;
+		}
+		if (event == IXML_SCAN_START)
+		{
+			if (scan.depth != 4 || action->ArgCount == UPNP_MAX_ARGS) return -1;
+			action->ArgName[action->ArgCount] = scan.localName;
+			action->ArgValue[action->ArgCount] = "";
+			continue;
+		}
+		if (event != IXML_SCAN_END) return -1;
+		if (scan.depth == 3) break;
+		action->ArgCount++;
+	}
+
+	// the rest must be well-formed too
+	while ((event = ixmlScan_next(&scan)) > IXML_SCAN_EOF);
+	return (event == IXML_SCAN_EOF) ? 0 : -1;
+}
+
+/****************************************************************************
+*	Function :	get_action_args
+*
+*	Parameters :
+*		IN IXML_Document *action_doc :	the action node
+*		OUT struct Upnp_Action_Request *action :	gets the arguments
+*
+*	Description :	This function collects the arguments of an action the
+*		DOM parser has read.
+*
+*	Return : void
+*
+*	Note :
+****************************************************************************/
+static void get_action_args(
+		IN IXML_Document * action_doc,
+		OUT struct Upnp_Action_Request *action
+		)
+{
+	IXML_Node *node;
+	const DOMString value;
+
+	action->ArgCount = 0;
+	node = ixmlNode_getFirstChild((IXML_Node *)action_doc);
+	if (node) node = ixmlNode_getFirstChild(node);
+	for (; node && action->ArgCount < UPNP_MAX_ARGS; node = ixmlNode_getNextSibling(node))
+	{
+		if (ixmlNode_getNodeType(node) != eELEMENT_NODE) continue;
+		value = ixmlNode_getNodeValue(ixmlNode_getFirstChild(node));
+		action->ArgName[action->ArgCount] = ixmlNode_getLocalName(node);
+		action->ArgValue[action->ArgCount] = value ? value : "";
+		action->ArgCount++;
+	}
+}
+
 /****************************************************************************
 *	Function :	handle_invoke_action
 *
@@ -896,12 +1042,11 @@ static XINLINE void handle_query_variable(
 *		IN SOCKINFO *info :	Socket info
 *		IN http_message_t* request : HTTP Request	
 *		IN memptr action_name :	 Name of the SOAP Action
-*		IN IXML_Document *xml_doc :	document containing the SOAP action 
-*									request
 *
 *	Description :	This functions handle the SOAP action request. It checks 
 *		the integrity of the SOAP action request and gives the call back to 
-*		the device application.
+*		the device application. The request is read by the streaming parser
+*		when it can be, by the DOM parser otherwise.
 *
 *	Return : void
 *
@@ -910,11 +1055,13 @@ static XINLINE void handle_query_variable(
 static void handle_invoke_action(
 		IN SOCKINFO * info,
 		IN http_message_t * request,
-		IN memptr action_name,
-		IN IXML_Document * xml_doc
+		IN memptr action_name
 		)
 {
 	char save_char;
+	char body[SOAP_SCAN_SIZE];
+	char service_type[NAME_SIZE];
+	IXML_Document *xml_doc = NULL;
 	IXML_Document *resp_node = NULL;
 	struct Upnp_Action_Request action;
 	Upnp_FunPtr soap_event_callback;
@@ -923,6 +1070,7 @@ static void handle_invoke_action(
 	const char *err_str;
 
 	action.ActionResult = NULL;
+	action.ActionResultText = NULL;
 
 	// null-terminate
 	save_char = action_name.buf[action_name.length];
@@ -932,15 +1080,41 @@ static void handle_invoke_action(
 	err_code = SOAP_INVALID_ACTION;
 	err_str = Soap_Invalid_Action;
 
-	// get action node
-	if (get_action_node(xml_doc, action_name.buf, &resp_node) == -1)
-		goto error_handler;
-
 	// get device info for action event
-	err_code = get_device_info(request, 0, xml_doc, action.DevUDN,
-			action.ServiceID, &soap_event_callback, &cookie);
+	err_code = get_device_info(request, 0, NULL, action.DevUDN,
+			action.ServiceID, service_type, &soap_event_callback, &cookie);
 	if (err_code != UPNP_E_SUCCESS) goto error_handler;
 
+	// get action and arguments
+	err_code = SOAP_INVALID_ACTION;
+	if (request->entity.length < sizeof(body))
+	{
+		memcpy(body, request->entity.buf, request->entity.length);
+		body[request->entity.length] = '\0';
+	}
+	if (request->entity.length >= sizeof(body) ||
+		scan_action(body, action_name.buf, service_type, &action) != 0)
+	{
+		err_code = ixmlParseBufferEx(request->entity.buf, &xml_doc);
+		if (err_code != IXML_SUCCESS)
+		{
+			if (err_code == IXML_INSUFFICIENT_MEMORY) err_code = UPNP_E_OUTOF_MEMORY;
+			else err_code = SOAP_ACTION_FAILED;
+
+			err_str = "XML error";
+			goto error_handler;
+		}
+		err_code = SOAP_INVALID_ACTION;
+		if (get_action_node(xml_doc, action_name.buf, &resp_node) == -1)
+			goto error_handler;
+		if (check_soap_body(xml_doc, service_type, action_name.buf) != UPNP_E_SUCCESS)
+		{
+			err_code = UPNP_E_INVALID_SERVICE;
+			goto error_handler;
+		}
+		get_action_args(resp_node, &action);
+	}
+
 	namecopy(action.ActionName, action_name.buf);
 	linecopy(action.ErrStr, "");
 	action.ActionRequest = resp_node;
@@ -967,19 +1141,21 @@ static void handle_invoke_action(
 		goto error_handler;
 	}
 	// validate, and handle action error
-	if (action.ActionResult == NULL)
+	if (action.ActionResult == NULL && action.ActionResultText == NULL)
 	{
 		err_code = SOAP_ACTION_FAILED;
 		err_str = Soap_Action_Failed;
 		goto error_handler;
 	}
 	// send response
-	send_action_response(info, action.ActionResult, request);
+	send_action_response(info, action.ActionResult, action.ActionResultText, request);
 	err_code = 0;
 	// error handling and cleanup
 error_handler:
+	if (action.ActionResultText) free(action.ActionResultText);
 	ixmlDocument_free(action.ActionResult);
 	ixmlDocument_free(resp_node);
+	ixmlDocument_free(xml_doc);
 	action_name.buf[action_name.length] = save_char;    // restore
 	if (err_code != 0)
 	{
@@ -1023,6 +1199,13 @@ void soap_device_callback(
 	if (!has_xml_content_type(request)) goto error_handler;
 	// type of request
 	if (get_request_type(request, &action_name) != 0) goto error_handler;
+
+	if (action_name.length != 0)
+	{	// invoke action, it parses the request itself
+		handle_invoke_action(info, request, action_name);
+		return;
+	}
+
 	// parse XML
 	err_code = ixmlParseBufferEx(request->entity.buf, &xml_doc);
 	if (err_code != IXML_SUCCESS)
@@ -1034,14 +1217,8 @@ void soap_device_callback(
 		goto error_handler;
 	}
 
-	if (action_name.length == 0)
-	{	// query var
-		handle_query_variable(info, request, xml_doc);
-	}
-	else
-	{	// invoke action
-		handle_invoke_action(info, request, action_name, xml_doc);
-	}
+	// query var
+	handle_query_variable(info, request, xml_doc);
 
 	err_code = 0;               // no error
 
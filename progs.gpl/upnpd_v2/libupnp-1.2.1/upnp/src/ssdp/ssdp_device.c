@@ -80,11 +80,10 @@ void * advertiseAndReplyThread(IN void *data)
 *
 * Description:														
 *	This function handles the search request. It do the sanity checks of
-*	the request and then schedules a thread to send a random time reply (
-*	random within maximum time given by the control point to reply).
+*	the request and then queues the prepared replies to be sent at a random
+*	time (random within maximum time given by the control point to reply).
 *
-* Returns: void *
-*	1 if successful else appropriate error
+* Returns: void
 ***************************************************************************/
 void ssdp_handle_device_request(
 		IN http_message_t * hmsg,
@@ -99,9 +98,8 @@ void ssdp_handle_device_request(
 	char save_char;
 	SsdpEvent event;
 	int ret_code;
-	SsdpSearchReply *threadArg = NULL;
 	int replyTime;
-	int maxAge;
+	int window;
 
 	/* check man hdr */
 	if (httpmsg_find_hdr(hmsg, HDR_MAN, &hdr_value) == NULL ||
@@ -129,46 +127,28 @@ void ssdp_handle_device_request(
 	{
 		return; /* no info found */
 	}
-	maxAge = dev_info->MaxAge;
 
 	dtrace("ssdp_handle_device_request with Cmd %d SEARCH\n", event.Cmd);
-	dtrace("	MAX-AGE     =  %d\n", maxAge);
+	dtrace("	MAX-AGE     =  %d\n", dev_info->MaxAge);
 	dtrace("	MX          =  %d\n", event.Mx);
 	dtrace("	DeviceType  =  %s\n", event.DeviceType);
 	dtrace("	DeviceUuid  =  %s\n", event.UDN);
 	dtrace("	ServiceType =  %s\n", event.ServiceType);
 
-	threadArg = (SsdpSearchReply *) malloc(sizeof(SsdpSearchReply));
-	if (threadArg == NULL) return;
-
-	threadArg->handle = handle;
-	threadArg->dest_addr = (*dest_addr);
-	threadArg->event = event;
-	threadArg->MaxAge = maxAge;
-
-#if 0
-	TPJobInit( &job, advertiseAndReplyThread, threadArg );
-	TPJobSetFreeFunction( &job, ( free_routine ) free );
-#endif
-
 	/* Subtract a percentage from the mx
 	 * to allow for network and processing delays
 	 * (i.e. if search is for 30 seconds,
 	 * respond withing 0 - 27 seconds) */
+	window = mx;
 	if (mx >= 2)
 	{
 		mx -= MAXVAL(1, mx / MX_FUDGE_FACTOR);
 	}
 	if (mx < 1) mx = 1;
 
+	/* the replies are sent from the miniserver loop */
 	replyTime = rand() % mx;
-	imillisleep(replyTime*100);
-
-	advertiseAndReplyThread(threadArg);
-#if 0
-	TimerThreadSchedule(&gTimerThread, replyTime, REL_SEC, &job,
-			SHORT_TERM, NULL);
-#endif
+	ssdp_reply_search(handle, dest_addr, &event, window, replyTime*100);
 }
 
 /************************************************************************
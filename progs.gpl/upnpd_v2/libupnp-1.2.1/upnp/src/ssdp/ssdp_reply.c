@@ -0,0 +1,431 @@
+/* vi: set sw=4 ts=4: */
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000-2003 Intel Corporation 
+// All rights reserved. 
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met: 
+//
+// * Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer. 
+// * Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation 
+// and/or other materials provided with the distribution. 
+// * Neither name of Intel Corporation nor the names of its contributors 
+// may be used to endorse or promote products derived from this software 
+// without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR 
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifdef INCLUDE_DEVICE_APIS
+#if EXCLUDE_SSDP == 0
+#include <stdio.h>
+#include "config.h"
+#include "ssdplib.h"
+#include "upnpapi.h"
+#include "httpparser.h"
+#include "httpreadwrite.h"
+#include "statcodes.h"
+#include "unixutil.h"
+
+/* The replies to M-SEARCH are made once, when the device is advertised,
+ * and kept as complete datagrams. Answering a search only puts the current
+ * DATE into them. Searches are answered from the miniserver loop after
+ * their random delay, all replies of a search in one go over one socket. */
+
+typedef struct SSDP_REPLY
+{
+	struct SSDP_REPLY *		next;
+	enum SsdpSearchType		type;		// search that is answered with it
+	char *					target;		// ST
+	char *					text;
+	int						length;
+	int						date;		// offset of the DATE value, -1 if none
+} ssdp_reply;
+
+typedef struct SSDP_SEARCH
+{
+	struct SSDP_SEARCH *	next;
+	UpnpDevice_Handle		handle;
+	struct sockaddr_in		addr;
+	enum SsdpSearchType		type;
+	char					target[LINE_SIZE];
+	int						copies;		// sent so far
+	struct timeval			expires;	// a repeated search is dropped until then
+} ssdp_search;
+
+typedef struct SSDP_SOURCE
+{
+	struct in_addr			addr;
+	long					tokens;		// in 1/1000 searches
+	struct timeval			stamp;
+} ssdp_source;
+
+static ssdp_reply *reply_list = NULL;
+static ssdp_reply **reply_tail = &reply_list;
+static ssdp_search *search_list = NULL;
+static int search_count = 0;
+static ssdp_source source_table[SSDP_MAX_SOURCES];
+static int reply_sock = -1;
+
+static long msec_since(struct timeval *then, struct timeval *now)
+{
+	return (now->tv_sec - then->tv_sec) * 1000 + (now->tv_usec - then->tv_usec) / 1000;
+}
+
+/************************************************************************
+* Function : ssdp_reply_clear
+*
+* Description:
+*	Drops the prepared search replies.
+***************************************************************************/
+void ssdp_reply_clear(void)
+{
+	ssdp_reply *reply;
+
+	while ((reply = reply_list) != NULL)
+	{
+		reply_list = reply->next;
+		free(reply->text);
+		free(reply);
+	}
+	reply_tail = &reply_list;
+}
+
+/************************************************************************
+* Function : reply_add
+*
+* Description:
+*	Makes the reply of one search target, the same CreateServicePacket
+*	makes for MSGTYPE_REPLY.
+***************************************************************************/
+static int reply_add(
+		IN enum SsdpSearchType type,
+		IN char *nt,
+		IN char *usn,
+		IN char *location,
+		IN int duration
+		)
+{
+	ssdp_reply *reply;
+	membuffer buf;
+	char *date;
+
+	reply = (ssdp_reply *)malloc(sizeof(ssdp_reply) + strlen(nt) + 1);
+	if (reply == NULL) return UPNP_E_OUTOF_MEMORY;
+
+	membuffer_init(&buf);
+	buf.size_inc = 30;
+	if (http_MakeMessage(&buf, 1, 1,
+				"R" "sdc" "D" "s" "ssc" "S" "ssc" "ssc" "c",
+				HTTP_OK, "CACHE-CONTROL: max-age=", duration, "EXT:\r\n",
+				"LOCATION: ", location, "ST: ", nt, "USN: ", usn) != 0)
+	{
+		membuffer_destroy(&buf);
+		free(reply);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	reply->next = NULL;
+	reply->type = type;
+	reply->target = (char *)(reply + 1);
+	strcpy(reply->target, nt);
+	reply->length = buf.length;
+	reply->text = membuffer_detach(&buf);
+	membuffer_destroy(&buf);
+
+	date = strstr(reply->text, "\r\nDATE: ");
+	reply->date = date ? (date + 8 - reply->text) : -1;
+
+	*reply_tail = reply;
+	reply_tail = &reply->next;
+	return UPNP_E_SUCCESS;
+}
+
+/************************************************************************
+* Function : ssdp_reply_device
+*
+* Description:
+*	Prepares the search replies of a device.
+***************************************************************************/
+int ssdp_reply_device(
+		IN int RootDev,
+		IN char *DevType,
+		IN char *Udn,
+		IN char *Location,
+		IN int Duration
+		)
+{
+	char Mil_Usn[LINE_SIZE];
+
+	if (RootDev)
+	{
+		sprintf(Mil_Usn, "%s::upnp:rootdevice", Udn);
+		if (reply_add(SSDP_ROOTDEVICE, "upnp:rootdevice", Mil_Usn, Location, Duration) != UPNP_E_SUCCESS)
+			return UPNP_E_OUTOF_MEMORY;
+	}
+	if (reply_add(SSDP_DEVICEUDN, Udn, Udn, Location, Duration) != UPNP_E_SUCCESS)
+		return UPNP_E_OUTOF_MEMORY;
+
+	sprintf(Mil_Usn, "%s::%s", Udn, DevType);
+	return reply_add(SSDP_DEVICETYPE, DevType, Mil_Usn, Location, Duration);
+}
+
+/************************************************************************
+* Function : ssdp_reply_service
+*
+* Description:
+*	Prepares the search reply of a service.
+***************************************************************************/
+int ssdp_reply_service(
+		IN char *ServType,
+		IN char *Udn,
+		IN char *Location,
+		IN int Duration
+		)
+{
+	char Mil_Usn[LINE_SIZE];
+
+	sprintf(Mil_Usn, "%s::%s", Udn, ServType);
+	return reply_add(SSDP_SERVICE, ServType, Mil_Usn, Location, Duration);
+}
+
+/************************************************************************
+* Function : reply_match
+*
+* Description:
+*	Tells if a prepared reply answers the search, the same way
+*	AdvertiseAndReply picks its replies.
+***************************************************************************/
+static int reply_match(IN ssdp_reply *reply, IN ssdp_search *search)
+{
+	switch (search->type)
+	{
+	case SSDP_ALL:
+		return 1;
+	case SSDP_ROOTDEVICE:
+		return reply->type == SSDP_ROOTDEVICE;
+	case SSDP_DEVICEUDN:
+		return reply->type == SSDP_DEVICEUDN && strcasecmp(search->target, reply->target) == 0;
+	case SSDP_DEVICETYPE:
+	case SSDP_SERVICE:
+		return reply->type == search->type &&
+			strncasecmp(search->target, reply->target, strlen(search->target)) == 0;
+	default:
+		return 0;
+	}
+}
+
+/************************************************************************
+* Function : reply_send
+*
+* Description:
+*	Sends all replies of a search. Timer callback, it goes on with the
+*	next copy after SSDP_PAUSE and keeps the search until it expires.
+***************************************************************************/
+static void reply_send(IN void *param)
+{
+	ssdp_search *search = (ssdp_search *)param;
+	ssdp_search **prev;
+	ssdp_reply *reply;
+	membuffer date;
+	struct timeval now;
+	long left;
+	int sent = 0;
+
+	gettimeofday(&now, NULL);
+	if (search->copies == NUM_COPY)
+	{
+		left = msec_since(&now, &search->expires);
+		if (left > 0)
+		{
+			miniserv_add_timed_callback(reply_send, search, left);
+			return;
+		}
+		for (prev = &search_list; *prev; prev = &(*prev)->next)
+		{
+			if (*prev == search)
+			{
+				*prev = search->next;
+				break;
+			}
+		}
+		search_count--;
+		free(search);
+		return;
+	}
+
+	// not advertised yet, prepare them now
+	if (reply_list == NULL) AdvertiseAndReply(2, search->handle, 0, NULL, NULL, NULL, NULL, 0);
+
+	if (reply_sock < 0)
+	{
+		reply_sock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (reply_sock >= 0) Make_Socket_NoBlocking(reply_sock);
+	}
+
+	membuffer_init(&date);
+	if (http_MakeMessage(&date, 1, 1, "D") == 0 && reply_sock >= 0)
+	{
+		for (reply = reply_list; reply; reply = reply->next)
+		{
+			if (!reply_match(reply, search)) continue;
+			// "DATE: " value "\r\n", the same length every time
+			if (reply->date >= 0 && date.length > 8 &&
+				reply->text[reply->date + date.length - 8] == '\r')
+				memcpy(reply->text + reply->date, date.buf + 6, date.length - 8);
+			if (sendto(reply_sock, reply->text, reply->length, 0,
+						(struct sockaddr *)&search->addr, sizeof(struct sockaddr_in)) > 0)
+			{
+				sent++;
+			}
+		}
+	}
+	membuffer_destroy(&date);
+	dtrace("SSDP reply to %s:%d, %d datagrams\n", inet_ntoa(search->addr.sin_addr),
+			ntohs(search->addr.sin_port), sent);
+
+	search->copies++;
+	miniserv_add_timed_callback(reply_send, search, search->copies < NUM_COPY ? SSDP_PAUSE : 0);
+}
+
+/************************************************************************
+* Function : source_allow
+*
+* Description:
+*	Token bucket of each control point: SSDP_SEARCH_BURST searches and
+*	then SSDP_SEARCH_RATE per second. The least recently seen control
+*	point gives its place to a new one.
+***************************************************************************/
+static int source_allow(IN struct in_addr addr, IN struct timeval *now)
+{
+	ssdp_source *src = NULL;
+	ssdp_source *oldest = &source_table[0];
+	long elapsed;
+	int i;
+
+	for (i = 0; i < SSDP_MAX_SOURCES; i++)
+	{
+		if (source_table[i].addr.s_addr == addr.s_addr)
+		{
+			src = &source_table[i];
+			break;
+		}
+		if (timercmp(&source_table[i].stamp, &oldest->stamp, <)) oldest = &source_table[i];
+	}
+	if (src == NULL)
+	{
+		src = oldest;
+		src->addr = addr;
+		src->tokens = SSDP_SEARCH_BURST * 1000;
+	}
+	else
+	{
+		/* Idle long enough to refill, or the clock stepped back: a full
+		 * bucket. Checking the seconds first keeps msec_since() and the
+		 * product below inside a 32 bit long. */
+		elapsed = now->tv_sec - src->stamp.tv_sec;
+		if (elapsed >= 0 && elapsed <= SSDP_SEARCH_REFILL / 1000)
+			elapsed = msec_since(&src->stamp, now);
+		else
+			elapsed = -1;
+		if (elapsed < 0 || elapsed >= SSDP_SEARCH_REFILL)
+			src->tokens = SSDP_SEARCH_BURST * 1000;
+		else
+		{
+			src->tokens += elapsed * SSDP_SEARCH_RATE;
+			if (src->tokens > SSDP_SEARCH_BURST * 1000) src->tokens = SSDP_SEARCH_BURST * 1000;
+		}
+	}
+	src->stamp = *now;
+
+	if (src->tokens < 1000) return 0;
+	src->tokens -= 1000;
+	return 1;
+}
+
+/************************************************************************
+* Function : ssdp_reply_search
+*
+* Description:
+*	Queues the replies to a search.
+***************************************************************************/
+void ssdp_reply_search(
+		IN UpnpDevice_Handle Hnd,
+		IN struct sockaddr_in *DestAddr,
+		IN SsdpEvent *Evt,
+		IN int Mx,
+		IN int Delay
+		)
+{
+	ssdp_search *search;
+	enum SsdpSearchType type = Evt->RequestType;
+	char *target = "";
+	struct timeval now;
+
+	switch (type)
+	{
+	case SSDP_DEVICEUDN:
+		target = Evt->UDN;
+		if (target[0]) break;
+		// no UDN in the ST, taken as a device type search
+		type = SSDP_DEVICETYPE;
+	case SSDP_DEVICETYPE:
+		target = Evt->DeviceType;
+		break;
+	case SSDP_SERVICE:
+		target = Evt->ServiceType;
+		break;
+	default:
+		break;
+	}
+
+	gettimeofday(&now, NULL);
+	for (search = search_list; search; search = search->next)
+	{
+		if (search->addr.sin_addr.s_addr == DestAddr->sin_addr.s_addr &&
+			search->addr.sin_port == DestAddr->sin_port &&
+			search->type == type && strcmp(search->target, target) == 0)
+		{
+			dtrace("SSDP search from %s repeated\n", inet_ntoa(DestAddr->sin_addr));
+			return;
+		}
+	}
+	if (!source_allow(DestAddr->sin_addr, &now))
+	{
+		dtrace("SSDP search from %s over the rate\n", inet_ntoa(DestAddr->sin_addr));
+		return;
+	}
+	if (search_count >= SSDP_MAX_SEARCHES || strlen(target) >= LINE_SIZE) return;
+
+	search = (ssdp_search *)malloc(sizeof(ssdp_search));
+	if (search == NULL) return;
+	search->handle = Hnd;
+	search->addr = *DestAddr;
+	search->type = type;
+	strcpy(search->target, target);
+	search->copies = 0;
+	search->expires = now;
+	search->expires.tv_sec += (Mx > 0) ? Mx : 1;
+	search->next = search_list;
+	search_list = search;
+	search_count++;
+
+	miniserv_add_timed_callback(reply_send, search, Delay);
+}
+
+#endif // EXCLUDE_SSDP
+#endif // INCLUDE_DEVICE_APIS
@@ -71,7 +71,7 @@ struct SSDPSockArray
 *																	
 * Parameters:														
 *	IN int AdFlag: -1 = Send shutdown, 0 = send reply, 
-*					1 = Send Advertisement
+*					1 = Send Advertisement, 2 = prepare the search replies
 *	IN UpnpDevice_Handle Hnd: Device handle
 *	IN enum SsdpSearchType SearchType:Search type for sending replies
 *	IN struct sockaddr_in *DestAddr:Destination address
@@ -82,6 +82,7 @@ struct SSDPSockArray
 *
 * Description:														
 *	This function sends SSDP advertisements, replies and shutdown messages.
+*	The search replies are prepared again with every advertisement.
 *
 * Returns: int
 *	UPNP_E_SUCCESS if successful else appropriate error
@@ -122,6 +123,8 @@ int AdvertiseAndReply(
 	/* get server info */
 	get_sdk_info(SERVER);
 
+	if (AdFlag) ssdp_reply_clear();
+
 	// parse the device list and send advertisements/replies 
 	for (i=0;; i++)
 	{
@@ -157,8 +160,9 @@ int AdvertiseAndReply(
 		if (AdFlag)
 		{
 			// send the device advertisement 
-			if (AdFlag==1)	DeviceAdvertisement(devType, i == 0, UDNstr, SInfo->DescURL, Exp);
-			else			DeviceShutdown(devType, i == 0, UDNstr, SERVER, SInfo->DescURL, Exp);
+			if (AdFlag > 0)		ssdp_reply_device(i == 0, devType, UDNstr, SInfo->DescURL, defaultExp);
+			if (AdFlag == 1)	DeviceAdvertisement(devType, i == 0, UDNstr, SInfo->DescURL, Exp);
+			if (AdFlag == -1)	DeviceShutdown(devType, i == 0, UDNstr, SERVER, SInfo->DescURL, Exp);
 		}
 		else
 		{
@@ -237,8 +241,9 @@ int AdvertiseAndReply(
 
 			if (AdFlag)
 			{
-				if (AdFlag==1)	ServiceAdvertisement(UDNstr, servType, SInfo->DescURL, Exp);
-				else			ServiceShutdown(UDNstr, servType, SInfo->DescURL, Exp );
+				if (AdFlag > 0)		ssdp_reply_service(servType, UDNstr, SInfo->DescURL, defaultExp);
+				if (AdFlag == 1)	ServiceAdvertisement(UDNstr, servType, SInfo->DescURL, Exp);
+				if (AdFlag == -1)	ServiceShutdown(UDNstr, servType, SInfo->DescURL, Exp );
 			}
 			else
 			{
@@ -19,12 +19,7 @@ static void action(const char * udn, const char * serviceid, void * param)
 {
 	struct Upnp_Action_Request * req = (struct Upnp_Action_Request *)param;
 	//dtrace("action(%s, %s, %s)\n", udn, serviceid, req->ActionName);
-
-	if (strcmp(req->ActionName, "GetCommonLinkProperties")==0)
-	{
-		lrgbin_system("rgdb -s /runtime/switch/getlinktype 1");
-	}
-
+	/* GetCommonLinkProperties asks for the link type itself, see igdaction.c */
 	build_action_result(req, "urn:schemas-upnp-org:service:WANCommonInterfaceConfig:1");
 }
 
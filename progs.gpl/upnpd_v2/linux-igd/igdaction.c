@@ -0,0 +1,415 @@
+/* vi: set sw=4 ts=4: */
+/* igdaction.c
+ *
+ * Native handlers for the WANIPConnection and WANCommonInterfaceConfig
+ * actions control points poll and for the port mapping actions. They follow
+ * the upnpd action templates, but answer from the cached xmldb view in
+ * igdview.c instead of running a template through xmldb and a shell for
+ * every call. Actions without a handler here still go to the templates.
+ * The port mappings are kept in the table in igdmap.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <upnp.h>
+#include <ixml.h>
+
+#include "upnpigd.h"
+#include "lrgbin.h"
+#include "igdview.h"
+#include "igdmap.h"
+
+#define RESULT_SIZE		GLOBAL_BUFFER_SIZE
+#define VALUE_SIZE		256
+
+struct action_result
+{
+	int len;
+	char buf[RESULT_SIZE];
+};
+
+typedef int (*native_handler)(struct action_args * args, struct action_result * r, int wid);
+
+struct native_action
+{
+	const char *	name;
+	native_handler	handler;
+};
+
+struct native_service
+{
+	const char *					serviceid;
+	int								wid;
+	const struct native_action *	actions;
+};
+
+/**************************************************************************/
+
+static void result_printf(struct action_result * r, const char * format, ...)
+{
+	va_list marker;
+	int n;
+
+	if (r->len >= RESULT_SIZE) return;
+	va_start(marker, format);
+	n = vsnprintf(r->buf + r->len, RESULT_SIZE - r->len, format, marker);
+	va_end(marker);
+	if (n < 0 || r->len + n >= RESULT_SIZE)	r->len = RESULT_SIZE;
+	else									r->len += n;
+}
+
+/* <name>value</name>, the values may come from control points. */
+static void result_arg(struct action_result * r, const char * name, const char * value)
+{
+	result_printf(r, "\n<%s>", name);
+	for (; *value && r->len < RESULT_SIZE; value++)
+	{
+		switch (*value)
+		{
+		case '&':	result_printf(r, "&amp;"); break;
+		case '<':	result_printf(r, "&lt;"); break;
+		case '>':	result_printf(r, "&gt;"); break;
+		case '"':	result_printf(r, "&quot;"); break;
+		case '\'':	result_printf(r, "&apos;"); break;
+		default:
+			if (r->len < RESULT_SIZE - 1) r->buf[r->len++] = *value;
+			else r->len = RESULT_SIZE;
+			break;
+		}
+	}
+	result_printf(r, "</%s>", name);
+}
+
+/* a WAN counter, "0" until it has been read once */
+static void result_stat(struct action_result * r, const char * name, int router, const char * node)
+{
+	char value[VALUE_SIZE];
+
+	if (!router || igdview_get(value, sizeof(value), IGD_TTL_STATUS, "%s", node) == 0) strcpy(value, "0");
+	result_arg(r, name, value);
+}
+
+static int router_on(void)
+{
+	return igdview_getint(IGD_TTL_STATUS, "/runtime/router/enable") == 1;
+}
+
+/**************************************************************************/
+/* Port mappings */
+
+static int valid_port(const char * port)
+{
+	int value = 0;
+
+	if (!*port) return 0;
+	for (; *port; port++)
+	{
+		if (*port < '0' || *port > '9') return 0;
+		value = value * 10 + (*port - '0');
+		if (value > 65535) return 0;
+	}
+	return value > 0;
+}
+
+/* these strings end up in the NAT rules */
+static int valid_ipaddr(const char * ipaddr)
+{
+	struct in_addr addr;
+
+	if (strlen(ipaddr) >= IGDMAP_ADDR_SIZE) return 0;
+	if (strspn(ipaddr, "0123456789.") != strlen(ipaddr)) return 0;
+	return inet_aton(ipaddr, &addr);
+}
+
+static int proto_num(const char * protocol)
+{
+	return strcmp(protocol, "TCP")==0 ? 1 : 2;
+}
+
+static struct igdmap_entry * find_mapping(struct action_args * args, int wid)
+{
+	return igdmap_find(wid, action_arg(args, "NewRemoteHost"), atoi(action_arg(args, "NewExternalPort")),
+			proto_num(action_arg(args, "NewProtocol")));
+}
+
+static void result_int(struct action_result * r, const char * name, unsigned long value)
+{
+	char buff[16];
+
+	sprintf(buff, "%lu", value);
+	result_arg(r, name, buff);
+}
+
+static void result_mapping(struct action_result * r, struct igdmap_entry * e)
+{
+	result_int(r, "NewInternalPort", e->f.intport);
+	result_arg(r, "NewInternalClient", e->f.client);
+	result_int(r, "NewEnabled", e->f.enabled);
+	result_arg(r, "NewPortMappingDescription", e->f.desc);
+	result_int(r, "NewLeaseDuration", igdmap_lease(e));
+}
+
+/**************************************************************************/
+/* WANIPConnection */
+
+static int add_port_mapping(struct action_args * args, struct action_result * r, int wid)
+{
+	const char * remote = action_arg(args, "NewRemoteHost");
+	const char * extport = action_arg(args, "NewExternalPort");
+	const char * protocol = action_arg(args, "NewProtocol");
+	const char * intport = action_arg(args, "NewInternalPort");
+	const char * client = action_arg(args, "NewInternalClient");
+	struct igdmap_fields f;
+	struct igdmap_entry * e;
+
+	if (!router_on()) return 501;
+	if (!valid_port(extport) || !*protocol || !valid_port(intport) || !valid_ipaddr(client)) return 402;
+	if (*remote && !valid_ipaddr(remote)) return 402;
+
+	memset(&f, 0, sizeof(f));
+	f.enabled = strcmp(action_arg(args, "NewEnabled"), "1")==0;
+	f.proto = proto_num(protocol);
+	f.extport = atoi(extport);
+	f.intport = atoi(intport);
+	snprintf(f.remote, sizeof(f.remote), "%s", remote);
+	snprintf(f.client, sizeof(f.client), "%s", client);
+	snprintf(f.desc, sizeof(f.desc), "%s", action_arg(args, "NewPortMappingDescription"));
+	if (f.enabled) igdview_get(f.wanip, sizeof(f.wanip), IGD_TTL_STATUS, "/runtime/wan/inf:%d/ip", wid);
+
+	/* the same client may add its mapping again to renew the lease */
+	e = igdmap_find(wid, f.remote, f.extport, f.proto);
+	if (e && strcmp(e->f.client, f.client)) return 718;
+
+	if (igdmap_set(wid, &f, strtoul(action_arg(args, "NewLeaseDuration"), NULL, 10)) < 0) return 501;
+	return 200;
+}
+
+static int delete_port_mapping(struct action_args * args, struct action_result * r, int wid)
+{
+	struct igdmap_entry * e;
+
+	if (!router_on()) return 501;
+
+	e = find_mapping(args, wid);
+	if (e) igdmap_delete(e);
+	return 200;
+}
+
+static int get_connection_type_info(struct action_args * args, struct action_result * r, int wid)
+{
+	const char * type = router_on() ? "IP_Routed" : "IP_Bridged";
+
+	result_arg(r, "NewConnectionType", type);
+	result_arg(r, "NewPossibleConnectionTypes", type);
+	return 200;
+}
+
+static int get_external_ip_address(struct action_args * args, struct action_result * r, int wid)
+{
+	char ipaddr[VALUE_SIZE];
+
+	if (router_on())	igdview_get(ipaddr, sizeof(ipaddr), IGD_TTL_STATUS, "/runtime/wan/inf:%d/ip", wid);
+	else				igdview_get(ipaddr, sizeof(ipaddr), IGD_TTL_STATUS, "/lan/ethernet/ip");
+	result_arg(r, "NewExternalIPAddress", ipaddr);
+	return 200;
+}
+
+static int get_generic_port_mapping_entry(struct action_args * args, struct action_result * r, int wid)
+{
+	struct igdmap_entry * e;
+
+	if (!router_on()) return 501;
+
+	e = igdmap_get(wid, atoi(action_arg(args, "NewPortMappingIndex")));
+	if (!e) return 713;
+
+	result_arg(r, "NewRemoteHost", e->f.remote);
+	result_int(r, "NewExternalPort", e->f.extport);
+	result_arg(r, "NewProtocol", e->f.proto == 1 ? "TCP" : "UDP");
+	result_mapping(r, e);
+	return 200;
+}
+
+static int get_nat_rsip_status(struct action_args * args, struct action_result * r, int wid)
+{
+	result_arg(r, "NewRSIPAvailable", "0");
+	result_arg(r, "NewNATEnabled", router_on() ? "1" : "0");
+	return 200;
+}
+
+static int get_specific_port_mapping_entry(struct action_args * args, struct action_result * r, int wid)
+{
+	struct igdmap_entry * e;
+
+	if (!router_on()) return 501;
+
+	e = find_mapping(args, wid);
+	if (!e) return 714;
+
+	result_mapping(r, e);
+	return 200;
+}
+
+static int get_status_info(struct action_args * args, struct action_result * r, int wid)
+{
+	char value[VALUE_SIZE];
+	int uptime;
+
+	if (router_on())
+	{
+		igdview_get(value, sizeof(value), IGD_TTL_STATUS, "/runtime/wan/inf:%d/connectstatus", wid);
+		result_arg(r, "NewConnectionStatus", strcmp(value, "connected")==0 ? "Connected" : "Disconnected");
+	}
+	else
+	{
+		result_arg(r, "NewConnectionStatus", "Connected");
+	}
+	result_arg(r, "NewLastConnectionError", "ERROR_NONE");
+
+	uptime = igdview_getint(IGD_TTL_STATUS, "/runtime/sys/uptime") -
+			 igdview_getint(IGD_TTL_STATUS, "/runtime/wan/inf:%d/uptime", wid);
+	sprintf(value, "%d", uptime);
+	result_arg(r, "NewUptime", value);
+	return 200;
+}
+
+static const struct native_action wanipconn_actions[] =
+{
+	{ "AddPortMapping",					add_port_mapping },
+	{ "DeletePortMapping",				delete_port_mapping },
+	{ "GetConnectionTypeInfo",			get_connection_type_info },
+	{ "GetExternalIPAddress",			get_external_ip_address },
+	{ "GetGenericPortMappingEntry",		get_generic_port_mapping_entry },
+	{ "GetNATRSIPStatus",				get_nat_rsip_status },
+	{ "GetSpecificPortMappingEntry",	get_specific_port_mapping_entry },
+	{ "GetStatusInfo",					get_status_info },
+	{ NULL, NULL }
+};
+
+/**************************************************************************/
+/* WANCommonInterfaceConfig */
+
+static int get_common_link_properties(struct action_args * args, struct action_result * r, int wid)
+{
+	char value[VALUE_SIZE];
+
+	/* ask for the link type to be refreshed before reading it again */
+	if (igdview_stale(IGD_TTL_STATUS, "/runtime/wan/inf:1/linkType"))
+		igdview_set("/runtime/switch/getlinktype", "1");
+
+	result_arg(r, "NewWANAccessType", "Ethernet");
+	result_arg(r, "NewLayer1UpstreamMaxBitRate", "100000000");
+	result_arg(r, "NewLayer1DownstreamMaxBitRate", "100000000");
+	igdview_get(value, sizeof(value), IGD_TTL_STATUS, "/runtime/wan/inf:1/linkType");
+	result_arg(r, "NewPhysicalLinkStatus", strcmp(value, "1")==0 ? "Up" : "Down");
+	return 200;
+}
+
+static int get_total_bytes_received(struct action_args * args, struct action_result * r, int wid)
+{
+	result_stat(r, "NewTotalBytesReceived", router_on(), "/runtime/stats/wan/inf:1/rx/bytes");
+	return 200;
+}
+
+static int get_total_bytes_sent(struct action_args * args, struct action_result * r, int wid)
+{
+	result_stat(r, "NewTotalBytesSent", router_on(), "/runtime/stats/wan/inf:1/tx/bytes");
+	return 200;
+}
+
+static int get_total_packets_received(struct action_args * args, struct action_result * r, int wid)
+{
+	result_stat(r, "NewTotalPacketsReceived", router_on(), "/runtime/stats/wan/inf:1/rx/packets");
+	return 200;
+}
+
+static int get_total_packets_sent(struct action_args * args, struct action_result * r, int wid)
+{
+	result_stat(r, "NewTotalPacketsSent", router_on(), "/runtime/stats/wan/inf:1/tx/packets");
+	return 200;
+}
+
+static int get_ics_statistics(struct action_args * args, struct action_result * r, int wid)
+{
+	char value[32];
+	int router = router_on();
+
+	result_stat(r, "TotalBytesSent", router, "/runtime/stats/wan/inf:1/tx/bytes");
+	result_stat(r, "TotalBytesReceived", router, "/runtime/stats/wan/inf:1/rx/bytes");
+	result_stat(r, "TotalPacketsSent", router, "/runtime/stats/wan/inf:1/tx/packets");
+	result_stat(r, "TotalPacketsReceived", router, "/runtime/stats/wan/inf:1/rx/packets");
+	result_arg(r, "Layer1DownstreamMaxBitRate", "100000000");
+	sprintf(value, "%d", igdview_getint(IGD_TTL_STATUS, "/runtime/sys/uptime") -
+			igdview_getint(IGD_TTL_STATUS, "/runtime/wan/inf:1/uptime"));
+	result_arg(r, "Uptime", value);
+	return 200;
+}
+
+static const struct native_action wancommonifc_actions[] =
+{
+	{ "GetCommonLinkProperties",		get_common_link_properties },
+	{ "GetTotalBytesReceived",			get_total_bytes_received },
+	{ "GetTotalBytesSent",				get_total_bytes_sent },
+	{ "GetTotalPacketsReceived",		get_total_packets_received },
+	{ "GetTotalPacketsSent",			get_total_packets_sent },
+	{ "X_GetICSStatistics",				get_ics_statistics },
+	{ NULL, NULL }
+};
+
+/**************************************************************************/
+
+static const struct native_service native_services[] =
+{
+	{ "urn:upnp-org:serviceId:WANIPConn1",		1, wanipconn_actions },
+	{ "urn:upnp-org:serviceId:WANIPConn2",		2, wanipconn_actions },
+	{ "urn:upnp-org:serviceId:WANCommonIFC1",	1, wancommonifc_actions },
+	{ NULL, 0, NULL }
+};
+
+/* Returns 0 if the action was answered here, -1 if it should go to the
+ * action template. */
+int native_action_result(struct Upnp_Action_Request * req, const char * service)
+{
+	const struct native_service * svc;
+	const struct native_action * act;
+	struct action_args args;
+	struct action_result r;
+	int ErrCode;
+
+	for (svc = native_services; svc->serviceid; svc++)
+	{
+		if (strcmp(req->ServiceID, svc->serviceid)==0) break;
+	}
+	if (!svc->serviceid) return -1;
+
+	for (act = svc->actions; act->name; act++)
+	{
+		if (strcmp(req->ActionName, act->name)==0) break;
+	}
+	if (!act->name) return -1;
+
+	get_action_args(req, &args);
+	r.len = 0;
+	result_printf(&r, "<u:%sResponse xmlns:u=\"%s\">", req->ActionName, service);
+	ErrCode = act->handler(&args, &r, svc->wid);
+	if (ErrCode == 200)
+	{
+		result_printf(&r, "</u:%sResponse>", req->ActionName);
+		if (r.len >= RESULT_SIZE) ErrCode = 501;
+	}
+	action_error(req, ErrCode);
+	if (ErrCode == 200)
+	{
+		req->ErrCode = UPNP_E_SUCCESS;
+		/* the values are escaped by result_arg(), the text goes out as is */
+		req->ActionResultText = strdup(r.buf);
+	}
+	return 0;
+}
@@ -0,0 +1,522 @@
+/* vi: set sw=4 ts=4: */
+/* igdmap.c
+ *
+ * Port mapping table. The entries of a WAN connection are kept in an array
+ * in the order GetGenericPortMappingEntry numbers them, and hashed on
+ * (remote host, external port, protocol) for the other actions. The table
+ * is read from xmldb the first time it is used, so upnpd can be restarted
+ * without losing the mappings, and written back IGDMAP_PERSIST_MSEC after a
+ * change. Only the nodes that differ from what xmldb already holds are
+ * written.
+ *
+ * Entries with a lease sit in a timer wheel of one second slots, an entry
+ * expiring at second T in slot (T % IGDMAP_WHEEL_SIZE). The wheel only
+ * turns while there are leases. Seconds are the system uptime, the same
+ * clock the "expire" node in xmldb is kept in.
+ *
+ * The DNAT rules of the changes made within IGDMAP_FW_MSEC go to the
+ * kernel in one "iptables-restore --noflush", one table replace instead of
+ * one per rule. Forwarding needs no rule of its own, FOR_DNAT accepts all
+ * DNATed connections.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/sysinfo.h>
+
+#include <upnp.h>
+
+#include "lrgbin.h"
+#include "igdview.h"
+#include "igdmap.h"
+
+#define ENTRY			"/runtime/upnp/wan:%d/entry:%d"
+
+#define FW_RULES		"/var/run/upnp_nat.rules"
+#define FW_SCRIPT		"/var/run/upnp_fw.sh"
+
+#define HASH_MASK		(IGDMAP_HASH_SIZE - 1)
+#define WHEEL_MASK		(IGDMAP_WHEEL_SIZE - 1)
+
+struct igdmap_table
+{
+	int						loaded;
+	int						count;
+	int						size;
+	struct igdmap_entry **	order;		/* by index */
+	struct igdmap_fields *	image;		/* what xmldb holds, by index */
+	int						valid;		/* image[0 .. valid-1] is known */
+	int						stored;		/* entries in xmldb */
+	struct igdmap_entry *	hash[IGDMAP_HASH_SIZE];
+};
+
+static struct igdmap_table map_tables[IGDMAP_MAX_WAN];
+static int persist_pending = 0;
+
+static struct igdmap_entry * wheel[IGDMAP_WHEEL_SIZE];
+static unsigned long wheel_last = 0;	/* the last second looked at */
+static int wheel_running = 0;
+static int leased = 0;
+
+static char * fw_batch = NULL;
+static size_t fw_len = 0;
+static size_t fw_size = 0;
+
+static void map_remove(struct igdmap_entry * e);
+
+static unsigned long map_uptime(void)
+{
+	struct sysinfo info;
+
+	sysinfo(&info);
+	return (unsigned long)info.uptime;
+}
+
+/**************************************************************************/
+/* NAT rules */
+
+static void fw_commit(void * param)
+{
+	FILE * fp;
+	char * line;
+	char * end;
+
+	if (fw_len == 0) return;
+	fp = fopen(FW_RULES, "w");
+	if (!fp)
+	{
+		dtrace("Can not write %s !!\n", FW_RULES);
+		fw_len = 0;
+		return;
+	}
+	fputs("*nat\n", fp);
+	fwrite(fw_batch, 1, fw_len, fp);
+	fputs("COMMIT\n", fp);
+	fclose(fp);
+
+	if (lrgbin_system("iptables-restore --noflush < %s", FW_RULES) != 0)
+	{
+		/* iptables-restore drops the whole batch when one rule fails, a
+		 * -D for a rule the firewall scripts have flushed already, so the
+		 * rules are tried one by one. */
+		dtrace("iptables-restore failed, one rule at a time.\n");
+		fp = fopen(FW_SCRIPT, "w");
+		if (fp)
+		{
+			fputs("#!/bin/sh\n", fp);
+			for (line = fw_batch; line < fw_batch + fw_len; line = end + 1)
+			{
+				end = memchr(line, '\n', fw_batch + fw_len - line);
+				fprintf(fp, "iptables -t nat %.*s\n", (int)(end - line), line);
+			}
+			fclose(fp);
+			lrgbin_system("sh %s > /dev/console", FW_SCRIPT);
+		}
+	}
+	fw_len = 0;
+}
+
+/* Queue "-A ..." or "-D ...". A -D of a rule added in the same batch takes
+ * the -A out instead. */
+static void fw_queue(char op, const struct igdmap_fields * f)
+{
+	char line[MAX_CMD_LEN];
+	char * batch;
+	char * p;
+	size_t len;
+
+	len = snprintf(line, sizeof(line), "-%c PRE_UPNP%s%s -p %s -d %s --dport %d -j DNAT --to %s:%d\n",
+			op, f->remote[0] ? " -s " : "", f->remote, f->proto == 1 ? "tcp" : "udp",
+			f->wanip, f->extport, f->client, f->intport);
+	dtrace("%s", line);
+
+	if (op == 'D')
+	{
+		line[1] = 'A';
+		for (p = fw_batch; p && p + len <= fw_batch + fw_len; p = memchr(p, '\n', fw_batch + fw_len - p) + 1)
+		{
+			if (memcmp(p, line, len)) continue;
+			memmove(p, p + len, fw_batch + fw_len - p - len);
+			fw_len -= len;
+			return;
+		}
+		line[1] = 'D';
+	}
+
+	if (fw_len + len > fw_size)
+	{
+		batch = realloc(fw_batch, fw_len + len + MAX_CMD_LEN);
+		if (!batch) return;
+		fw_batch = batch;
+		fw_size = fw_len + len + MAX_CMD_LEN;
+	}
+	if (fw_len == 0) UpnpScheduleCallback(fw_commit, NULL, IGDMAP_FW_MSEC);
+	memcpy(fw_batch + fw_len, line, len);
+	fw_len += len;
+}
+
+/**************************************************************************/
+/* xmldb */
+
+static void persist_field(int wid, int index, const char * name, const char * value)
+{
+	char node[128];
+
+	snprintf(node, sizeof(node), ENTRY "/%s", wid, index, name);
+	if (igdview_put(node, value) < 0) persist_pending = -1;
+}
+
+static void persist_int(int wid, int index, const char * name, unsigned long value)
+{
+	char buff[16];
+
+	sprintf(buff, "%lu", value);
+	persist_field(wid, index, name, buff);
+}
+
+/* Write the fields of the entry at 'index' which differ from what xmldb
+ * holds there. */
+static void persist_entry(int wid, struct igdmap_table * t, int index)
+{
+	const struct igdmap_fields * f = &t->order[index]->f;
+	struct igdmap_fields * old = &t->image[index];
+	int all = index >= t->valid || index >= t->stored;
+	int i = index + 1;
+
+	if (all || f->enabled != old->enabled)			persist_int(wid, i, "enable", f->enabled);
+	if (all || strcmp(f->remote, old->remote))		persist_field(wid, i, "remoteip", f->remote);
+	if (all || strcmp(f->client, old->client))		persist_field(wid, i, "ip", f->client);
+	if (all || f->intport != old->intport)			persist_int(wid, i, "port1", f->intport);
+	if (all || f->extport != old->extport)			persist_int(wid, i, "port2", f->extport);
+	if (all || f->proto != old->proto)				persist_int(wid, i, "protocol", f->proto);
+	if (all || strcmp(f->desc, old->desc))			persist_field(wid, i, "description", f->desc);
+	if (all || strcmp(f->wanip, old->wanip))		persist_field(wid, i, "wanip", f->wanip);
+	if (all || f->expires != old->expires)			persist_int(wid, i, "expire", f->expires);
+	*old = *f;
+}
+
+static void map_persist(void * param)
+{
+	struct igdmap_table * t;
+	char node[128];
+	int wid, i;
+
+	persist_pending = 0;
+	for (wid=1; wid<=IGDMAP_MAX_WAN; wid++)
+	{
+		t = &map_tables[wid - 1];
+		if (!t->loaded) continue;
+
+		for (i=0; i<t->count && persist_pending == 0; i++) persist_entry(wid, t, i);
+		if (persist_pending)
+		{
+			/* try again later, from the entry that failed */
+			t->valid = i - 1;
+			if (t->stored < i) t->stored = i;
+			break;
+		}
+		t->valid = t->count;
+		if (t->stored < t->count) t->stored = t->count;
+
+		/* from the end, xmldb renumbers the entries after a deleted one */
+		for (; t->stored > t->count; t->stored--)
+		{
+			snprintf(node, sizeof(node), ENTRY, wid, t->stored);
+			if (igdview_del(node) < 0) break;
+		}
+		if (t->stored > t->count)
+		{
+			persist_pending = -1;
+			break;
+		}
+	}
+	if (persist_pending) UpnpScheduleCallback(map_persist, NULL, IGDMAP_PERSIST_MSEC);
+}
+
+static void map_dirty(void)
+{
+	if (persist_pending) return;
+	persist_pending = 1;
+	UpnpScheduleCallback(map_persist, NULL, IGDMAP_PERSIST_MSEC);
+}
+
+/**************************************************************************/
+/* lease timer */
+
+static void wheel_unlink(struct igdmap_entry * e)
+{
+	if (!e->wprev) return;
+	*e->wprev = e->wnext;
+	if (e->wnext) e->wnext->wprev = e->wprev;
+	e->wnext = NULL;
+	e->wprev = NULL;
+	leased--;
+}
+
+static void wheel_tick(void * param)
+{
+	struct igdmap_entry * e;
+	struct igdmap_entry * next;
+	unsigned long now = map_uptime();
+	unsigned long sec;
+	int slots;
+
+	slots = now - wheel_last >= IGDMAP_WHEEL_SIZE ? IGDMAP_WHEEL_SIZE : (int)(now - wheel_last);
+	for (sec = now - slots + 1; slots > 0; slots--, sec++)
+	{
+		for (e = wheel[sec & WHEEL_MASK]; e; e = next)
+		{
+			next = e->wnext;
+			if (e->f.expires > now) continue;	/* a later revolution */
+			dtrace("port mapping %d/%s expired\n", e->f.extport, e->f.proto == 1 ? "TCP" : "UDP");
+			map_remove(e);
+		}
+	}
+	wheel_last = now;
+	if (leased > 0)	UpnpScheduleCallback(wheel_tick, NULL, 1000);
+	else			wheel_running = 0;
+}
+
+static void wheel_link(struct igdmap_entry * e)
+{
+	struct igdmap_entry ** slot = &wheel[e->f.expires & WHEEL_MASK];
+
+	if (!wheel_running)
+	{
+		wheel_running = 1;
+		wheel_last = map_uptime();
+		UpnpScheduleCallback(wheel_tick, NULL, 1000);
+	}
+	leased++;
+	e->wprev = slot;
+	e->wnext = *slot;
+	if (*slot) (*slot)->wprev = &e->wnext;
+	*slot = e;
+}
+
+/**************************************************************************/
+
+static unsigned int map_hashfn(const char * remote, int extport, int proto)
+{
+	unsigned int h = extport * 2 + proto;
+
+	while (*remote) h = h * 31 + (unsigned char)*remote++;
+	return h & HASH_MASK;
+}
+
+static void hash_unlink(struct igdmap_table * t, struct igdmap_entry * e)
+{
+	struct igdmap_entry ** prev;
+
+	prev = &t->hash[map_hashfn(e->f.remote, e->f.extport, e->f.proto)];
+	for (; *prev; prev = &(*prev)->hnext)
+	{
+		if (*prev != e) continue;
+		*prev = e->hnext;
+		return;
+	}
+}
+
+static int map_grow(struct igdmap_table * t)
+{
+	struct igdmap_entry ** order;
+	struct igdmap_fields * image;
+	int size = t->size ? t->size * 2 : 16;
+
+	order = realloc(t->order, size * sizeof(*order));
+	if (!order) return -1;
+	t->order = order;
+	image = realloc(t->image, size * sizeof(*image));
+	if (!image) return -1;
+	t->image = image;
+	t->size = size;
+	return 0;
+}
+
+/* A new entry at the end of the table. The NAT rule and xmldb are up to
+ * the caller. */
+static struct igdmap_entry * map_append(int wid, const struct igdmap_fields * f)
+{
+	struct igdmap_table * t = &map_tables[wid - 1];
+	struct igdmap_entry * e;
+	unsigned int h;
+
+	if (t->count >= IGDMAP_MAX_ENTRIES) return NULL;
+	if (t->count >= t->size && map_grow(t) < 0) return NULL;
+	e = (struct igdmap_entry *)calloc(1, sizeof(struct igdmap_entry));
+	if (!e) return NULL;
+
+	e->f = *f;
+	e->wid = wid;
+	e->index = t->count;
+	t->order[t->count++] = e;
+	h = map_hashfn(f->remote, f->extport, f->proto);
+	e->hnext = t->hash[h];
+	t->hash[h] = e;
+	if (f->expires) wheel_link(e);
+	return e;
+}
+
+static void load_field(char * buff, size_t size, int wid, int index, const char * name)
+{
+	igdview_get(buff, size, 0, ENTRY "/%s", wid, index, name);
+}
+
+static int load_int(int wid, int index, const char * name)
+{
+	char buff[16];
+
+	load_field(buff, sizeof(buff), wid, index, name);
+	return atoi(buff);
+}
+
+/* Read the entries upnpd left in xmldb when it was started before. */
+static struct igdmap_table * map_table(int wid)
+{
+	struct igdmap_table * t;
+	struct igdmap_fields f;
+	unsigned long now;
+	char node[64];
+	int i, count;
+
+	if (wid < 1 || wid > IGDMAP_MAX_WAN) return NULL;
+	t = &map_tables[wid - 1];
+	if (t->loaded) return t;
+	t->loaded = 1;
+
+	now = map_uptime();
+	count = igdview_getint(0, "/runtime/upnp/wan:%d/entry#", wid);
+	for (i=1; i<=count; i++)
+	{
+		memset(&f, 0, sizeof(f));
+		f.enabled = load_int(wid, i, "enable");
+		f.proto = load_int(wid, i, "protocol");
+		f.extport = load_int(wid, i, "port2");
+		f.intport = load_int(wid, i, "port1");
+		f.expires = load_int(wid, i, "expire");
+		load_field(f.remote, sizeof(f.remote), wid, i, "remoteip");
+		load_field(f.client, sizeof(f.client), wid, i, "ip");
+		load_field(f.wanip, sizeof(f.wanip), wid, i, "wanip");
+		load_field(f.desc, sizeof(f.desc), wid, i, "description");
+		if (!map_append(wid, &f)) break;
+		t->image[i - 1] = f;
+	}
+	t->valid = t->count;
+	t->stored = count;
+	snprintf(node, sizeof(node), "/runtime/upnp/wan:%d/", wid);
+	igdview_flush(node);
+
+	/* the leases that ran out while upnpd was not there */
+	for (i = t->count - 1; i >= 0; i--)
+	{
+		if (t->order[i]->f.expires && t->order[i]->f.expires <= now) map_remove(t->order[i]);
+	}
+	if (t->stored != t->count) map_dirty();
+	return t;
+}
+
+/* Take an entry out of the table and the kernel. */
+static void map_remove(struct igdmap_entry * e)
+{
+	struct igdmap_table * t = &map_tables[e->wid - 1];
+	int i;
+
+	if (e->f.wanip[0]) fw_queue('D', &e->f);
+	hash_unlink(t, e);
+	wheel_unlink(e);
+	for (i = e->index + 1; i < t->count; i++)
+	{
+		t->order[i - 1] = t->order[i];
+		t->order[i - 1]->index = i - 1;
+	}
+	t->count--;
+	map_dirty();
+	free(e);
+}
+
+/**************************************************************************/
+
+int igdmap_count(int wid)
+{
+	struct igdmap_table * t = map_table(wid);
+	return t ? t->count : 0;
+}
+
+struct igdmap_entry * igdmap_get(int wid, int index)
+{
+	struct igdmap_table * t = map_table(wid);
+
+	if (!t || index < 0 || index >= t->count) return NULL;
+	return t->order[index];
+}
+
+/* The entries loaded from xmldb may hold the same key more than once, the
+ * last one is found, as the action templates did. */
+struct igdmap_entry * igdmap_find(int wid, const char * remote, int extport, int proto)
+{
+	struct igdmap_table * t = map_table(wid);
+	struct igdmap_entry * e;
+	struct igdmap_entry * found = NULL;
+
+	if (!t) return NULL;
+	for (e = t->hash[map_hashfn(remote, extport, proto)]; e; e = e->hnext)
+	{
+		if (e->f.extport != extport || e->f.proto != proto || strcmp(e->f.remote, remote)) continue;
+		if (!found || e->index > found->index) found = e;
+	}
+	return found;
+}
+
+/* Add the mapping, or change the one with the same key. There is a DNAT
+ * rule for it when f->wanip is set. 'lease' is in seconds, 0 for none.
+ * Returns -1 when the table is full. */
+int igdmap_set(int wid, const struct igdmap_fields * f, unsigned long lease)
+{
+	struct igdmap_table * t = map_table(wid);
+	struct igdmap_fields n = *f;
+	struct igdmap_entry * e;
+
+	if (!t) return -1;
+	if (lease > IGDMAP_MAX_LEASE) lease = IGDMAP_MAX_LEASE;
+	n.expires = lease ? map_uptime() + lease : 0;
+
+	e = igdmap_find(wid, f->remote, f->extport, f->proto);
+	if (!e)
+	{
+		e = map_append(wid, &n);
+		if (!e) return -1;
+		if (n.wanip[0]) fw_queue('A', &n);
+		map_dirty();
+		return 0;
+	}
+
+	if (e->f.enabled != n.enabled || e->f.intport != n.intport ||
+		strcmp(e->f.client, n.client) || strcmp(e->f.wanip, n.wanip))
+	{
+		if (e->f.wanip[0]) fw_queue('D', &e->f);
+		if (n.wanip[0]) fw_queue('A', &n);
+	}
+	wheel_unlink(e);
+	e->f = n;
+	if (n.expires) wheel_link(e);
+	map_dirty();
+	return 0;
+}
+
+void igdmap_delete(struct igdmap_entry * e)
+{
+	map_remove(e);
+}
+
+/* Seconds left of the lease, 0 for none. */
+unsigned long igdmap_lease(const struct igdmap_entry * e)
+{
+	unsigned long now;
+
+	if (!e->f.expires) return 0;
+	now = map_uptime();
+	return e->f.expires > now ? e->f.expires - now : 1;
+}
@@ -0,0 +1,53 @@
+/* vi: set sw=4 ts=4: */
+#ifndef __IGDMAP_H__
+#define __IGDMAP_H__
+
+/* The port mapping table of each WAN connection. upnpd is the only writer
+ * of /runtime/upnp/wan:N/entry, so the table is kept here and written back
+ * to xmldb later; the NAT rules of a burst of changes go to the kernel in
+ * one iptables-restore. */
+
+#define IGDMAP_MAX_WAN			2
+#define IGDMAP_MAX_ENTRIES		256
+#define IGDMAP_MAX_LEASE		604800	/* one week, in seconds */
+
+#define IGDMAP_HASH_SIZE		64		/* power of 2 */
+#define IGDMAP_WHEEL_SIZE		64		/* one second slots, power of 2 */
+
+#define IGDMAP_ADDR_SIZE		16
+#define IGDMAP_DESC_SIZE		128
+
+#define IGDMAP_FW_MSEC			100		/* NAT rules are committed after this */
+#define IGDMAP_PERSIST_MSEC		1000	/* xmldb is written after this */
+
+struct igdmap_fields
+{
+	int				enabled;
+	int				proto;			/* 1 TCP, 2 UDP */
+	int				extport;
+	int				intport;
+	unsigned long	expires;		/* uptime in seconds, 0 for no lease */
+	char			remote[IGDMAP_ADDR_SIZE];
+	char			client[IGDMAP_ADDR_SIZE];
+	char			wanip[IGDMAP_ADDR_SIZE];	/* the DNAT rule in the kernel */
+	char			desc[IGDMAP_DESC_SIZE];
+};
+
+struct igdmap_entry
+{
+	struct igdmap_entry *	hnext;	/* key hash chain */
+	struct igdmap_entry *	wnext;	/* timer wheel slot */
+	struct igdmap_entry **	wprev;
+	int						wid;
+	int						index;	/* 0 based ordinal */
+	struct igdmap_fields	f;
+};
+
+int  igdmap_count(int wid);
+struct igdmap_entry * igdmap_get(int wid, int index);
+struct igdmap_entry * igdmap_find(int wid, const char * remote, int extport, int proto);
+int  igdmap_set(int wid, const struct igdmap_fields * f, unsigned long lease);
+void igdmap_delete(struct igdmap_entry * e);
+unsigned long igdmap_lease(const struct igdmap_entry * e);
+
+#endif
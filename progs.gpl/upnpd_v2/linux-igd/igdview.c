@@ -0,0 +1,272 @@
+/* vi: set sw=4 ts=4: */
+/* igdview.c
+ *
+ * The action handlers read the WAN status from xmldb on every call, P2P
+ * clients poll some of these actions several times a second. Values read
+ * here are kept in a small hash table and only read again from xmldb when
+ * they are older than the caller allows. A single xmldb connection is
+ * kept open for the life of upnpd.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <upnp.h>
+
+#include "lrgbin.h"
+#include "igdview.h"
+
+#define VIEW_PATH_SIZE		256
+#define VIEW_VALUE_SIZE		512
+
+struct view_node
+{
+	struct view_node *	next;
+	unsigned long		stamp;		/* msec when the value was read */
+	char *				value;
+	char				path[1];
+};
+
+static struct view_node * view_hash[IGDVIEW_HASH_SIZE];
+static int view_nodes = 0;
+static int view_fd = -1;
+
+static unsigned long view_msec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static unsigned int view_hashfn(const char * path)
+{
+	unsigned int h = 0;
+	while (*path) h = h * 31 + (unsigned char)*path++;
+	return h & (IGDVIEW_HASH_SIZE - 1);
+}
+
+static struct view_node * view_find(const char * path, unsigned int h)
+{
+	struct view_node * node;
+
+	for (node = view_hash[h]; node; node = node->next)
+	{
+		if (strcmp(node->path, path)==0) return node;
+	}
+	return NULL;
+}
+
+static struct view_node * view_store(const char * path, unsigned int h, const char * value)
+{
+	struct view_node * node;
+	char * copy;
+
+	copy = strdup(value);
+	if (!copy) return NULL;
+
+	node = view_find(path, h);
+	if (!node)
+	{
+		if (view_nodes >= IGDVIEW_MAX_NODES) igdview_flush(NULL);
+		node = (struct view_node *)malloc(sizeof(struct view_node) + strlen(path));
+		if (!node)
+		{
+			free(copy);
+			return NULL;
+		}
+		strcpy(node->path, path);
+		node->value = NULL;
+		node->next = view_hash[h];
+		view_hash[h] = node;
+		view_nodes++;
+	}
+	if (node->value) free(node->value);
+	node->value = copy;
+	node->stamp = view_msec();
+	return node;
+}
+
+/* The connection is opened on first use and opened again once if xmldb
+ * went away. */
+static int view_open(void)
+{
+	if (view_fd < 0) view_fd = lrgdb_open(NULL);
+	return view_fd;
+}
+
+static void view_close(void)
+{
+	if (view_fd >= 0) lrgdb_close(view_fd);
+	view_fd = -1;
+}
+
+static const char * view_lookup(int ttl, const char * path)
+{
+	static char value[VIEW_VALUE_SIZE];
+	struct view_node * node;
+	unsigned int h;
+	int retry;
+
+	h = view_hashfn(path);
+	node = view_find(path, h);
+	if (node && view_msec() - node->stamp < (unsigned long)ttl) return node->value;
+
+	for (retry=0; retry<2; retry++)
+	{
+		if (view_open() < 0) break;
+		if (lrgdb_get_value(view_fd, value, sizeof(value), path) >= 0)
+		{
+			node = view_store(path, h, value);
+			return node ? node->value : value;
+		}
+		view_close();
+	}
+	dtrace("igdview: can not read %s\n", path);
+	return node ? node->value : "";
+}
+
+/* Copy the value of a node into 'buff', reading it from xmldb if the cached
+ * copy is older than 'ttl' msec. Returns the length of the value. */
+int igdview_get(char * buff, size_t size, int ttl, const char * format, ...)
+{
+	char path[VIEW_PATH_SIZE];
+	va_list marker;
+
+	va_start(marker, format);
+	vsnprintf(path, sizeof(path), format, marker);
+	va_end(marker);
+
+	snprintf(buff, size, "%s", view_lookup(ttl, path));
+	return strlen(buff);
+}
+
+int igdview_getint(int ttl, const char * format, ...)
+{
+	char path[VIEW_PATH_SIZE];
+	va_list marker;
+
+	va_start(marker, format);
+	vsnprintf(path, sizeof(path), format, marker);
+	va_end(marker);
+
+	return atoi(view_lookup(ttl, path));
+}
+
+/* Returns 1 if the next igdview_get() of the node will go to xmldb. */
+int igdview_stale(int ttl, const char * format, ...)
+{
+	char path[VIEW_PATH_SIZE];
+	struct view_node * node;
+	va_list marker;
+
+	va_start(marker, format);
+	vsnprintf(path, sizeof(path), format, marker);
+	va_end(marker);
+
+	node = view_find(path, view_hashfn(path));
+	return (node && view_msec() - node->stamp < (unsigned long)ttl) ? 0 : 1;
+}
+
+static int view_write(const char * node, const char * value, int keep)
+{
+	struct view_node ** prev;
+	struct view_node * found;
+	unsigned int h = view_hashfn(node);
+	int retry;
+
+	for (retry=0; retry<2; retry++)
+	{
+		if (view_open() < 0) break;
+		if (lrgdb_set(view_fd, 0, node, value) >= 0)
+		{
+			if (keep)
+			{
+				view_store(node, h, value);
+				return 0;
+			}
+			for (prev = &view_hash[h]; (found = *prev) != NULL; prev = &found->next)
+			{
+				if (strcmp(found->path, node)) continue;
+				*prev = found->next;
+				free(found->value);
+				free(found);
+				view_nodes--;
+				break;
+			}
+			return 0;
+		}
+		view_close();
+	}
+	dtrace("igdview: can not set %s\n", node);
+	return -1;
+}
+
+/* Write a node through to xmldb and keep the new value. */
+int igdview_set(const char * node, const char * value)
+{
+	return view_write(node, value, 1);
+}
+
+/* Write a node through to xmldb without keeping it, for the nodes upnpd
+ * holds elsewhere and never reads back. */
+int igdview_put(const char * node, const char * value)
+{
+	return view_write(node, value, 0);
+}
+
+/* Delete a node from xmldb. xmldb renumbers the nodes that follow it, so
+ * everything cached under the same parent is dropped. */
+int igdview_del(const char * node)
+{
+	char parent[VIEW_PATH_SIZE];
+	char * slash;
+	int retry, ret = -1;
+
+	for (retry=0; retry<2; retry++)
+	{
+		if (view_open() < 0) break;
+		if (lrgdb_del(view_fd, 0, node) >= 0)
+		{
+			ret = 0;
+			break;
+		}
+		view_close();
+	}
+
+	snprintf(parent, sizeof(parent), "%s", node);
+	slash = strrchr(parent, '/');
+	if (slash) slash[1] = '\0';
+	igdview_flush(parent);
+	return ret;
+}
+
+/* Drop the cached nodes whose path starts with 'prefix', all of them if
+ * 'prefix' is NULL. */
+void igdview_flush(const char * prefix)
+{
+	struct view_node ** prev;
+	struct view_node * node;
+	size_t len = prefix ? strlen(prefix) : 0;
+	int i;
+
+	for (i=0; i<IGDVIEW_HASH_SIZE; i++)
+	{
+		prev = &view_hash[i];
+		while ((node = *prev) != NULL)
+		{
+			if (prefix && strncmp(node->path, prefix, len))
+			{
+				prev = &node->next;
+				continue;
+			}
+			*prev = node->next;
+			free(node->value);
+			free(node);
+			view_nodes--;
+		}
+	}
+}
@@ -0,0 +1,23 @@
+/* vi: set sw=4 ts=4: */
+#ifndef __IGDVIEW_H__
+#define __IGDVIEW_H__
+
+/* Cached view of the xmldb nodes read by the native action handlers.
+ * Values are kept for 'ttl' milliseconds after they were read; nodes
+ * upnpd writes itself are updated in place. */
+
+#define IGDVIEW_HASH_SIZE	64
+#define IGDVIEW_MAX_NODES	512
+
+#define IGD_TTL_STATUS		1000	/* WAN status and counters */
+#define IGD_TTL_OWNED		60000	/* nodes only upnpd writes */
+
+int  igdview_get(char * buff, size_t size, int ttl, const char * format, ...);
+int  igdview_getint(int ttl, const char * format, ...);
+int  igdview_stale(int ttl, const char * format, ...);
+int  igdview_set(const char * node, const char * value);
+int  igdview_put(const char * node, const char * value);
+int  igdview_del(const char * node);
+void igdview_flush(const char * prefix);
+
+#endif
@@ -247,9 +247,10 @@ static int send_xmldb_cmd(int fd, action_t action, unsigned long flags, const ch
 	ipc.action = action;
 	ipc.flags = flags;
 	ipc.length = length;
-	size = write(fd, &ipc, sizeof(ipc));
+	/* a long lived connection must not kill us if xmldb restarts */
+	size = send(fd, &ipc, sizeof(ipc), MSG_NOSIGNAL);
 	if (size <= 0) return -1;
-	size = write(fd, data, length);
+	size = send(fd, data, length, MSG_NOSIGNAL);
 	if (size <= 0) return -1;
 	return 0;
 }
@@ -327,6 +328,36 @@ ssize_t lrgdb_getwb(int fd, char * buff, size_t size, const char * format, ...)
 	return ret;
 }
 
+/* get the value of a node into 'buff', reading the whole reply from xmldb.
+ * Values longer than 'size' are truncated. Returns the length of the value,
+ * -1 if the connection failed. */
+ssize_t lrgdb_get_value(int fd, char * buff, size_t size, const char * node)
+{
+	char drain[128];
+	size_t count = 0;
+	ssize_t rn;
+	char * dst;
+	size_t room;
+
+	if (lrgdb_get(fd, 0, node, NULL) < 0) return -1;
+	for (;;)
+	{
+		if (count < size)	{ dst = buff + count; room = size - count; }
+		else				{ dst = drain; room = sizeof(drain); }
+		rn = read(fd, dst, room);
+		if (rn < 0 && errno == EINTR) continue;
+		if (rn <= 0) return -1;
+		if (dst != drain) count += rn;
+		if (dst[rn-1] == '\0') break;
+	}
+	if (count >= size)
+	{
+		count = size - 1;
+		buff[count] = '\0';
+	}
+	return strlen(buff);
+}
+
 /*
 int lrgdb_patch(int fd, unsigned long flags, const char * tempfile, FILE * out)
 {
@@ -33,7 +33,8 @@ char * lrgbin_get_line_from_file(FILE * file, int strip_new_line);
 int lrgdb_open(const char * sockname);
 void lrgdb_close(int fd);
 int lrgdb_get(int fd, unsigned long flags, const char * node, FILE * out);
-int lrgdb_getwb(int fd, char * buff, size_t size, const char * format, ...);
+ssize_t lrgdb_getwb(int fd, char * buff, size_t size, const char * format, ...);
+ssize_t lrgdb_get_value(int fd, char * buff, size_t size, const char * node);
 int lrgdb_patch(int fd, unsigned long flags, const char * tempfile, FILE * out);
 int lrgdb_ephp(int fd, unsigned long flags, const char * phpfile, FILE * out);
 int lrgdb_do_ephp(const char * phpfile, char * buffer, size_t size);
@@ -0,0 +1,273 @@
+/* vi: set sw=4 ts=4: */
+/* soapbench.c
+ *
+ * SOAP load generator for upnpd. Sends the same action over and over,
+ * with up to -c requests in flight, and reports the actions answered per
+ * second. "%i" in an argument value is replaced by the request number, so
+ *
+ *   soapbench -n 500 -f 20000 AddPortMapping NewRemoteHost= \
+ *       NewExternalPort=%i NewProtocol=TCP NewInternalPort=%i \
+ *       NewInternalClient=192.168.0.100 NewEnabled=1 \
+ *       NewPortMappingDescription=bench NewLeaseDuration=0
+ *
+ * adds 500 different mappings, and
+ *
+ *   soapbench -c 4 -u /WANCommonIFC1 \
+ *       -s urn:schemas-upnp-org:service:WANCommonInterfaceConfig:1 \
+ *       GetTotalBytesReceived
+ *
+ * polls a counter the way P2P clients do.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_CONN		64
+#define MAX_ARGS		16
+#define REQUEST_SIZE	4096
+#define REPLY_SIZE		4096
+
+struct bench_conn
+{
+	int				fd;
+	int				seq;
+	struct timeval	start;
+	char			request[REQUEST_SIZE];
+	int				req_len;
+	int				sent;
+	char			reply[REPLY_SIZE];
+	int				got;
+};
+
+static struct sockaddr_in server;
+static char * host = "127.0.0.1";
+static int port = 49152;
+static char * url = "/WANIPConn1";
+static char * service = "urn:schemas-upnp-org:service:WANIPConnection:1";
+static char * action;
+static char * arg_name[MAX_ARGS];
+static char * arg_value[MAX_ARGS];
+static int arg_count = 0;
+static int first = 0;
+static int modulo = 0;
+static int verbose = 0;
+
+static int total = 1000;
+static int issued = 0;
+static int done = 0;
+static int ok = 0;
+static int failed = 0;
+static double lat_sum = 0;
+static double lat_max = 0;
+
+static double elapsed(struct timeval * from)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - from->tv_sec) + (now.tv_usec - from->tv_usec) / 1000000.0;
+}
+
+static void show_usage(int exit_code)
+{
+	printf(	"Usage: soapbench [OPTIONS] action [name=value ...]\n"
+			"  -h {host}           upnpd address (default 127.0.0.1).\n"
+			"  -p {port}           upnpd port (default 49152).\n"
+			"  -u {url}            control URL (default /WANIPConn1).\n"
+			"  -s {service}        service type (default WANIPConnection:1).\n"
+			"  -n {count}          number of requests (default 1000).\n"
+			"  -c {count}          requests in flight (default 1).\n"
+			"  -f {first}          first value of %%i (default 0).\n"
+			"  -m {modulo}         %%i wraps around after this many requests.\n"
+			"  -v                  print the first reply.\n"
+		);
+	exit(exit_code);
+}
+
+/* value with %i replaced by the request number */
+static char * expand(char * out, size_t size, const char * value, int seq)
+{
+	const char * mark = strstr(value, "%i");
+
+	if (modulo > 0) seq %= modulo;
+	if (mark)	snprintf(out, size, "%.*s%d%s", (int)(mark - value), value, first + seq, mark + 2);
+	else		snprintf(out, size, "%s", value);
+	return out;
+}
+
+static void build_request(struct bench_conn * c)
+{
+	char body[REQUEST_SIZE / 2];
+	char value[256];
+	int len, i;
+
+	len = snprintf(body, sizeof(body),
+			"<?xml version=\"1.0\"?>\r\n"
+			"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+			"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+			"<s:Body><u:%s xmlns:u=\"%s\">", action, service);
+	for (i=0; i<arg_count; i++)
+	{
+		len += snprintf(body + len, sizeof(body) - len, "<%s>%s</%s>",
+				arg_name[i], expand(value, sizeof(value), arg_value[i], c->seq), arg_name[i]);
+	}
+	len += snprintf(body + len, sizeof(body) - len, "</u:%s></s:Body></s:Envelope>\r\n", action);
+
+	c->req_len = snprintf(c->request, sizeof(c->request),
+			"POST %s HTTP/1.1\r\n"
+			"HOST: %s:%d\r\n"
+			"CONTENT-LENGTH: %d\r\n"
+			"CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n"
+			"SOAPACTION: \"%s#%s\"\r\n"
+			"\r\n%s", url, host, port, len, service, action, body);
+	c->sent = 0;
+	c->got = 0;
+}
+
+static int start_request(struct bench_conn * c)
+{
+	c->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->fd < 0) return -1;
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	if (connect(c->fd, (struct sockaddr *)&server, sizeof(server)) < 0 && errno != EINPROGRESS)
+	{
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	c->seq = issued++;
+	gettimeofday(&c->start, NULL);
+	build_request(c);
+	return 0;
+}
+
+static void finish_request(struct bench_conn * c)
+{
+	double lat = elapsed(&c->start);
+
+	close(c->fd);
+	c->fd = -1;
+	c->reply[c->got] = '\0';
+	if (strncmp(c->reply, "HTTP/1.", 7)==0 && strncmp(c->reply + 8, " 200", 4)==0) ok++;
+	else failed++;
+	if (verbose && done == 0) printf("%s\n", c->reply);
+	done++;
+	lat_sum += lat;
+	if (lat > lat_max) lat_max = lat;
+}
+
+int main(int argc, char * argv[])
+{
+	struct bench_conn * conns;
+	struct timeval begin;
+	fd_set rset, wset;
+	int concurrent = 1;
+	int opt, i, maxfd, n;
+	char * eq;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "h:p:u:s:n:c:f:m:v")) > 0)
+	{
+		switch (opt)
+		{
+		case 'h':	host = optarg; break;
+		case 'p':	port = atoi(optarg); break;
+		case 'u':	url = optarg; break;
+		case 's':	service = optarg; break;
+		case 'n':	total = atoi(optarg); break;
+		case 'c':	concurrent = atoi(optarg); break;
+		case 'f':	first = atoi(optarg); break;
+		case 'm':	modulo = atoi(optarg); break;
+		case 'v':	verbose = 1; break;
+		default:	show_usage(-1); break;
+		}
+	}
+	if (optind >= argc) show_usage(-1);
+	action = argv[optind++];
+	for (; optind < argc && arg_count < MAX_ARGS; optind++)
+	{
+		eq = strchr(argv[optind], '=');
+		if (!eq) show_usage(-1);
+		*eq = '\0';
+		arg_name[arg_count] = argv[optind];
+		arg_value[arg_count] = eq + 1;
+		arg_count++;
+	}
+	if (concurrent < 1) concurrent = 1;
+	if (concurrent > MAX_CONN) concurrent = MAX_CONN;
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	if (!inet_aton(host, &server.sin_addr))
+	{
+		printf("Invalid address %s !\n", host);
+		return -1;
+	}
+
+	conns = (struct bench_conn *)calloc(concurrent, sizeof(struct bench_conn));
+	if (!conns) return -1;
+	for (i=0; i<concurrent; i++) conns[i].fd = -1;
+
+	gettimeofday(&begin, NULL);
+	while (done < total)
+	{
+		FD_ZERO(&rset);
+		FD_ZERO(&wset);
+		maxfd = -1;
+		for (i=0; i<concurrent; i++)
+		{
+			if (conns[i].fd < 0 && issued < total && start_request(&conns[i]) < 0)
+			{
+				printf("Can not connect to %s:%d: %s\n", host, port, strerror(errno));
+				return -1;
+			}
+			if (conns[i].fd < 0) continue;
+			if (conns[i].sent < conns[i].req_len)	FD_SET(conns[i].fd, &wset);
+			else									FD_SET(conns[i].fd, &rset);
+			if (conns[i].fd > maxfd) maxfd = conns[i].fd;
+		}
+		if (maxfd < 0) break;
+		if (select(maxfd + 1, &rset, &wset, NULL, NULL) < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+		for (i=0; i<concurrent; i++)
+		{
+			struct bench_conn * c = &conns[i];
+
+			if (c->fd < 0) continue;
+			if (FD_ISSET(c->fd, &wset))
+			{
+				n = send(c->fd, c->request + c->sent, c->req_len - c->sent, MSG_NOSIGNAL);
+				if (n > 0) c->sent += n;
+				else if (errno != EAGAIN) finish_request(c);
+			}
+			else if (FD_ISSET(c->fd, &rset))
+			{
+				n = recv(c->fd, c->reply + c->got, REPLY_SIZE - 1 - c->got, 0);
+				if (n > 0) c->got += n;
+				else if (n < 0 && errno == EAGAIN) continue;
+				/* the status line is all we look at */
+				if (n <= 0 || c->got == REPLY_SIZE - 1) finish_request(c);
+			}
+		}
+	}
+	secs = elapsed(&begin);
+
+	printf("%s: %d requests in %.3f s, %.1f actions/s, %d ok, %d failed, "
+			"latency avg %.2f ms, max %.2f ms\n",
+			action, done, secs, secs > 0 ? done / secs : 0, ok, failed,
+			done ? lat_sum * 1000 / done : 0, lat_max * 1000);
+	free(conns);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+/* vi: set sw=4 ts=4: */
+/* ssdpbench.c
+ *
+ * M-SEARCH replay for upnpd. The searches found in pcap captures are sent
+ * to upnpd again, -n times over, from -c control points, and the replies
+ * are counted. A storm of media clients looking for each other is
+ *
+ *   ssdpbench -c 16 -n 50 -t ssdp:all -x 1 -P `pidof upnpd` ../cap/upnp3.cap
+ *
+ * The control points are 127.0.0.2 and up, upnpd does not answer searches
+ * from its own address. -P reports the CPU time upnpd spent on them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_CLIENTS		64
+#define MAX_SEARCHES	256
+#define PACKET_SIZE		2048
+
+struct pcap_hdr
+{
+	unsigned int	magic;
+	unsigned short	major, minor;
+	int				zone;
+	unsigned int	sigfigs, snaplen, linktype;
+};
+
+struct pcap_rec
+{
+	unsigned int	sec, usec, incl, orig;
+};
+
+static char * searches[MAX_SEARCHES];
+static int search_len[MAX_SEARCHES];
+static int search_count = 0;
+
+static char * host = "127.0.0.1";
+static int port = 1900;
+static char * base = "127.0.0.2";
+static char * target = NULL;
+static int mx = -1;
+static int verbose = 0;
+
+static double elapsed(struct timeval * from)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - from->tv_sec) + (now.tv_usec - from->tv_usec) / 1000000.0;
+}
+
+static void show_usage(int exit_code)
+{
+	printf(	"Usage: ssdpbench [OPTIONS] capture.cap ...\n"
+			"  -h {host}           upnpd address (default 127.0.0.1).\n"
+			"  -p {port}           SSDP port (default 1900).\n"
+			"  -b {address}        first control point address (default 127.0.0.2).\n"
+			"  -c {count}          control points (default 1).\n"
+			"  -n {count}          times the searches are sent (default 10).\n"
+			"  -r {rate}           searches per second (default as fast as possible).\n"
+			"  -t {target}         replace the ST of the searches.\n"
+			"  -x {mx}             replace the MX of the searches.\n"
+			"  -w {msec}           wait for replies after the last search (default 1000).\n"
+			"  -P {pid}            report the CPU time of upnpd.\n"
+			"  -v                  print the first reply.\n"
+		);
+	exit(exit_code);
+}
+
+static unsigned int swap32(unsigned int v, int swap)
+{
+	return swap ? ((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24)) : v;
+}
+
+/* replace the value of a header, returns the new length */
+static int set_header(char * buff, int len, const char * name, const char * value)
+{
+	char out[PACKET_SIZE];
+	char * p;
+	char * end;
+	int n;
+
+	for (p = buff; p; p = strstr(p, "\r\n"), p = p ? p + 2 : NULL)
+	{
+		if (strncasecmp(p, name, strlen(name))) continue;
+		end = strstr(p, "\r\n");
+		if (!end) break;
+		n = snprintf(out, sizeof(out), "%.*s%s %s%s", (int)(p - buff), buff, name, value, end);
+		if (n >= (int)sizeof(out)) break;
+		memcpy(buff, out, n + 1);
+		return n;
+	}
+	return len;
+}
+
+/* the search with its ST and MX replaced by -t and -x */
+static void add_search(const unsigned char * data, int len)
+{
+	char buff[PACKET_SIZE];
+	char value[16];
+
+	if (search_count >= MAX_SEARCHES || len >= PACKET_SIZE) return;
+	memcpy(buff, data, len);
+	buff[len] = '\0';
+
+	if (target) len = set_header(buff, len, "ST:", target);
+	if (mx >= 0)
+	{
+		sprintf(value, "%d", mx);
+		len = set_header(buff, len, "MX:", value);
+	}
+
+	searches[search_count] = malloc(len);
+	if (!searches[search_count]) return;
+	memcpy(searches[search_count], buff, len);
+	search_len[search_count++] = len;
+}
+
+/* M-SEARCH datagrams of an Ethernet capture */
+static int read_capture(const char * file)
+{
+	unsigned char packet[65536];
+	struct pcap_hdr hdr;
+	struct pcap_rec rec;
+	const unsigned char * ip;
+	const unsigned char * udp;
+	unsigned int incl;
+	int swap, ihl, ulen, found = 0;
+	FILE * fp;
+
+	fp = fopen(file, "rb");
+	if (!fp) return -1;
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+		(hdr.magic != 0xa1b2c3d4 && hdr.magic != 0xd4c3b2a1))
+	{
+		fclose(fp);
+		return -1;
+	}
+	swap = (hdr.magic == 0xd4c3b2a1);
+	if (swap32(hdr.linktype, swap) != 1)
+	{
+		fclose(fp);
+		return -1;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1)
+	{
+		incl = swap32(rec.incl, swap);
+		if (incl > sizeof(packet) || fread(packet, incl, 1, fp) != 1) break;
+		if (incl < 14 + 20 + 8 || packet[12] != 0x08 || packet[13] != 0x00) continue;
+		ip = packet + 14;
+		ihl = (ip[0] & 15) * 4;
+		if (ip[9] != 17 || 14 + ihl + 8 > (int)incl) continue;
+		udp = ip + ihl;
+		if (((udp[2] << 8) | udp[3]) != 1900) continue;
+		ulen = ((udp[4] << 8) | udp[5]) - 8;
+		if (ulen <= 0 || 14 + ihl + 8 + ulen > (int)incl) continue;
+		if (strncmp((const char *)udp + 8, "M-SEARCH", 8)) continue;
+		add_search(udp + 8, ulen);
+		found++;
+	}
+	fclose(fp);
+	return found;
+}
+
+static double cpu_time(int pid)
+{
+	char path[64];
+	char line[1024];
+	unsigned long utime, stime;
+	char * p;
+	FILE * fp;
+	int i;
+
+	if (pid <= 0) return 0;
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if (!fp) return 0;
+	p = fgets(line, sizeof(line), fp);
+	fclose(fp);
+	if (!p) return 0;
+
+	/* utime and stime are the 14th and 15th fields, the name may hold spaces */
+	p = strrchr(line, ')');
+	if (!p) return 0;
+	for (i = 2; i < 14 && p; i++) p = strchr(p + 1, ' ');
+	if (!p || sscanf(p, "%lu %lu", &utime, &stime) != 2) return 0;
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+int main(int argc, char * argv[])
+{
+	struct sockaddr_in server, local;
+	struct timeval begin, last, tv;
+	char reply[PACKET_SIZE];
+	int fds[MAX_CLIENTS];
+	int clients = 1, rounds = 10, rate = 0, wait = 1000, pid = 0;
+	int sent = 0, replies = 0, bad = 0, total;
+	int opt, i, n, maxfd;
+	unsigned long bytes = 0;
+	double cpu, secs, pace;
+	fd_set rset;
+
+	while ((opt = getopt(argc, argv, "h:p:b:c:n:r:t:x:w:P:v")) > 0)
+	{
+		switch (opt)
+		{
+		case 'h':	host = optarg; break;
+		case 'p':	port = atoi(optarg); break;
+		case 'b':	base = optarg; break;
+		case 'c':	clients = atoi(optarg); break;
+		case 'n':	rounds = atoi(optarg); break;
+		case 'r':	rate = atoi(optarg); break;
+		case 't':	target = optarg; break;
+		case 'x':	mx = atoi(optarg); break;
+		case 'w':	wait = atoi(optarg); break;
+		case 'P':	pid = atoi(optarg); break;
+		case 'v':	verbose = 1; break;
+		default:	show_usage(-1); break;
+		}
+	}
+	if (optind >= argc) show_usage(-1);
+	for (; optind < argc; optind++)
+	{
+		if (read_capture(argv[optind]) < 0)
+		{
+			printf("Can not read capture %s !\n", argv[optind]);
+			return -1;
+		}
+	}
+	if (search_count == 0)
+	{
+		printf("No M-SEARCH in the captures !\n");
+		return -1;
+	}
+	if (clients < 1) clients = 1;
+	if (clients > MAX_CLIENTS) clients = MAX_CLIENTS;
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	if (!inet_aton(host, &server.sin_addr) || !inet_aton(base, &local.sin_addr))
+	{
+		printf("Invalid address !\n");
+		return -1;
+	}
+
+	maxfd = -1;
+	for (i=0; i<clients; i++)
+	{
+		fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (fds[i] < 0 || bind(fds[i], (struct sockaddr *)&local, sizeof(local)) < 0)
+		{
+			printf("Can not bind %s: %s\n", inet_ntoa(local.sin_addr), strerror(errno));
+			return -1;
+		}
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		if (fds[i] > maxfd) maxfd = fds[i];
+		local.sin_addr.s_addr = htonl(ntohl(local.sin_addr.s_addr) + 1);
+	}
+
+	total = rounds * search_count;
+	pace = rate > 0 ? 1.0 / rate : 0;
+	cpu = cpu_time(pid);
+	gettimeofday(&begin, NULL);
+	gettimeofday(&last, NULL);
+
+	for (;;)
+	{
+		/* the next search is due, or replies are waited for */
+		if (sent < total && elapsed(&begin) >= sent * pace)
+		{
+			n = sent % search_count;
+			sendto(fds[sent % clients], searches[n], search_len[n], 0,
+					(struct sockaddr *)&server, sizeof(server));
+			sent++;
+			if (sent == total) gettimeofday(&last, NULL);
+			if (sent % clients) continue;
+		}
+		else if (sent == total && elapsed(&last) * 1000 >= wait)
+		{
+			break;
+		}
+
+		FD_ZERO(&rset);
+		for (i=0; i<clients; i++) FD_SET(fds[i], &rset);
+		tv.tv_sec = 0;
+		tv.tv_usec = (sent == total) ? 10000 : (pace > 0) ? 1000 : 0;
+		if (select(maxfd + 1, &rset, NULL, NULL, &tv) <= 0) continue;
+
+		for (i=0; i<clients; i++)
+		{
+			if (!FD_ISSET(fds[i], &rset)) continue;
+			while ((n = recv(fds[i], reply, sizeof(reply) - 1, 0)) > 0)
+			{
+				reply[n] = '\0';
+				if (strncmp(reply, "HTTP/1.1 200 OK", 15) == 0) replies++;
+				else bad++;
+				if (verbose && replies + bad == 1) printf("%s\n", reply);
+				bytes += n;
+				if (sent == total) gettimeofday(&last, NULL);
+			}
+		}
+	}
+	/* the wait after the last reply is not counted */
+	secs = elapsed(&begin) - wait / 1000.0;
+
+	printf("%d searches (%d in the captures) from %d control points in %.3f s, "
+			"%d replies (%.1f per search, %lu bytes), %d bad\n",
+			sent, search_count, clients, secs, replies, sent ? (double)replies / sent : 0,
+			bytes, bad);
+	if (pid > 0) printf("upnpd CPU time %.2f s\n", cpu_time(pid) - cpu);
+	return 0;
+}
@@ -309,49 +309,78 @@ static walk_node(IXML_Node * node, int depth)
 }
 #endif
 
+/* Collect the arguments of an action. Arguments without a value are left
+ * out, like the templates see them. The strings belong to req. */
+int get_action_args(struct Upnp_Action_Request * req, struct action_args * args)
+{
+	int i;
+
+	args->count = 0;
+	for (i=0; i<req->ArgCount && args->count < MAX_ACTION_ARGS; i++)
+	{
+		//dtrace("action vars: %s=%s\n", req->ArgName[i], req->ArgValue[i]);
+		if (req->ArgName[i] && req->ArgValue[i][0])
+		{
+			args->name[args->count] = req->ArgName[i];
+			args->value[args->count] = req->ArgValue[i];
+			args->count++;
+		}
+	}
+	return args->count;
+}
+
+/* value of an argument, "" if the request did not have it */
+const char * action_arg(struct action_args * args, const char * name)
+{
+	int i;
+
+	for (i=0; i<args->count; i++)
+	{
+		if (strcmp(args->name[i], name)==0) return args->value[i];
+	}
+	return "";
+}
+
 static char * get_action_variables(struct Upnp_Action_Request * req)
 {
+	struct action_args args;
 	char * buffer = NULL;
 	char tmp[512];
-	int index = 0;
-	const DOMString name;
-	const DOMString value;
-	IXML_NodeList * nodeList = NULL;
-	IXML_Node * node = NULL;
+	int i;
 
 	sprintf(tmp, "%s/%s_action.php\nshell=/var/run/upnp_action.sh\nudn=%s\nserviceid=%s\naction=%s", g_template,
 			req->ServiceID, req->DevUDN, req->ServiceID, req->ActionName);
 	buffer = strdup(tmp);
 	if (!buffer) return NULL;
 
-	nodeList = ixmlDocument_getElementsByTagNameNS(req->ActionRequest, "*", req->ActionName);
-	if (nodeList)
+	get_action_args(req, &args);
+	for (i=0; i<args.count; i++)
 	{
-		node = ixmlNodeList_item(nodeList, 0);
-		if (node)
-		{
-			node = ixmlNode_getFirstChild(node);
-			while (node)
-			{
-				name = ixmlNode_getLocalName(node);
-				value = ixmlNode_getNodeValue(ixmlNode_getFirstChild(node));
-				//dtrace("action vars: %s=%s\n", name, value);
-				if (name && value)
-				{
-					index++;
-					sprintf(tmp, "\n%s=%s", name, value);
-					buffer = realloc(buffer, strlen(buffer)+strlen(tmp)+1);
-					if (buffer) strcat(buffer, tmp);
-				}
-				node = ixmlNode_getNextSibling(node);
-			}
-			//dtrace("vars : [%s]\n", buffer);
-		}
-		ixmlNodeList_free(nodeList);
+		sprintf(tmp, "\n%s=%s", args.name[i], args.value[i]);
+		buffer = realloc(buffer, strlen(buffer)+strlen(tmp)+1);
+		if (buffer) strcat(buffer, tmp);
 	}
+	//dtrace("vars : [%s]\n", buffer);
 	return buffer;
 }
 
+void action_error(struct Upnp_Action_Request * req, int ErrCode)
+{
+	switch (ErrCode)
+	{
+	case 200:	break;
+	case 401:	strcpy(req->ErrStr, "Invalid Action"); break;
+	case 402:	strcpy(req->ErrStr, "Invalid Args"); break;
+	case 403:	strcpy(req->ErrStr, "Out of Sync"); break;
+	case 501:	strcpy(req->ErrStr, "Action Failed"); break;
+	case 713:	strcpy(req->ErrStr, "SpecifiedArrayIndexInvalid"); break;
+	case 714:	strcpy(req->ErrStr, "NoSuchEntryInArray"); break;
+	case 718:	strcpy(req->ErrStr, "ConflictInMappingEntry"); break;
+	default:	strcpy(req->ErrStr, "Unknown Error"); break;
+	}
+	req->ErrCode = ErrCode;
+}
+
 void build_action_result(struct Upnp_Action_Request * req, const char * service)
 {
 	char * cmd;
@@ -360,6 +389,10 @@ void build_action_result(struct Upnp_Action_Request * req, const char * service)
 	int ErrCode = 200;
 	char * result;
 
+	/* the hot WANIPConnection and WANCommonInterfaceConfig actions are
+	 * answered in upnpd, the others still go to the templates. */
+	if (native_action_result(req, service) == 0) return;
+
 	cmd = get_action_variables(req);
 	if (cmd)
 	{
@@ -379,18 +412,7 @@ void build_action_result(struct Upnp_Action_Request * req, const char * service)
 				ErrCode = atoi(result+8);
 				dtrace("ErrCode = %d !!\n", ErrCode);
 			}
-			switch (ErrCode)
-			{
-			case 200:	break;
-			case 401:	strcpy(req->ErrStr, "Invalid Action"); break;
-			case 402:	strcpy(req->ErrStr, "Invalid Args"); break;
-			case 403:	strcpy(req->ErrStr, "Out of Sync"); break;
-			case 501:	strcpy(req->ErrStr, "Action Failed"); break;
-			case 713:	strcpy(req->ErrStr, "SpecifiedArrayIndexInvalid"); break;
-			case 714:	strcpy(req->ErrStr, "NoSuchEntryInArray"); break;
-			default:	strcpy(req->ErrStr, "Unknown Error"); break;
-			}
-			req->ErrCode = ErrCode;
+			action_error(req, ErrCode);
 			if (ErrCode == 200)
 			{
 				offset = strlen(g_buffer);
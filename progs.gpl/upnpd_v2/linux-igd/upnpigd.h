@@ -17,6 +17,19 @@ typedef void (* upnp_cbfn)(const char * udn, const char * serviceid, void * req)
 
 int upnp_add_service(const char * serviceid, upnp_cbfn subscription,
 		upnp_cbfn action, upnp_cbfn statevar, upnp_cbfn notify);
+#define MAX_ACTION_ARGS		16
+
+struct action_args
+{
+	int count;
+	const char * name[MAX_ACTION_ARGS];
+	const char * value[MAX_ACTION_ARGS];
+};
+
+int get_action_args(struct Upnp_Action_Request * req, struct action_args * args);
+const char * action_arg(struct action_args * args, const char * name);
+void action_error(struct Upnp_Action_Request * req, int ErrCode);
+int native_action_result(struct Upnp_Action_Request * req, const char * service);
 void build_action_result(struct Upnp_Action_Request * req, const char * service);
 void build_property_result(struct Upnp_Subscription_Request * req);
 void build_notify_result(const char * udn, const char * serviceid);
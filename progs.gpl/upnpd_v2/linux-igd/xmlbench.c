@@ -0,0 +1,199 @@
+/* vi: set sw=4 ts=4: */
+/* xmlbench.c
+ *
+ * Compares the DOM parser with the streaming parser on the work upnpd does
+ * for one SOAP action: find the action in the request, collect its
+ * arguments and get the response out as text. The heap calls are counted
+ * through the linker's --wrap, so
+ *
+ *   xmlbench -n 20000
+ *
+ * reports the allocations, the bytes and the time per request of each.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <ixml.h>
+
+#define MAX_ARGS		32
+
+static const char * request =
+	"<?xml version=\"1.0\"?>\r\n"
+	"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+	"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+	"<s:Body><u:AddPortMapping xmlns:u=\"urn:schemas-upnp-org:service:WANIPConnection:1\">"
+	"<NewRemoteHost></NewRemoteHost>"
+	"<NewExternalPort>6881</NewExternalPort>"
+	"<NewProtocol>TCP</NewProtocol>"
+	"<NewInternalPort>6881</NewInternalPort>"
+	"<NewInternalClient>192.168.0.100</NewInternalClient>"
+	"<NewEnabled>1</NewEnabled>"
+	"<NewPortMappingDescription>BitTorrent &amp; co</NewPortMappingDescription>"
+	"<NewLeaseDuration>0</NewLeaseDuration>"
+	"</u:AddPortMapping></s:Body></s:Envelope>\r\n";
+
+static const char * response =
+	"<u:AddPortMappingResponse xmlns:u=\"urn:schemas-upnp-org:service:WANIPConnection:1\">"
+	"</u:AddPortMappingResponse>";
+
+static const char * service = "urn:schemas-upnp-org:service:WANIPConnection:1";
+
+/* heap accounting */
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t n, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+void   __real_free(void * ptr);
+char * __real_strdup(const char * s);
+
+static unsigned long heap_calls = 0;
+static unsigned long heap_bytes = 0;
+
+void * __wrap_malloc(size_t size)				{ heap_calls++; heap_bytes += size; return __real_malloc(size); }
+void * __wrap_calloc(size_t n, size_t size)		{ heap_calls++; heap_bytes += n * size; return __real_calloc(n, size); }
+void * __wrap_realloc(void * ptr, size_t size)	{ heap_calls++; heap_bytes += size; return __real_realloc(ptr, size); }
+void   __wrap_free(void * ptr)					{ __real_free(ptr); }
+char * __wrap_strdup(const char * s)			{ heap_calls++; heap_bytes += strlen(s) + 1; return __real_strdup(s); }
+
+static const char * arg_name[MAX_ARGS];
+static const char * arg_value[MAX_ARGS];
+static int arg_count;
+
+/* what soap_device.c and upnpigd.c did before the streaming parser */
+static int dom_action(void)
+{
+	IXML_Document * doc = NULL;
+	IXML_Document * action = NULL;
+	IXML_Document * result;
+	IXML_NodeList * nl;
+	IXML_Node * node;
+	DOMString text;
+	int ret = -1;
+
+	if (ixmlParseBufferEx((char *)request, &doc) != IXML_SUCCESS) return -1;
+
+	nl = ixmlDocument_getElementsByTagNameNS(doc, "*", "Body");
+	node = nl ? ixmlNode_getFirstChild(ixmlNodeList_item(nl, 0)) : NULL;
+	if (nl) ixmlNodeList_free(nl);
+	if (!node) goto out;
+	text = ixmlPrintDocument(node);
+	if (!text) goto out;
+	ixmlParseBufferEx(text, &action);
+	ixmlFreeDOMString(text);
+	if (!action) goto out;
+
+	arg_count = 0;
+	nl = ixmlDocument_getElementsByTagNameNS(action, "*", "AddPortMapping");
+	if (nl)
+	{
+		node = ixmlNode_getFirstChild(ixmlNodeList_item(nl, 0));
+		for (; node && arg_count < MAX_ARGS; node = ixmlNode_getNextSibling(node))
+		{
+			arg_name[arg_count] = ixmlNode_getLocalName(node);
+			arg_value[arg_count] = ixmlNode_getNodeValue(ixmlNode_getFirstChild(node));
+			arg_count++;
+		}
+		ixmlNodeList_free(nl);
+	}
+
+	result = ixmlParseBuffer((char *)response);
+	if (result)
+	{
+		text = ixmlPrintDocument((IXML_Node *)result);
+		if (text) ret = 0;
+		ixmlFreeDOMString(text);
+		ixmlDocument_free(result);
+	}
+out:
+	if (action) ixmlDocument_free(action);
+	ixmlDocument_free(doc);
+	return ret;
+}
+
+/* what soap_device.c does now */
+static int scan_action(void)
+{
+	char body[4096];
+	IXML_Scanner scan;
+	char * text;
+	int event, ret;
+
+	strcpy(body, request);
+	ixmlScan_init(&scan, body);
+	arg_count = 0;
+	while ((event = ixmlScan_next(&scan)) > IXML_SCAN_EOF)
+	{
+		if (event == IXML_SCAN_START && scan.depth == 3 &&
+			(!scan.namespaceURI || strcmp(scan.namespaceURI, service) ||
+			 strcmp(scan.localName, "AddPortMapping")))
+		{
+			return -1;
+		}
+		if (event == IXML_SCAN_START && scan.depth == 4 && arg_count < MAX_ARGS)
+		{
+			arg_name[arg_count] = scan.localName;
+			arg_value[arg_count++] = "";
+		}
+		if (event == IXML_SCAN_TEXT && scan.depth == 4) arg_value[arg_count - 1] = scan.text;
+	}
+
+	/* the response text is built by igdaction.c and sent as is */
+	text = strdup(response);
+	ret = (event == IXML_SCAN_EOF && text) ? 0 : -1;
+	free(text);
+	return ret;
+}
+
+static void run(const char * name, int (*action)(void), int count)
+{
+	struct timeval from, to;
+	unsigned long calls, bytes;
+	double usec;
+	int i;
+
+	calls = heap_calls;
+	bytes = heap_bytes;
+	gettimeofday(&from, NULL);
+	for (i=0; i<count; i++)
+	{
+		if (action() < 0)
+		{
+			printf("%s: request %d failed !\n", name, i);
+			exit(1);
+		}
+	}
+	gettimeofday(&to, NULL);
+	usec = (to.tv_sec - from.tv_sec) * 1000000.0 + (to.tv_usec - from.tv_usec);
+
+	printf("%-6s %d args, %.1f allocations, %.0f bytes, %.2f us per request\n",
+			name, arg_count, (double)(heap_calls - calls) / count,
+			(double)(heap_bytes - bytes) / count, usec / count);
+}
+
+int main(int argc, char * argv[])
+{
+	int count = 10000;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "n:v")) > 0)
+	{
+		switch (opt)
+		{
+		case 'n':	count = atoi(optarg); break;
+		case 'v':
+			scan_action();
+			for (i=0; i<arg_count; i++) printf("%s=%s\n", arg_name[i], arg_value[i]);
+			break;
+		default:
+			printf("Usage: xmlbench [-n count] [-v]\n");
+			return -1;
+		}
+	}
+	if (count < 1) count = 1;
+
+	run("dom", dom_action, count);
+	run("scan", scan_action, count);
+	return 0;
+}
@@ -33,19 +33,39 @@ typedef struct {
 
 void print_usage(void)
 {
-	printf("Usage: 7zip input-file output-file kernel/loader big/little\n");
+	printf("Usage: 7zip input-file output-file kernel/loader big/little [-mt]\n");
 	printf("           -k(K): self-decompress in kernel\n");
 	printf("           -l(L): decompress in loader\n");
+	printf("           -mt: run the match finder in a second thread, same output\n");
 }
 
 
+/*
+ * Sum of the bytes, a word at a time.  The bytes of each word are added in
+ * two 16 bit lanes of pairs, which are folded into crc every 128 words
+ * before they can overflow (128 * 2 * 255 < 65536).
+ */
 unsigned int imgCRC(unsigned char *ptr, unsigned int len)
 {
-  unsigned int i;
   unsigned int crc = 0;
+  unsigned int *word;
+  unsigned int words, lanes, w, n;
+
+  for(; len > 0 && ((unsigned long) ptr & 3) != 0; len--)
+    crc += *ptr++;
+
+  word = (unsigned int *) ptr;
+  for(words = len >> 2; words > 0; words -= n) {
+    n = words < 128 ? words : 128;
+    for(lanes = 0, w = 0; w < n; w++)
+      lanes += (word[w] & 0x00ff00ff) + ((word[w] >> 8) & 0x00ff00ff);
+    crc += (lanes & 0xffff) + (lanes >> 16);
+    word += n;
+  }
 
-  for(i=0; i < len; i++)
-    crc += ptr[i];
+  ptr = (unsigned char *) word;
+  for(len &= 3; len > 0; len--)
+    crc += *ptr++;
 
   return crc;
 }
@@ -73,8 +93,9 @@ int main(int argc, char **argv)
   LZMA_Header lzma_header;
   int hdrSize = sizeof(LZMA_Header);
   char endian;
+  int multiThread = 0;
 
-  if (argc < 5) {
+  if (argc < 5 || (argc > 5 && (argc > 6 || strcmp(argv[5], "-mt") != 0))) {
 	  printf("Error: Invalid number of arguments\n");
 	  print_usage();
 	  return(-1);
@@ -109,6 +130,9 @@ int main(int argc, char **argv)
 	  print_usage();
 	  return (-1);
   }
+
+  if (argc > 5)
+	  multiThread = 1;
   
   // Open the input file for reading
   ifd = open(ifname,O_RDONLY,S_IREAD);
@@ -128,11 +152,11 @@ int main(int argc, char **argv)
 	  return(-1);
   }
 
-  // Allocate memory for output buffer
-  // TODO: How big to create?  Can we assume for now it will be smaller?
-  dstPtr = (unsigned char *)malloc(inSize);
+  // Allocate memory for output buffer, the header and the LZMA stream,
+  // which is a little larger than the input if it does not compress
+  dstPtr = (unsigned char *)malloc(hdrSize + inSize + inSize / 8 + 256);
   if( dstPtr==NULL ) {
-	  printf("Error: Unable to create output buffer size of %d\n", inSize);
+	  printf("Error: Unable to create output buffer size of %d\n", hdrSize + inSize + inSize / 8 + 256);
 	  return(-1);
   }
 
@@ -154,7 +178,7 @@ int main(int argc, char **argv)
   
 
   // Encode the data
-  rc = EncodeLZMA(dstPtr+hdrSize, &outSize, srcPtr, &inSize);
+  rc = EncodeLZMAMultiThread(dstPtr+hdrSize, &outSize, srcPtr, &inSize, multiThread);
   if (rc != 0)
   {
 	  printf("Compression Error.\n");
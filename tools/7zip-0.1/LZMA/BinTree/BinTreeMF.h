@@ -1,10 +1,19 @@
+#include <pthread.h>
 #include "../Common/ICoder.h"
 #include "BinTree.h"
 
+// Multi thread mode: the binary tree runs in its own thread and hands the
+// matches at every position to the encoder in blocks of kMtBlockSize words,
+// each match as its length followed by distances[0..length].
+const UINT32 kMtNumBlocks = 8;
+const UINT32 kMtBlockSize = 1 << 15;
 
 class CMatchFinderBinTree
 {
 public:
+  CMatchFinderBinTree();
+  ~CMatchFinderBinTree();
+
   int Init(BYTE *ptr, UINT32 inSize);
   void ReleaseStream();
   int MovePos();
@@ -20,9 +29,41 @@ public:
 private:
   CInTree _matchFinder;
 
+  // the encoder reads the input through _inWindow, which is _matchFinder
+  // itself or, in multi thread mode, _window moving in step with the encoder
+  CLZInWindow *_inWindow;
+  CLZInWindow _window;
+
+  bool _multiThread;
+  UINT32 _matchMaxLen;
+  UINT32 *_blocks;
+  UINT32 _blockLen[kMtNumBlocks];
+  UINT32 _numFilled;            // blocks filled and not yet released by the encoder
+  UINT32 _readBlock;
+  bool _readHeld;
+  const UINT32 *_readPtr;
+  const UINT32 *_readEnd;
+  bool _threadDone;
+  bool _threadStop;
+  bool _threadRunning;
+  pthread_t _thread;
+  pthread_mutex_t _mutex;
+  pthread_cond_t _blockFilled;
+  pthread_cond_t _blockFreed;
+
+  static void *ThreadFunc(void *p);
+  void FindMatches();
+  bool NextBlock();
+  void StopThread();
+
 public:
-  void SetCutValue(UINT32 cutValue) 
-  { 
-    _matchFinder.SetCutValue(cutValue); 
+  void SetCutValue(UINT32 cutValue)
+  {
+    _matchFinder.SetCutValue(cutValue);
+  }
+  // before Create
+  void SetMultiThread(bool multiThread)
+  {
+    _multiThread = multiThread;
   }
 };
@@ -3,53 +3,208 @@
 #include "BinTreeMain.h"
 
 
+CMatchFinderBinTree::CMatchFinderBinTree():
+_inWindow(&_matchFinder),
+_multiThread(false),
+_blocks(0),
+_threadRunning(false)
+{
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_blockFilled, NULL);
+  pthread_cond_init(&_blockFreed, NULL);
+}
+
+CMatchFinderBinTree::~CMatchFinderBinTree()
+{
+  StopThread();
+  delete []_blocks;
+  pthread_cond_destroy(&_blockFreed);
+  pthread_cond_destroy(&_blockFilled);
+  pthread_mutex_destroy(&_mutex);
+}
+
 int CMatchFinderBinTree::Init(BYTE *ptr, UINT32 inSize)
-{ 
-  return _matchFinder.Init(ptr, inSize); 
+{
+  if (!_multiThread)
+    return _matchFinder.Init(ptr, inSize);
+
+  StopThread();
+  RINOK(_matchFinder.Init(ptr, inSize));
+  RINOK(_window.Init(ptr, inSize));
+  _numFilled = 0;
+  _readBlock = 0;
+  _readHeld = false;
+  _readPtr = _readEnd = 0;
+  _threadDone = false;
+  _threadStop = false;
+  if (pthread_create(&_thread, NULL, ThreadFunc, this) != 0)
+    return (-1);
+  _threadRunning = true;
+  return (0);
 }
 
 void CMatchFinderBinTree::ReleaseStream()
-{ 
-  // _matchFinder.ReleaseStream(); 
+{
+  // _matchFinder.ReleaseStream();
+  StopThread();
 }
 
 int CMatchFinderBinTree::MovePos()
-{ 
-  return _matchFinder.MovePos(); 
+{
+  if (_multiThread)
+    return _window.MovePos();
+  return _matchFinder.MovePos();
 }
 
 BYTE CMatchFinderBinTree::GetIndexByte(UINT32 index)
-{ 
-  return _matchFinder.GetIndexByte(index); 
+{
+  return _inWindow->GetIndexByte(index);
 }
 
 UINT32 CMatchFinderBinTree::GetMatchLen(UINT32 index, UINT32 back, UINT32 limit)
-{ 
-  return _matchFinder.GetMatchLen(index, back, limit); 
+{
+  return _inWindow->GetMatchLen(index, back, limit);
 }
 
 UINT32 CMatchFinderBinTree::GetNumAvailableBytes()
-{ 
-  return _matchFinder.GetNumAvailableBytes(); 
+{
+  return _inWindow->GetNumAvailableBytes();
 }
-  
+
 int CMatchFinderBinTree::Create(UINT32 sizeHistory,UINT32 keepAddBufferBefore, UINT32 matchMaxLen,UINT32 keepAddBufferAfter)
-{ 
+{
   UINT32 windowReservSize = (sizeHistory + keepAddBufferBefore + matchMaxLen + keepAddBufferAfter) / 2 + 256;
-  return _matchFinder.Create(sizeHistory,keepAddBufferBefore,matchMaxLen,keepAddBufferAfter,windowReservSize); 
+  RINOK(_matchFinder.Create(sizeHistory,keepAddBufferBefore,matchMaxLen,keepAddBufferAfter,windowReservSize));
+  _inWindow = &_matchFinder;
+  if (!_multiThread)
+    return (0);
+
+  // same sizes as the window of _matchFinder, so both move their blocks at
+  // the same positions and the encoder sees the same available bytes
+  _window.Create(sizeHistory + keepAddBufferBefore, matchMaxLen + keepAddBufferAfter, windowReservSize);
+  _inWindow = &_window;
+  _matchMaxLen = matchMaxLen;
+  if (_blocks == 0)
+    _blocks = new UINT32[kMtNumBlocks * kMtBlockSize];
+  return (0);
+}
+
+// The encoder calls GetLongestMatch or DummyLongestMatch once at every
+// position.  Both make the same changes to the tree, so the thread can find
+// the matches at every position ahead of the encoder and the output is the
+// same as with one thread.
+void *CMatchFinderBinTree::ThreadFunc(void *p)
+{
+  ((CMatchFinderBinTree *)p)->FindMatches();
+  return NULL;
+}
+
+void CMatchFinderBinTree::FindMatches()
+{
+  UINT32 writeBlock = 0;
+
+  while (true)
+  {
+    pthread_mutex_lock(&_mutex);
+    while (_numFilled == kMtNumBlocks && !_threadStop)
+      pthread_cond_wait(&_blockFreed, &_mutex);
+    bool stop = _threadStop;
+    pthread_mutex_unlock(&_mutex);
+    if (stop)
+      return;
+
+    // GetLongestMatch writes up to distances[3] even if it finds less
+    UINT32 *block = _blocks + writeBlock * kMtBlockSize;
+    UINT32 size = 0;
+    bool done = false;
+    while (size + 1 + MyMax(_matchMaxLen, UINT32(3)) + 1 <= kMtBlockSize)
+    {
+      if (_matchFinder.GetNumAvailableBytes() == 0)
+      {
+        done = true;
+        break;
+      }
+      UINT32 len = _matchFinder.GetLongestMatch(block + size + 1);
+      block[size] = len;
+      size += len + 2;
+      _matchFinder.MovePos();
+    }
+
+    pthread_mutex_lock(&_mutex);
+    _blockLen[writeBlock] = size;
+    _numFilled++;
+    _threadDone = done;
+    pthread_cond_signal(&_blockFilled);
+    pthread_mutex_unlock(&_mutex);
+    if (done)
+      return;
+    writeBlock = (writeBlock + 1) % kMtNumBlocks;
+  }
+}
+
+// release the block the encoder has read and wait for the next one
+bool CMatchFinderBinTree::NextBlock()
+{
+  pthread_mutex_lock(&_mutex);
+  if (_readHeld)
+  {
+    _readHeld = false;
+    _readBlock = (_readBlock + 1) % kMtNumBlocks;
+    _numFilled--;
+    pthread_cond_signal(&_blockFreed);
+  }
+  while (_numFilled == 0 && !_threadDone)
+    pthread_cond_wait(&_blockFilled, &_mutex);
+  if (_numFilled != 0)
+  {
+    _readHeld = true;
+    _readPtr = _blocks + _readBlock * kMtBlockSize;
+    _readEnd = _readPtr + _blockLen[_readBlock];
+  }
+  pthread_mutex_unlock(&_mutex);
+  return _readHeld && _readPtr != _readEnd;
+}
+
+void CMatchFinderBinTree::StopThread()
+{
+  if (!_threadRunning)
+    return;
+  pthread_mutex_lock(&_mutex);
+  _threadStop = true;
+  pthread_cond_signal(&_blockFreed);
+  pthread_mutex_unlock(&_mutex);
+  pthread_join(_thread, NULL);
+  _threadRunning = false;
 }
 
 UINT32 CMatchFinderBinTree::GetLongestMatch(UINT32 *distances)
-{ 
-  return _matchFinder.GetLongestMatch(distances); 
+{
+  if (!_multiThread)
+    return _matchFinder.GetLongestMatch(distances);
+
+  if (_readPtr == _readEnd && !NextBlock())
+    return 0;
+  UINT32 len = *_readPtr++;
+  for (UINT32 i = 0; i <= len; i++)
+    distances[i] = _readPtr[i];
+  _readPtr += len + 1;
+  return len;
 }
 
 void CMatchFinderBinTree::DummyLongestMatch()
-{ 
-  _matchFinder.DummyLongestMatch(); 
+{
+  if (!_multiThread)
+  {
+    _matchFinder.DummyLongestMatch();
+    return;
+  }
+
+  if (_readPtr == _readEnd && !NextBlock())
+    return;
+  _readPtr += *_readPtr + 2;
 }
 
 const BYTE * CMatchFinderBinTree::GetPointerToCurrentPos()
 {
-  return _matchFinder.GetPointerToCurrentPos();
+  return _inWindow->GetPointerToCurrentPos();
 }
@@ -137,9 +137,9 @@ public:
       if ((_pos + index) + limit > _streamPos)
         limit = _streamPos - (_pos + index);
     back++;
-    BYTE *pby = _buffer + _pos + index;
+    BYTE *pby = _buffer + (_pos + index);
     UINT32 i;
-    for(i = 0; i < limit && pby[i] == pby[i - back]; i++);
+    for(i = 0; i < limit && pby[i] == pby[(int) (i - back)]; i++);
     return i;
   }
 
@@ -148,9 +148,11 @@ public:
     return _streamPos - _pos; 
   }
 
+  // subValue may be UINT32(-1) (see CInTree::Init), offsets before _pos
+  // wrap as UINT32 and are added to pointers signed for 64 bit hosts
   void ReduceOffsets(UINT32 subValue)
   {
-    _buffer += subValue;
+    _buffer += (int) subValue;
     _posLimit -= subValue;
     _pos -= subValue;
     _streamPos -= subValue;
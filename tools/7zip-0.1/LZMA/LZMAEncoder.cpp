@@ -33,16 +33,22 @@ const UINT32 kNumFastBytesDefault = 0x40;
 
 extern "C" {
 
-  int EncodeLZMA(unsigned char *pbDest, unsigned int *uiDecomprLen, unsigned char *pbSrc, unsigned int *uiComprLen)
+  int EncodeLZMAMultiThread(unsigned char *pbDest, unsigned int *uiDecomprLen, unsigned char *pbSrc, unsigned int *uiComprLen, int multiThread)
   {
      CEncoder MyEncoder;
   
+     MyEncoder.SetMultiThread(multiThread != 0);
      /*======================================================
      Decode
      =======================================================*/
      return MyEncoder.CodeReal(pbSrc,pbDest,uiComprLen,uiDecomprLen,0);
   }
 
+  int EncodeLZMA(unsigned char *pbDest, unsigned int *uiDecomprLen, unsigned char *pbSrc, unsigned int *uiComprLen)
+  {
+     return EncodeLZMAMultiThread(pbDest, uiDecomprLen, pbSrc, uiComprLen, 0);
+  }
+
 }
 
 class CFastPosInit
@@ -65,6 +71,7 @@ public:
 } g_FastPosInit;
 
 CEncoder::CEncoder():
+  _matchFinder(0),
   _dictionarySize(1 << kDefaultDictionaryLogSize),
   _dictionarySizePrev(UINT32(-1)),
   _numFastBytes(kNumFastBytesDefault),
@@ -78,6 +85,7 @@ CEncoder::CEncoder():
   UINT32 i;
 
   _fastMode = false;
+  _multiThread = false;
   _posAlignEncoder.Create(kNumAlignBits);
 
   for(i = 0; i < kNumPosModels; i++)
@@ -90,6 +98,7 @@ int CEncoder::Create()
   if (!_matchFinder)
   {
     _matchFinder = new CMatchFinderBinTree;
+    _matchFinder->SetMultiThread(_multiThread);
   }
 
   if (_dictionarySize == _dictionarySizePrev && _numFastBytesPrev == _numFastBytes)
@@ -404,7 +413,7 @@ UINT32 CEncoder::GetOptimum(UINT32 &backRes, UINT32 position)
     UINT32 curPrice = _optimum[cur].Price; 
     const BYTE *data = _matchFinder->GetPointerToCurrentPos() - 1;
     BYTE currentByte = *data;
-    BYTE matchByte = data[0 - reps[0] - 1];
+    BYTE matchByte = data[(int) (0 - reps[0] - 1)];
 
     UINT32 posState = (position & _posStateMask);
 
@@ -450,7 +459,7 @@ UINT32 CEncoder::GetOptimum(UINT32 &backRes, UINT32 position)
       UINT32 backOffset = reps[0] + 1;
       UINT32 temp;
       for (temp = 1; temp < numAvailableBytes; temp++)
-        if (data[temp] != data[temp - backOffset])
+        if (data[temp] != data[(int) (temp - backOffset)])
           break;
       UINT32 lenTest2 = temp - 1;
       if (lenTest2 >= 2)
@@ -482,7 +491,7 @@ UINT32 CEncoder::GetOptimum(UINT32 &backRes, UINT32 position)
       UINT32 backOffset = reps[repIndex] + 1;
       UINT32 lenTest;
       for (lenTest = 0; lenTest < numAvailableBytes; lenTest++)
-        if (data[lenTest] != data[lenTest - backOffset])
+        if (data[lenTest] != data[(int) (lenTest - backOffset)])
           break;
       for(; lenTest >= 2; lenTest--)
       {
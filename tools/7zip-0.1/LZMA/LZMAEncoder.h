@@ -128,6 +128,7 @@ private:
 
   bool _writeEndMark;
   bool _fastMode; 
+  bool _multiThread;
 
   UINT32  _inpBufSize;
   
@@ -205,10 +206,19 @@ private:
 
 public:
   CEncoder();
+  ~CEncoder()
+  {
+    delete _matchFinder;
+  }
   void SetWriteEndMarkerMode(bool writeEndMarker)
   { 
     _writeEndMark= writeEndMarker; 
   }
+  // run the match finder in a second thread, the output does not change
+  void SetMultiThread(bool multiThread)
+  {
+    _multiThread = multiThread;
+  }
 
   int Create();
 
@@ -36,6 +36,8 @@
 #define _LZMA_ENCODER_H_
 
 int EncodeLZMA(unsigned char *pbDst,unsigned int *uiDecomprLen, unsigned char *pbSrc, unsigned int *uiComprLen);
+/* same output as EncodeLZMA, with the match finder in a second thread if multiThread is set */
+int EncodeLZMAMultiThread(unsigned char *pbDst,unsigned int *uiDecomprLen, unsigned char *pbSrc, unsigned int *uiComprLen, int multiThread);
 
 #endif
 
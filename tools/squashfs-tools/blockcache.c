@@ -0,0 +1,336 @@
+/*
+ * Create a squashfs filesystem.  This is a highly compressed read only filesystem.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * blockcache.c
+ *
+ * Persistent cache of compressed data and fragment blocks, for -cache.
+ * A block is looked up by the 64 bit FNV-1a hash, the Adler-32 and the size
+ * of its uncompressed data.  The compressor output does not depend on
+ * anything else, so a hit gives the bytes compressing the block would, and
+ * the filesystem is the same as one built without the cache.  The cache file
+ * records the compressor output for a fixed probe block, if the compressor
+ * or its settings change the cache is not used.  The cache is written back
+ * holding the blocks used by this run only.
+ */
+
+#define TRUE 1
+#define FALSE 0
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "squashfs_fs.h"
+#include "blockcache.h"
+
+#define ERROR(s, args...)		fprintf(stderr, s, ## args)
+
+#define CACHE_HASH_SIZE		65536
+#define CACHE_HASH(h)		((unsigned int) (h) & (CACHE_HASH_SIZE - 1))
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define PROBE_SIZE	512
+
+extern int block_size;
+extern unsigned long long fnv_hash(unsigned long long hash, unsigned char *b, unsigned int bytes);
+extern unsigned int compress_block(char *d, char *s, int size, int block_size, int uncompressed, int data_block, int *res);
+
+struct cache_node {
+	struct block_cache_entry	entry;
+	char				*data;
+	struct cache_node		*next;
+};
+
+static char *cache_file = NULL, *file_data = NULL;
+static struct cache_node *cache_table[CACHE_HASH_SIZE];
+static struct block_cache_header cache_header;
+static int cache_hits = 0, cache_misses = 0, cache_entries = 0;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static unsigned int block_check(unsigned char *b, int bytes)
+{
+	unsigned int a = 1, s = 0;
+	int n;
+
+	while(bytes) {
+		n = bytes < 5552 ? bytes : 5552;
+		bytes -= n;
+		while(n--) {
+			a += *b++;
+			s += a;
+		}
+		a %= 65521;
+		s %= 65521;
+	}
+
+	return (s << 16) | a;
+}
+
+
+static void add_node(struct cache_node *node)
+{
+	int h = CACHE_HASH(node->entry.hash);
+
+	node->next = cache_table[h];
+	cache_table[h] = node;
+	cache_entries ++;
+}
+
+
+static struct cache_node *lookup(struct block_cache_key *key)
+{
+	struct cache_node *node;
+
+	for(node = cache_table[CACHE_HASH(key->hash)]; node; node = node->next)
+		if(node->entry.hash == key->hash && node->entry.check == key->check &&
+				node->entry.size == key->size)
+			break;
+
+	return node;
+}
+
+
+/* compress the probe block, the fingerprint of the compressor and its settings */
+static int probe(unsigned int *c_byte, unsigned long long *hash)
+{
+	static char text[] = "squashfs block cache probe ";
+	char in[PROBE_SIZE], out[block_size << 1];
+	int i, res;
+
+	for(i = 0; i < PROBE_SIZE; i++)
+		in[i] = text[i % (sizeof(text) - 1)] ^ (i >> 6);
+
+	*c_byte = compress_block(out, in, PROBE_SIZE, block_size, FALSE, FALSE, &res);
+	if(res != Z_OK)
+		return FALSE;
+	*hash = fnv_hash(FNV_OFFSET, (unsigned char *) out, SQUASHFS_COMPRESSED_SIZE(*c_byte));
+	return TRUE;
+}
+
+
+static void load(int fd, long long size)
+{
+	struct block_cache_header header;
+	struct cache_node *node;
+	long long offset;
+	unsigned int i, bytes;
+
+	if(size < sizeof(header) || (file_data = (char *) malloc(size)) == NULL ||
+			read(fd, file_data, size) != size) {
+		ERROR("Could not read block cache %s, not using it\n", cache_file);
+		return;
+	}
+
+	memcpy(&header, file_data, sizeof(header));
+	if(memcmp(header.magic, BLOCK_CACHE_MAGIC, 4) != 0 || header.version != BLOCK_CACHE_VERSION) {
+		ERROR("%s is not a block cache, not using it\n", cache_file);
+		return;
+	}
+	if(header.probe_c_byte != cache_header.probe_c_byte || header.probe_hash != cache_header.probe_hash) {
+		printf("Block cache %s was written by another compressor, not using it\n", cache_file);
+		return;
+	}
+
+	for(offset = sizeof(header), i = 0; i < header.entries; i++) {
+		if(offset + sizeof(struct block_cache_entry) > size)
+			goto corrupt;
+		if((node = (struct cache_node *) malloc(sizeof(struct cache_node))) == NULL) {
+			ERROR("Out of memory loading block cache, using part of it\n");
+			return;
+		}
+		memcpy(&node->entry, file_data + offset, sizeof(struct block_cache_entry));
+		offset += sizeof(struct block_cache_entry);
+		bytes = SQUASHFS_COMPRESSED_SIZE_BLOCK(node->entry.c_byte);
+		if(node->entry.size < 1 || node->entry.size > SQUASHFS_FILE_MAX_SIZE ||
+				bytes > SQUASHFS_FILE_MAX_SIZE || offset + bytes > size) {
+			free(node);
+			goto corrupt;
+		}
+		node->data = file_data + offset;
+		node->entry.used = FALSE;
+		offset += bytes;
+		add_node(node);
+	}
+	return;
+
+corrupt:
+	ERROR("Block cache %s is truncated or corrupt, using %d entries\n", cache_file, cache_entries);
+}
+
+
+/*
+ * Use filename as the block cache, it need not exist.  Returns FALSE if
+ * the cache cannot be used.
+ */
+int block_cache_open(char *filename)
+{
+	struct stat buf;
+	int fd;
+
+	if(!probe(&cache_header.probe_c_byte, &cache_header.probe_hash)) {
+		ERROR("Compressor failed on the block cache probe, not using the cache\n");
+		return FALSE;
+	}
+	cache_file = filename;
+
+	if((fd = open(filename, O_RDONLY)) == -1) {
+		if(errno != ENOENT)
+			perror("Could not open block cache, starting an empty one");
+		return TRUE;
+	}
+	if(fstat(fd, &buf) == 0)
+		load(fd, buf.st_size);
+	close(fd);
+
+	return TRUE;
+}
+
+
+/*
+ * Look the block up, on a hit the compressed block is copied to d.  Called
+ * from the compressor threads.
+ */
+int block_cache_get(struct block_cache_key *key, char *s, int size, char *d, unsigned int *c_byte)
+{
+	struct cache_node *node;
+
+	if(cache_file == NULL)
+		return FALSE;
+
+	key->hash = fnv_hash(FNV_OFFSET, (unsigned char *) s, size);
+	key->check = block_check((unsigned char *) s, size);
+	key->size = size;
+
+	pthread_mutex_lock(&cache_mutex);
+	if((node = lookup(key)) != NULL) {
+		node->entry.used = TRUE;
+		cache_hits ++;
+	} else
+		cache_misses ++;
+	pthread_mutex_unlock(&cache_mutex);
+
+	if(node == NULL)
+		return FALSE;
+
+	/* entries are never changed or freed once added */
+	memcpy(d, node->data, SQUASHFS_COMPRESSED_SIZE_BLOCK(node->entry.c_byte));
+	*c_byte = node->entry.c_byte;
+	return TRUE;
+}
+
+
+/* add a block compressed after block_cache_get() missed it */
+void block_cache_put(struct block_cache_key *key, char *d, unsigned int c_byte)
+{
+	struct cache_node *node;
+	unsigned int bytes = SQUASHFS_COMPRESSED_SIZE_BLOCK(c_byte);
+
+	if(cache_file == NULL)
+		return;
+
+	if((node = (struct cache_node *) malloc(sizeof(struct cache_node))) == NULL ||
+			(node->data = (char *) malloc(bytes)) == NULL) {
+		free(node);
+		return;
+	}
+	node->entry.hash = key->hash;
+	node->entry.check = key->check;
+	node->entry.size = key->size;
+	node->entry.c_byte = c_byte;
+	node->entry.used = TRUE;
+	memcpy(node->data, d, bytes);
+
+	pthread_mutex_lock(&cache_mutex);
+	if(lookup(key) == NULL) {
+		add_node(node);
+		node = NULL;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	/* another compressor added the same block */
+	if(node) {
+		free(node->data);
+		free(node);
+	}
+}
+
+
+/* write the blocks used by this run back to the cache file */
+void block_cache_close()
+{
+	struct cache_node *node;
+	char tmp[strlen(cache_file ? cache_file : "") + 5];
+	FILE *file;
+	int i;
+
+	if(cache_file == NULL)
+		return;
+
+	sprintf(tmp, "%s.tmp", cache_file);
+	if((file = fopen(tmp, "w")) == NULL) {
+		perror("Could not create block cache");
+		return;
+	}
+
+	memcpy(cache_header.magic, BLOCK_CACHE_MAGIC, 4);
+	cache_header.version = BLOCK_CACHE_VERSION;
+	cache_header.entries = 0;
+	for(i = 0; i < CACHE_HASH_SIZE; i++)
+		for(node = cache_table[i]; node; node = node->next)
+			if(node->entry.used)
+				cache_header.entries ++;
+
+	if(fwrite(&cache_header, sizeof(cache_header), 1, file) != 1)
+		goto failed;
+	for(i = 0; i < CACHE_HASH_SIZE; i++)
+		for(node = cache_table[i]; node; node = node->next)
+			if(node->entry.used && (fwrite(&node->entry, sizeof(struct block_cache_entry), 1, file) != 1 ||
+					fwrite(node->data, SQUASHFS_COMPRESSED_SIZE_BLOCK(node->entry.c_byte), 1, file) != 1))
+				goto failed;
+	if(fclose(file) != 0) {
+		file = NULL;
+		goto failed;
+	}
+
+	if(rename(tmp, cache_file) == -1) {
+		perror("Could not replace block cache");
+		unlink(tmp);
+	}
+	return;
+
+failed:
+	perror("Could not write block cache");
+	if(file)
+		fclose(file);
+	unlink(tmp);
+}
+
+
+void block_cache_stats(int *hits, int *misses)
+{
+	*hits = cache_hits;
+	*misses = cache_misses;
+}
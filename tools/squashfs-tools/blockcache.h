@@ -0,0 +1,54 @@
+/*
+ * Create a squashfs filesystem.  This is a highly compressed read only filesystem.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * blockcache.h
+ */
+
+#define BLOCK_CACHE_MAGIC	"sqbc"
+#define BLOCK_CACHE_VERSION	1
+
+/* cache file header, followed by the entries */
+struct block_cache_header {
+	char			magic[4];
+	unsigned int		version;
+	unsigned int		entries;
+	/* the compressor output for a fixed block, a change of compressor or settings empties the cache */
+	unsigned int		probe_c_byte;
+	unsigned long long	probe_hash;
+};
+
+/* an entry on disk is this, followed by SQUASHFS_COMPRESSED_SIZE_BLOCK(c_byte) bytes */
+struct block_cache_entry {
+	unsigned long long	hash;		/* 64 bit FNV-1a of the uncompressed block */
+	unsigned int		check;		/* Adler-32 of the uncompressed block */
+	int			size;
+	unsigned int		c_byte;
+	unsigned int		used;
+};
+
+/* a block looked up by block_cache_get(), passed back to block_cache_put() */
+struct block_cache_key {
+	unsigned long long	hash;
+	unsigned int		check;
+	int			size;
+};
+
+extern int block_cache_open(char *filename);
+extern int block_cache_get(struct block_cache_key *key, char *s, int size, char *d, unsigned int *c_byte);
+extern void block_cache_put(struct block_cache_key *key, char *d, unsigned int c_byte);
+extern void block_cache_close();
+extern void block_cache_stats(int *hits, int *misses);
@@ -0,0 +1,818 @@
+/*
+ * Create a squashfs filesystem.  This is a highly compressed read only filesystem.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * bootsort.c
+ *
+ * Generate a mksquashfs -sort file from a trace of the files read during
+ * boot and the first UI load.  Files are sorted in the order they were
+ * first read, so the files read together at boot are in neighbouring data
+ * blocks and the small ones fill the same fragments.  The trace can be
+ *
+ *	strace -f -o boot.trace ...	open, read, pread, lseek, mmap, execve,
+ *					dup, fork and close are followed
+ *	cat /proc/<pid>/maps		mapped files
+ *	path [offset length]		one file per line
+ *
+ * Paths are those of the target, they are looked up in the root directory
+ * given to mksquashfs, following its symbolic links.  The blocks the traced
+ * reads touch are predicted for the directory order mksquashfs uses without
+ * -sort and for the sorted order.  Duplicate files share the blocks of the
+ * first copy as they do in mksquashfs, the inode and directory tables are
+ * not counted.
+ *
+ *	bootsort -o rootfs.sort userland/target boot.trace
+ *	mksquashfs userland/target rootfs.img -sort rootfs.sort
+ */
+
+#define TRUE 1
+#define FALSE 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <squashfs_fs.h>
+
+#define ERROR(s, args...)		fprintf(stderr, s, ## args)
+#define BAD_ERROR(s, args...)		{\
+					fprintf(stderr, "FATAL ERROR:" s, ##args);\
+					exit(1);\
+					}
+
+#define FILE_HASH_SIZE		65536
+#define FD_HASH_SIZE		1024
+#define MAX_PENDING		64
+#define MAX_LINE		16384
+#define MAX_SYMLINKS		32
+
+/* a regular file of the root directory */
+struct file {
+	char		*path;		/* relative to the root directory */
+	long long	size;
+	unsigned long long checksum;
+	int		order;		/* first read in the trace, 0 if not read */
+	unsigned int	blocks;
+	unsigned int	frag_bytes;
+	unsigned int	block;		/* first data block */
+	int		fragment;
+	int		tail_read;
+	struct file	*hash_next;
+	struct file	*dup_next;
+	struct file	*next;		/* directory order */
+};
+
+/* a read of a file, in trace order */
+struct access {
+	struct file	*file;
+	long long	offset;
+	long long	length;
+	struct access	*next;
+};
+
+/* an open file descriptor of a traced process */
+struct fd_entry {
+	int		pid;
+	int		fd;
+	struct file	*file;
+	long long	offset;
+	struct fd_entry	*next;
+};
+
+/* a system call strace split with <unfinished ...> */
+struct pending {
+	int		pid;
+	char		*line;
+};
+
+struct file *file_hash[FILE_HASH_SIZE], *dup_hash[FILE_HASH_SIZE], *files = NULL, **files_tail = &files;
+int file_count = 0, traced_count = 0;
+struct access *accesses = NULL, **accesses_tail = &accesses;
+int access_count = 0;
+struct fd_entry *fd_hash[FD_HASH_SIZE];
+struct pending pending[MAX_PENDING];
+
+char *root;
+int block_size = SQUASHFS_FILE_SIZE, block_log = SQUASHFS_FILE_LOG;
+int no_fragments = FALSE, always_use_fragments = FALSE, duplicate_checking = TRUE, verbose = FALSE;
+int frag_cache = SQUASHFS_CACHED_FRAGMENTS;
+
+
+unsigned int hash_path(char *path)
+{
+	unsigned int hash = 0;
+
+	while(*path)
+		hash = hash * 31 + (unsigned char) *path++;
+
+	return hash & (FILE_HASH_SIZE - 1);
+}
+
+
+struct file *lookup_file(char *path)
+{
+	struct file *file;
+
+	for(file = file_hash[hash_path(path)]; file; file = file->hash_next)
+		if(strcmp(file->path, path) == 0)
+			return file;
+
+	return NULL;
+}
+
+
+/* 64 bit FNV-1a hash of the file, to find the duplicates mksquashfs finds */
+unsigned long long get_checksum(char *filename, long long size)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	unsigned char buffer[SQUASHFS_FILE_MAX_SIZE];
+	int fd, bytes, i;
+
+	if((fd = open(filename, O_RDONLY)) == -1)
+		return 0;
+	while(size > 0 && (bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+		for(i = 0; i < bytes && i < size; i++) {
+			hash ^= buffer[i];
+			hash *= 0x100000001b3ULL;
+		}
+		size -= bytes;
+	}
+	close(fd);
+
+	return hash;
+}
+
+
+void add_file(char *path, char *filename, long long size)
+{
+	struct file *file;
+	unsigned int hash = hash_path(path);
+
+	if((file = (struct file *) calloc(1, sizeof(struct file))) == NULL ||
+			(file->path = strdup(path)) == NULL)
+		BAD_ERROR("Out of memory allocating file entry\n");
+
+	file->size = size > SQUASHFS_MAX_FILE_SIZE ? SQUASHFS_MAX_FILE_SIZE : size;
+	if(duplicate_checking)
+		file->checksum = get_checksum(filename, file->size);
+	file->hash_next = file_hash[hash];
+	file_hash[hash] = file;
+	*files_tail = file;
+	files_tail = &file->next;
+	file_count ++;
+}
+
+
+/*
+ * Regular files in the order mksquashfs writes them without -sort, directories
+ * are read with readdir() and written when they are found
+ */
+void scan_dir(char *pathname, char *relative)
+{
+	DIR *linuxdir;
+	struct dirent *d_name;
+	struct stat buf;
+	char filename[8192], relname[8192];
+
+	if((linuxdir = opendir(pathname)) == NULL) {
+		ERROR("Could not open %s, skipping...\n", pathname);
+		return;
+	}
+
+	while((d_name = readdir(linuxdir)) != NULL) {
+		if(strcmp(d_name->d_name, ".") == 0 || strcmp(d_name->d_name, "..") == 0)
+			continue;
+		strcat(strcat(strcpy(filename, pathname), "/"), d_name->d_name);
+		if(*relative)
+			strcat(strcat(strcpy(relname, relative), "/"), d_name->d_name);
+		else
+			strcpy(relname, d_name->d_name);
+
+		if(lstat(filename, &buf) == -1) {
+			char buffer[8192];
+			sprintf(buffer, "Cannot stat dir/file %s, ignoring", filename);
+			perror(buffer);
+			continue;
+		}
+
+		if(S_ISREG(buf.st_mode))
+			add_file(relname, filename, buf.st_size);
+		else if(S_ISDIR(buf.st_mode))
+			scan_dir(filename, relname);
+	}
+
+	closedir(linuxdir);
+}
+
+
+/*
+ * Resolve a target path to a file of the root directory, symbolic links
+ * are followed as they would be on the target
+ */
+struct file *resolve(char *target)
+{
+	char path[8192], rest[8192], link[8192], filename[8192];
+	char *name, *next;
+	struct stat buf;
+	int links = 0, len;
+
+	path[0] = '\0';
+	if(strlen(target) >= sizeof(rest))
+		return NULL;
+	strcpy(rest, target);
+
+	for(name = rest; *name; name = next) {
+		while(*name == '/')
+			name ++;
+		if(*name == '\0')
+			break;
+		if((next = strchr(name, '/')) != NULL)
+			*next++ = '\0';
+		else
+			next = name + strlen(name);
+
+		if(strcmp(name, ".") == 0)
+			continue;
+		if(strcmp(name, "..") == 0) {
+			char *slash = strrchr(path, '/');
+			if(slash)
+				*slash = '\0';
+			else
+				path[0] = '\0';
+			continue;
+		}
+
+		if(strlen(path) + strlen(name) + 2 >= sizeof(path))
+			return NULL;
+		if(path[0])
+			strcat(path, "/");
+		strcat(path, name);
+
+		sprintf(filename, "%s/%s", root, path);
+		if(lstat(filename, &buf) == -1)
+			return NULL;
+		if(!S_ISLNK(buf.st_mode))
+			continue;
+
+		if(++links > MAX_SYMLINKS || (len = readlink(filename, link, sizeof(link) - 1)) == -1)
+			return NULL;
+		link[len] = '\0';
+
+		/* the link replaces the name, an absolute link starts again at the root */
+		if(strlen(link) + strlen(next) + 2 >= sizeof(rest))
+			return NULL;
+		sprintf(filename, "%s/%s", link, next);
+		strcpy(rest, filename);
+		next = rest;
+		if(link[0] == '/')
+			path[0] = '\0';
+		else {
+			char *slash = strrchr(path, '/');
+			if(slash)
+				*slash = '\0';
+			else
+				path[0] = '\0';
+		}
+	}
+
+	return lookup_file(path);
+}
+
+
+void add_access(struct file *file, long long offset, long long length)
+{
+	struct access *access;
+
+	if(file == NULL || offset >= file->size || length <= 0)
+		return;
+	if(offset + length > file->size)
+		length = file->size - offset;
+
+	if((access = (struct access *) malloc(sizeof(struct access))) == NULL)
+		BAD_ERROR("Out of memory allocating access entry\n");
+	access->file = file;
+	access->offset = offset;
+	access->length = length;
+	access->next = NULL;
+	*accesses_tail = access;
+	accesses_tail = &access->next;
+	access_count ++;
+
+	if(file->order == 0)
+		file->order = ++ traced_count;
+}
+
+
+struct fd_entry **find_fd(int pid, int fd)
+{
+	struct fd_entry **entry;
+
+	for(entry = &fd_hash[(pid * 31 + fd) & (FD_HASH_SIZE - 1)]; *entry; entry = &(*entry)->next)
+		if((*entry)->pid == pid && (*entry)->fd == fd)
+			break;
+
+	return entry;
+}
+
+
+void close_fd(int pid, int fd)
+{
+	struct fd_entry **entry = find_fd(pid, fd), *old = *entry;
+
+	if(old) {
+		*entry = old->next;
+		free(old);
+	}
+}
+
+
+/* only descriptors of files in the root directory are kept */
+void open_fd(int pid, int fd, struct file *file, long long offset)
+{
+	struct fd_entry *entry;
+
+	close_fd(pid, fd);
+	if(file == NULL)
+		return;
+
+	if((entry = (struct fd_entry *) malloc(sizeof(struct fd_entry))) == NULL)
+		BAD_ERROR("Out of memory allocating fd entry\n");
+	entry->pid = pid;
+	entry->fd = fd;
+	entry->file = file;
+	entry->offset = offset;
+	entry->next = fd_hash[(pid * 31 + fd) & (FD_HASH_SIZE - 1)];
+	fd_hash[(pid * 31 + fd) & (FD_HASH_SIZE - 1)] = entry;
+}
+
+
+void fork_fds(int pid, int child)
+{
+	struct fd_entry *entry;
+	int i;
+
+	for(i = 0; i < FD_HASH_SIZE; i++)
+		for(entry = fd_hash[i]; entry; entry = entry->next)
+			if(entry->pid == pid)
+				open_fd(child, entry->fd, entry->file, entry->offset);
+}
+
+
+/* the first quoted string of the arguments */
+struct file *path_arg(char *args)
+{
+	char path[8192], *p, *q = path;
+
+	if((p = strchr(args, '"')) == NULL)
+		return NULL;
+	for(p++; *p && *p != '"' && q < path + sizeof(path) - 1; p++)
+		*q++ = *p;
+	*q = '\0';
+
+	return resolve(path);
+}
+
+
+/* the n'th comma separated argument */
+long long number_arg(char *args, int n)
+{
+	while(n-- && args)
+		if((args = strchr(args, ',')) != NULL)
+			args ++;
+
+	return args ? strtoll(args, NULL, 0) : -1;
+}
+
+
+void strace_call(int pid, char *call, char *args, char *result)
+{
+	long long res, offset;
+	struct fd_entry *entry;
+	char *p;
+	int fd;
+
+	if(*result == '?' || *result == '-')
+		return;
+	res = strtoll(result, NULL, 0);
+	fd = atoi(args);
+	entry = *find_fd(pid, fd);
+
+	if(strcmp(call, "open") == 0 || strcmp(call, "openat") == 0 || strcmp(call, "creat") == 0)
+		open_fd(pid, res, path_arg(args), 0);
+	else if(strcmp(call, "execve") == 0) {
+		struct file *file = path_arg(args);
+		if(file)
+			add_access(file, 0, file->size);
+	} else if(strcmp(call, "read") == 0 || strcmp(call, "readv") == 0) {
+		if(entry) {
+			add_access(entry->file, entry->offset, res);
+			entry->offset += res;
+		}
+	} else if(strcmp(call, "pread") == 0 || strcmp(call, "pread64") == 0) {
+		if(entry && (p = strrchr(args, ',')) != NULL)
+			add_access(entry->file, strtoll(p + 1, NULL, 0), res);
+	} else if(strcmp(call, "lseek") == 0) {
+		if(entry)
+			entry->offset = res;
+	} else if(strcmp(call, "_llseek") == 0) {
+		if(entry && (p = strchr(args, '[')) != NULL)
+			entry->offset = strtoll(p + 1, NULL, 0);
+	} else if(strcmp(call, "mmap") == 0 || strcmp(call, "mmap2") == 0) {
+		if((entry = *find_fd(pid, number_arg(args, 4))) != NULL) {
+			offset = number_arg(args, 5);
+			if(strcmp(call, "mmap2") == 0)
+				offset *= 4096;
+			add_access(entry->file, offset, number_arg(args, 1));
+		}
+	} else if(strcmp(call, "sendfile") == 0 || strcmp(call, "sendfile64") == 0) {
+		if((entry = *find_fd(pid, number_arg(args, 1))) != NULL) {
+			if((p = strchr(args, '[')) != NULL)
+				add_access(entry->file, strtoll(p + 1, NULL, 0), res);
+			else {
+				add_access(entry->file, entry->offset, res);
+				entry->offset += res;
+			}
+		}
+	} else if(strcmp(call, "close") == 0)
+		close_fd(pid, fd);
+	else if(strcmp(call, "dup") == 0 || strcmp(call, "dup2") == 0 || strcmp(call, "dup3") == 0 ||
+			(strcmp(call, "fcntl") == 0 && strstr(args, "F_DUPFD")) || (strcmp(call, "fcntl64") == 0 &&
+			strstr(args, "F_DUPFD"))) {
+		if(entry)
+			open_fd(pid, res, entry->file, entry->offset);
+	} else if(strcmp(call, "fork") == 0 || strcmp(call, "vfork") == 0 || strcmp(call, "clone") == 0) {
+		if(res > 0)
+			fork_fds(pid, res);
+	}
+}
+
+
+struct pending *find_pending(int pid)
+{
+	int i;
+
+	for(i = 0; i < MAX_PENDING; i++)
+		if(pending[i].line && pending[i].pid == pid)
+			return &pending[i];
+
+	return NULL;
+}
+
+
+/*
+ * An strace line, the pid and time stamps of -f and -t are skipped.  Calls
+ * split by another process are joined again.
+ */
+int strace_line(char *line)
+{
+	char joined[MAX_LINE * 2], *p = line, *call, *args, *result;
+	struct pending *split;
+	int pid = 0, i;
+
+	for(;;) {
+		while(*p == ' ')
+			p ++;
+		if(strncmp(p, "[pid", 4) == 0) {
+			pid = atoi(p + 4);
+			if((p = strchr(p, ']')) == NULL)
+				return FALSE;
+			p ++;
+		} else if(isdigit(*p)) {
+			char *end = p + strspn(p, "0123456789:.");
+			if(*end != ' ')
+				return FALSE;
+			if(strspn(p, "0123456789") == end - p && pid == 0)
+				pid = atoi(p);
+			p = end;
+		} else
+			break;
+	}
+
+	if(strncmp(p, "<... ", 5) == 0) {
+		if((split = find_pending(pid)) == NULL || (args = strstr(p, "resumed>")) == NULL)
+			return TRUE;
+		snprintf(joined, sizeof(joined), "%s%s", split->line, args + 8);
+		free(split->line);
+		split->line = NULL;
+		p = joined;
+	} else if((args = strstr(p, " <unfinished ...>")) != NULL) {
+		*args = '\0';
+		for(i = 0; i < MAX_PENDING && pending[i].line; i++);
+		if(i < MAX_PENDING && (pending[i].line = strdup(p)) != NULL)
+			pending[i].pid = pid;
+		return TRUE;
+	}
+
+	for(call = p; isalnum(*p) || *p == '_'; p++);
+	if(*p != '(' || p == call)
+		return FALSE;
+	*p = '\0';
+	args = p + 1;
+	if((result = strstr(args, ") = ")) == NULL)
+		return TRUE;
+	while((p = strstr(result + 4, ") = ")) != NULL)
+		result = p;
+	*result = '\0';
+	strace_call(pid, call, args, result + 4);
+	return TRUE;
+}
+
+
+void read_trace(char *filename)
+{
+	char line[MAX_LINE], path[8192];
+	unsigned long long start, end, offset, length;
+	int lines = 0, skipped = 0;
+	FILE *fd;
+
+	if((fd = fopen(filename, "r")) == NULL)
+		BAD_ERROR("Could not open trace %s: %s\n", filename, strerror(errno));
+
+	while(fgets(line, sizeof(line), fd) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		lines ++;
+
+		/* /proc/<pid>/maps */
+		if(sscanf(line, "%Lx-%Lx %*s %Lx %*s %*s %8191s", &start, &end, &offset, path) == 4) {
+			if(path[0] == '/')
+				add_access(resolve(path), offset, end - start);
+			continue;
+		}
+
+		if(strace_line(line))
+			continue;
+
+		/* path [offset length] */
+		if(line[0] == '/') {
+			struct file *file;
+			int n = sscanf(line, "%8191s %Ld %Ld", path, &offset, &length);
+			if((file = resolve(path)) == NULL)
+				skipped ++;
+			else if(n == 3)
+				add_access(file, offset, length);
+			else
+				add_access(file, 0, file->size);
+		}
+	}
+
+	fclose(fd);
+	if(verbose)
+		printf("%s: %d lines, %d accesses, %d paths not in %s\n", filename, lines, access_count, skipped, root);
+}
+
+
+/* blocks and fragments of the files as mksquashfs writes them in this order */
+void layout(struct file **order)
+{
+	unsigned int block = 0, fragment_size = 0;
+	int i, fragments = 0;
+
+	memset(dup_hash, 0, sizeof(dup_hash));
+	for(i = 0; i < file_count; i++) {
+		struct file *file = order[i], *dupl;
+		unsigned int hash = (unsigned int) file->checksum & (FILE_HASH_SIZE - 1);
+
+		if(duplicate_checking) {
+			for(dupl = dup_hash[hash]; dupl; dupl = dupl->dup_next)
+				if(dupl->size == file->size && dupl->checksum == file->checksum)
+					break;
+			if(dupl) {
+				file->blocks = dupl->blocks;
+				file->frag_bytes = dupl->frag_bytes;
+				file->block = dupl->block;
+				file->fragment = dupl->fragment;
+				continue;
+			}
+			file->dup_next = dup_hash[hash];
+			dup_hash[hash] = file;
+		}
+
+		if(!no_fragments && (file->size < block_size || always_use_fragments)) {
+			file->blocks = file->size >> block_log;
+			file->frag_bytes = file->size % block_size;
+		} else {
+			file->blocks = (file->size + block_size - 1) >> block_log;
+			file->frag_bytes = 0;
+		}
+		file->block = block;
+		block += file->blocks;
+
+		if(file->frag_bytes) {
+			if(fragment_size + file->frag_bytes > block_size) {
+				fragments ++;
+				fragment_size = 0;
+			}
+			file->fragment = fragments;
+			fragment_size += file->frag_bytes;
+		} else
+			file->fragment = -1;
+	}
+}
+
+
+int compare_block(const void *a, const void *b)
+{
+	unsigned int x = *(unsigned int *) a, y = *(unsigned int *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Data blocks are decompressed once into the page cache.  A fragment is
+ * decompressed when a file tail is read and the fragment is not in the
+ * kernel's least recently used cache of frag_cache fragments.
+ */
+void predict(char *name, struct file **order)
+{
+	unsigned int *blocks = NULL, *frags, nblocks = 0, size = 0, nfrags = 0, i;
+	int distinct_blocks = 0, distinct_frags = 0, cache[SQUASHFS_MAX_CACHED_FRAGMENTS], decompressions = 0;
+	struct access *access;
+
+	layout(order);
+
+	if((frags = (unsigned int *) malloc(access_count * sizeof(unsigned int) + 1)) == NULL)
+		BAD_ERROR("Out of memory allocating prediction\n");
+
+	for(i = 0; i < frag_cache; i++)
+		cache[i] = -1;
+	for(i = 0; i < file_count; i++)
+		order[i]->tail_read = FALSE;
+
+	for(access = accesses; access; access = access->next) {
+		struct file *file = access->file;
+		long long end = access->offset + access->length;
+		unsigned int first = access->offset >> block_log, last = (end - 1) >> block_log, b;
+
+		for(b = first; b <= last && b < file->blocks; b++) {
+			if(nblocks == size) {
+				size = size ? size << 1 : 1024;
+				if((blocks = (unsigned int *) realloc(blocks, size * sizeof(unsigned int))) == NULL)
+					BAD_ERROR("Out of memory allocating prediction\n");
+			}
+			blocks[nblocks ++] = file->block + b;
+		}
+
+		if(file->fragment != -1 && end > ((long long) file->blocks << block_log) && !file->tail_read) {
+			file->tail_read = TRUE;
+			frags[nfrags ++] = file->fragment;
+			/* cache[0] is the most recently used */
+			for(i = 0; i < frag_cache - 1 && cache[i] != file->fragment; i++);
+			if(cache[i] != file->fragment)
+				decompressions ++;
+			for(; i; i--)
+				cache[i] = cache[i - 1];
+			cache[0] = file->fragment;
+		}
+	}
+
+	qsort(blocks, nblocks, sizeof(unsigned int), compare_block);
+	for(i = 0; i < nblocks; i++)
+		if(i == 0 || blocks[i] != blocks[i - 1])
+			distinct_blocks ++;
+	qsort(frags, nfrags, sizeof(unsigned int), compare_block);
+	for(i = 0; i < nfrags; i++)
+		if(i == 0 || frags[i] != frags[i - 1])
+			distinct_frags ++;
+
+	printf("%-16s %6d data blocks, %5d fragment blocks, %5d fragment decompressions, %6d blocks decompressed\n",
+		name, distinct_blocks, distinct_frags, decompressions, distinct_blocks + decompressions);
+
+	free(blocks);
+	free(frags);
+}
+
+
+int compare_order(const void *a, const void *b)
+{
+	struct file *x = *(struct file **) a, *y = *(struct file **) b;
+
+	return x->order - y->order;
+}
+
+
+void show_usage(char *name, int exit_code)
+{
+	ERROR("Usage: %s [options] root trace ...\n", name);
+	ERROR("\nOptions are\n");
+	ERROR("\t-o <sort_file>\t\twrite the mksquashfs sort file\n");
+	ERROR("\t-b <block_size>\t\tset data block to <block_size>.  Default %d bytes\n", SQUASHFS_FILE_SIZE);
+	ERROR("\t-no-fragments\t\tas the mksquashfs option\n");
+	ERROR("\t-always-use-fragments\tas the mksquashfs option\n");
+	ERROR("\t-no-duplicates\t\tas the mksquashfs option\n");
+	ERROR("\t-frag-cache <n>\t\tpredict for the frag_cache=<n> mount option.  Default %d\n", SQUASHFS_CACHED_FRAGMENTS);
+	ERROR("\t-v\t\t\tprint the trace statistics\n");
+	exit(exit_code);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct file **order, *file;
+	char *sort_file = NULL;
+	FILE *out;
+	int i, n;
+
+	for(i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if(strcmp(argv[i], "-o") == 0) {
+			if(++i == argc)
+				show_usage(argv[0], 1);
+			sort_file = argv[i];
+		} else if(strcmp(argv[i], "-b") == 0) {
+			if(++i == argc)
+				show_usage(argv[0], 1);
+			block_size = strtol(argv[i], NULL, 10);
+			for(block_log = 12; block_log <= 16 && (1 << block_log) != block_size; block_log++);
+			if(block_log > 16) {
+				ERROR("%s: -b block size not 4096, 8192, 16384, 32768 or 65536\n", argv[0]);
+				exit(1);
+			}
+		} else if(strcmp(argv[i], "-no-fragments") == 0)
+			no_fragments = TRUE;
+		else if(strcmp(argv[i], "-always-use-fragments") == 0)
+			always_use_fragments = TRUE;
+		else if(strcmp(argv[i], "-no-duplicates") == 0)
+			duplicate_checking = FALSE;
+		else if(strcmp(argv[i], "-frag-cache") == 0) {
+			if(++i == argc)
+				show_usage(argv[0], 1);
+			frag_cache = strtol(argv[i], NULL, 10);
+			if(frag_cache < 1 || frag_cache > SQUASHFS_MAX_CACHED_FRAGMENTS) {
+				ERROR("%s: -frag-cache should be 1 to %d\n", argv[0], SQUASHFS_MAX_CACHED_FRAGMENTS);
+				exit(1);
+			}
+		} else if(strcmp(argv[i], "-v") == 0)
+			verbose = TRUE;
+		else
+			show_usage(argv[0], 1);
+	}
+	if(argc - i < 2)
+		show_usage(argv[0], 1);
+
+	root = argv[i++];
+	scan_dir(root, "");
+	for(; i < argc; i++)
+		read_trace(argv[i]);
+
+	if((order = (struct file **) malloc((file_count + 1) * sizeof(struct file *))) == NULL)
+		BAD_ERROR("Out of memory allocating file order\n");
+
+	printf("%d files in %s, %d read in the trace (%d reads)\n", file_count, root, traced_count, access_count);
+	if(traced_count > 32767) {
+		ERROR("More than 32767 files read, only the first 32767 are sorted\n");
+		traced_count = 32767;
+	}
+
+	for(i = 0, file = files; file; file = file->next)
+		order[i++] = file;
+	predict("directory order", order);
+
+	/*
+	 * mksquashfs writes the lowest priority first, files of the same
+	 * priority in the reverse order they are found
+	 */
+	for(n = 0, file = files; file; file = file->next)
+		if(file->order && file->order <= traced_count)
+			order[n++] = file;
+	qsort(order, n, sizeof(struct file *), compare_order);
+	for(i = file_count - 1, file = files; file; file = file->next)
+		if(!file->order || file->order > traced_count)
+			order[i--] = file;
+	predict("trace order", order);
+
+	if(sort_file == NULL)
+		return 0;
+
+	if((out = fopen(sort_file, "w")) == NULL)
+		BAD_ERROR("Could not open %s: %s\n", sort_file, strerror(errno));
+	for(i = 0; i < n; i++) {
+		if(strpbrk(order[i]->path, " \t\n")) {
+			ERROR("Can not sort %s, the sort file does not allow spaces\n", order[i]->path);
+			continue;
+		}
+		fprintf(out, "%s %d\n", order[i]->path, order[i]->order - n - 1);
+	}
+	fclose(out);
+
+	return 0;
+}
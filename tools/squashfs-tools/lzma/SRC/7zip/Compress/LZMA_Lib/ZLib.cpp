@@ -26,11 +26,17 @@
  */
 
 #include <zlib.h>
+#include <pthread.h>
 
 #define ZLIB_LC 3
 #define ZLIB_LP 0
 #define ZLIB_PB 2
 
+/*
+ * smallest dictionary of the kept encoders, it is grown to the block size
+ */
+#define ZLIB_MIN_DICT (1 << 16)
+
 #ifdef WIN32
 #include <initguid.h>
 #else
@@ -55,6 +61,13 @@ public:
 
   virtual ~CInMemoryStream() {}
 
+  void Reset(const Bytef *data, UInt64 size)
+  {
+	  m_data = data;
+	  m_size = size;
+	  m_offset = 0;
+  }
+
   MY_UNKNOWN_IMP2(IInStream, IStreamGetSize)
 
   STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize)
@@ -118,6 +131,16 @@ public:
   COutMemoryStream(Bytef *data, UInt64 maxsize) : 
 	  m_data(data), m_size(0), m_maxsize(maxsize), m_offset(0) {}
   virtual ~COutMemoryStream() {}
+
+  void Reset(Bytef *data, UInt64 maxsize)
+  {
+	  m_data = data;
+	  m_size = 0;
+	  m_maxsize = maxsize;
+	  m_offset = 0;
+  }
+
+  UInt64 Size() const { return m_size; }
   
   MY_UNKNOWN_IMP1(IOutStream)
 
@@ -181,20 +204,37 @@ protected:
 };
 
 
-ZEXTERN int ZEXPORT orig_compress2 OF((Bytef *dest,   uLongf *destLen,
-                                  const Bytef *source, uLong sourceLen,
-                                  int level))
+/*
+ * An encoder with its BT4 match finder is several megabytes, it is built
+ * once per thread and only reset between blocks.
+ */
+class CEncoderContext
+{
+public:
+	CEncoderContext() : dictionarySize(0), level(-1)
+	{
+		inStreamSpec = new CInMemoryStream(0, 0);
+		inStream = inStreamSpec;
+		outStreamSpec = new COutMemoryStream(0, 0);
+		outStream = outStreamSpec;
+		encoderSpec = new NCompress::NLZMA::CEncoder;
+		encoder = encoderSpec;
+	}
+
+	HRESULT SetProperties(UInt32 dictSize, int newLevel);
+
+	CInMemoryStream *inStreamSpec;
+	CMyComPtr<ISequentialInStream> inStream;
+	COutMemoryStream *outStreamSpec;
+	CMyComPtr<ISequentialOutStream> outStream;
+	NCompress::NLZMA::CEncoder *encoderSpec;
+	CMyComPtr<ICompressCoder> encoder;
+	UInt32 dictionarySize;
+	int level;
+};
+
+HRESULT CEncoderContext::SetProperties(UInt32 dictSize, int newLevel)
 {
-	CInMemoryStream *inStreamSpec = new CInMemoryStream(source, sourceLen);
-	CMyComPtr<ISequentialInStream> inStream = inStreamSpec;
-	
-	COutMemoryStream *outStreamSpec = new COutMemoryStream(dest, *destLen);
-	CMyComPtr<ISequentialOutStream> outStream = outStreamSpec;
-	
-	NCompress::NLZMA::CEncoder *encoderSpec = 
-		new NCompress::NLZMA::CEncoder;
-	CMyComPtr<ICompressCoder> encoder = encoderSpec;
-	
 	PROPID propIDs[] = 
 	{
 		NCoderPropID::kDictionarySize,
@@ -211,7 +251,7 @@ ZEXTERN int ZEXPORT orig_compress2 OF((Bytef *dest,   uLongf *destLen,
 	PROPVARIANT properties[kNumProps];
 	for (int p = 0; p < 6; p++)
 		properties[p].vt = VT_UI4;
-	properties[0].ulVal = UInt32(1 << (level + 14));
+	properties[0].ulVal = UInt32(dictSize);
 	properties[1].ulVal = UInt32(ZLIB_PB);
 	properties[2].ulVal = UInt32(ZLIB_LC); // for normal files
 	properties[3].ulVal = UInt32(ZLIB_LP); // for normal files
@@ -224,22 +264,91 @@ ZEXTERN int ZEXPORT orig_compress2 OF((Bytef *dest,   uLongf *destLen,
 	properties[7].vt = VT_BOOL;
 	properties[7].boolVal = VARIANT_TRUE;
 	
-	if (encoderSpec->SetCoderProperties(propIDs, properties, kNumProps) != S_OK)
-		return Z_MEM_ERROR; // should not happen
+	RINOK(encoderSpec->SetCoderProperties(propIDs, properties, kNumProps));
+	dictionarySize = dictSize;
+	level = newLevel;
+	return S_OK;
+}
+
+static pthread_key_t contextKey;
+static pthread_once_t contextOnce = PTHREAD_ONCE_INIT;
+
+static void FreeContext(void *context)
+{
+	delete (CEncoderContext *)context;
+}
+
+static void CreateContextKey()
+{
+	pthread_key_create(&contextKey, FreeContext);
+}
+
+static CEncoderContext *GetContext()
+{
+	pthread_once(&contextOnce, CreateContextKey);
+	CEncoderContext *context = (CEncoderContext *)pthread_getspecific(contextKey);
+	if (context == 0)
+	{
+		context = new CEncoderContext;
+		if (pthread_setspecific(contextKey, context) != 0)
+		{
+			delete context;
+			return 0;
+		}
+	}
+	return context;
+}
+
+ZEXTERN int ZEXPORT orig_compress2 OF((Bytef *dest,   uLongf *destLen,
+                                  const Bytef *source, uLong sourceLen,
+                                  int level))
+{
+	if (level == Z_DEFAULT_COMPRESSION)
+		level = 6;
+	if (level < 0 || level > 9)
+		return Z_STREAM_ERROR;
+
+	CEncoderContext *context = GetContext();
+	if (context == 0)
+		return Z_MEM_ERROR;
+
+	/*
+	 * a window larger than the block finds no other match, the dictionary
+	 * only grows so that small metadata blocks do not rebuild the tree
+	 */
+	UInt32 dictSize = ZLIB_MIN_DICT;
+	UInt32 maxDictSize = UInt32(1 << (level + 14));
+	while (dictSize < sourceLen && dictSize < maxDictSize)
+		dictSize <<= 1;
+	if (dictSize > maxDictSize)
+		dictSize = maxDictSize;
+	if (level == context->level && dictSize < context->dictionarySize)
+		dictSize = context->dictionarySize;
+
+	if (dictSize != context->dictionarySize || level != context->level)
+	{
+		if (context->SetProperties(dictSize, level) != S_OK)
+			return Z_STREAM_ERROR;
+	}
+
+	context->inStreamSpec->Reset(source, sourceLen);
+	context->outStreamSpec->Reset(dest, *destLen);
 	
-	HRESULT result = encoder->Code(inStream, outStream, 0, 0, 0);
+	HRESULT result = context->encoder->Code(context->inStream, 
+			context->outStream, 0, 0, 0);
 	if (result == E_OUTOFMEMORY)
 	{
+		/* the next block starts over with a new encoder */
+		FreeContext(context);
+		pthread_setspecific(contextKey, 0);
 		return Z_MEM_ERROR;
 	}   
 	else if (result != S_OK)
 	{
-		return Z_BUF_ERROR;	// should not happen
+		return Z_BUF_ERROR;	// output buffer full
 	}   
 	
-	UInt64 fileSize;
-	outStreamSpec->Seek(0, STREAM_SEEK_END, &fileSize);
-	*destLen = fileSize;
+	*destLen = context->outStreamSpec->Size();
 	
 	return Z_OK;
 }
@@ -248,11 +357,15 @@ ZEXTERN int ZEXPORT compress2 OF((Bytef *dest,   uLongf *destLen,
                                   const Bytef *source, uLong sourceLen,
                                   int level))
 {
-    strcpy((char*)dest,"7zip");
+    int ret;
+
+    if (*destLen < 4)
+        return Z_BUF_ERROR;
+    memcpy(dest,"7zip",4);
     *destLen -= 4;
-    orig_compress2(dest+4, destLen, source, sourceLen,level);
+    ret = orig_compress2(dest+4, destLen, source, sourceLen,level);
     *destLen += 4;
-    return Z_OK;
+    return ret;
 }
 
 ZEXTERN int ZEXPORT orig_uncompress OF((Bytef *dest,   uLongf *destLen,
@@ -295,6 +408,5 @@ ZEXTERN int ZEXPORT uncompress OF((Bytef *dest,   uLongf *destLen,
        source += 4;
        sourceLen -= 4;
     }
-    orig_uncompress(dest,destLen,source,sourceLen);	
-    return Z_OK;
+    return orig_uncompress(dest,destLen,source,sourceLen);
 }
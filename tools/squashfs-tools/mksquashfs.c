@@ -39,9 +39,12 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 
 #include "mksquashfs.h"
 #include "squashfs_fs.h"
+#include "pipeline.h"
+#include "blockcache.h"
 
 #ifdef SQUASHFS_TRACE
 #define TRACE(s, args...)		printf("mksquashfs: "s, ## args)
@@ -63,6 +66,15 @@
 int duplicate_checking = 1, noF = 0, no_fragments = 0, always_use_fragments = 0;
 int total_compressed = 0, total_uncompressed = 0;
 
+/* number of compressor threads, 1 compresses inline */
+int processors = 1;
+
+/* filesystem creation time, -1 for now */
+long fstime = -1;
+
+/* -cache file, compressed blocks kept between runs */
+char *block_cache_name = NULL;
+
 int fd;
 
 /* superblock attributes */
@@ -100,9 +112,20 @@ struct directory {
 	squashfs_dir_header	*entry_count_p;
 };
 
-struct file_info *dupl[65536], *frag_dups[65536];
+/* duplicate checking tables, hashed by the low bits of a 64 bit FNV-1a hash */
+#define DUP_HASH_SIZE	65536
+#define DUP_HASH(h)	((unsigned int) (h) & (DUP_HASH_SIZE - 1))
+
+struct file_info *dupl[DUP_HASH_SIZE], *frag_dups[DUP_HASH_SIZE];
+struct block_info *block_dups[DUP_HASH_SIZE];
+struct frag_info *frag_index[DUP_HASH_SIZE];
 int dup_files = 0;
 
+/* duplicate checking statistics */
+int dup_checked = 0, dup_found = 0, dup_block_files = 0, dup_fragments = 0, dup_verify_reads = 0;
+long long dup_saved_bytes = 0, dup_verify_bytes = 0;
+double dup_seconds = 0;
+
 int swap, silent = TRUE;
 int file_count = 0, sym_count = 0, dev_count = 0, dir_count = 0, fifo_count = 0, sock_count = 0;
 
@@ -146,12 +169,28 @@ struct old_root_entry_info {
 /* in memory file info */
 struct file_info {
 	unsigned int		bytes;
-	unsigned short		checksum;
+	unsigned long long	checksum;
 	unsigned int		start;
 	unsigned int		*block_list;
 	struct file_info	*next;
 	struct fragment		*fragment;
-	unsigned short		fragment_checksum;
+	unsigned long long	fragment_checksum;
+};
+
+/* a data block written to the filesystem, follow is the next block of the same file */
+struct block_info {
+	unsigned long long	checksum;
+	unsigned int		start;
+	unsigned int		c_byte;
+	struct block_info	*next;
+	struct block_info	*follow;
+};
+
+/* a fragment filled with the tail of a file */
+struct frag_info {
+	unsigned long long	checksum;
+	struct fragment		*fragment;
+	struct frag_info	*next;
 };
 
 /* count of how many times SIGINT or SIGQUIT has been sent */
@@ -198,6 +237,8 @@ squashfs_inode get_sorted_inode(struct stat *buf);
 int read_sort_file(char *filename, int source, char *source_path[]);
 void sort_files_and_write(int source, char *source_path[]);
 struct file_info *duplicate(unsigned char *(get_next_file_block)(struct duplicate_buffer_handle *, unsigned int), struct duplicate_buffer_handle *file_start, int bytes, unsigned int **block_list, int *start, int blocks, struct fragment **fragment, char *frag_data, int frag_bytes);
+struct fragment *duplicate_fragment(char *frag_data, int frag_bytes);
+void add_fragment(struct fragment *fragment, char *frag_data);
 
 #define FALSE 0
 
@@ -241,30 +282,61 @@ void sighandler()
 }
 
 
-unsigned int mangle(char *d, char *s, int size, int block_size, int uncompressed, int data_block)
+/*
+ * Compress a block, called from the compressor threads as well, so errors
+ * are returned in res and reported by compress_error().  Data and fragment
+ * blocks go through the block cache.
+ */
+unsigned int compress_block(char *d, char *s, int size, int block_size, int uncompressed, int data_block, int *res)
 {
 	unsigned long c_byte = block_size << 1;
-	unsigned int res;
+	struct block_cache_key key;
+	unsigned int cached;
+	int use_cache = !uncompressed && data_block;
 
-	if(!uncompressed && (res = compress2(d, &c_byte, s, size, 9)) != Z_OK) {
-		if(res == Z_MEM_ERROR)
-			BAD_ERROR("zlib::compress failed, not enough memory\n");
-		else if(res == Z_BUF_ERROR)
-			BAD_ERROR("zlib::compress failed, not enough room in output buffer\n");
-		else
-			BAD_ERROR("zlib::compress failed, unknown error %d\n", res);
+	*res = Z_OK;
+	if(use_cache && block_cache_get(&key, s, size, d, &cached))
+		return cached;
+
+	if(!uncompressed && (*res = compress2(d, &c_byte, s, size, 9)) != Z_OK)
 		return 0;
-	}
 
 	if(uncompressed || c_byte >= size) {
 		memcpy(d, s, size);
-		return size | (data_block ? SQUASHFS_COMPRESSED_BIT_BLOCK : SQUASHFS_COMPRESSED_BIT);
+		c_byte = size | (data_block ? SQUASHFS_COMPRESSED_BIT_BLOCK : SQUASHFS_COMPRESSED_BIT);
 	}
 
+	if(use_cache)
+		block_cache_put(&key, d, c_byte);
 	return (unsigned int) c_byte;
 }
 
 
+void compress_error(int res)
+{
+	if(res == Z_MEM_ERROR)
+		BAD_ERROR("zlib::compress failed, not enough memory\n");
+	else if(res == Z_BUF_ERROR)
+		BAD_ERROR("zlib::compress failed, not enough room in output buffer\n");
+	else
+		BAD_ERROR("zlib::compress failed, unknown error %d\n", res);
+}
+
+
+unsigned int mangle(char *d, char *s, int size, int block_size, int uncompressed, int data_block)
+{
+	int res;
+	unsigned int c_byte = compress_block(d, s, size, block_size, uncompressed, data_block, &res);
+
+	if(res != Z_OK) {
+		compress_error(res);
+		return 0;
+	}
+
+	return c_byte;
+}
+
+
 squashfs_base_inode_header *get_inode(int req_size)
 {
 	int data_space;
@@ -814,6 +886,9 @@ struct fragment *get_and_fill_fragment(char *buff, int size)
 	if(size == 0)
 		return &empty_fragment;
 
+	if(duplicate_checking && (ffrg = duplicate_fragment(buff, size)) != NULL)
+		return ffrg;
+
 	if(fragment_size + size > block_size)
 		write_fragment();
 
@@ -826,6 +901,9 @@ struct fragment *get_and_fill_fragment(char *buff, int size)
 	memcpy(fragment_data + fragment_size, buff, size);
 	fragment_size += size;
 
+	if(duplicate_checking)
+		add_fragment(ffrg, buff);
+
 	return ffrg;
 }
 
@@ -896,24 +974,33 @@ unsigned char *read_from_file(struct duplicate_buffer_handle *handle, unsigned i
 }
 
 
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+unsigned long long fnv_hash(unsigned long long hash, unsigned char *b, unsigned int bytes)
+{
+	while(bytes--) {
+		hash ^= *b++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+
 /*
- * Compute 16 bit BSD checksum over the data
+ * Compute 64 bit FNV-1a hash over the data
  */
-unsigned short get_checksum(unsigned char *(get_next_file_block)(struct duplicate_buffer_handle *, unsigned int), struct duplicate_buffer_handle *handle, int l)
+unsigned long long get_checksum(unsigned char *(get_next_file_block)(struct duplicate_buffer_handle *, unsigned int), struct duplicate_buffer_handle *handle, int l)
 {
-	unsigned short chksum = 0;
+	unsigned long long chksum = FNV_OFFSET;
 	unsigned int bytes = 0;
-	unsigned char *b;
 	struct duplicate_buffer_handle position = *handle;
 
 	while(l) {
 		bytes = l > SQUASHFS_FILE_MAX_SIZE ? SQUASHFS_FILE_MAX_SIZE : l;
 		l -= bytes;
-		b = get_next_file_block(&position, bytes);
-		while(bytes--) {
-			chksum = (chksum & 1) ? (chksum >> 1) | 0x8000 : chksum >> 1;
-			chksum += *b++;
-		}
+		chksum = fnv_hash(chksum, get_next_file_block(&position, bytes), bytes);
 	}
 
 	return chksum;
@@ -942,45 +1029,79 @@ void add_file(int start, int file_bytes, unsigned int *block_listp, int blocks,
 	else
 		datap = get_fragment(fragment_data, frg);
 	handle.start = start;
-	if((dupl_ptr = duplicate(read_from_file, &handle, file_bytes, &block_listp, &start, blocks, &frg, datap, bytes)) != NULL)
+	if((dupl_ptr = duplicate(read_from_file, &handle, file_bytes, &block_listp, &start, blocks, &frg, datap, bytes)) != NULL) {
 		dupl_ptr->fragment = frg;
+		if(bytes)
+			add_fragment(frg, datap);
+	}
 	cached_frag = fragment;
 }
 
 
+double elapsed(struct timeval *from)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - from->tv_sec) + (now.tv_usec - from->tv_usec) / 1000000.0;
+}
+
+
+/*
+ * Compare data already written at start with the data of a file, the
+ * candidates have the same hash so this read is normally the only one
+ */
+int verify_bytes(unsigned char *(get_next_file_block)(struct duplicate_buffer_handle *, unsigned int), struct duplicate_buffer_handle *file_start, unsigned int start, unsigned int bytes)
+{
+	unsigned char buffer1[SQUASHFS_FILE_MAX_SIZE];
+	struct duplicate_buffer_handle position = *file_start;
+	unsigned char *buffer;
+
+	dup_verify_reads ++;
+	while(bytes) {
+		int avail_bytes = bytes > SQUASHFS_FILE_MAX_SIZE ? SQUASHFS_FILE_MAX_SIZE : bytes;
+
+		buffer = get_next_file_block(&position, avail_bytes);
+		read_bytes(fd, start, avail_bytes, buffer1);
+		dup_verify_bytes += avail_bytes;
+		if(memcmp(buffer, buffer1, avail_bytes) != 0)
+			return FALSE;
+		bytes -= avail_bytes;
+		start += avail_bytes;
+	}
+
+	return TRUE;
+}
+
+
 struct file_info *duplicate(unsigned char *(get_next_file_block)(struct duplicate_buffer_handle *, unsigned int), struct duplicate_buffer_handle *file_start, int bytes, unsigned int **block_list, int *start, int blocks, struct fragment **fragment, char *frag_data, int frag_bytes)
 {
-	unsigned short checksum = get_checksum(get_next_file_block, file_start, bytes);
-	struct duplicate_buffer_handle handle = { frag_data, 0 };
-	unsigned short fragment_checksum = get_checksum(read_from_buffer, &handle, frag_bytes);
-	struct file_info *dupl_ptr = bytes ? dupl[checksum] : frag_dups[fragment_checksum];
+	struct timeval begin;
+	unsigned long long checksum, fragment_checksum;
+	struct file_info *dupl_ptr;
 
+	gettimeofday(&begin, NULL);
+	checksum = get_checksum(get_next_file_block, file_start, bytes);
+	fragment_checksum = fnv_hash(FNV_OFFSET, frag_data, frag_bytes);
+	dupl_ptr = bytes ? dupl[DUP_HASH(checksum)] : frag_dups[DUP_HASH(fragment_checksum)];
+	dup_checked ++;
 
 	for(; dupl_ptr; dupl_ptr = dupl_ptr->next)
-		if(bytes == dupl_ptr->bytes && frag_bytes == dupl_ptr->fragment->size && fragment_checksum == dupl_ptr->fragment_checksum) {
-			unsigned char buffer1[SQUASHFS_FILE_MAX_SIZE];
-			unsigned int dup_bytes = dupl_ptr->bytes, dup_start = dupl_ptr->start;
-			struct duplicate_buffer_handle position = *file_start;
-			unsigned char *buffer;
-			while(dup_bytes) {
-				int avail_bytes = dup_bytes > SQUASHFS_FILE_MAX_SIZE ? SQUASHFS_FILE_MAX_SIZE : dup_bytes;
-
-				buffer = get_next_file_block(&position, avail_bytes);
-				read_bytes(fd, dup_start, avail_bytes, buffer1);
-				if(memcmp(buffer, buffer1, avail_bytes) != 0)
-					break;
-				dup_bytes -= avail_bytes;
-				dup_start += avail_bytes;
-			}
-			if(dup_bytes == 0) {
+		if(bytes == dupl_ptr->bytes && checksum == dupl_ptr->checksum && frag_bytes == dupl_ptr->fragment->size &&
+				fragment_checksum == dupl_ptr->fragment_checksum) {
+			if(verify_bytes(get_next_file_block, file_start, dupl_ptr->start, bytes)) {
 				char frag_buffer1[block_size];
-				char *fragment_buffer1 = get_fragment(frag_buffer1, dupl_ptr->fragment);
+				char *fragment_buffer1 = frag_bytes ? get_fragment(frag_buffer1, dupl_ptr->fragment) : NULL;
+				dup_verify_bytes += frag_bytes;
 				if(frag_bytes == 0 || memcmp(frag_data, fragment_buffer1, frag_bytes) == 0) {
-					TRACE("Found duplicate file, start 0x%x, size %d, checksum 0x%x, fragment %d, size %d, offset %d, checksum 0x%x\n", dupl_ptr->start,
+					TRACE("Found duplicate file, start 0x%x, size %d, checksum 0x%Lx, fragment %d, size %d, offset %d, checksum 0x%Lx\n", dupl_ptr->start,
 						dupl_ptr->bytes, dupl_ptr->checksum, dupl_ptr->fragment->index, frag_bytes, dupl_ptr->fragment->offset, fragment_checksum);
 					*block_list = dupl_ptr->block_list;
 					*start = dupl_ptr->start;
 					*fragment = dupl_ptr->fragment;
+					dup_found ++;
+					dup_saved_bytes += bytes + frag_bytes;
+					dup_seconds += elapsed(&begin);
 					return 0;
 				}
 			}
@@ -1002,17 +1123,159 @@ struct file_info *duplicate(unsigned char *(get_next_file_block)(struct duplicat
 	memcpy(dupl_ptr->block_list, *block_list, blocks * sizeof(unsigned int));
 	dup_files ++;
 	if(bytes) {
-		dupl_ptr->next = dupl[checksum];
-		dupl[checksum] = dupl_ptr;
+		dupl_ptr->next = dupl[DUP_HASH(checksum)];
+		dupl[DUP_HASH(checksum)] = dupl_ptr;
 	} else {
-		dupl_ptr->next = frag_dups[fragment_checksum];
-		frag_dups[fragment_checksum] = dupl_ptr;
+		dupl_ptr->next = frag_dups[DUP_HASH(fragment_checksum)];
+		frag_dups[DUP_HASH(fragment_checksum)] = dupl_ptr;
 	}
 
+	dup_seconds += elapsed(&begin);
 	return dupl_ptr;
 }
 
 
+/*
+ * A file which is not a duplicate may still have the same blocks as a
+ * run of blocks written for another file.  Blocks of a file are
+ * contiguous in the filesystem, so only a whole run can be shared.
+ * Returns TRUE and the start of the run if one is found, otherwise the
+ * blocks are written by the caller and added with add_blocks().
+ */
+int duplicate_blocks(char *data, unsigned int *block_list, int blocks, unsigned long long *checksums, unsigned int *start)
+{
+	struct timeval begin;
+	struct block_info *dupl_ptr, *follow;
+	struct duplicate_buffer_handle handle;
+	unsigned int offset = 0, file_bytes;
+	int i;
+
+	gettimeofday(&begin, NULL);
+	for(i = 0; i < blocks; i++) {
+		int size = SQUASHFS_COMPRESSED_SIZE_BLOCK(block_list[i]);
+		checksums[i] = fnv_hash(FNV_OFFSET, data + offset, size);
+		offset += size;
+	}
+	file_bytes = offset;
+
+	for(dupl_ptr = blocks ? block_dups[DUP_HASH(checksums[0])] : NULL; dupl_ptr; dupl_ptr = dupl_ptr->next) {
+		if(dupl_ptr->checksum != checksums[0] || dupl_ptr->c_byte != block_list[0])
+			continue;
+		for(i = 1, follow = dupl_ptr->follow; i < blocks && follow && follow->checksum == checksums[i] &&
+				follow->c_byte == block_list[i]; i++, follow = follow->follow);
+		if(i < blocks)
+			continue;
+
+		handle.ptr = data;
+		if(verify_bytes(read_from_buffer, &handle, dupl_ptr->start, file_bytes)) {
+			TRACE("Found duplicate blocks, start 0x%x, %d blocks\n", dupl_ptr->start, blocks);
+			*start = dupl_ptr->start;
+			dup_block_files ++;
+			dup_saved_bytes += file_bytes;
+			dup_seconds += elapsed(&begin);
+			return TRUE;
+		}
+	}
+
+	dup_seconds += elapsed(&begin);
+	return FALSE;
+}
+
+
+void add_blocks(unsigned int start, unsigned int *block_list, int blocks, unsigned long long *checksums)
+{
+	struct block_info *block, *prev = NULL;
+	int i;
+
+	for(i = 0; i < blocks; i++) {
+		if((block = (struct block_info *) malloc(sizeof(struct block_info))) == NULL)
+			BAD_ERROR("Out of memory in block duplicate table allocation!\n");
+		block->checksum = checksums[i];
+		block->start = start;
+		block->c_byte = block_list[i];
+		block->follow = NULL;
+		block->next = block_dups[DUP_HASH(checksums[i])];
+		block_dups[DUP_HASH(checksums[i])] = block;
+		if(prev)
+			prev->follow = block;
+		prev = block;
+		start += SQUASHFS_COMPRESSED_SIZE_BLOCK(block_list[i]);
+	}
+}
+
+
+/*
+ * Share the fragment of another file with the same tail
+ */
+struct fragment *duplicate_fragment(char *frag_data, int frag_bytes)
+{
+	struct timeval begin;
+	unsigned long long checksum = fnv_hash(FNV_OFFSET, frag_data, frag_bytes);
+	struct frag_info *frag_ptr;
+	char frag_buffer1[block_size];
+
+	gettimeofday(&begin, NULL);
+	for(frag_ptr = frag_index[DUP_HASH(checksum)]; frag_ptr; frag_ptr = frag_ptr->next)
+		if(frag_ptr->checksum == checksum && frag_ptr->fragment->size == frag_bytes) {
+			dup_verify_reads ++;
+			dup_verify_bytes += frag_bytes;
+			if(memcmp(frag_data, get_fragment(frag_buffer1, frag_ptr->fragment), frag_bytes) == 0) {
+				dup_fragments ++;
+				dup_saved_bytes += frag_bytes;
+				dup_seconds += elapsed(&begin);
+				return frag_ptr->fragment;
+			}
+		}
+
+	dup_seconds += elapsed(&begin);
+	return NULL;
+}
+
+
+void add_fragment(struct fragment *fragment, char *frag_data)
+{
+	struct frag_info *frag_ptr;
+
+	if((frag_ptr = (struct frag_info *) malloc(sizeof(struct frag_info))) == NULL)
+		BAD_ERROR("Out of memory in fragment duplicate table allocation!\n");
+	frag_ptr->checksum = fnv_hash(FNV_OFFSET, frag_data, fragment->size);
+	frag_ptr->fragment = fragment;
+	frag_ptr->next = frag_index[DUP_HASH(frag_ptr->checksum)];
+	frag_index[DUP_HASH(frag_ptr->checksum)] = frag_ptr;
+}
+
+
+/*
+ * Number of data blocks of a file and the bytes which go in a fragment
+ */
+void file_layout(long long read_size, unsigned int *blocks, unsigned int *frag_bytes)
+{
+	if(!no_fragments && (read_size < block_size || always_use_fragments)) {
+		*blocks = read_size >> block_log;
+		*frag_bytes = read_size % block_size;
+	} else {
+		*blocks = (read_size + block_size - 1) >> block_log;
+		*frag_bytes = 0;
+	}
+}
+
+
+void queue_file(char *filename, long long size)
+{
+	long long read_size = (size > SQUASHFS_MAX_FILE_SIZE) ? SQUASHFS_MAX_FILE_SIZE : size;
+	unsigned int blocks, frag_bytes;
+
+	file_layout(read_size, &blocks, &frag_bytes);
+	pipeline_add(filename, read_size, blocks, frag_bytes);
+}
+
+
+/* compressed file data, kept between files */
+char *c_buffer = NULL;
+int c_buffer_size = 0;
+unsigned long long *block_checksums = NULL;
+int block_checksums_size = 0;
+
 #define MINALLOCBYTES (1024 * 1024)
 squashfs_inode write_file(char *filename, long long size, int *duplicate_file)
 {
@@ -1021,43 +1284,65 @@ squashfs_inode write_file(char *filename, long long size, int *duplicate_file)
 	long long read_size = (size > SQUASHFS_MAX_FILE_SIZE) ? SQUASHFS_MAX_FILE_SIZE : size;
 	unsigned int blocks = (read_size + block_size - 1) >> block_log;
 	unsigned int block_list[blocks], *block_listp = block_list;
-	char buff[block_size], *c_buffer;
-	int allocated_blocks = blocks, i, bbytes, whole_file = 1;
+	char buff[block_size], *b;
+	int allocated_blocks, i, bbytes, whole_file = 1;
 	struct fragment *fragment;
 	struct file_info *dupl_ptr;
 	struct duplicate_buffer_handle handle;
+	struct pipe_file *pipe_file;
+	struct pipe_block *pipe_block;
 
-	if(!no_fragments && (read_size < block_size || always_use_fragments)) {
-		allocated_blocks = blocks = read_size >> block_log;
-		frag_bytes = read_size % block_size;
-	} else
-		frag_bytes = 0;
+	file_layout(read_size, &blocks, &frag_bytes);
+	allocated_blocks = blocks;
 
 	if(size > read_size)
 		ERROR("file %s truncated to %Ld bytes\n", filename, SQUASHFS_MAX_FILE_SIZE);
 
 	total_bytes += read_size;
-	if((file = open(filename, O_RDONLY)) == -1) {
+	if((pipe_file = pipeline_file(filename, read_size)) != NULL) {
+		if(pipe_file->state == PIPE_FAILED) {
+			errno = pipe_file->error;
+			perror("Error in opening file, skipping...");
+			return SQUASHFS_INVALID;
+		}
+	} else if((file = open(filename, O_RDONLY)) == -1) {
 		perror("Error in opening file, skipping...");
 		return SQUASHFS_INVALID;
 	}
 
-	do {
-		if((c_buffer = (char *) malloc((allocated_blocks + 1) << block_log)) == NULL) {
-			TRACE("Out of memory allocating write_file buffer, allocated_blocks %d, blocks %d\n", allocated_blocks, blocks);
-			whole_file = 0;
-			if((allocated_blocks << (block_log - 1)) < MINALLOCBYTES)
-				BAD_ERROR("Out of memory allocating write_file buffer, could not allocate %d blocks (%d Kbytes)\n", allocated_blocks, allocated_blocks << (block_log - 10));
-			allocated_blocks >>= 1;
+	while(c_buffer_size < (allocated_blocks + 1) << block_log) {
+		if((b = (char *) realloc(c_buffer, (allocated_blocks + 1) << block_log)) != NULL) {
+			c_buffer = b;
+			c_buffer_size = (allocated_blocks + 1) << block_log;
+			break;
 		}
-	} while(!c_buffer);
+		TRACE("Out of memory allocating write_file buffer, allocated_blocks %d, blocks %d\n", allocated_blocks, blocks);
+		whole_file = 0;
+		if((allocated_blocks << (block_log - 1)) < MINALLOCBYTES)
+			BAD_ERROR("Out of memory allocating write_file buffer, could not allocate %d blocks (%d Kbytes)\n", allocated_blocks, allocated_blocks << (block_log - 10));
+		allocated_blocks >>= 1;
+	}
 
 	for(start = bytes; block < blocks; file_bytes += bbytes) {
 		for(i = 0, bbytes = 0; (i < allocated_blocks) && (block < blocks); i++) {
 			int available_bytes = read_size - (block * block_size) > block_size ? block_size : read_size - (block * block_size);
-			if(read(file, buff, available_bytes) == -1)
-				goto read_err;
-			c_byte = mangle(c_buffer + bbytes, buff, available_bytes, block_size, noD, 1);
+			if(pipe_file) {
+				pipe_block = pipeline_get();
+				if(pipe_block->error) {
+					errno = pipe_block->error;
+					pipeline_put(pipe_block);
+					goto read_err;
+				}
+				if(pipe_block->res != Z_OK)
+					compress_error(pipe_block->res);
+				c_byte = pipe_block->c_byte;
+				memcpy(c_buffer + bbytes, pipe_block->out, SQUASHFS_COMPRESSED_SIZE_BLOCK(c_byte));
+				pipeline_put(pipe_block);
+			} else {
+				if(read(file, buff, available_bytes) == -1)
+					goto read_err;
+				c_byte = mangle(c_buffer + bbytes, buff, available_bytes, block_size, noD, 1);
+			}
 			block_list[block ++] = c_byte;
 			bbytes += SQUASHFS_COMPRESSED_SIZE_BLOCK(c_byte);
 		}
@@ -1067,17 +1352,40 @@ squashfs_inode write_file(char *filename, long long size, int *duplicate_file)
 		}
 	}
 
-	if(frag_bytes != 0)
-		if(read(file, buff, frag_bytes) == -1)
+	if(frag_bytes != 0) {
+		if(pipe_file) {
+			pipe_block = pipeline_get();
+			if(pipe_block->error) {
+				errno = pipe_block->error;
+				pipeline_put(pipe_block);
+				goto read_err;
+			}
+			memcpy(buff, pipe_block->in, frag_bytes);
+			pipeline_put(pipe_block);
+		} else if(read(file, buff, frag_bytes) == -1)
 			goto read_err;
+	}
 
-	close(file);
+	if(!pipe_file)
+		close(file);
 	if(whole_file) {
 		handle.ptr = c_buffer;
 		if(duplicate_checking && (dupl_ptr = duplicate(read_from_buffer, &handle, file_bytes, &block_listp, &start, blocks, &fragment, buff, frag_bytes)) == NULL) {
 			*duplicate_file = TRUE;
 			goto wr_inode;
 		}
+		if(duplicate_checking && blocks) {
+			if(block_checksums_size < blocks) {
+				if((block_checksums = (unsigned long long *) realloc(block_checksums, blocks * sizeof(unsigned long long))) == NULL)
+					BAD_ERROR("Out of memory allocating block checksums\n");
+				block_checksums_size = blocks;
+			}
+			if(duplicate_blocks(c_buffer, block_list, blocks, block_checksums, &start)) {
+				dupl_ptr->start = start;
+				goto wr_fragment;
+			}
+			add_blocks(start, block_list, blocks, block_checksums);
+		}
 		write_bytes(fd, bytes, file_bytes, c_buffer);
 		bytes += file_bytes;
 	} else {
@@ -1091,6 +1399,7 @@ squashfs_inode write_file(char *filename, long long size, int *duplicate_file)
 		}
 	}
 
+wr_fragment:
 	fragment = get_and_fill_fragment(buff, frag_bytes);
 	if(duplicate_checking)
 		dupl_ptr->fragment = fragment;
@@ -1098,13 +1407,13 @@ squashfs_inode write_file(char *filename, long long size, int *duplicate_file)
 	*duplicate_file = FALSE;
 
 wr_inode:
-	free(c_buffer);
 	file_count ++;
 	return create_inode(filename, SQUASHFS_FILE_TYPE, read_size, start, blocks, block_listp, fragment);
 
 read_err:
 	perror("Error in reading file, skipping...");
-	free(c_buffer);
+	if(!pipe_file)
+		close(file);
 	return SQUASHFS_INVALID;
 }
 
@@ -1277,6 +1586,53 @@ int single_readdir(void *l, char *filename, char *dir_name)
 }
 
 
+/*
+ * Queue the regular files below pathname for the compressor threads, in
+ * the order dir_scan() will write them
+ */
+void queue_dir(char *pathname)
+{
+	DIR *linuxdir;
+	struct dirent *d_name;
+	struct stat buf;
+	char filename[8192];
+
+	if((linuxdir = opendir(pathname)) == NULL)
+		return;
+
+	while((d_name = readdir(linuxdir)) != NULL) {
+		if(strcmp(d_name->d_name, ".") == 0 || strcmp(d_name->d_name, "..") == 0)
+			continue;
+		strcat(strcat(strcpy(filename, pathname), "/"), d_name->d_name);
+		if(lstat(filename, &buf) == -1 || excluded(filename, &buf))
+			continue;
+		if(S_ISREG(buf.st_mode))
+			queue_file(filename, buf.st_size);
+		else if(S_ISDIR(buf.st_mode))
+			queue_dir(filename);
+	}
+
+	closedir(linuxdir);
+}
+
+
+void queue_sources()
+{
+	struct stat buf;
+	int i;
+
+	for(i = 0; i < source; i++) {
+		if(getbase(source_path[i]) == NULL || lstat(source_path[i], &buf) == -1 ||
+				excluded(source_path[i], &buf))
+			continue;
+		if(S_ISREG(buf.st_mode))
+			queue_file(source_path[i], buf.st_size);
+		else if(S_ISDIR(buf.st_mode))
+			queue_dir(source_path[i]);
+	}
+}
+
+
 squashfs_inode dir_scan(char *pathname, void* (_opendir)(char *, struct directory *), int (_readdir)(void *, char *, char *),
 		void (_closedir)(void *))
 {
@@ -1466,6 +1822,8 @@ int main(int argc, char *argv[])
 	squashfs_super_block sBlk;
 	char *b, *root_name = NULL;
 	int be, nopad = FALSE, delete = FALSE, keep_as_directory = FALSE, orig_be;
+	struct timeval start_time, end_time;
+	double seconds;
 
 #if __BYTE_ORDER == __BIG_ENDIAN
 	be = TRUE;
@@ -1474,6 +1832,8 @@ int main(int argc, char *argv[])
 #endif
 
 	block_log = slog(block_size);
+	if((processors = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		processors = 1;
 	if(argc > 1 && strcmp(argv[1], "-version") == 0) {
 		VERSION();
 		exit(0);
@@ -1499,6 +1859,22 @@ int main(int argc, char *argv[])
 				ERROR("%s: -ef missing filename\n", argv[0]);
 				exit(1);
 			}
+		} else if(strcmp(argv[i], "-processors") == 0) {
+			if((++i == argc) || (processors = strtol(argv[i], &b, 10), *b != '\0') || processors < 1) {
+				ERROR("%s: -processors missing or invalid processor number\n", argv[0]);
+				exit(1);
+			}
+		} else if(strcmp(argv[i], "-fstime") == 0) {
+			if((++i == argc) || (fstime = strtol(argv[i], &b, 10), *b != '\0') || fstime < 0) {
+				ERROR("%s: -fstime missing or invalid time\n", argv[0]);
+				exit(1);
+			}
+		} else if(strcmp(argv[i], "-cache") == 0) {
+			if(++i == argc) {
+				ERROR("%s: -cache missing filename\n", argv[0]);
+				exit(1);
+			}
+			block_cache_name = argv[i];
 		} else if(strcmp(argv[i], "-no-duplicates") == 0)
 			duplicate_checking = FALSE;
 
@@ -1609,6 +1985,11 @@ printOptions:
 		        ERROR("\t\t\t\t\twith priority per line.  Priority -32768 to 32767, default priority 0\n");
 			ERROR("\t-b block size\t\t\tsize of blocks in ");
 			ERROR("filesystem, default %d\n", SQUASHFS_FILE_SIZE);
+			ERROR("\t-processors number\t\tnumber of compressor threads, default the number of processors\n");
+			ERROR("\t\t\t\t\t1 compresses inline\n");
+			ERROR("\t-fstime time\t\t\tset the filesystem creation time, in seconds since the epoch\n");
+			ERROR("\t-cache file\t\t\tkeep compressed data blocks in file and reuse them on the next run,\n");
+			ERROR("\t\t\t\t\tthe filesystem is the same as without the cache\n");
 			ERROR("\t-noappend\t\t\tDo not append to existing filesystem on dest, write a new filesystem\n");
 		        ERROR("\t\t\t\t\tThis is the default action if dest does not exist, or if no filesystem is on it\n");
 			ERROR("\t-keep-as-directory\t\tIf one source directory is specified, create a root directory\n");
@@ -1696,7 +2077,9 @@ printOptions:
 			fclose(fd);
 		} else if(strcmp(argv[i], "-e") == 0)
 			break;
-		else if(strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-root-becomes") == 0 || strcmp(argv[i], "-sort") == 0)
+		else if(strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-root-becomes") == 0 || strcmp(argv[i], "-sort") == 0 ||
+				strcmp(argv[i], "-processors") == 0 || strcmp(argv[i], "-fstime") == 0 ||
+				strcmp(argv[i], "-cache") == 0)
 			i++;
 
 	if(i != argc) {
@@ -1714,9 +2097,12 @@ printOptions:
 			sorted ++;
 		} else if(strcmp(argv[i], "-e") == 0)
 			break;
-		else if(strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-root-becomes") == 0 || strcmp(argv[i], "-ef") == 0)
+		else if(strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-root-becomes") == 0 || strcmp(argv[i], "-ef") == 0 ||
+				strcmp(argv[i], "-processors") == 0 || strcmp(argv[i], "-fstime") == 0 ||
+				strcmp(argv[i], "-cache") == 0)
 			i++;
 
+	gettimeofday(&start_time, NULL);
 	if((fragment_data = (char *) malloc(block_size)) == NULL)
 		BAD_ERROR("Out of memory allocating fragment_data");
 
@@ -1798,8 +2184,21 @@ printOptions:
 		EXIT_MKSQUASHFS();
 	}
 
+	if(block_cache_name && !block_cache_open(block_cache_name))
+		block_cache_name = NULL;
+
+	if(processors > 1 && !pipeline_init(processors))
+		processors = 1;
+
 	if(sorted)
 		sort_files_and_write(source, source_path);
+	else {
+		if(!keep_as_directory && source == 1 && S_ISDIR(buf.st_mode))
+			queue_dir(source_path[0]);
+		else
+			queue_sources();
+		pipeline_start();
+	}
 
 	if(delete && !keep_as_directory && source == 1 && S_ISDIR(buf.st_mode))
 		sBlk.root_inode = dir_scan(source_path[0], linux_opendir, linux_readdir, linux_closedir);
@@ -1814,7 +2213,7 @@ printOptions:
 	sBlk.block_size = block_size;
 	sBlk.block_log = block_log;
 	sBlk.flags = SQUASHFS_MKFLAGS(noI, noD, check_data, noF, no_fragments, always_use_fragments, duplicate_checking);
-	sBlk.mkfs_time = time(NULL);
+	sBlk.mkfs_time = fstime >= 0 ? fstime : time(NULL);
 
 restore_filesystem:
 	write_fragment();
@@ -1871,6 +2270,11 @@ restore_filesystem:
 		write_bytes(fd, bytes, 4096 - i, temp);
 	}
 
+	block_cache_close();
+
+	gettimeofday(&end_time, NULL);
+	seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1000000.0;
+
 	total_bytes += total_inode_bytes + total_directory_bytes + uid_count
 		* sizeof(unsigned short) + guid_count * sizeof(unsigned short) +
 		sizeof(squashfs_super_block);
@@ -1881,6 +2285,8 @@ restore_filesystem:
 	printf("Filesystem size %.2f Kbytes (%.2f Mbytes)\n", bytes / 1024.0, bytes / (1024.0 * 1024.0));
 	printf("\t%.2f%% of uncompressed filesystem size (%.2f Kbytes)\n",
 		((float) bytes / total_bytes) * 100.0, total_bytes / 1024.0);
+	printf("Compressed in %.2f seconds, %.2f Kbytes/s, %d compressor thread%s\n", seconds,
+		seconds > 0 ? total_bytes / 1024.0 / seconds : 0.0, processors, processors > 1 ? "s" : "");
 	printf("Inode table size %d bytes (%.2f Kbytes)\n",
 		inode_bytes, inode_bytes / 1024.0);
 	printf("\t%.2f%% of uncompressed inode table size (%d bytes)\n",
@@ -1889,10 +2295,20 @@ restore_filesystem:
 		directory_bytes, directory_bytes / 1024.0);
 	printf("\t%.2f%% of uncompressed directory table size (%d bytes)\n",
 		((float) directory_bytes / total_directory_bytes) * 100.0, total_directory_bytes);
-	if(duplicate_checking)
+	if(duplicate_checking) {
 		printf("Number of duplicate files found %d\n", file_count - dup_files);
-	else
+		printf("\t%d files checked, %.2f%% duplicates, %d sharing blocks, %d sharing fragments\n", dup_checked,
+			dup_checked ? dup_found * 100.0 / dup_checked : 0.0, dup_block_files, dup_fragments);
+		printf("\t%.2f Kbytes not written, %d verify reads (%.2f Kbytes), %.2f seconds\n", dup_saved_bytes / 1024.0,
+			dup_verify_reads, dup_verify_bytes / 1024.0, dup_seconds);
+	} else
 		printf("No duplicate files removed\n");
+	if(block_cache_name) {
+		int hits, misses;
+
+		block_cache_stats(&hits, &misses);
+		printf("Block cache %s, %d blocks reused, %d compressed\n", block_cache_name, hits, misses);
+	}
 	printf("Number of inodes %d\n", inode_count);
 	printf("Number of files %d\n", file_count);
 	if(!no_fragments)
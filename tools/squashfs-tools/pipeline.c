@@ -0,0 +1,336 @@
+/*
+ * Create a squashfs filesystem.  This is a highly compressed read only filesystem.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * pipeline.c
+ *
+ * Data blocks are read by one reader thread and compressed by the
+ * compressor threads.  The files are queued before writing starts in the
+ * order write_file() will ask for them, and write_file() takes the blocks
+ * back in that order, so duplicate checking, fragments and the layout of
+ * the filesystem are the same as when the blocks are compressed inline.
+ * At most PIPELINE_BLOCKS blocks per compressor are in flight.
+ */
+
+#define TRUE 1
+#define FALSE 0
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+
+#define ERROR(s, args...)		fprintf(stderr, s, ## args)
+
+extern int block_size, noD;
+extern unsigned int compress_block(char *d, char *s, int size, int block_size, int uncompressed, int data_block, int *res);
+
+static struct pipe_file *files = NULL, **files_tail = &files, *next_file = NULL;
+static int started = FALSE;
+
+/* ring of window blocks, the reader fills read_seq, write_file() takes write_seq */
+static struct pipe_block *ring = NULL;
+static unsigned int window = 0, read_seq = 0, write_seq = 0;
+
+/* blocks waiting for a compressor */
+static struct pipe_block *compress_head = NULL, **compress_tail = &compress_head;
+
+static pthread_mutex_t pipe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reader_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static int compressors = 0;
+
+
+static struct pipe_block *get_free_block()
+{
+	struct pipe_block *block;
+
+	pthread_mutex_lock(&pipe_mutex);
+	while(read_seq - write_seq >= window)
+		pthread_cond_wait(&reader_cond, &pipe_mutex);
+	block = &ring[read_seq++ % window];
+	pthread_mutex_unlock(&pipe_mutex);
+
+	return block;
+}
+
+
+static void queue_block(struct pipe_block *block)
+{
+	pthread_mutex_lock(&pipe_mutex);
+	if(block->compress && block->error == 0) {
+		block->next = NULL;
+		*compress_tail = block;
+		compress_tail = &block->next;
+		pthread_cond_signal(&compress_cond);
+	} else {
+		block->done = TRUE;
+		pthread_cond_signal(&writer_cond);
+	}
+	pthread_mutex_unlock(&pipe_mutex);
+}
+
+
+static void *reader(void *arg)
+{
+	struct pipe_file *file;
+	struct pipe_block *block;
+	unsigned int i;
+	int fd, error;
+
+	for(file = files; file; file = file->next) {
+		fd = open(file->filename, O_RDONLY);
+		error = errno;
+
+		pthread_mutex_lock(&pipe_mutex);
+		if(fd == -1) {
+			file->state = PIPE_FAILED;
+			file->error = error;
+		} else
+			file->state = PIPE_OPENED;
+		pthread_cond_signal(&writer_cond);
+		pthread_mutex_unlock(&pipe_mutex);
+
+		if(fd == -1)
+			continue;
+
+		for(i = 0; i < file->blocks + (file->frag_bytes ? 1 : 0); i++) {
+			block = get_free_block();
+			block->file = file;
+			block->compress = i < file->blocks;
+			block->size = !block->compress ? file->frag_bytes :
+				file->size - ((long long) i * block_size) > block_size ? block_size :
+				file->size - ((long long) i * block_size);
+			block->error = 0;
+			if(read(fd, block->in, block->size) == -1)
+				block->error = errno;
+			queue_block(block);
+			if(block->error)
+				break;
+		}
+		close(fd);
+	}
+
+	return NULL;
+}
+
+
+static void *compressor(void *arg)
+{
+	struct pipe_block *block;
+
+	pthread_mutex_lock(&pipe_mutex);
+	for(;;) {
+		while(compress_head == NULL)
+			pthread_cond_wait(&compress_cond, &pipe_mutex);
+		block = compress_head;
+		if((compress_head = block->next) == NULL)
+			compress_tail = &compress_head;
+		pthread_mutex_unlock(&pipe_mutex);
+
+		block->c_byte = compress_block(block->out, block->in, block->size, block_size, noD, 1, &block->res);
+
+		pthread_mutex_lock(&pipe_mutex);
+		block->done = TRUE;
+		if(block == &ring[write_seq % window])
+			pthread_cond_signal(&writer_cond);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Allocate the block ring for processors compressor threads, the threads
+ * are started by pipeline_start() once the files are queued
+ */
+int pipeline_init(int processors)
+{
+	unsigned int i;
+
+	window = processors * PIPELINE_BLOCKS;
+	if((ring = (struct pipe_block *) calloc(window, sizeof(struct pipe_block))) == NULL)
+		goto failed;
+	for(i = 0; i < window; i++)
+		if((ring[i].in = (char *) malloc(block_size)) == NULL ||
+				(ring[i].out = (char *) malloc(block_size << 1)) == NULL)
+			goto failed;
+
+	compressors = processors;
+	return TRUE;
+
+failed:
+	ERROR("Out of memory allocating the compressor blocks, compressing inline\n");
+	if(ring)
+		for(i = 0; i < window; i++) {
+			free(ring[i].in);
+			free(ring[i].out);
+		}
+	free(ring);
+	ring = NULL;
+	return FALSE;
+}
+
+
+void pipeline_add(char *filename, long long size, unsigned int blocks, unsigned int frag_bytes)
+{
+	struct pipe_file *file;
+
+	if(ring == NULL || started)
+		return;
+
+	if((file = (struct pipe_file *) malloc(sizeof(struct pipe_file))) == NULL ||
+			(file->filename = strdup(filename)) == NULL) {
+		ERROR("Out of memory queueing %s, compressing it inline\n", filename);
+		free(file);
+		return;
+	}
+
+	file->size = size;
+	file->blocks = blocks;
+	file->frag_bytes = frag_bytes;
+	file->state = PIPE_PENDING;
+	file->error = 0;
+	file->next = NULL;
+	*files_tail = file;
+	files_tail = &file->next;
+}
+
+
+void pipeline_start()
+{
+	pthread_t thread;
+	sigset_t sigmask, old_mask;
+	int i;
+
+	if(ring == NULL || started)
+		return;
+	started = TRUE;
+	next_file = files;
+
+	/* SIGINT and SIGTERM restore the filesystem from the main thread */
+	sigfillset(&sigmask);
+	pthread_sigmask(SIG_BLOCK, &sigmask, &old_mask);
+	if(pthread_create(&thread, NULL, reader, NULL) != 0) {
+		ERROR("Failed to create the reader thread, compressing inline\n");
+		files = NULL;
+		next_file = NULL;
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+		return;
+	}
+	pthread_detach(thread);
+	for(i = 0; i < compressors; i++) {
+		if(pthread_create(&thread, NULL, compressor, NULL) != 0) {
+			if(i == 0) {
+				ERROR("Failed to create a compressor thread\n");
+				exit(1);
+			}
+			break;
+		}
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+
+/*
+ * The next block in file order, waiting for it to be read and compressed
+ */
+struct pipe_block *pipeline_get()
+{
+	struct pipe_block *block = &ring[write_seq % window];
+
+	pthread_mutex_lock(&pipe_mutex);
+	while(read_seq == write_seq || !block->done)
+		pthread_cond_wait(&writer_cond, &pipe_mutex);
+	pthread_mutex_unlock(&pipe_mutex);
+
+	return block;
+}
+
+
+void pipeline_put(struct pipe_block *block)
+{
+	pthread_mutex_lock(&pipe_mutex);
+	block->done = FALSE;
+	write_seq++;
+	pthread_cond_signal(&reader_cond);
+	pthread_mutex_unlock(&pipe_mutex);
+}
+
+
+static void wait_opened(struct pipe_file *file)
+{
+	pthread_mutex_lock(&pipe_mutex);
+	while(file->state == PIPE_PENDING)
+		pthread_cond_wait(&writer_cond, &pipe_mutex);
+	pthread_mutex_unlock(&pipe_mutex);
+}
+
+
+/* drop the blocks of a queued file write_file() did not ask for */
+static void skip_file(struct pipe_file *file)
+{
+	struct pipe_block *block;
+	unsigned int i;
+	int error;
+
+	wait_opened(file);
+	if(file->state == PIPE_FAILED)
+		return;
+
+	for(i = 0; i < file->blocks + (file->frag_bytes ? 1 : 0); i++) {
+		block = pipeline_get();
+		error = block->error;
+		pipeline_put(block);
+		if(error)
+			break;
+	}
+}
+
+
+/*
+ * Find a queued file, skipping any queued before it.  Returns NULL if the
+ * file was not queued, it is then compressed inline.
+ */
+struct pipe_file *pipeline_file(char *filename, long long size)
+{
+	struct pipe_file *file;
+
+	if(!started)
+		return NULL;
+
+	for(file = next_file; file; file = file->next)
+		if(file->size == size && strcmp(file->filename, filename) == 0)
+			break;
+	if(file == NULL)
+		return NULL;
+
+	for(; next_file != file; next_file = next_file->next)
+		skip_file(next_file);
+	next_file = file->next;
+
+	wait_opened(file);
+	return file;
+}
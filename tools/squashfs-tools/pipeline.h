@@ -0,0 +1,58 @@
+/*
+ * Create a squashfs filesystem.  This is a highly compressed read only filesystem.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * pipeline.h
+ */
+
+/* in flight blocks per compressor thread */
+#define PIPELINE_BLOCKS		8
+
+#define PIPE_PENDING		0
+#define PIPE_OPENED		1
+#define PIPE_FAILED		2
+
+/* a file queued in the order write_file() will ask for it */
+struct pipe_file {
+	char			*filename;
+	long long		size;
+	unsigned int		blocks;
+	unsigned int		frag_bytes;
+	int			state;
+	int			error;		/* errno of a failed open */
+	struct pipe_file	*next;
+};
+
+/* one data block, or the fragment tail of a file which is not compressed */
+struct pipe_block {
+	struct pipe_file	*file;
+	int			size;
+	int			compress;
+	int			done;
+	int			error;		/* errno of a failed read */
+	int			res;		/* compress2() result */
+	unsigned int		c_byte;
+	char			*in;
+	char			*out;
+	struct pipe_block	*next;
+};
+
+extern int pipeline_init(int processors);
+extern void pipeline_add(char *filename, long long size, unsigned int blocks, unsigned int frag_bytes);
+extern void pipeline_start();
+extern struct pipe_file *pipeline_file(char *filename, long long size);
+extern struct pipe_block *pipeline_get();
+extern void pipeline_put(struct pipe_block *block);
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 
 #include <squashfs_fs.h>
+#include "pipeline.h"
 
 #ifdef SQUASHFS_TRACE
 #define TRACE(s, args...)		printf("mksquashfs: "s, ## args)
@@ -80,6 +81,7 @@ struct sorted_inode_entry *sorted_inode_list[65536];
 extern int silent;
 extern int excluded(char *filename, struct stat *buf);
 extern squashfs_inode write_file(char *filename, long long size, int *c_size);
+extern void queue_file(char *filename, long long size);
 
 
 int add_to_sorted_inode_list(squashfs_inode inode, dev_t st_dev, ino_t st_ino)
@@ -293,6 +295,11 @@ void sort_files_and_write(int source, char *source_path[])
 		}
 	}
 
+	for(i = 0; i < 65536; i++)
+		for(entry = priority_list[i]; entry; entry = entry->next)
+			queue_file(entry->filename, entry->size);
+	pipeline_start();
+
 	for(i = 0; i < 65536; i++)
 		for(entry = priority_list[i]; entry; entry = entry->next) {
 			TRACE("%d: %s\n", i - 32768, entry->filename);
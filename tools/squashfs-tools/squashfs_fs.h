@@ -119,10 +119,12 @@ typedef unsigned int			squashfs_fragment_index;
 #define SQUASHFS_FRAGMENT_INDEX_OFFSET(A)	(SQUASHFS_FRAGMENT_BYTES(A) % SQUASHFS_METADATA_SIZE)
 #define SQUASHFS_FRAGMENT_INDEXES(A)	((SQUASHFS_FRAGMENT_BYTES(A) + SQUASHFS_METADATA_SIZE - 1) / SQUASHFS_METADATA_SIZE)
 #define SQUASHFS_FRAGMENT_INDEX_BYTES(A)	(SQUASHFS_FRAGMENT_INDEXES(A) * sizeof(squashfs_fragment_index))
-#define SQUASHFS_CACHED_FRAGMENTS	3
 
-/* cached data constants for filesystem */
+/* cached data constants for filesystem, defaults for the frag_cache= and meta_cache= mount options */
+#define SQUASHFS_CACHED_FRAGMENTS	3
+#define SQUASHFS_MAX_CACHED_FRAGMENTS	32
 #define SQUASHFS_CACHED_BLKS		8
+#define SQUASHFS_MAX_CACHED_BLKS	128
 
 #define SQUASHFS_MAX_FILE_SIZE_LOG	32
 #define SQUASHFS_MAX_FILE_SIZE		((long long) 1 << (SQUASHFS_MAX_FILE_SIZE_LOG - 1))